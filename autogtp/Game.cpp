@@ -45,6 +45,39 @@ Game::Game(const QString& weights, const QString& opt, const QString& binary,
     m_fileName = QUuid::createUuid().toRfc4122().toHex();
 }
 
+void Game::resetGame() {
+    m_winner.clear();
+    m_moveDone.clear();
+    m_result.clear();
+    m_resignation = false;
+    m_blackToMove = true;
+    m_blackResigned = false;
+    m_passes = 0;
+    m_moveNum = 0;
+    m_fileName = QUuid::createUuid().toRfc4122().toHex();
+}
+
+bool Game::canReuse(const QString& weights, const QString& opt) const {
+    return state() == QProcess::Running
+        && m_cmdLine == m_binary + " " + opt + " " + weights;
+}
+
+bool Game::newGame() {
+    // Start over in the running engine, so the weights don't have to be
+    // loaded again.
+    resetGame();
+    if (!sendGtpCommand("clear_board")) {
+        return false;
+    }
+    for (auto command : m_commands) {
+        if (!sendGtpCommand(command)) {
+            QTextStream(stdout) << "GTP failed on: " << command << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 bool Game::checkGameEnd() {
     return (m_resignation ||
             m_passes > 1 ||
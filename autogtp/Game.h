@@ -32,6 +32,8 @@ public:
          const QStringList& commands = QStringList("time_settings 0 1 0"));
     ~Game() = default;
     bool gameStart(const VersionTuple& min_version);
+    bool canReuse(const QString& weights, const QString& opt) const;
+    bool newGame();
     void move();
     bool waitForMove() { return waitReady(); }
     bool readMove();
@@ -80,6 +82,7 @@ private:
     bool m_blackResigned;
     int m_passes;
     int m_moveNum;
+    void resetGame();
     bool sendGtpCommand(QString cmd);
     void checkVersion(const VersionTuple &min_version);
     bool waitReady();
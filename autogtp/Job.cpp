@@ -21,6 +21,7 @@
 #include "Management.h"
 #include <QTextStream>
 #include <chrono>
+#include <utility>
 
 #include <QFile>
 #include <QThread>
@@ -50,16 +51,43 @@ void Job::init(const Order &o) {
 
 }
 
+bool Job::prepareGame(std::unique_ptr<Game>& game, const QString& weights) {
+    // Engines stay up between games, and are only restarted when the
+    // network or options change (or the engine died).
+    if (game && game->canReuse(weights, m_option)) {
+        return game->newGame();
+    }
+    quitGame(game);
+    game = std::make_unique<Game>(weights, m_option);
+    return game->gameStart(m_leelazMinVersion);
+}
+
+void Job::quitGame(std::unique_ptr<Game>& game) {
+    if (game) {
+        game->gameQuit();
+        game.reset();
+    }
+}
+
 ProductionJob::ProductionJob(QString gpu, Management *parent) :
 Job(gpu, parent)
 {
 }
 
+ProductionJob::~ProductionJob() {
+    quitGame(m_game);
+}
+
 ValidationJob::ValidationJob(QString gpu, Management *parent) :
 Job(gpu, parent)
 {
 }
 
+ValidationJob::~ValidationJob() {
+    quitGame(m_first);
+    quitGame(m_second);
+}
+
 WaitJob::WaitJob(QString gpu, Management *parent) :
 Job(gpu, parent)
 {
@@ -67,10 +95,11 @@ Job(gpu, parent)
 
 Result ProductionJob::execute(){
     Result res(Result::Error);
-    Game game("networks/" + m_network + ".gz", m_option);
-    if (!game.gameStart(m_leelazMinVersion)) {
+    if (!prepareGame(m_game, "networks/" + m_network + ".gz")) {
+        quitGame(m_game);
         return res;
     }
+    auto& game = *m_game;
     if (!m_sgf.isEmpty()) {
         game.loadSgf(m_sgf);
         game.loadTraining(m_sgf);
@@ -81,6 +110,7 @@ Result ProductionJob::execute(){
     do {
         game.move();
         if (!game.waitForMove()) {
+            quitGame(m_game);
             return res;
         }
         game.readMove();
@@ -112,7 +142,9 @@ Result ProductionJob::execute(){
     default:
         break;
     }
-    game.gameQuit();
+    if (m_state.load() != RUNNING) {
+        quitGame(m_game);
+    }
     return res;
 }
 
@@ -131,19 +163,35 @@ void ProductionJob::init(const Order &o) {
 
 Result ValidationJob::execute(){
     Result res(Result::Error);
-    Game first("networks/" + m_firstNet + ".gz",  m_option);
-    if (!first.gameStart(m_leelazMinVersion)) {
+    auto fail = [this, &res]() {
+        quitGame(m_first);
+        quitGame(m_second);
         return res;
+    };
+    const QString firstWeights = "networks/" + m_firstNet + ".gz";
+    const QString secondWeights = "networks/" + m_secondNet + ".gz";
+    // The nets change colours between games, the engines go with them.
+    auto runs = [this](const std::unique_ptr<Game>& game,
+                       const QString& weights) {
+        return game && game->canReuse(weights, m_option);
+    };
+    if (!runs(m_first, firstWeights) && !runs(m_second, secondWeights)
+        && (runs(m_first, secondWeights) || runs(m_second, firstWeights))) {
+        std::swap(m_first, m_second);
+    }
+    if (!prepareGame(m_first, firstWeights)) {
+        return fail();
     }
+    auto& first = *m_first;
     if (!m_sgfFirst.isEmpty()) {
         first.loadSgf(m_sgfFirst);
         first.setMovesCount(m_moves);
         QFile::remove(m_sgfFirst + ".sgf");
     }
-    Game second("networks/" + m_secondNet + ".gz", m_option);
-    if (!second.gameStart(m_leelazMinVersion)) {
-        return res;
+    if (!prepareGame(m_second, secondWeights)) {
+        return fail();
     }
+    auto& second = *m_second;
     if (!m_sgfSecond.isEmpty()) {
         second.loadSgf(m_sgfSecond);
         second.setMovesCount(m_moves);
@@ -155,7 +203,7 @@ Result ValidationJob::execute(){
     do {
         first.move();
         if (!first.waitForMove()) {
-            return res;
+            return fail();
         }
         first.readMove();
        m_boss->incMoves();
@@ -165,7 +213,7 @@ Result ValidationJob::execute(){
         second.setMove(bmove + first.getMove());
         second.move();
         if (!second.waitForMove()) {
-            return res;
+            return fail();
         }
         second.readMove();
        m_boss->incMoves();
@@ -198,8 +246,10 @@ Result ValidationJob::execute(){
     default:
         break;
     }
-    first.gameQuit();
-    second.gameQuit();
+    if (m_state.load() != RUNNING) {
+        quitGame(m_first);
+        quitGame(m_second);
+    }
     return res;
 }
 
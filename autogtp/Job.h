@@ -24,7 +24,9 @@
 #include <QObject>
 #include <QAtomicInt>
 #include <QTextStream>
+#include <memory>
 class Management;
+class Game;
 using VersionTuple = std::tuple<int, int, int>;
 
 class Job : public QObject {
@@ -49,6 +51,8 @@ public:
     }
 
 protected:
+    bool prepareGame(std::unique_ptr<Game>& game, const QString& weights);
+    void quitGame(std::unique_ptr<Game>& game);
     QAtomicInt m_state;
     QString m_option;
     QString m_gpu;
@@ -62,10 +66,11 @@ class ProductionJob : public Job {
     Q_OBJECT
 public:
     ProductionJob(QString gpu, Management *parent);
-    ~ProductionJob() = default;
+    ~ProductionJob();
     void init(const Order &o);
     Result execute();
 private:
+    std::unique_ptr<Game> m_game;
     QString m_network;
     QString m_sgf;
     bool m_debug;
@@ -75,10 +80,12 @@ class ValidationJob : public Job {
     Q_OBJECT
 public:
     ValidationJob(QString gpu, Management *parent);
-    ~ValidationJob() = default;
+    ~ValidationJob();
     void init(const Order &o);
     Result execute();
 private:
+    std::unique_ptr<Game> m_first;
+    std::unique_ptr<Game> m_second;
     QString m_firstNet;
     QString m_secondNet;
     QString m_sgfFirst;
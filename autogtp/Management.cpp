@@ -34,6 +34,7 @@
 constexpr int RETRY_DELAY_MIN_SEC = 30;
 constexpr int RETRY_DELAY_MAX_SEC = 60 * 60;  // 1 hour
 constexpr int MAX_RETRIES = 3;           // Stop retrying after 3 times
+constexpr int FILE_WAIT_SEC = 60;
 const QString Leelaz_min_version = "0.12";
 
 Management::Management(const int gpus,
@@ -553,6 +554,14 @@ void Management::fetchNetwork(const QString &net, const QString &hash) {
 }
 
 
+// leelaz compresses training data in the background after dump_training
+// returns, and only creates the file once it is complete.
+void Management::waitForFile(const QString &fileName) {
+    for (auto i = 0; i < FILE_WAIT_SEC * 10 && !QFile::exists(fileName); i++) {
+        QThread::msleep(100);
+    }
+}
+
 void Management::archiveFiles(const QString &fileName) {
     if (!m_keepPath.isEmpty()) {
         QFile(fileName + ".sgf").copy(m_keepPath + '/' + fileName + ".sgf");
@@ -761,6 +770,10 @@ http://zero.sjeng.org/submit
 
 void Management::uploadData(const QMap<QString,QString> &r, const QMap<QString,QString> &l) {
     QTextStream(stdout) << "Uploading game: " << r["file"] << ".sgf for network " << l["network"] << endl;
+    waitForFile(r["file"] + ".txt.0.gz");
+    if (l["debug"] == "true") {
+        waitForFile(r["file"] + ".debug.txt.0.gz");
+    }
     archiveFiles(r["file"]);
     gzipFile(r["file"] + ".sgf");
     QStringList prog_cmdline;
@@ -100,6 +100,7 @@ private:
     void gzipFile(const QString &fileName);
     bool sendCurl(const QStringList &lines);
     void saveCurlCmdLine(const QStringList &prog_cmdline, const QString &name);
+    void waitForFile(const QString &fileName);
     void archiveFiles(const QString &fileName);
     void cleanupFiles(const QString &fileName);
     void uploadData(const QMap<QString,QString> &r, const QMap<QString,QString> &l);
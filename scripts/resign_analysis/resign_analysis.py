@@ -104,8 +104,11 @@ def parseGames(filenames, resignthr, verbose, prefixes):
         training_filename = filename.replace(".debug", "")
         with open(filename) as fh, open(training_filename) as tfh:
             version = fh.readline().rstrip()
-            assert version == "2"
+            assert version in ("2", "3")
             (cfg_resignpct, network) = fh.readline().split()
+            if version == "3":
+                # visits, playouts, fast visits, full search probability
+                fh.readline()
             if prefixes:
                 net_name = os.path.basename(network)
                 matches = filter(lambda n: net_name.startswith(n), prefixes)
@@ -0,0 +1,136 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "AnalysisServer.h"
+
+#include <cctype>
+#include <csignal>
+#include <istream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <boost/asio.hpp>
+
+#include "GTP.h"
+#include "GameState.h"
+#include "Utils.h"
+
+using namespace Utils;
+using boost::asio::ip::tcp;
+
+class SessionStream : public GtpStream {
+public:
+    explicit SessionStream(tcp::socket& socket) : m_socket(socket) {}
+
+    void write(const std::string& text) override {
+        boost::system::error_code ec;
+        boost::asio::write(m_socket, boost::asio::buffer(text), ec);
+        if (ec) {
+            m_closed = true;
+        }
+    }
+
+    // A dead connection counts as input so pondering stops.
+    bool input_pending() override {
+        boost::system::error_code ec;
+        return m_closed || m_buffer.size() > 0
+            || m_socket.available(ec) > 0 || ec;
+    }
+
+    bool read_line(std::string& line) {
+        boost::system::error_code ec;
+        boost::asio::read_until(m_socket, m_buffer, '\n', ec);
+        if (ec && m_buffer.size() == 0) {
+            return false;
+        }
+        std::istream is(&m_buffer);
+        std::getline(is, line);
+        return true;
+    }
+
+private:
+    tcp::socket& m_socket;
+    boost::asio::streambuf m_buffer;
+    bool m_closed{false};
+};
+
+// Returns the command id for quit/exit, which must end only the
+// session and not the whole process, or -2 for other commands.
+static int quit_id(const std::string& line) {
+    std::istringstream is(line);
+    auto id = -1;
+    if (!line.empty() && std::isdigit(line[0])) {
+        is >> id;
+    }
+    std::string command;
+    is >> command;
+    if (command == "quit" || command == "exit") {
+        return id;
+    }
+    return -2;
+}
+
+static void run_session(std::shared_ptr<tcp::socket> socket) {
+    SessionStream stream(*socket);
+    set_gtp_stream(&stream);
+
+    auto game = std::make_unique<GameState>();
+    game->init_game(BOARD_SIZE, 7.5f);
+
+    auto line = std::string{};
+    while (stream.read_line(line)) {
+        log_input(line);
+        const auto id = quit_id(line);
+        if (id != -2) {
+            gtp_printf(id, "");
+            break;
+        }
+        GTP::execute(*game, line);
+    }
+    set_gtp_stream(nullptr);
+}
+
+AnalysisServer::AnalysisServer(unsigned short port) : m_port(port) {}
+
+void AnalysisServer::run() {
+#ifndef _WIN32
+    // Writing to a client that went away must not kill the server.
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    boost::asio::io_service io_service;
+    tcp::acceptor acceptor(io_service,
+        tcp::endpoint(boost::asio::ip::address_v4::loopback(), m_port));
+    myprintf("Analysis server listening on localhost:%d.\n", m_port);
+
+    for (;;) {
+        auto socket = std::make_shared<tcp::socket>(io_service);
+        boost::system::error_code ec;
+        acceptor.accept(*socket, ec);
+        if (ec) {
+            myprintf("Accept failed: %s\n", ec.message().c_str());
+            continue;
+        }
+        std::thread([this, socket]() {
+            myprintf("Session opened, %d active.\n", ++m_sessions);
+            run_session(socket);
+            myprintf("Session closed, %d active.\n", --m_sessions);
+        }).detach();
+    }
+}
@@ -0,0 +1,44 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ANALYSISSERVER_H_INCLUDED
+#define ANALYSISSERVER_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+
+/*
+    Serves many independent GTP sessions from one process, so that they
+    share the network weights, the NNCache and the OpenCL contexts.
+    Every connection to localhost:port is a session with its own game
+    and search, speaking plain GTP. Concurrent searches split the
+    search threads evenly (see UCTSearch::thread_share).
+*/
+class AnalysisServer {
+public:
+    explicit AnalysisServer(unsigned short port);
+    // Accepts connections until the process is terminated.
+    void run();
+
+private:
+    unsigned short m_port;
+    std::atomic<int> m_sessions{0};
+};
+
+#endif
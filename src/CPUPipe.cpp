@@ -32,6 +32,7 @@
 #endif
 
 #include "CPUPipe.h"
+#include "Float16.h"
 #include "Network.h"
 #include "Im2Col.h"
 
@@ -45,13 +46,46 @@ using ConstEigenMatrixMap =
     Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
 #endif
 
-void CPUPipe::initialize(int channels) {
+using Float16::to_float;
+
+// Moves finished activations into storage. For float storage that is
+// just a swap, the old buffer gets overwritten by the next convolution.
+static void store(std::vector<float>& in, std::vector<float>& out) {
+    std::swap(in, out);
+}
+
+template <typename storage_t>
+static void store(std::vector<float>& in, std::vector<storage_t>& out) {
+    out.resize(in.size());
+    Float16::convert(in.data(), out.data(), in.size());
+}
+
+// Returns n floats starting at data[offset], widening them into
+// scratch if they aren't stored as float.
+static const float* load(const std::vector<float>& data,
+                         const size_t offset, const size_t /*n*/,
+                         std::vector<float>& /*scratch*/) {
+    return data.data() + offset;
+}
+
+template <typename storage_t>
+static const float* load(const std::vector<storage_t>& data,
+                         const size_t offset, const size_t n,
+                         std::vector<float>& scratch) {
+    scratch.resize(n);
+    Float16::convert(data.data() + offset, scratch.data(), n);
+    return scratch.data();
+}
+
+template <typename storage_t>
+void CPUPipe<storage_t>::initialize(int channels) {
     m_input_channels = channels;
 }
 
-void CPUPipe::winograd_transform_in(const std::vector<float>& in,
-                                    std::vector<float>& V,
-                                    const int C) {
+template <typename storage_t>
+void CPUPipe<storage_t>::winograd_transform_in(const std::vector<storage_t>& in,
+                                               std::vector<float>& V,
+                                               const int C) {
     constexpr auto W = BOARD_SIZE;
     constexpr auto H = BOARD_SIZE;
     constexpr auto WTILES = WINOGRAD_WTILES;
@@ -68,6 +102,7 @@ void CPUPipe::winograd_transform_in(const std::vector<float>& in,
     auto buffer_entries = 0;
 
     std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA> T1;
+    auto scratch = std::vector<float>{};
 
     const auto Bt = std::array<float, WINOGRAD_TILE>
                {1.0f,  0.0f,     -5.0f/2.0f,  0.0f,      1.0f, 0.0f,
@@ -78,9 +113,10 @@ void CPUPipe::winograd_transform_in(const std::vector<float>& in,
                 0.0f,  1.0f,      0.0f,      -5.0f/2.0f, 0.0f, 1.0f};
 
     for (auto ch = 0; ch < C; ch++) {
+        const auto in_ch = load(in, ch * (W*H), W*H, scratch);
         for (auto yin = 0; yin < H; yin++) {
             for (auto xin = 0; xin < W; xin++) {
-                in_pad[yin + 1][xin + 1] = in[ch*(W*H) + yin*W + xin];
+                in_pad[yin + 1][xin + 1] = in_ch[yin*W + xin];
             }
         }
         for (auto block_y = 0; block_y < WTILES; block_y++) {
@@ -130,21 +166,28 @@ void CPUPipe::winograd_transform_in(const std::vector<float>& in,
     }
 }
 
-void CPUPipe::winograd_sgemm(const std::vector<float>& U,
-                             const std::vector<float>& V,
-                             std::vector<float>& M,
-                             const int C, const int K) {
+template <typename storage_t>
+void CPUPipe<storage_t>::winograd_sgemm(const std::vector<storage_t>& U,
+                                        const std::vector<float>& V,
+                                        std::vector<float>& M,
+                                        const int C, const int K) {
     constexpr auto P = WINOGRAD_P;
 
+    // Reduced precision weights are widened one tile at a time. The
+    // K x C slice is small enough to still be in cache for the sgemm,
+    // so only half the bytes come from memory.
+    auto scratch = std::vector<float>{};
+
     for (auto b = 0; b < WINOGRAD_TILE; b++) {
         const auto offset_u = b * K * C;
         const auto offset_v = b * C * P;
         const auto offset_m = b * K * P;
+        const auto u = load(U, offset_u, K * C, scratch);
 #ifdef USE_BLAS
         cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
                     K, P, C,
                     1.0f,
-                    &U[offset_u], K,
+                    u, K,
                     &V[offset_v], P,
                     0.0f,
                     &M[offset_m], P);
@@ -152,14 +195,15 @@ void CPUPipe::winograd_sgemm(const std::vector<float>& U,
         auto C_mat = EigenMatrixMap<float>(M.data() + offset_m, P, K);
         C_mat.noalias() =
            ConstEigenMatrixMap<float>(V.data() + offset_v, P, C)
-            * ConstEigenMatrixMap<float>(U.data() + offset_u, K, C).transpose();
+            * ConstEigenMatrixMap<float>(u, K, C).transpose();
 #endif
     }
 }
 
-void CPUPipe::winograd_transform_out(const std::vector<float>& M,
-                                     std::vector<float>& Y,
-                                     const int K) {
+template <typename storage_t>
+void CPUPipe<storage_t>::winograd_transform_out(const std::vector<float>& M,
+                                                std::vector<float>& Y,
+                                                const int K) {
     constexpr auto W = BOARD_SIZE;
     constexpr auto H = BOARD_SIZE;
     constexpr auto WTILES = WINOGRAD_WTILES;
@@ -225,12 +269,13 @@ void CPUPipe::winograd_transform_out(const std::vector<float>& M,
     }
 }
 
-void CPUPipe::winograd_convolve3(const int outputs,
-                                 const std::vector<float>& input,
-                                 const std::vector<float>& U,
-                                 std::vector<float>& V,
-                                 std::vector<float>& M,
-                                 std::vector<float>& output) {
+template <typename storage_t>
+void CPUPipe<storage_t>::winograd_convolve3(const int outputs,
+                                            const std::vector<storage_t>& input,
+                                            const std::vector<storage_t>& U,
+                                            std::vector<float>& V,
+                                            std::vector<float>& M,
+                                            std::vector<float>& output) {
 
     constexpr unsigned int filter_len = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
     const auto input_channels = U.size() / (outputs * filter_len);
@@ -291,12 +336,12 @@ void convolve(const size_t outputs,
     }
 }
 
-template <size_t spatial_size>
+template <size_t spatial_size, typename storage_t = float>
 void batchnorm(const size_t channels,
                std::vector<float>& data,
                const float* const means,
                const float* const stddevs,
-               const float* const eltwise = nullptr) {
+               const storage_t* const eltwise = nullptr) {
     const auto lambda_ReLU = [](const auto val) { return (val > 0.0f) ?
                                                           val : 0.0f; };
     for (auto c = size_t{0}; c < channels; ++c) {
@@ -313,15 +358,17 @@ void batchnorm(const size_t channels,
             // BN + residual add
             const auto res = &eltwise[c * spatial_size];
             for (auto b = size_t{0}; b < spatial_size; b++) {
-                arr[b] = lambda_ReLU((scale_stddev * (arr[b] - mean)) + res[b]);
+                arr[b] = lambda_ReLU((scale_stddev * (arr[b] - mean))
+                                     + to_float(res[b]));
             }
         }
     }
 }
 
-void CPUPipe::forward(const std::vector<float>& input,
-                      std::vector<float>& output_pol,
-                      std::vector<float>& output_val) {
+template <typename storage_t>
+void CPUPipe<storage_t>::forward(const std::vector<float>& input,
+                                 std::vector<float>& output_pol,
+                                 std::vector<float>& output_val) {
     // Input convolution
     constexpr auto P = WINOGRAD_P;
     // Calculate output channels
@@ -336,42 +383,55 @@ void CPUPipe::forward(const std::vector<float>& input,
     auto V = std::vector<float>(WINOGRAD_TILE * input_channels * P);
     auto M = std::vector<float>(WINOGRAD_TILE * output_channels * P);
 
-    winograd_convolve3(output_channels, input, m_weights->m_conv_weights[0], V, M, conv_out);
+    auto planes = std::vector<storage_t>(input.size());
+    Float16::convert(input.data(), planes.data(), input.size());
+    winograd_convolve3(output_channels, planes, m_conv_weights[0], V, M, conv_out);
     batchnorm<NUM_INTERSECTIONS>(output_channels, conv_out,
-                                 m_weights->m_batchnorm_means[0].data(),
-                                 m_weights->m_batchnorm_stddevs[0].data());
+                                 m_batchnorm_means[0].data(),
+                                 m_batchnorm_stddevs[0].data());
 
     // Residual tower
-    auto conv_in = std::vector<float>(output_channels * NUM_INTERSECTIONS);
-    auto res = std::vector<float>(output_channels * NUM_INTERSECTIONS);
-    for (auto i = size_t{1}; i < m_weights->m_conv_weights.size(); i += 2) {
+    auto conv_in = std::vector<storage_t>(output_channels * NUM_INTERSECTIONS);
+    auto res = std::vector<storage_t>(output_channels * NUM_INTERSECTIONS);
+    for (auto i = size_t{1}; i < m_conv_weights.size(); i += 2) {
         auto output_channels = m_input_channels;
-        std::swap(conv_out, conv_in);
-        winograd_convolve3(output_channels, conv_in,
-                           m_weights->m_conv_weights[i], V, M, conv_out);
+        store(conv_out, res);
+        winograd_convolve3(output_channels, res,
+                           m_conv_weights[i], V, M, conv_out);
         batchnorm<NUM_INTERSECTIONS>(output_channels, conv_out,
-                                     m_weights->m_batchnorm_means[i].data(),
-                                     m_weights->m_batchnorm_stddevs[i].data());
+                                     m_batchnorm_means[i].data(),
+                                     m_batchnorm_stddevs[i].data());
 
-        std::swap(conv_in, res);
-        std::swap(conv_out, conv_in);
+        store(conv_out, conv_in);
         winograd_convolve3(output_channels, conv_in,
-                           m_weights->m_conv_weights[i + 1], V, M, conv_out);
+                           m_conv_weights[i + 1], V, M, conv_out);
         batchnorm<NUM_INTERSECTIONS>(output_channels, conv_out,
-                                     m_weights->m_batchnorm_means[i + 1].data(),
-                                     m_weights->m_batchnorm_stddevs[i + 1].data(),
+                                     m_batchnorm_means[i + 1].data(),
+                                     m_batchnorm_stddevs[i + 1].data(),
                                      res.data());
     }
-    convolve<1>(Network::OUTPUTS_POLICY, conv_out, m_conv_pol_w, m_conv_pol_b, output_pol);
-    convolve<1>(Network::OUTPUTS_VALUE, conv_out, m_conv_val_w, m_conv_val_b, output_val);
+    if (!output_pol.empty()) {
+        convolve<1>(Network::OUTPUTS_POLICY, conv_out, m_conv_pol_w, m_conv_pol_b, output_pol);
+    }
+    if (!output_val.empty()) {
+        convolve<1>(Network::OUTPUTS_VALUE, conv_out, m_conv_val_w, m_conv_val_b, output_val);
+    }
 }
 
-void CPUPipe::push_weights(unsigned int /*filter_size*/,
-                           unsigned int /*channels*/,
-                           unsigned int outputs,
-                           std::shared_ptr<const ForwardPipeWeights> weights) {
-
-    m_weights = weights;
+template <typename storage_t>
+void CPUPipe<storage_t>::push_weights(unsigned int /*filter_size*/,
+                                      unsigned int /*channels*/,
+                                      unsigned int outputs,
+                                      std::shared_ptr<const ForwardPipeWeights> weights) {
+
+    // Keep our own copy, in storage format, of what the tower needs.
+    m_conv_weights.clear();
+    for (const auto& w : weights->m_conv_weights) {
+        m_conv_weights.emplace_back(w.size());
+        Float16::convert(w.data(), m_conv_weights.back().data(), w.size());
+    }
+    m_batchnorm_means = weights->m_batchnorm_means;
+    m_batchnorm_stddevs = weights->m_batchnorm_stddevs;
 
     // Output head convolutions
     m_conv_pol_w = weights->m_conv_pol_w;
@@ -380,3 +440,6 @@ void CPUPipe::push_weights(unsigned int /*filter_size*/,
     m_conv_val_b.resize(m_conv_val_w.size() / outputs, 0.0f);
 }
 
+template class CPUPipe<float>;
+template class CPUPipe<Float16::half_t>;
+template class CPUPipe<Float16::bfloat16_t>;
@@ -25,6 +25,12 @@
 
 #include "ForwardPipe.h"
 
+/*
+    storage_t is the type weights and the activations between layers are
+    kept in: float, or one of the 16-bit formats from Float16.h. The
+    convolutions widen everything to float and accumulate in float.
+*/
+template <typename storage_t>
 class CPUPipe : public ForwardPipe {
 public:
     virtual void initialize(const int channels);
@@ -38,11 +44,11 @@ public:
                               std::shared_ptr<const ForwardPipeWeights> weights);
 
 private:
-    void winograd_transform_in(const std::vector<float>& in,
+    void winograd_transform_in(const std::vector<storage_t>& in,
                                std::vector<float>& V,
                                const int C);
 
-    void winograd_sgemm(const std::vector<float>& U,
+    void winograd_sgemm(const std::vector<storage_t>& U,
                         const std::vector<float>& V,
                         std::vector<float>& M,
                         const int C, const int K);
@@ -52,8 +58,8 @@ private:
                                 const int K);
 
     void winograd_convolve3(const int outputs,
-                            const std::vector<float>& input,
-                            const std::vector<float>& U,
+                            const std::vector<storage_t>& input,
+                            const std::vector<storage_t>& U,
                             std::vector<float>& V,
                             std::vector<float>& M,
                             std::vector<float>& output);
@@ -62,7 +68,9 @@ private:
     int m_input_channels;
 
     // Input + residual block tower
-    std::shared_ptr<const ForwardPipeWeights> m_weights;
+    std::vector<std::vector<storage_t>> m_conv_weights;
+    std::vector<std::vector<float>> m_batchnorm_means;
+    std::vector<std::vector<float>> m_batchnorm_stddevs;
 
     std::vector<float> m_conv_pol_w;
     std::vector<float> m_conv_val_w;
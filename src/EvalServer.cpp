@@ -0,0 +1,311 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "EvalServer.h"
+
+#include <algorithm>
+#include <array>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <vector>
+
+#include "GTP.h"
+#include "Network.h"
+#include "RemotePipe.h"
+#include "ThreadPool.h"
+#include "Utils.h"
+
+using namespace Utils;
+using boost::asio::ip::tcp;
+
+class EvalServer::Connection {
+public:
+    Connection(Network& network, const std::uint64_t fingerprint,
+               boost::asio::io_service& io_service, tcp::socket& socket)
+        : m_network(network), m_fingerprint(fingerprint),
+          m_io_service(io_service), m_socket(socket) {}
+
+    // Serves the client until it hangs up or the io_service is stopped.
+    void run();
+
+private:
+    // The socket is only used by these, from handlers run by
+    // m_io_service on the session thread. Evaluations run on the
+    // thread pool and post their answers back.
+    void read_hello();
+    void read_request();
+    void write_next();
+    void shutdown();
+    void evaluate(const RemoteProtocol::Message msg,
+                  const std::vector<std::uint8_t>& packed);
+
+    Network& m_network;
+    std::uint64_t m_fingerprint;
+    boost::asio::io_service& m_io_service;
+    tcp::socket& m_socket;
+    ThreadGroup m_tasks{thread_pool};
+    bool m_connected{false};
+
+    RemoteProtocol::HelloBytes m_hello;
+    RemoteProtocol::MessageBytes m_message;
+    std::shared_ptr<std::vector<std::uint8_t>> m_packed;
+    std::deque<std::shared_ptr<std::vector<std::uint8_t>>> m_writes;
+};
+
+void EvalServer::Connection::run() {
+    boost::system::error_code ec;
+    m_socket.set_option(tcp::no_delay(true), ec);
+    read_hello();
+    m_io_service.run();
+    // Answers that come in now have nobody to go to.
+    m_tasks.wait_all();
+    if (m_connected) {
+        myprintf("Eval client disconnected.\n");
+    }
+}
+
+void EvalServer::Connection::read_hello() {
+    using namespace RemoteProtocol;
+
+    boost::asio::async_read(m_socket, boost::asio::buffer(m_hello),
+        [this](const boost::system::error_code& ec, size_t) {
+            const auto theirs = decode_hello(m_hello);
+            if (ec || theirs.magic != MAGIC) {
+                return;
+            }
+            // The client decides whether it can use us.
+            m_hello = encode(Hello{MAGIC, VERSION, BOARD_SIZE,
+                                   std::uint32_t(cfg_num_threads),
+                                   m_fingerprint});
+            boost::asio::async_write(m_socket, boost::asio::buffer(m_hello),
+                [this, theirs](const boost::system::error_code& ec, size_t) {
+                    if (ec || theirs.version != VERSION
+                        || theirs.board_size != BOARD_SIZE
+                        || theirs.fingerprint != m_fingerprint) {
+                        return;
+                    }
+                    boost::system::error_code ignored;
+                    myprintf("Eval client %s connected.\n",
+                             m_socket.remote_endpoint(ignored).address()
+                                 .to_string().c_str());
+                    m_connected = true;
+                    read_request();
+                });
+        });
+}
+
+void EvalServer::Connection::read_request() {
+    m_packed = std::make_shared<std::vector<std::uint8_t>>(
+        RemoteProtocol::packed_size());
+    const auto buffers = std::array<boost::asio::mutable_buffer, 2>{
+        boost::asio::buffer(m_message), boost::asio::buffer(*m_packed)};
+    boost::asio::async_read(m_socket, buffers,
+        [this](const boost::system::error_code& ec, size_t) {
+            if (ec) {
+                shutdown();
+                return;
+            }
+            const auto msg = RemoteProtocol::decode_message(m_message);
+            m_tasks.add_task([this, msg, packed = m_packed] {
+                evaluate(msg, *packed);
+            });
+            read_request();
+        });
+}
+
+void EvalServer::Connection::evaluate(const RemoteProtocol::Message msg,
+                                      const std::vector<std::uint8_t>& packed) {
+    using namespace RemoteProtocol;
+
+    auto output_pol = std::vector<float>(
+        msg.heads & POLICY_OUTPUT
+        ? Network::OUTPUTS_POLICY * NUM_INTERSECTIONS : 0);
+    auto output_val = std::vector<float>(
+        msg.heads & VALUE_OUTPUT
+        ? Network::OUTPUTS_VALUE * NUM_INTERSECTIONS : 0);
+    auto reply = Message{msg.id, msg.heads};
+    try {
+        m_network.forward(unpack_planes(packed), output_pol, output_val);
+    } catch (const std::exception& e) {
+        myprintf("Eval server: %s\n", e.what());
+        reply.heads = 0;
+        output_pol.clear();
+        output_val.clear();
+    }
+    convert_outputs(output_pol);
+    convert_outputs(output_val);
+
+    const auto header = encode(reply);
+    const auto pol_bytes = output_pol.size() * sizeof(float);
+    const auto val_bytes = output_val.size() * sizeof(float);
+    auto response = std::make_shared<std::vector<std::uint8_t>>(
+        header.size() + pol_bytes + val_bytes);
+    auto out = std::copy(begin(header), end(header), response->data());
+    if (pol_bytes) {
+        std::memcpy(out, output_pol.data(), pol_bytes);
+    }
+    if (val_bytes) {
+        std::memcpy(out + pol_bytes, output_val.data(), val_bytes);
+    }
+    m_io_service.post([this, response] {
+        m_writes.emplace_back(response);
+        if (m_writes.size() == 1) {
+            write_next();
+        }
+    });
+}
+
+void EvalServer::Connection::write_next() {
+    boost::asio::async_write(m_socket,
+        boost::asio::buffer(*m_writes.front()),
+        [this](const boost::system::error_code& ec, size_t) {
+            if (ec) {
+                shutdown();
+                return;
+            }
+            m_writes.pop_front();
+            if (!m_writes.empty()) {
+                write_next();
+            }
+        });
+}
+
+void EvalServer::Connection::shutdown() {
+    boost::system::error_code ec;
+    m_socket.shutdown(tcp::socket::shutdown_both, ec);
+}
+
+EvalServer::EvalServer(Network& network, const std::uint64_t fingerprint)
+    : m_network(network), m_fingerprint(fingerprint),
+      m_acceptor(m_io_service) {}
+
+EvalServer::~EvalServer() {
+    stop();
+}
+
+unsigned short EvalServer::listen(const std::string& address) {
+    auto host = std::string{};
+    auto port = std::string{};
+    if (!RemoteProtocol::parse_endpoint(address, host, port)) {
+        myprintf("Eval server: expected host:port, got %s.\n",
+                 address.c_str());
+        return 0;
+    }
+
+    boost::system::error_code ec;
+    tcp::resolver resolver(m_io_service);
+    const auto it = resolver.resolve(tcp::resolver::query(host, port), ec);
+    if (!ec) {
+        const auto endpoint = it->endpoint();
+        m_acceptor.open(endpoint.protocol(), ec);
+        if (!ec) {
+            m_acceptor.set_option(tcp::acceptor::reuse_address(true), ec);
+            m_acceptor.bind(endpoint, ec);
+        }
+        if (!ec) {
+            m_acceptor.listen(tcp::acceptor::max_connections, ec);
+        }
+    }
+    if (ec) {
+        myprintf("Eval server: %s\n", ec.message().c_str());
+        return 0;
+    }
+    const auto bound = m_acceptor.local_endpoint(ec).port();
+    myprintf("Eval server listening on %s:%d.\n", host.c_str(), bound);
+    return bound;
+}
+
+void EvalServer::run() {
+#ifndef _WIN32
+    // Writing to a client that went away must not kill the server.
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    while (m_running) {
+        auto io_service = std::make_shared<boost::asio::io_service>();
+        auto socket = std::make_shared<tcp::socket>(*io_service);
+        boost::system::error_code ec;
+        m_acceptor.accept(*socket, ec);
+        if (!m_running) {
+            break;
+        }
+        if (ec) {
+            myprintf("Accept failed: %s\n", ec.message().c_str());
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        reap_sessions();
+        m_sessions.emplace_back();
+        auto& session = m_sessions.back();
+        session.io_service = io_service;
+        session.socket = socket;
+        session.thread = std::thread([this, &session] {
+            Connection(m_network, m_fingerprint, *session.io_service,
+                       *session.socket).run();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            session.finished = true;
+        });
+    }
+}
+
+size_t EvalServer::get_num_sessions() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    reap_sessions();
+    return m_sessions.size();
+}
+
+void EvalServer::reap_sessions() {
+    for (auto it = begin(m_sessions); it != end(m_sessions); ) {
+        if (it->finished) {
+            it->thread.join();
+            it = m_sessions.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void EvalServer::stop() {
+    if (!m_running.exchange(false) || !m_acceptor.is_open()) {
+        return;
+    }
+    // Wake up the accept in run().
+    boost::system::error_code ec;
+    tcp::socket wakeup(m_io_service);
+    auto endpoint = m_acceptor.local_endpoint(ec);
+    if (endpoint.address().is_unspecified()) {
+        endpoint.address(boost::asio::ip::address_v4::loopback());
+    }
+    wakeup.connect(endpoint, ec);
+
+    // Sessions take the lock when they finish, so join them without it.
+    auto sessions = std::list<Session>{};
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& session : m_sessions) {
+            session.io_service->stop();
+        }
+        sessions.splice(end(sessions), m_sessions);
+    }
+    for (auto& session : sessions) {
+        session.thread.join();
+    }
+}
+
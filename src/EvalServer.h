@@ -0,0 +1,82 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EVALSERVER_H_INCLUDED
+#define EVALSERVER_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <boost/asio.hpp>
+
+class Network;
+
+/*
+    Serves network evaluations to searches on other processes that use
+    --remote-eval (see RemotePipe for the protocol). Each connection has
+    a thread that does all its socket I/O. Requests from all connections
+    run on the thread pool, so -t sets how many are evaluated at once.
+*/
+class EvalServer {
+public:
+    EvalServer(Network& network, const std::uint64_t fingerprint);
+    ~EvalServer();
+
+    // Binds to "host:port", or just "port" for localhost. Port 0
+    // picks a free one. Returns the port, 0 on failure.
+    unsigned short listen(const std::string& address);
+    // Accepts connections until stop() is called from another thread.
+    void run();
+    void stop();
+    // Clients still connected.
+    size_t get_num_sessions();
+
+private:
+    class Connection;
+
+    struct Session {
+        // Runs the handlers of the connection on its thread.
+        std::shared_ptr<boost::asio::io_service> io_service;
+        std::shared_ptr<boost::asio::ip::tcp::socket> socket;
+        std::thread thread;
+        bool finished{false};
+    };
+
+    // Joins the sessions whose client went away. Needs m_mutex.
+    void reap_sessions();
+
+    Network& m_network;
+    std::uint64_t m_fingerprint;
+    boost::asio::io_service m_io_service;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    std::atomic<bool> m_running{true};
+
+    // Protects m_sessions and their finished flags. A list, so each
+    // session thread can keep a reference to its own entry.
+    std::mutex m_mutex;
+    std::list<Session> m_sessions;
+};
+
+#endif
@@ -23,7 +23,6 @@
 #include <algorithm>
 #include <array>
 #include <iostream>
-#include <queue>
 #include <sstream>
 #include <string>
 
@@ -243,42 +242,62 @@ void FastBoard::remove_neighbour(const int vtx, const int color) {
     }
 }
 
-int FastBoard::calc_reach_color(int color) const {
-    auto reachable = 0;
-    auto bd = std::vector<bool>(m_numvertices, false);
-    auto open = std::queue<int>();
-    for (auto i = 0; i < m_boardsize; i++) {
-        for (auto j = 0; j < m_boardsize; j++) {
-            auto vertex = get_vertex(i, j);
-            if (m_state[vertex] == color) {
-                reachable++;
-                bd[vertex] = true;
-                open.push(vertex);
-            }
+int FastBoard::area_difference() const {
+    auto diff = 0;
+    for (auto i = 0; i < m_numvertices; i++) {
+        if (m_state[i] == BLACK) {
+            diff++;
+        } else if (m_state[i] == WHITE) {
+            diff--;
         }
     }
-    while (!open.empty()) {
-        /* colored field, spread */
-        auto vertex = open.front();
-        open.pop();
-
-        for (auto k = 0; k < 4; k++) {
-            auto neighbor = vertex + m_dirs[k];
-            if (!bd[neighbor] && m_state[neighbor] == EMPTY) {
-                reachable++;
-                bd[neighbor] = true;
-                open.push(neighbor);
+
+    /*
+        Flood fill each empty region once, and credit it to a side
+        only if it reaches stones of that color alone. This is the
+        same result as intersecting the reach of both colors, but
+        only visits every empty point a single time.
+    */
+    auto seen = std::array<bool, NUM_VERTICES>{};
+    auto open = std::array<unsigned short, NUM_VERTICES>{};
+    for (auto e = 0; e < m_empty_cnt; e++) {
+        const auto start = m_empty[e];
+        if (seen[start]) {
+            continue;
+        }
+        auto region = 0;
+        auto reach = 0;
+        auto open_cnt = 0;
+        seen[start] = true;
+        open[open_cnt++] = start;
+        while (open_cnt > 0) {
+            const auto vertex = open[--open_cnt];
+            region++;
+            for (auto k = 0; k < 4; k++) {
+                const auto neighbor = vertex + m_dirs[k];
+                const auto state = m_state[neighbor];
+                if (state == EMPTY) {
+                    if (!seen[neighbor]) {
+                        seen[neighbor] = true;
+                        open[open_cnt++] = neighbor;
+                    }
+                } else if (state != INVAL) {
+                    reach |= 1 << state;
+                }
             }
         }
+        if (reach == (1 << BLACK)) {
+            diff += region;
+        } else if (reach == (1 << WHITE)) {
+            diff -= region;
+        }
     }
-    return reachable;
+    return diff;
 }
 
 // Needed for scoring passed out games not in MC playouts
 float FastBoard::area_score(float komi) const {
-    auto white = calc_reach_color(WHITE);
-    auto black = calc_reach_color(BLACK);
-    return black - white - komi;
+    return area_difference() - komi;
 }
 
 void FastBoard::display_board(int lastmove) {
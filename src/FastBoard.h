@@ -22,7 +22,6 @@
 #include "config.h"
 
 #include <array>
-#include <queue>
 #include <string>
 #include <utility>
 #include <vector>
@@ -74,6 +73,7 @@ public:
     int count_pliberties(const int i) const;
     bool is_eye(const int color, const int vtx) const;
 
+    int area_difference() const;
     float area_score(float komi) const;
 
     int get_prisoners(int side) const;
@@ -119,8 +119,6 @@ protected:
     int m_boardsize;
     int m_sidevertices;
 
-    int calc_reach_color(int color) const;
-
     int count_neighbours(const int color, const int i) const;
     void merge_strings(const int ip, const int aip);
     void add_neighbour(const int i, const int color);
@@ -0,0 +1,188 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FLOAT16_H_INCLUDED
+#define FLOAT16_H_INCLUDED
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__) || defined(__AVX2__) || defined(__AVX512BF16__)
+#include <immintrin.h>
+#endif
+
+/*
+    16-bit floating point storage formats. Values are only stored in
+    these, all arithmetic is done after widening to float.
+*/
+namespace Float16 {
+
+// IEEE 754 binary16.
+struct half_t {
+    std::uint16_t bits;
+};
+
+// The upper half of a float (bfloat16): same range, 8 bit mantissa.
+struct bfloat16_t {
+    std::uint16_t bits;
+};
+
+inline std::uint32_t float_bits(const float f) {
+    auto u = std::uint32_t{};
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+inline float bits_float(const std::uint32_t u) {
+    auto f = float{};
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+inline float to_float(const float x) {
+    return x;
+}
+
+inline float to_float(const half_t x) {
+#ifdef __F16C__
+    return _cvtsh_ss(x.bits);
+#else
+    // Shift the exponent and mantissa into place and rebias, then fix
+    // up infinities, NaNs and denormals.
+    constexpr auto shifted_exp = std::uint32_t{0x7c00} << 13;
+    auto u = std::uint32_t(x.bits & 0x7fff) << 13;
+    const auto exp = u & shifted_exp;
+    u += (127 - 15) << 23;
+    auto f = float{};
+    if (exp == shifted_exp) {
+        f = bits_float(u + ((128 - 16) << 23));
+    } else if (exp == 0) {
+        f = bits_float(u + (1 << 23)) - bits_float(113 << 23);
+    } else {
+        f = bits_float(u);
+    }
+    return bits_float(float_bits(f) | (std::uint32_t(x.bits & 0x8000) << 16));
+#endif
+}
+
+inline float to_float(const bfloat16_t x) {
+    return bits_float(std::uint32_t(x.bits) << 16);
+}
+
+// Round to nearest even, like the hardware conversions.
+inline half_t to_half(const float f) {
+#ifdef __F16C__
+    return {std::uint16_t(_cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT))};
+#else
+    auto u = float_bits(f);
+    const auto sign = std::uint16_t((u >> 16) & 0x8000);
+    u &= 0x7fffffff;
+    auto bits = std::uint16_t{};
+    if (u >= (127 + 16) << 23) {
+        // Overflow to infinity, keep NaNs NaN.
+        bits = u > 0x7f800000 ? 0x7e00 : 0x7c00;
+    } else if (u < (127 - 14) << 23) {
+        // Denormal or zero: adding 0.5 lines the mantissa up with the
+        // half denormal spacing and lets the FPU do the rounding.
+        const auto r = bits_float(u) + 0.5f;
+        bits = std::uint16_t(float_bits(r) - float_bits(0.5f));
+    } else {
+        const auto mant_odd = (u >> 13) & 1;
+        u += (std::uint32_t(15 - 127) << 23) + 0xfff + mant_odd;
+        bits = std::uint16_t(u >> 13);
+    }
+    return {std::uint16_t(bits | sign)};
+#endif
+}
+
+inline bfloat16_t to_bfloat16(const float f) {
+    auto u = float_bits(f);
+    if ((u & 0x7fffffff) > 0x7f800000) {
+        // Quiet NaN, don't let rounding turn it into infinity.
+        return {std::uint16_t((u >> 16) | 0x40)};
+    }
+    u += 0x7fff + ((u >> 16) & 1);
+    return {std::uint16_t(u >> 16)};
+}
+
+inline void convert(const float* in, float* out, const size_t n) {
+    std::copy(in, in + n, out);
+}
+
+inline void convert(const float* in, half_t* out, const size_t n) {
+    auto i = size_t{0};
+#ifdef __F16C__
+    for (; i + 8 <= n; i += 8) {
+        const auto h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i),
+                                       _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), h);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = to_half(in[i]);
+    }
+}
+
+inline void convert(const half_t* in, float* out, const size_t n) {
+    auto i = size_t{0};
+#ifdef __F16C__
+    for (; i + 8 <= n; i += 8) {
+        const auto h =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(h));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = to_float(in[i]);
+    }
+}
+
+inline void convert(const float* in, bfloat16_t* out, const size_t n) {
+    auto i = size_t{0};
+#ifdef __AVX512BF16__
+    for (; i + 16 <= n; i += 16) {
+        const auto b = _mm512_cvtneps_pbh(_mm512_loadu_ps(in + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                            reinterpret_cast<const __m256i&>(b));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = to_bfloat16(in[i]);
+    }
+}
+
+inline void convert(const bfloat16_t* in, float* out, const size_t n) {
+    auto i = size_t{0};
+#ifdef __AVX2__
+    for (; i + 8 <= n; i += 8) {
+        const auto b =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        const auto f = _mm256_slli_epi32(_mm256_cvtepu16_epi32(b), 16);
+        _mm256_storeu_ps(out + i, _mm256_castsi256_ps(f));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = to_float(in[i]);
+    }
+}
+
+}
+
+#endif
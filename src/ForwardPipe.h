@@ -46,6 +46,8 @@ public:
 
     virtual void initialize(const int channels) = 0;
     virtual bool needs_autodetect() { return false; };
+    // An empty output vector means that head isn't needed, pipes can
+    // skip computing it.
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val) = 0;
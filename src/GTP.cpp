@@ -25,6 +25,7 @@
 #include <cstdlib>
 #include <exception>
 #include <fstream>
+#include <iterator>
 #include <limits>
 #include <memory>
 #include <random>
@@ -37,7 +38,10 @@
 #include "FullBoard.h"
 #include "GameState.h"
 #include "Network.h"
+#include "PositionIndex.h"
+#include "Profile.h"
 #include "SGFTree.h"
+#include "ScoreCache.h"
 #include "SMP.h"
 #include "Training.h"
 #include "UCTSearch.h"
@@ -50,6 +54,9 @@ bool cfg_gtp_mode;
 bool cfg_allow_pondering;
 int cfg_num_threads;
 int cfg_max_threads;
+int cfg_search_replicas;
+int cfg_virtual_loss;
+collision_t cfg_collisions;
 int cfg_max_playouts;
 int cfg_max_visits;
 size_t cfg_max_memory;
@@ -57,6 +64,10 @@ size_t cfg_max_tree_size;
 int cfg_max_cache_ratio_percent;
 TimeManagement::enabled_t cfg_timemanage;
 int cfg_lagbuffer_cs;
+bool cfg_adaptive_time;
+float cfg_time_min_ratio;
+float cfg_time_max_ratio;
+std::string cfg_time_log;
 int cfg_resignpct;
 int cfg_noise;
 int cfg_random_cnt;
@@ -68,6 +79,7 @@ bool cfg_dumbpass;
 std::vector<int> cfg_gpus;
 bool cfg_sgemm_exhaustive;
 bool cfg_tune_only;
+int cfg_batch_size;
 #ifdef USE_HALF
 precision_t cfg_precision;
 #endif
@@ -83,9 +95,31 @@ bool cfg_quiet;
 std::string cfg_options_str;
 bool cfg_benchmark;
 bool cfg_cpu_only;
-int cfg_analyze_interval_centis;
+cpu_precision_t cfg_cpu_precision;
+thread_local int cfg_analyze_interval_centis;
+thread_local bool cfg_analyze_changed_only;
+int cfg_analysis_port;
+std::string cfg_eval_server;
+std::vector<std::string> cfg_remote_eval;
+int cfg_selfplay_games;
+int cfg_selfplay_parallel;
+std::string cfg_selfplay_output;
+bool cfg_training_binary;
+int cfg_training_compression;
+int cfg_fast_visits;
+float cfg_full_search_prob;
+std::string cfg_match_weightsfile;
+int cfg_match_games;
+int cfg_match_parallel;
+float cfg_sprt_elo0;
+float cfg_sprt_elo1;
+std::string cfg_position_index;
+std::string cfg_build_index;
+std::vector<std::string> cfg_index_sgf;
 
 std::unique_ptr<Network> GTP::s_network;
+std::unique_ptr<PositionIndex> GTP::s_position_index;
+std::mutex GTP::s_position_index_mutex;
 
 void GTP::initialize(std::unique_ptr<Network>&& net) {
     s_network = std::move(net);
@@ -103,6 +137,11 @@ void GTP::initialize(std::unique_ptr<Network>&& net) {
     }
     myprintf(message.c_str());
     myprintf("\n");
+
+    if (!cfg_position_index.empty()) {
+        std::tie(result, message) = load_position_index(cfg_position_index);
+        myprintf("Position index: %s\n", message.c_str());
+    }
 }
 
 void GTP::setup_default_parameters() {
@@ -117,6 +156,9 @@ void GTP::setup_default_parameters() {
 #else
     cfg_num_threads = cfg_max_threads;
 #endif
+    cfg_search_replicas = 1;
+    cfg_virtual_loss = UCTNode::VIRTUAL_LOSS_COUNT;
+    cfg_collisions = collision_t::DISCARD;
     cfg_max_memory = UCTSearch::DEFAULT_MAX_MEMORY;
     cfg_max_playouts = UCTSearch::UNLIMITED_PLAYOUTS;
     cfg_max_visits = UCTSearch::UNLIMITED_PLAYOUTS;
@@ -125,11 +167,16 @@ void GTP::setup_default_parameters() {
     cfg_max_cache_ratio_percent = 10;
     cfg_timemanage = TimeManagement::AUTO;
     cfg_lagbuffer_cs = 100;
+    cfg_adaptive_time = false;
+    cfg_time_min_ratio = 0.25f;
+    cfg_time_max_ratio = 2.0f;
+    cfg_time_log.clear();
     cfg_weightsfile = leelaz_file("best-network");
 #ifdef USE_OPENCL
     cfg_gpus = { };
     cfg_sgemm_exhaustive = false;
     cfg_tune_only = false;
+    cfg_batch_size = 1;
 #ifdef USE_HALF
     cfg_precision = precision_t::AUTO;
 #endif
@@ -153,8 +200,24 @@ void GTP::setup_default_parameters() {
 #else
     cfg_cpu_only = false;
 #endif
+    cfg_cpu_precision = cpu_precision_t::SINGLE;
 
     cfg_analyze_interval_centis = 0;
+    cfg_analyze_changed_only = false;
+    cfg_analysis_port = 0;
+    cfg_eval_server.clear();
+    cfg_remote_eval.clear();
+    cfg_selfplay_games = 0;
+    cfg_selfplay_parallel = 1;
+    cfg_selfplay_output = "selfplay";
+    cfg_training_binary = false;
+    cfg_training_compression = 9;
+    cfg_fast_visits = 0;
+    cfg_full_search_prob = 0.25f;
+    cfg_match_games = 400;
+    cfg_match_parallel = 1;
+    cfg_sprt_elo0 = 0.0f;
+    cfg_sprt_elo1 = 35.0f;
 
     // C++11 doesn't guarantee *anything* about how random this is,
     // and in MinGW it isn't random at all. But we can mix it in, which
@@ -199,6 +262,11 @@ const std::string GTP::s_commands[] = {
     "lz-genmove_analyze",
     "lz-memory_report",
     "lz-setoption",
+    "lz-save_tree",
+    "lz-load_tree",
+    "lz-profile",
+    "load_position_index",
+    "query_position",
     ""
 };
 
@@ -245,14 +313,73 @@ std::string GTP::get_life_list(const GameState & game, bool live) {
     return result;
 }
 
+std::pair<bool, std::string> GTP::load_position_index(
+    const std::string& filename) {
+    std::unique_ptr<PositionIndex> index;
+    try {
+        index = std::make_unique<PositionIndex>(filename);
+    } catch (const std::exception& e) {
+        return {false, e.what()};
+    }
+    auto message = std::to_string(index->get_num_positions())
+                   + " positions from " + std::to_string(index->get_num_games())
+                   + " games";
+    std::lock_guard<std::mutex> lock(s_position_index_mutex);
+    s_position_index = std::move(index);
+    return {true, message};
+}
+
+// First line: how often the current position occurs in the index, in how
+// many games, and how those games ended. Then one line per game, up to
+// max_games: SGF file, game number in the file, move number and winner.
+std::string GTP::query_position(const GameState& game, size_t max_games) {
+    const auto range =
+        s_position_index->lookup(PositionIndex::position_hash(game));
+    auto games = size_t{0};
+    auto black_wins = size_t{0};
+    auto white_wins = size_t{0};
+    auto lines = std::string{};
+    // Occurrences of a position are sorted by game.
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it != range.first && it->game == std::prev(it)->game) {
+            continue;
+        }
+        const auto& info = s_position_index->get_game(it->game);
+        games++;
+        if (info.winner == FastBoard::BLACK) {
+            black_wins++;
+        } else if (info.winner == FastBoard::WHITE) {
+            white_wins++;
+        }
+        if (games <= max_games) {
+            const auto winner = info.winner == FastBoard::BLACK ? "B"
+                              : info.winner == FastBoard::WHITE ? "W" : "-";
+            lines += "\n" + info.sgf_file + " " + std::to_string(info.index)
+                     + " " + std::to_string(it->move) + " " + winner;
+        }
+    }
+    const auto count = size_t(range.second - range.first);
+    return std::to_string(count) + " occurrences in "
+           + std::to_string(games) + " games, black won "
+           + std::to_string(black_wins) + ", white won "
+           + std::to_string(white_wins) + lines;
+}
+
 void GTP::execute(GameState & game, const std::string& xinput) {
     std::string input;
-    static auto search = std::make_unique<UCTSearch>(game, *s_network);
+    // One search per thread, so every analysis server session has its own.
+    static thread_local auto search =
+        std::make_unique<UCTSearch>(game, *s_network);
 
     bool transform_lowercase = true;
 
     // Required on Unixy systems
-    if (xinput.find("loadsgf") != std::string::npos) {
+    if (xinput.find("loadsgf") != std::string::npos
+        || xinput.find("lz-save_tree") != std::string::npos
+        || xinput.find("lz-load_tree") != std::string::npos
+        || xinput.find("convert_training") != std::string::npos
+        || xinput.find("load_position_index") != std::string::npos
+        || xinput.find("lz-profile") != std::string::npos) {
         transform_lowercase = false;
     }
 
@@ -287,6 +414,7 @@ void GTP::execute(GameState & game, const std::string& xinput) {
     if (input == "") {
         return;
     } else if (input == "exit") {
+        Training::finish_output();
         exit(EXIT_SUCCESS);
     } else if (input.find("#") == 0) {
         return;
@@ -311,6 +439,7 @@ void GTP::execute(GameState & game, const std::string& xinput) {
         gtp_printf(id, PROGRAM_VERSION);
         return;
     } else if (command == "quit") {
+        Training::finish_output();
         gtp_printf(id, "");
         exit(EXIT_SUCCESS);
     } else if (command.find("known_command") == 0) {
@@ -362,7 +491,8 @@ void GTP::execute(GameState & game, const std::string& xinput) {
         Training::clear_training();
         game.reset_game();
         search = std::make_unique<UCTSearch>(game, *s_network);
-        assert(UCTNodePointer::get_tree_size() == 0);
+        assert(UCTSearch::s_searches > 1
+               || UCTNodePointer::get_tree_size() == 0);
         gtp_printf(id, "");
         return;
     } else if (command.find("komi") == 0) {
@@ -495,6 +625,10 @@ void GTP::execute(GameState & game, const std::string& xinput) {
                     return;
                 }
             }
+            // Optionally only send the moves that changed since the
+            // previous line, for clients that merge updates.
+            cmdstream >> tmp;
+            cfg_analyze_changed_only = !cmdstream.fail() && tmp == "changed";
         }
         // Start multi-line response.
         if (id != -1) gtp_printf_raw("=%d\n", id);
@@ -506,6 +640,7 @@ void GTP::execute(GameState & game, const std::string& xinput) {
             search->ponder();
         }
         cfg_analyze_interval_centis = 0;
+        cfg_analyze_changed_only = false;
         // Terminate multi-line response
         gtp_printf_raw("\n");
         return;
@@ -757,7 +892,7 @@ void GTP::execute(GameState & game, const std::string& xinput) {
         auto sgftree = std::make_unique<SGFTree>();
 
         try {
-            sgftree->load_from_file(filename);
+            sgftree->load_from_file(filename, 0, true);
             game = sgftree->follow_mainline_state(movenum - 1);
             gtp_printf(id, "");
         } catch (const std::exception&) {
@@ -832,6 +967,22 @@ void GTP::execute(GameState & game, const std::string& xinput) {
         gtp_printf(id, "");
         return;
 
+    } else if (command.find("scorebench") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp;
+        int iterations;
+
+        cmdstream >> tmp;  // eat scorebench
+        cmdstream >> iterations;
+
+        if (!cmdstream.fail()) {
+            ScoreCache::benchmark(game, iterations);
+        } else {
+            ScoreCache::benchmark(game);
+        }
+        gtp_printf(id, "");
+        return;
+
     } else if (command.find("printsgf") == 0) {
         std::istringstream cmdstream(command);
         std::string tmp, filename;
@@ -898,6 +1049,8 @@ void GTP::execute(GameState & game, const std::string& xinput) {
             who_won = FullBoard::WHITE;
         } else if (winner_color == "b" || winner_color == "black") {
             who_won = FullBoard::BLACK;
+        } else if (winner_color == "draw") {
+            who_won = FullBoard::EMPTY;
         } else {
             gtp_fail_printf(id, "syntax not understood");
             return;
@@ -954,6 +1107,133 @@ void GTP::execute(GameState & game, const std::string& xinput) {
             "Network with overhead: %d MiB / Search tree: %d MiB / Network cache: %d\n",
             total / MiB, base_memory / MiB, tree_size / MiB, cache_size / MiB);
         return;
+    } else if (command.find("convert_training") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, inname, outname;
+
+        // tmp will eat convert_training
+        cmdstream >> tmp >> inname >> outname;
+
+        if (cmdstream.fail()) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+
+        bool result;
+        std::string message;
+        std::tie(result, message) =
+            Training::convert_training(inname, outname);
+        if (result) {
+            gtp_printf(id, "%s", message.c_str());
+        } else {
+            gtp_fail_printf(id, "%s", message.c_str());
+        }
+        return;
+    } else if (command.find("lz-profile") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, action;
+
+        cmdstream >> tmp;   // eat lz-profile
+        cmdstream >> action;
+
+        if (action.empty()) {
+            gtp_printf(id, "%s", Profile::to_json().c_str());
+        } else if (action == "on" || action == "off") {
+            Profile::set_enabled(action == "on");
+            gtp_printf(id, "");
+        } else if (action == "reset") {
+            Profile::reset();
+            gtp_printf(id, "");
+        } else if (action == "trace") {
+            auto seconds = 0.0;
+            cmdstream >> seconds;
+            if (cmdstream.fail() || seconds <= 0.0) {
+                gtp_fail_printf(id, "syntax not understood");
+                return;
+            }
+            Profile::start_trace(seconds);
+            gtp_printf(id, "");
+        } else if (action == "save") {
+            std::string filename;
+            cmdstream >> filename;
+            if (cmdstream.fail()) {
+                gtp_fail_printf(id, "syntax not understood");
+            } else if (!Profile::save_trace(filename)) {
+                gtp_fail_printf(id, "cannot write %s", filename.c_str());
+            } else {
+                gtp_printf(id, "");
+            }
+        } else {
+            gtp_fail_printf(id, "syntax not understood");
+        }
+        return;
+    } else if (command.find("load_position_index") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, filename;
+
+        // tmp will eat load_position_index
+        cmdstream >> tmp >> filename;
+
+        if (cmdstream.fail()) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+
+        bool result;
+        std::string message;
+        std::tie(result, message) = load_position_index(filename);
+        if (result) {
+            gtp_printf(id, "%s", message.c_str());
+        } else {
+            gtp_fail_printf(id, "%s", message.c_str());
+        }
+        return;
+    } else if (command.find("query_position") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp;
+        int max_games = 10;
+
+        cmdstream >> tmp;   // eat query_position
+        if (!cmdstream.eof()) {
+            cmdstream >> max_games;
+            if (cmdstream.fail() || max_games < 0) {
+                gtp_fail_printf(id, "syntax not understood");
+                return;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(s_position_index_mutex);
+        if (!s_position_index) {
+            gtp_fail_printf(id, "no position index loaded");
+            return;
+        }
+        auto result = query_position(game, max_games);
+        gtp_printf(id, "%s", result.c_str());
+        return;
+    } else if (command.find("lz-save_tree") == 0
+               || command.find("lz-load_tree") == 0) {
+        auto save = command.find("lz-save_tree") == 0;
+        std::istringstream cmdstream(command);
+        std::string tmp, filename;
+
+        cmdstream >> tmp;   // eat lz-save_tree or lz-load_tree
+        cmdstream >> filename;
+
+        if (cmdstream.fail()) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+
+        bool result;
+        std::string message;
+        std::tie(result, message) =
+            save ? search->save_tree(filename) : search->load_tree(filename);
+        if (result) {
+            gtp_printf(id, "%s", message.c_str());
+        } else {
+            gtp_fail_printf(id, "%s", message.c_str());
+        }
+        return;
     } else if (command.find("lz-setoption") == 0) {
         return execute_setoption(*search.get(), id, command);
     }
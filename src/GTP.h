@@ -22,6 +22,8 @@
 #include "config.h"
 
 #include <cstdio>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -29,10 +31,18 @@
 #include "GameState.h"
 #include "UCTSearch.h"
 
+class PositionIndex;
+
 extern bool cfg_gtp_mode;
 extern bool cfg_allow_pondering;
 extern int cfg_num_threads;
 extern int cfg_max_threads;
+extern int cfg_search_replicas;
+extern int cfg_virtual_loss;
+enum class collision_t {
+    DISCARD, RETRY, WAIT
+};
+extern collision_t cfg_collisions;
 extern int cfg_max_playouts;
 extern int cfg_max_visits;
 extern size_t cfg_max_memory;
@@ -40,6 +50,10 @@ extern size_t cfg_max_tree_size;
 extern int cfg_max_cache_ratio_percent;
 extern TimeManagement::enabled_t cfg_timemanage;
 extern int cfg_lagbuffer_cs;
+extern bool cfg_adaptive_time;
+extern float cfg_time_min_ratio;
+extern float cfg_time_max_ratio;
+extern std::string cfg_time_log;
 extern int cfg_resignpct;
 extern int cfg_noise;
 extern int cfg_random_cnt;
@@ -51,6 +65,7 @@ extern bool cfg_dumbpass;
 extern std::vector<int> cfg_gpus;
 extern bool cfg_sgemm_exhaustive;
 extern bool cfg_tune_only;
+extern int cfg_batch_size;
 #ifdef USE_HALF
 enum class precision_t {
     AUTO, SINGLE, HALF
@@ -69,7 +84,30 @@ extern bool cfg_quiet;
 extern std::string cfg_options_str;
 extern bool cfg_benchmark;
 extern bool cfg_cpu_only;
-extern int cfg_analyze_interval_centis;
+enum class cpu_precision_t {
+    SINGLE, HALF, BFLOAT16
+};
+extern cpu_precision_t cfg_cpu_precision;
+extern thread_local int cfg_analyze_interval_centis;
+extern thread_local bool cfg_analyze_changed_only;
+extern int cfg_analysis_port;
+extern std::string cfg_eval_server;
+extern std::vector<std::string> cfg_remote_eval;
+extern int cfg_selfplay_games;
+extern int cfg_selfplay_parallel;
+extern std::string cfg_selfplay_output;
+extern bool cfg_training_binary;
+extern int cfg_training_compression;
+extern int cfg_fast_visits;
+extern float cfg_full_search_prob;
+extern std::string cfg_match_weightsfile;
+extern int cfg_match_games;
+extern int cfg_match_parallel;
+extern float cfg_sprt_elo0;
+extern float cfg_sprt_elo1;
+extern std::string cfg_position_index;
+extern std::string cfg_build_index;
+extern std::vector<std::string> cfg_index_sgf;
 
 static constexpr size_t MiB = 1024LL * 1024LL;
 
@@ -88,6 +126,10 @@ private:
     static constexpr int GTP_VERSION = 2;
 
     static std::string get_life_list(const GameState & game, bool live);
+    static std::pair<bool, std::string> load_position_index(
+        const std::string& filename);
+    static std::string query_position(const GameState& game,
+                                      size_t max_games);
     static const std::string s_commands[];
     static const std::string s_options[];
     static std::pair<std::string, std::string> parse_option(
@@ -99,6 +141,9 @@ private:
 
     // Memory estimation helpers
     static size_t get_base_memory();
+    // Shared by the analysis server sessions.
+    static std::unique_ptr<PositionIndex> s_position_index;
+    static std::mutex s_position_index_mutex;
     static size_t add_overhead(size_t s) { return s * 11LL / 10LL; }
     static size_t remove_overhead(size_t s) { return s * 10LL / 11LL; }
 };
@@ -45,6 +45,14 @@ bool KoState::superko() const {
     return (res != last);
 }
 
+std::uint64_t KoState::get_history_hash() const {
+    auto res = std::uint64_t{0};
+    for (const auto hash : m_ko_hash_history) {
+        res = (res ^ hash) * 0x100000001B3ULL;
+    }
+    return res;
+}
+
 void KoState::reset_game() {
     FastState::reset_game();
 
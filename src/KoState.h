@@ -30,6 +30,8 @@ class KoState : public FastState {
 public:
     void init_game(int size, float komi);
     bool superko() const;
+    // Hash over all positions so far, as superko depends on them.
+    std::uint64_t get_history_hash() const;
     void reset_game();
 
     void play_move(int color, int vertex);
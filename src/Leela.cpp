@@ -30,12 +30,19 @@
 #include <string>
 #include <vector>
 
+#include "AnalysisServer.h"
+#include "EvalServer.h"
 #include "GTP.h"
 #include "GameState.h"
+#include "Match.h"
 #include "Network.h"
 #include "NNCache.h"
+#include "PositionIndex.h"
 #include "Random.h"
+#include "RemotePipe.h"
+#include "SelfPlay.h"
 #include "ThreadPool.h"
+#include "Training.h"
 #include "Utils.h"
 #include "Zobrist.h"
 
@@ -59,6 +66,17 @@ static void parse_commandline(int argc, char *argv[]) {
         ("gtp,g", "Enable GTP mode.")
         ("threads,t", po::value<int>()->default_value(cfg_num_threads),
                       "Number of threads to use.")
+        ("search-replicas", po::value<int>()->default_value(1),
+                            "Split the threads into this many groups, each "
+                            "searching its own tree. Root statistics are "
+                            "merged periodically. Reduces contention with "
+                            "many threads.")
+        ("virtual-loss", po::value<int>()->default_value(cfg_virtual_loss),
+                         "Losses added to a node while a thread searches "
+                         "below it, to steer other threads elsewhere.")
+        ("collisions", po::value<std::string>()->default_value("discard"),
+                       "What a thread does on reaching a leaf another "
+                       "thread is evaluating (discard/retry/wait).")
         ("playouts,p", po::value<int>(),
                        "Weaken engine by limiting the number of playouts. "
                        "Requires --noponder.")
@@ -79,10 +97,39 @@ static void parse_commandline(int argc, char *argv[]) {
                        ", but use full time if moving faster doesn't save time.\n"
                        "fast = Same as on but always plays faster.\n"
                        "no_pruning = For self play training use.\n")
+        ("adaptive-time",
+                       "Stop early when the best move is stable and think "
+                       "longer when it is not.")
+        ("time-ratio", po::value<std::string>()->default_value("0.25:2.0"),
+                       "Bounds for --adaptive-time as min:max fractions "
+                       "of the normal time for a move.")
+        ("time-log", po::value<std::string>(),
+                     "Append --adaptive-time decisions to this file.")
         ("noponder", "Disable thinking on opponent's time.")
         ("benchmark", "Test network and exit. Default args:\n-v3200 --noponder "
                       "-m0 -t1 -s1.")
         ("cpu-only", "Use CPU-only implementation and do not use GPU.")
+        ("cpu-precision", po::value<std::string>()->default_value("single"),
+                          "Storage for weights and activations on the CPU "
+                          "(single/half/bf16). Computation is always in "
+                          "single precision.")
+        ("analysis-server", po::value<int>(),
+                            "Serve independent GTP sessions on this "
+                            "localhost TCP port, sharing one network.")
+        ("eval-server", po::value<std::string>(),
+                        "Serve network evaluations for --remote-eval "
+                        "searches on [host:]port.")
+        ("remote-eval", po::value<std::vector<std::string>>(),
+                        "Evaluate positions on a leelaz --eval-server at "
+                        "host:port. Repeat to add more workers.")
+        ("position-index", po::value<std::string>(),
+                           "Position index for the query_position "
+                           "GTP command.")
+        ("build-index", po::value<std::string>(),
+                        "Replay the --index-sgf games, write a position "
+                        "index to this file and exit. No weights needed.")
+        ("index-sgf", po::value<std::vector<std::string>>()->multitoken(),
+                      "SGF files to index.")
         ;
 #ifdef USE_OPENCL
     po::options_description gpu_desc("GPU options");
@@ -91,6 +138,10 @@ static void parse_commandline(int argc, char *argv[]) {
                 "ID of the OpenCL device(s) to use (disables autodetection).")
         ("full-tuner", "Try harder to find an optimal OpenCL tuning.")
         ("tune-only", "Tune OpenCL only and then exit.")
+        ("batchsize", po::value<int>()->default_value(cfg_batch_size),
+                      "Maximum number of positions evaluated together per "
+                      "OpenCL device. 1 = no batching, 0 = half the "
+                      "search threads per device.")
 #ifdef USE_HALF
         ("precision", po::value<std::string>(), "Floating-point precision (single/half/auto).\n"
                                                 "Default is to auto which automatically determines which one to use.")
@@ -111,6 +162,39 @@ static void parse_commandline(int argc, char *argv[]) {
         ("randomtemp",
             po::value<float>()->default_value(cfg_random_temp),
             "Temperature to use for random move selection.")
+        ("selfplay", po::value<int>(),
+                     "Play this many self-play games in-process, "
+                     "write training data and SGFs, then exit.")
+        ("selfplay-parallel",
+            po::value<int>()->default_value(cfg_selfplay_parallel),
+            "Number of self-play games to run at the same time.")
+        ("selfplay-output",
+            po::value<std::string>()->default_value(cfg_selfplay_output),
+            "Basename for self-play training chunks and SGFs.")
+        ("match", po::value<std::string>(),
+                  "Play the -w network against the network in this file "
+                  "in-process until the SPRT decides, then exit.")
+        ("match-games",
+            po::value<int>()->default_value(cfg_match_games),
+            "Maximum number of match games.")
+        ("match-parallel",
+            po::value<int>()->default_value(cfg_match_parallel),
+            "Number of match games to run at the same time.")
+        ("sprt", po::value<std::string>()->default_value("0.0:35.0"),
+                 "SPRT hypothesis for --match, as lower:upper Elo.")
+        ("fast-visits",
+            po::value<int>()->default_value(cfg_fast_visits),
+            "Playout cap randomization: visits for fast searches, which "
+            "are not used for training. 0 = always search fully.")
+        ("full-search-prob",
+            po::value<float>()->default_value(cfg_full_search_prob),
+            "Fraction of moves that get a full search when "
+            "--fast-visits is set.")
+        ("training-binary",
+            "Write training chunks in the compact binary format.")
+        ("training-compression",
+            po::value<int>()->default_value(cfg_training_compression),
+            "gzip level (0-9) for training chunks.")
         ;
 #ifdef USE_TUNER
     po::options_description tuner_desc("Tuning options");
@@ -195,17 +279,47 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_logfile_handle = fopen(cfg_logfile.c_str(), "a");
     }
 
+    if (vm.count("position-index")) {
+        cfg_position_index = vm["position-index"].as<std::string>();
+    }
+
+    if (vm.count("build-index")) {
+        cfg_build_index = vm["build-index"].as<std::string>();
+        if (!vm.count("index-sgf")) {
+            printf("--build-index needs SGF files to index (--index-sgf).\n");
+            exit(EXIT_FAILURE);
+        }
+        cfg_index_sgf = vm["index-sgf"].as<std::vector<std::string>>();
+    }
+
     cfg_weightsfile = vm["weights"].as<std::string>();
-    if (vm["weights"].defaulted() && !boost::filesystem::exists(cfg_weightsfile)) {
+    if (vm["weights"].defaulted() && cfg_build_index.empty()
+        && !boost::filesystem::exists(cfg_weightsfile)) {
         printf("A network weights file is required to use the program.\n");
         printf("By default, Leela Zero looks for it in %s.\n", cfg_weightsfile.c_str());
         exit(EXIT_FAILURE);
     }
 
+    if (vm.count("analysis-server")) {
+        cfg_analysis_port = vm["analysis-server"].as<int>();
+        cfg_gtp_mode = true;
+    }
+
     if (vm.count("gtp")) {
         cfg_gtp_mode = true;
     }
 
+    if (vm.count("eval-server")) {
+        cfg_eval_server = vm["eval-server"].as<std::string>();
+    }
+
+    if (vm.count("remote-eval")) {
+        cfg_remote_eval = vm["remote-eval"].as<std::vector<std::string>>();
+        // Search threads mostly wait on the workers, so allow enough of
+        // them to keep every worker busy.
+        cfg_max_threads = MAX_CPUS;
+    }
+
 #ifdef USE_OPENCL
     if (vm.count("gpu")) {
         cfg_gpus = vm["gpu"].as<std::vector<int> >();
@@ -224,6 +338,11 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_tune_only = true;
     }
 
+    if (vm.count("batchsize")) {
+        cfg_batch_size = std::min(std::max(0, vm["batchsize"].as<int>()),
+                                  MAX_BATCH);
+    }
+
 #ifdef USE_HALF
     if (vm.count("precision")) {
         auto precision = vm["precision"].as<std::string>();
@@ -251,6 +370,23 @@ static void parse_commandline(int argc, char *argv[]) {
     }
     myprintf("Using %d thread(s).\n", cfg_num_threads);
 
+    cfg_search_replicas = std::max(1, vm["search-replicas"].as<int>());
+    cfg_virtual_loss = std::max(0, vm["virtual-loss"].as<int>());
+
+    if (vm.count("collisions")) {
+        auto collisions = vm["collisions"].as<std::string>();
+        if ("discard" == collisions) {
+            cfg_collisions = collision_t::DISCARD;
+        } else if ("retry" == collisions) {
+            cfg_collisions = collision_t::RETRY;
+        } else if ("wait" == collisions) {
+            cfg_collisions = collision_t::WAIT;
+        } else {
+            printf("Unexpected option for --collisions, expecting discard/retry/wait\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     if (vm.count("seed")) {
         cfg_rng_seed = vm["seed"].as<std::uint64_t>();
         if (cfg_num_threads > 1) {
@@ -276,6 +412,20 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_cpu_only = true;
     }
 
+    if (vm.count("cpu-precision")) {
+        auto precision = vm["cpu-precision"].as<std::string>();
+        if ("single" == precision) {
+            cfg_cpu_precision = cpu_precision_t::SINGLE;
+        } else if ("half" == precision) {
+            cfg_cpu_precision = cpu_precision_t::HALF;
+        } else if ("bf16" == precision) {
+            cfg_cpu_precision = cpu_precision_t::BFLOAT16;
+        } else {
+            printf("Unexpected option for --cpu-precision, expecting single/half/bf16\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     if (vm.count("playouts")) {
         cfg_max_playouts = vm["playouts"].as<int>();
         if (!vm.count("noponder")) {
@@ -312,6 +462,38 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_random_min_visits = vm["randomvisits"].as<int>();
     }
 
+    if (vm.count("selfplay")) {
+        cfg_selfplay_games = vm["selfplay"].as<int>();
+        cfg_selfplay_parallel =
+            std::max(1, vm["selfplay-parallel"].as<int>());
+        cfg_selfplay_output = vm["selfplay-output"].as<std::string>();
+    }
+
+    if (vm.count("match")) {
+        cfg_match_weightsfile = vm["match"].as<std::string>();
+        cfg_match_games = vm["match-games"].as<int>();
+        cfg_match_parallel = std::max(1, vm["match-parallel"].as<int>());
+        const auto sprt = vm["sprt"].as<std::string>();
+        if (std::sscanf(sprt.c_str(), "%f:%f",
+                        &cfg_sprt_elo0, &cfg_sprt_elo1) != 2) {
+            printf("Unexpected --sprt value: %s\n", sprt.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (vm.count("fast-visits")) {
+        cfg_fast_visits = std::max(0, vm["fast-visits"].as<int>());
+        cfg_full_search_prob = vm["full-search-prob"].as<float>();
+    }
+
+    if (vm.count("training-binary")) {
+        cfg_training_binary = true;
+    }
+
+    if (vm.count("training-compression")) {
+        cfg_training_compression = vm["training-compression"].as<int>();
+    }
+
     if (vm.count("randomtemp")) {
         cfg_random_temp = vm["randomtemp"].as<float>();
     }
@@ -338,6 +520,20 @@ static void parse_commandline(int argc, char *argv[]) {
             cfg_noise ? TimeManagement::NO_PRUNING : TimeManagement::ON;
     }
 
+    if (vm.count("adaptive-time")) {
+        cfg_adaptive_time = true;
+        const auto ratio = vm["time-ratio"].as<std::string>();
+        if (std::sscanf(ratio.c_str(), "%f:%f",
+                        &cfg_time_min_ratio, &cfg_time_max_ratio) != 2
+            || cfg_time_min_ratio > 1.0f || cfg_time_max_ratio < 1.0f) {
+            printf("Unexpected --time-ratio value: %s\n", ratio.c_str());
+            exit(EXIT_FAILURE);
+        }
+        if (vm.count("time-log")) {
+            cfg_time_log = vm["time-log"].as<std::string>();
+        }
+    }
+
     if (vm.count("lagbuffer")) {
         int lagbuffer = vm["lagbuffer"].as<int>();
         if (lagbuffer != cfg_lagbuffer_cs) {
@@ -376,12 +572,15 @@ static void parse_commandline(int argc, char *argv[]) {
     cfg_options_str = out.str();
 }
 
-static void initialize_network() {
+static std::unique_ptr<Network> load_network(const std::string& weightsfile) {
     auto network = std::make_unique<Network>();
     auto playouts = std::min(cfg_max_playouts, cfg_max_visits);
-    network->initialize(playouts, cfg_weightsfile);
+    network->initialize(playouts, weightsfile);
+    return network;
+}
 
-    GTP::initialize(std::move(network));
+static void initialize_network() {
+    GTP::initialize(load_network(cfg_weightsfile));
 }
 
 // Setup global objects after command line has been parsed
@@ -396,8 +595,6 @@ void init_global_objects() {
     // Doing this here avoids mixing in the thread_id, which
     // improves reproducibility across platforms.
     Random::get_Rng().seedrandom(cfg_rng_seed);
-
-    initialize_network();
 }
 
 void benchmark(GameState& game) {
@@ -433,6 +630,14 @@ int main(int argc, char *argv[]) {
 
     init_global_objects();
 
+    if (!cfg_build_index.empty()) {
+        auto result = PositionIndex::build(cfg_index_sgf, cfg_build_index);
+        myprintf("%s\n", result.second.c_str());
+        return result.first ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    initialize_network();
+
     auto maingame = std::make_unique<GameState>();
 
     /* set board limits */
@@ -445,6 +650,37 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
+    if (!cfg_match_weightsfile.empty()) {
+        auto opponent = load_network(cfg_match_weightsfile);
+        Match match(*GTP::s_network, *opponent, cfg_match_games,
+                    cfg_match_parallel, cfg_sprt_elo0, cfg_sprt_elo1);
+        match.run();
+        return 0;
+    }
+
+    if (cfg_selfplay_games) {
+        SelfPlay selfplay(cfg_selfplay_games, cfg_selfplay_parallel,
+                          cfg_selfplay_output);
+        selfplay.run();
+        return 0;
+    }
+
+    if (!cfg_eval_server.empty()) {
+        EvalServer server(*GTP::s_network,
+                          RemoteProtocol::fingerprint(cfg_weightsfile));
+        if (!server.listen(cfg_eval_server)) {
+            return EXIT_FAILURE;
+        }
+        server.run();
+        return 0;
+    }
+
+    if (cfg_analysis_port) {
+        AnalysisServer server(cfg_analysis_port);
+        server.run();
+        return 0;
+    }
+
     for (;;) {
         if (!cfg_gtp_mode) {
             maingame->display_state();
@@ -468,5 +704,6 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    Training::finish_output();
     return 0;
 }
@@ -0,0 +1,170 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "Match.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "FastBoard.h"
+#include "GameState.h"
+#include "Training.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+Match::Match(Network& first, Network& second, int games, int parallel,
+             float elo0, float elo1)
+    : m_first(first), m_second(second), m_games(games),
+      m_parallel(parallel) {
+    m_sprt.initialize(elo0, elo1, 0.05, 0.05);
+    // Go has no draws, so seed one to keep the draw rate estimate
+    // valid, like the validation tool does.
+    m_sprt.addGameResult(Sprt::Draw);
+}
+
+void Match::run() {
+    auto threads = std::vector<std::thread>{};
+    for (auto i = 0; i < m_parallel; i++) {
+        threads.emplace_back(&Match::play_games, this);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const auto status = m_sprt.status();
+    if (status.result == Sprt::Continue) {
+        myprintf("No SPRT decision after %d games.\n", m_played);
+    } else {
+        myprintf("The first net is %s than the second.\n",
+                 status.result == Sprt::AcceptH0 ? "worse" : "better");
+    }
+    myprintf("First net won %d as black and %d as white, of %d games.\n",
+             m_first_black_wins, m_first_white_wins, m_played);
+}
+
+void Match::play_games() {
+    while (!m_stop) {
+        const auto index = m_next_game++;
+        if (index >= m_games) {
+            break;
+        }
+        const auto first_is_black = index % 2 == 0;
+        const auto result = play_game(first_is_black);
+        if (result != Sprt::NotEnded) {
+            finish_game(result, first_is_black);
+        }
+    }
+}
+
+void Match::add_searches(UCTSearch* black, UCTSearch* white) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_searches.push_back(black);
+    m_searches.push_back(white);
+    if (m_stop) {
+        black->stop();
+        white->stop();
+    }
+}
+
+void Match::remove_searches(UCTSearch* black, UCTSearch* white) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_searches.erase(std::remove_if(begin(m_searches), end(m_searches),
+                         [black, white](const UCTSearch* search) {
+                             return search == black || search == white;
+                         }),
+                     end(m_searches));
+}
+
+Sprt::GameResult Match::play_game(bool first_is_black) {
+    // think() records every position for training, which we don't want.
+    // This thread may have been used for other games before.
+    Training::clear_training();
+
+    auto game = std::make_unique<GameState>();
+    game->init_game(BOARD_SIZE, 7.5f);
+
+    auto black = std::make_unique<UCTSearch>(
+        *game, first_is_black ? m_first : m_second);
+    auto white = std::make_unique<UCTSearch>(
+        *game, first_is_black ? m_second : m_first);
+    add_searches(black.get(), white.get());
+    auto stopped = false;
+    do {
+        if (m_stop) {
+            stopped = true;
+            break;
+        }
+        const auto color = game->get_to_move();
+        auto& search = color == FastBoard::BLACK ? *black : *white;
+        const auto move = search.think(color);
+        game->play_move(move);
+    } while (!game->has_resigned() && game->get_passes() < 2);
+    remove_searches(black.get(), white.get());
+    Training::clear_training();
+    if (stopped) {
+        return Sprt::NotEnded;
+    }
+
+    auto winner = FastBoard::WHITE;
+    if (game->has_resigned()) {
+        if (game->who_resigned() == FastBoard::WHITE) {
+            winner = FastBoard::BLACK;
+        }
+    } else if (game->final_score() > 0.0f) {
+        winner = FastBoard::BLACK;
+    }
+    const auto first_won = (winner == FastBoard::BLACK) == first_is_black;
+    return first_won ? Sprt::Win : Sprt::Loss;
+}
+
+void Match::finish_game(Sprt::GameResult result, bool first_is_black) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stop) {
+        return;
+    }
+    m_sprt.addGameResult(result);
+    m_played++;
+    if (result == Sprt::Win) {
+        if (first_is_black) {
+            m_first_black_wins++;
+        } else {
+            m_first_white_wins++;
+        }
+    }
+
+    const auto status = m_sprt.status();
+    const auto wdl = m_sprt.getWDL();
+    Time now;
+    myprintf("Game %d: %d wins, %d losses, LLR %.2f (%.2f, %.2f), "
+             "%.1f games/hour\n",
+             m_played, std::get<0>(wdl), std::get<2>(wdl), status.llr,
+             status.lBound, status.uBound,
+             m_played * 3600.0 / Time::timediff_seconds(m_start, now));
+    if (status.result != Sprt::Continue) {
+        m_stop = true;
+        // Games still in progress can't change the decision.
+        for (const auto search : m_searches) {
+            search->stop();
+        }
+    }
+}
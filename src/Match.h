@@ -0,0 +1,71 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MATCH_H_INCLUDED
+#define MATCH_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "../validation/SPRT.h"
+#include "Network.h"
+#include "Timing.h"
+
+class UCTSearch;
+
+/*
+    Plays a match between two networks inside this process, several games
+    at a time. Both networks are loaded once and shared by all games.
+    Results go into an SPRT, and games still in progress are abandoned
+    as soon as it accepts either hypothesis.
+*/
+class Match {
+public:
+    Match(Network& first, Network& second, int games, int parallel,
+          float elo0, float elo1);
+    void run();
+
+private:
+    void play_games();
+    Sprt::GameResult play_game(bool first_is_black);
+    void finish_game(Sprt::GameResult result, bool first_is_black);
+    void add_searches(UCTSearch* black, UCTSearch* white);
+    void remove_searches(UCTSearch* black, UCTSearch* white);
+
+    Network& m_first;
+    Network& m_second;
+    int m_games;
+    int m_parallel;
+    std::atomic<int> m_next_game{0};
+    std::atomic<bool> m_stop{false};
+    Time m_start;
+
+    // Protects the statistics below, and the searches of the games in
+    // progress, which are stopped together with the match.
+    std::mutex m_mutex;
+    std::vector<UCTSearch*> m_searches;
+    Sprt m_sprt;
+    int m_played{0};
+    int m_first_black_wins{0};
+    int m_first_white_wins{0};
+};
+
+#endif
@@ -21,6 +21,7 @@
 #include <memory>
 
 #include "NNCache.h"
+#include "Profile.h"
 #include "Utils.h"
 #include "UCTSearch.h"
 #include "GTP.h"
@@ -31,29 +32,48 @@ const size_t NNCache::ENTRY_SIZE;
 
 NNCache::NNCache(int size) : m_size(size) {}
 
-bool NNCache::lookup(std::uint64_t hash, Netresult & result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+bool NNCache::lookup(std::uint64_t hash, Netresult & result,
+                     const int heads) {
+    std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+    {
+        Profile::Scope wait{Profile::CACHE_LOCK};
+        lock.lock();
+    }
     ++m_lookups;
 
     auto iter = m_cache.find(hash);
     if (iter == m_cache.end()) {
+        result.heads = 0;
         return false;  // Not found.
     }
 
     const auto& entry = iter->second;
+    result = entry->result;
+    if ((result.heads & heads) != heads) {
+        return false;  // Only part of what we need.
+    }
 
     // Found it.
     ++m_hits;
-    result = entry->result;
     return true;
 }
 
 void NNCache::insert(std::uint64_t hash,
                      const Netresult& result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+    {
+        Profile::Scope wait{Profile::CACHE_LOCK};
+        lock.lock();
+    }
 
-    if (m_cache.find(hash) != m_cache.end()) {
-        return;  // Already in the cache.
+    auto iter = m_cache.find(hash);
+    if (iter != m_cache.end()) {
+        // Already in the cache, replace it only if we have more heads.
+        if ((iter->second->result.heads | result.heads)
+            != iter->second->result.heads) {
+            iter->second = std::make_unique<Entry>(result);
+        }
+        return;
     }
 
     m_cache.emplace(hash, std::make_unique<Entry>(result));
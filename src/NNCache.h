@@ -37,6 +37,11 @@ public:
     static constexpr int MIN_CACHE_COUNT = 6'000;
 
     struct Netresult {
+        enum Heads {
+            POLICY_HEAD = 1, VALUE_HEAD = 2,
+            ALL_HEADS = POLICY_HEAD | VALUE_HEAD
+        };
+
         // 19x19 board positions
         std::array<float, NUM_INTERSECTIONS> policy;
 
@@ -46,7 +51,11 @@ public:
         // winrate
         float winrate;
 
-        Netresult() : policy_pass(0.0f), winrate(0.0f) {
+        // Which of the above hold results. A partial result can be
+        // completed later by evaluating only the missing head.
+        int heads;
+
+        Netresult() : policy_pass(0.0f), winrate(0.0f), heads(ALL_HEADS) {
             policy.fill(0.0f);
         }
     };
@@ -64,10 +73,13 @@ public:
     // Resize NNCache
     void resize(int size);
 
-    // Try and find an existing entry.
-    bool lookup(std::uint64_t hash, Netresult & result);
+    // Try and find an existing entry that has all of the given heads.
+    // On a miss, result.heads says which heads a partial entry has
+    // (copied into result), 0 if there is none.
+    bool lookup(std::uint64_t hash, Netresult & result,
+                const int heads = Netresult::ALL_HEADS);
 
-    // Insert a new entry.
+    // Insert a new entry, or complete a partial one.
     void insert(std::uint64_t hash,
                 const Netresult& result);
 
@@ -47,6 +47,7 @@
 
 #include "Network.h"
 #include "CPUPipe.h"
+#include "Float16.h"
 #ifdef USE_OPENCL
 #include "OpenCLScheduler.h"
 #include "UCTNode.h"
@@ -57,7 +58,9 @@
 #include "GameState.h"
 #include "GTP.h"
 #include "NNCache.h"
+#include "Profile.h"
 #include "Random.h"
+#include "RemotePipe.h"
 #include "ThreadPool.h"
 #include "Timing.h"
 #include "Utils.h"
@@ -97,19 +100,17 @@ float Network::benchmark_time(int centiseconds) {
     get_output(&state, Ensemble::RANDOM_SYMMETRY, -1, true, true);
 
     const Time start;
-    for (auto i = 0; i < cpus; i++) {
-        tg.add_task([this, &runcount, start, centiseconds, state]() {
-            while (true) {
-                runcount++;
-                get_output(&state, Ensemble::RANDOM_SYMMETRY, -1, true);
-                const Time end;
-                const auto elapsed = Time::timediff_centis(start, end);
-                if (elapsed >= centiseconds) {
-                    break;
-                }
+    tg.add_tasks(cpus, [this, &runcount, start, centiseconds, &state]() {
+        while (true) {
+            runcount++;
+            get_output(&state, Ensemble::RANDOM_SYMMETRY, -1, true);
+            const Time end;
+            const auto elapsed = Time::timediff_centis(start, end);
+            if (elapsed >= centiseconds) {
+                break;
             }
-        });
-    }
+        }
+    });
     tg.wait_all();
 
     const Time end;
@@ -124,14 +125,12 @@ void Network::benchmark(const GameState* const state, const int iterations) {
     ThreadGroup tg(thread_pool);
     std::atomic<int> runcount{0};
 
-    for (auto i = 0; i < cpus; i++) {
-        tg.add_task([this, &runcount, iterations, state]() {
-            while (runcount < iterations) {
-                runcount++;
-                get_output(state, Ensemble::RANDOM_SYMMETRY, -1, true);
-            }
-        });
-    }
+    tg.add_tasks(cpus, [this, &runcount, iterations, state]() {
+        while (runcount < iterations) {
+            runcount++;
+            get_output(state, Ensemble::RANDOM_SYMMETRY, -1, true);
+        }
+    });
     tg.wait_all();
 
     const Time end;
@@ -456,6 +455,92 @@ void Network::select_precision(int channels) {
 }
 #endif
 
+float Network::compare_to_reference(std::unique_ptr<ForwardPipe>& reference) {
+    // A few positions from a random game, so that the check doesn't
+    // only see an empty board.
+    constexpr auto NUM_POSITIONS = 4;
+    constexpr auto MOVES_BETWEEN = 20;
+
+    auto rng = Random{5489};
+    GameState state;
+    state.init_game(BOARD_SIZE, 7.5);
+
+    auto max_error = 0.0f;
+    for (auto pos = 0; pos < NUM_POSITIONS; pos++) {
+        const auto result = get_output_internal(&state, IDENTITY_SYMMETRY);
+        std::swap(m_forward, reference);
+        const auto ref = get_output_internal(&state, IDENTITY_SYMMETRY);
+        std::swap(m_forward, reference);
+
+        // L2-norm like compare_net_outputs.
+        auto error = 0.0f;
+        for (auto idx = size_t{0}; idx < result.policy.size(); ++idx) {
+            const auto diff = result.policy[idx] - ref.policy[idx];
+            error += diff * diff;
+        }
+        const auto diff_pass = result.policy_pass - ref.policy_pass;
+        const auto diff_winrate = result.winrate - ref.winrate;
+        error += diff_pass * diff_pass;
+        error += diff_winrate * diff_winrate;
+        error = std::sqrt(error);
+        if (std::isnan(error)) {
+            return error;
+        }
+        max_error = std::max(max_error, error);
+
+        for (auto i = 0; i < MOVES_BETWEEN; i++) {
+            const auto color = state.get_to_move();
+            auto vertex = int{FastBoard::PASS};
+            for (auto tries = 0; tries < 100; tries++) {
+                const auto x = rng.randfix<BOARD_SIZE>();
+                const auto y = rng.randfix<BOARD_SIZE>();
+                const auto v = state.board.get_vertex(x, y);
+                if (state.is_move_legal(color, v)) {
+                    vertex = v;
+                    break;
+                }
+            }
+            state.play_move(vertex);
+        }
+    }
+    return max_error;
+}
+
+void Network::select_cpu_precision(int channels) {
+    // Reduced precision only changes how values are stored, so it should
+    // stay very close to single precision. bf16 has 8 bits of mantissa
+    // left against 11 for half.
+    constexpr auto max_error = 0.05f;
+
+    if (cfg_cpu_precision == cpu_precision_t::SINGLE) {
+        myprintf("Initializing CPU-only evaluation.\n");
+        m_forward = init_net(channels, std::make_unique<CPUPipe<float>>());
+        return;
+    }
+
+    auto name = std::string{};
+    if (cfg_cpu_precision == cpu_precision_t::HALF) {
+        name = "half";
+        m_forward = init_net(channels,
+            std::make_unique<CPUPipe<Float16::half_t>>());
+    } else {
+        assert(cfg_cpu_precision == cpu_precision_t::BFLOAT16);
+        name = "bf16";
+        m_forward = init_net(channels,
+            std::make_unique<CPUPipe<Float16::bfloat16_t>>());
+    }
+    myprintf("Initializing CPU-only evaluation (%s precision storage).\n",
+             name.c_str());
+
+    auto reference = init_net(channels, std::make_unique<CPUPipe<float>>());
+    const auto error = compare_to_reference(reference);
+    myprintf("Error against single precision: %.4f\n", error);
+    if (error > max_error || std::isnan(error)) {
+        myprintf("Too inaccurate, falling back to single precision.\n");
+        m_forward = std::move(reference);
+    }
+}
+
 void Network::initialize(int playouts, const std::string & weightsfile) {
 #ifdef USE_BLAS
 #ifndef __APPLE__
@@ -540,31 +625,35 @@ void Network::initialize(int playouts, const std::string & weightsfile) {
         m_fwd_weights->m_conv_pol_b[i] = 0.0f;
     }
 
-#ifdef USE_OPENCL
-    if (cfg_cpu_only) {
-        myprintf("Initializing CPU-only evaluation.\n");
-        m_forward = init_net(channels, std::make_unique<CPUPipe>());
+    if (!cfg_remote_eval.empty()) {
+        myprintf("Initializing remote evaluation.\n");
+        m_forward = init_net(channels, std::make_unique<RemotePipe>(
+            cfg_remote_eval, RemoteProtocol::fingerprint(weightsfile)));
     } else {
+#ifdef USE_OPENCL
+        if (cfg_cpu_only) {
+            select_cpu_precision(channels);
+        } else {
 #ifdef USE_OPENCL_SELFCHECK
-        // initialize CPU reference first, so that we can self-check
-        // when doing fp16 vs. fp32 detections
-        m_forward_cpu = init_net(channels, std::make_unique<CPUPipe>());
+            // initialize CPU reference first, so that we can self-check
+            // when doing fp16 vs. fp32 detections
+            m_forward_cpu = init_net(channels, std::make_unique<CPUPipe<float>>());
 #endif
 #ifdef USE_HALF
-        // HALF support is enabled, and we are using the GPU.
-        // Select the precision to use at runtime.
-        select_precision(channels);
+            // HALF support is enabled, and we are using the GPU.
+            // Select the precision to use at runtime.
+            select_precision(channels);
 #else
-        myprintf("Initializing OpenCL (single precision).\n");
-        m_forward = init_net(channels,
-                             std::make_unique<OpenCLScheduler<float>>());
+            myprintf("Initializing OpenCL (single precision).\n");
+            m_forward = init_net(channels,
+                                 std::make_unique<OpenCLScheduler<float>>());
 #endif
-    }
+        }
 
 #else //!USE_OPENCL
-    myprintf("Initializing CPU-only evaluation.\n");
-    m_forward = init_net(channels, std::make_unique<CPUPipe>());
+        select_cpu_precision(channels);
 #endif
+    }
 
     // Need to estimate size before clearing up the pipe.
     get_estimated_size();
@@ -685,10 +774,13 @@ std::vector<float> softmax(const std::vector<float>& input,
 }
 
 bool Network::probe_cache(const GameState* const state,
-                          Network::Netresult& result) {
-    if (m_nncache.lookup(state->board.get_hash(), result)) {
+                          Network::Netresult& result,
+                          const int heads) {
+    if (m_nncache.lookup(state->board.get_hash(), result, heads)) {
         return true;
     }
+    // Hand back a partial entry for this position, if there is one.
+    const auto partial = result;
     // If we are not generating a self-play game, try to find
     // symmetries if we are in the early opening.
     if (!cfg_noise && !cfg_random_cnt
@@ -699,7 +791,7 @@ bool Network::probe_cache(const GameState* const state,
                 continue;
             }
             const auto hash = state->get_symmetry_hash(sym);
-            if (m_nncache.lookup(hash, result)) {
+            if (m_nncache.lookup(hash, result, heads)) {
                 decltype(result.policy) corrected_policy;
                 for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; ++idx) {
                     const auto sym_idx = symmetry_nn_idx_table[sym][idx];
@@ -711,30 +803,42 @@ bool Network::probe_cache(const GameState* const state,
         }
     }
 
+    result = partial;
     return false;
 }
 
 Network::Netresult Network::get_output(
     const GameState* const state, const Ensemble ensemble,
-    const int symmetry, const bool skip_cache, const bool force_selfcheck) {
+    const int symmetry, const bool skip_cache, const bool force_selfcheck,
+    const int heads) {
     Netresult result;
     if (state->board.get_boardsize() != BOARD_SIZE) {
         return result;
     }
 
+    // What the cache already has for this position.
+    auto cached = Netresult{};
+    cached.heads = 0;
     if (!skip_cache) {
         // See if we already have this in the cache.
-        if (probe_cache(state, result)) {
-            return result;
+        auto hit = false;
+        {
+            Profile::Scope probe{Profile::CACHE_PROBE};
+            hit = probe_cache(state, cached, heads);
+        }
+        Profile::count(hit ? Profile::CACHE_HITS : Profile::CACHE_MISSES);
+        if (hit) {
+            return cached;
         }
     }
+    const auto missing = heads & ~cached.heads;
 
     if (ensemble == DIRECT) {
         assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
-        result = get_output_internal(state, symmetry);
+        result = get_output_internal(state, symmetry, false, missing);
     } else if (ensemble == AVERAGE) {
         for (auto sym = 0; sym < NUM_SYMMETRIES; ++sym) {
-            auto tmpresult = get_output_internal(state, sym);
+            auto tmpresult = get_output_internal(state, sym, false, missing);
             result.winrate +=
                 tmpresult.winrate / static_cast<float>(NUM_SYMMETRIES);
             result.policy_pass +=
@@ -749,7 +853,7 @@ Network::Netresult Network::get_output(
         assert(ensemble == RANDOM_SYMMETRY);
         assert(symmetry == -1);
         const auto rand_sym = Random::get_Rng().randfix<NUM_SYMMETRIES>();
-        result = get_output_internal(state, rand_sym);
+        result = get_output_internal(state, rand_sym, false, missing);
 #ifdef USE_OPENCL_SELFCHECK
         // Both implementations are available, self-check the OpenCL driver by
         // running both with a probability of 1/2000.
@@ -758,7 +862,8 @@ Network::Netresult Network::get_output(
         if (m_forward_cpu != nullptr
             && (force_selfcheck || Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0)
         ) {
-            auto result_ref = get_output_internal(state, rand_sym, true);
+            auto result_ref =
+                get_output_internal(state, rand_sym, true, missing);
             compare_net_outputs(result, result_ref);
         }
 #else
@@ -767,27 +872,49 @@ Network::Netresult Network::get_output(
     }
 
     // v2 format (ELF Open Go) returns black value, not stm
-    if (m_value_head_not_stm) {
+    if (m_value_head_not_stm && (missing & Netresult::VALUE_HEAD)) {
         if (state->board.get_to_move() == FastBoard::WHITE) {
             result.winrate = 1.0f - result.winrate;
         }
     }
 
+    // Complete what was cached with what we computed.
+    if (cached.heads & ~missing & Netresult::POLICY_HEAD) {
+        result.policy = cached.policy;
+        result.policy_pass = cached.policy_pass;
+    }
+    if (cached.heads & ~missing & Netresult::VALUE_HEAD) {
+        result.winrate = cached.winrate;
+    }
+    result.heads = cached.heads | missing;
+
     // Insert result into cache.
     m_nncache.insert(state->board.get_hash(), result);
 
     return result;
 }
 
+void Network::forward(const std::vector<float>& input,
+                      std::vector<float>& output_pol,
+                      std::vector<float>& output_val) {
+    Profile::Scope eval{Profile::NN_EVAL};
+    m_forward->forward(input, output_pol, output_val);
+}
+
 Network::Netresult Network::get_output_internal(
-    const GameState* const state, const int symmetry, bool selfcheck) {
+    const GameState* const state, const int symmetry, bool selfcheck,
+    const int heads) {
     assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
     constexpr auto width = BOARD_SIZE;
     constexpr auto height = BOARD_SIZE;
+    const auto want_policy = (heads & Netresult::POLICY_HEAD) != 0;
+    const auto want_value = (heads & Netresult::VALUE_HEAD) != 0;
 
     const auto input_data = gather_features(state, symmetry);
-    std::vector<float> policy_data(OUTPUTS_POLICY * width * height);
-    std::vector<float> value_data(OUTPUTS_VALUE * width * height);
+    // Leaving an output empty tells the pipe to skip that head.
+    std::vector<float> policy_data(want_policy ? OUTPUTS_POLICY * width * height : 0);
+    std::vector<float> value_data(want_value ? OUTPUTS_VALUE * width * height : 0);
+    Profile::Scope eval{Profile::NN_EVAL};
 #ifdef USE_OPENCL_SELFCHECK
     if (selfcheck) {
         m_forward_cpu->forward(input_data, policy_data, value_data);
@@ -799,35 +926,38 @@ Network::Netresult Network::get_output_internal(
     (void) selfcheck;
 #endif
 
-    // Get the moves
-    batchnorm<NUM_INTERSECTIONS>(OUTPUTS_POLICY, policy_data,
-        m_bn_pol_w1.data(), m_bn_pol_w2.data());
-    const auto policy_out =
-        innerproduct<OUTPUTS_POLICY * NUM_INTERSECTIONS, POTENTIAL_MOVES, false>(
-            policy_data, m_ip_pol_w, m_ip_pol_b);
-    const auto outputs = softmax(policy_out, cfg_softmax_temp);
-
-    // Now get the value
-    batchnorm<NUM_INTERSECTIONS>(OUTPUTS_VALUE, value_data,
-        m_bn_val_w1.data(), m_bn_val_w2.data());
-    const auto winrate_data =
-        innerproduct<OUTPUTS_VALUE * NUM_INTERSECTIONS, VALUE_LAYER, true>(
-            value_data, m_ip1_val_w, m_ip1_val_b);
-    const auto winrate_out =
-        innerproduct<VALUE_LAYER, 1, false>(winrate_data, m_ip2_val_w, m_ip2_val_b);
-
-    // Map TanH output range [-1..1] to [0..1] range
-    const auto winrate = (1.0f + std::tanh(winrate_out[0])) / 2.0f;
-
     Netresult result;
-
-    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        result.policy[sym_idx] = outputs[idx];
+    result.heads = heads;
+
+    if (want_policy) {
+        // Get the moves
+        batchnorm<NUM_INTERSECTIONS>(OUTPUTS_POLICY, policy_data,
+            m_bn_pol_w1.data(), m_bn_pol_w2.data());
+        const auto policy_out =
+            innerproduct<OUTPUTS_POLICY * NUM_INTERSECTIONS, POTENTIAL_MOVES, false>(
+                policy_data, m_ip_pol_w, m_ip_pol_b);
+        const auto outputs = softmax(policy_out, cfg_softmax_temp);
+
+        for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
+            const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
+            result.policy[sym_idx] = outputs[idx];
+        }
+        result.policy_pass = outputs[NUM_INTERSECTIONS];
     }
 
-    result.policy_pass = outputs[NUM_INTERSECTIONS];
-    result.winrate = winrate;
+    if (want_value) {
+        // Now get the value
+        batchnorm<NUM_INTERSECTIONS>(OUTPUTS_VALUE, value_data,
+            m_bn_val_w1.data(), m_bn_val_w2.data());
+        const auto winrate_data =
+            innerproduct<OUTPUTS_VALUE * NUM_INTERSECTIONS, VALUE_LAYER, true>(
+                value_data, m_ip1_val_w, m_ip1_val_b);
+        const auto winrate_out =
+            innerproduct<VALUE_LAYER, 1, false>(winrate_data, m_ip2_val_w, m_ip2_val_b);
+
+        // Map TanH output range [-1..1] to [0..1] range
+        result.winrate = (1.0f + std::tanh(winrate_out[0])) / 2.0f;
+    }
 
     return result;
 }
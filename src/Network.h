@@ -63,11 +63,15 @@ public:
     using PolicyVertexPair = std::pair<float,int>;
     using Netresult = NNCache::Netresult;
 
+    // heads is a Netresult::Heads mask. Asking for one head skips the
+    // other head's layers, and the cache completes partial entries
+    // instead of evaluating the position again from scratch.
     Netresult get_output(const GameState* const state,
                          const Ensemble ensemble,
                          const int symmetry = -1,
                          const bool skip_cache = false,
-                         const bool force_selfcheck = false);
+                         const bool force_selfcheck = false,
+                         const int heads = Netresult::ALL_HEADS);
 
     static constexpr auto INPUT_MOVES = 8;
     static constexpr auto INPUT_CHANNELS = 2 * INPUT_MOVES + 2;
@@ -77,6 +81,13 @@ public:
 
     void initialize(int playouts, const std::string & weightsfile);
 
+    // Runs the tower and head convolutions on gathered input planes,
+    // leaving the rest of the heads to the caller. This is what an
+    // EvalServer provides to remote searches.
+    void forward(const std::vector<float>& input,
+                 std::vector<float>& output_pol,
+                 std::vector<float>& output_val);
+
     float benchmark_time(int centiseconds);
     void benchmark(const GameState * const state,
                    const int iterations = 1600);
@@ -118,17 +129,21 @@ private:
                                const std::vector<float>& V,
                                std::vector<float>& M, const int C, const int K);
     Netresult get_output_internal(const GameState* const state,
-                                  const int symmetry, bool selfcheck = false);
+                                  const int symmetry, bool selfcheck = false,
+                                  const int heads = Netresult::ALL_HEADS);
     static void fill_input_plane_pair(const FullBoard& board,
                                       std::vector<float>::iterator black,
                                       std::vector<float>::iterator white,
                                       const int symmetry);
-    bool probe_cache(const GameState* const state, Network::Netresult& result);
+    bool probe_cache(const GameState* const state, Network::Netresult& result,
+                     const int heads);
     std::unique_ptr<ForwardPipe>&& init_net(int channels,
                                             std::unique_ptr<ForwardPipe>&& pipe);
 #ifdef USE_HALF
     void select_precision(int channels);
 #endif
+    void select_cpu_precision(int channels);
+    float compare_to_reference(std::unique_ptr<ForwardPipe>& reference);
     std::unique_ptr<ForwardPipe> m_forward;
 #ifdef USE_OPENCL_SELFCHECK
     void compare_net_outputs(const Netresult& data, const Netresult& ref);
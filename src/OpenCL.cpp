@@ -99,6 +99,8 @@ void OpenCL<net_t>::ensure_context_initialized(OpenCLContext &opencl_context) {
             cl::Kernel(m_program, "out_transform_fused_bn_in");
         opencl_context.m_commandqueue =
             cl::CommandQueue(m_context, m_device);
+        opencl_context.m_uploadqueue =
+            cl::CommandQueue(m_context, m_device);
         opencl_context.m_is_initialized = true;
     }
 }
@@ -130,11 +132,22 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
                              std::vector<float>& output_val,
                              OpenCLContext & opencl_context,
                              const int batch_size) {
+    enqueue_forward(input, opencl_context, 0, batch_size);
+    finish_forward(output_pol, output_val, opencl_context, 0);
+}
+
+template <typename net_t>
+void OpenCL_Network<net_t>::enqueue_forward(const std::vector<float>& input,
+                                     OpenCLContext & opencl_context,
+                                     const int slot,
+                                     const int batch_size) {
     constexpr auto tiles = WINOGRAD_P;
     constexpr auto one_plane = NUM_INTERSECTIONS * sizeof(net_t);
     const auto finalSize_pol = m_layers[m_layers.size()-2].outputs * one_plane;
     const auto finalSize_val = m_layers.back().outputs * one_plane;
+    const auto max_batch = m_opencl.m_batch_size;
 
+    assert(batch_size <= max_batch);
     m_opencl.ensure_context_initialized(opencl_context);
 
     if (!opencl_context.m_buffers_allocated) {
@@ -150,12 +163,13 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
         const auto vwn = m_opencl.m_sgemm_tuners.vwn;
 
         const auto m_ceil = ceilMultiple(ceilMultiple(max_channels, mwg), vwm);
-        const auto n_ceil = ceilMultiple(ceilMultiple(tiles, nwg), vwn);
+        const auto n_ceil =
+            ceilMultiple(ceilMultiple(max_batch * tiles, nwg), vwn);
 
         const auto alloc_inSize =
-            MAX_BATCH * NUM_INTERSECTIONS * max_channels * sizeof(net_t);
+            max_batch * NUM_INTERSECTIONS * max_channels * sizeof(net_t);
         const auto alloc_vm_size =
-            MAX_BATCH * WINOGRAD_TILE * m_ceil * n_ceil * sizeof(net_t);
+            WINOGRAD_TILE * m_ceil * n_ceil * sizeof(net_t);
 
         auto v_zeros = std::vector<net_t>(alloc_vm_size);
 
@@ -173,27 +187,45 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
             m_opencl.m_context,
             CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, alloc_vm_size);
 
-        opencl_context.m_pinnedOutBuffer_pol = cl::Buffer(
-            m_opencl.m_context,
-            CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, MAX_BATCH * finalSize_pol);
-        opencl_context.m_pinnedOutBuffer_val = cl::Buffer(
-            m_opencl.m_context,
-            CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, MAX_BATCH * finalSize_val);
+        for (auto& buffers : opencl_context.m_slots) {
+            buffers.m_inBuffer = cl::Buffer(
+                m_opencl.m_context,
+                CL_MEM_READ_ONLY, alloc_inSize);
+            buffers.m_pinnedOutBuffer_pol = cl::Buffer(
+                m_opencl.m_context,
+                CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                max_batch * finalSize_pol);
+            buffers.m_pinnedOutBuffer_val = cl::Buffer(
+                m_opencl.m_context,
+                CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                max_batch * finalSize_val);
+        }
 
         opencl_context.m_buffers_allocated = true;
     }
 
+    auto& buffers = opencl_context.m_slots[slot];
+    assert(buffers.m_batch_size == 0);
     cl::Buffer & inBuffer = opencl_context.m_inBuffer;
     cl::Buffer & inBuffer2 = opencl_context.m_inBuffer2;
     cl::Buffer & VBuffer = opencl_context.m_VBuffer;
     cl::Buffer & MBuffer = opencl_context.m_MBuffer;
     cl::CommandQueue & queue = opencl_context.m_commandqueue;
 
-    std::vector<net_t> net_t_input(input.size());
-    std::copy(begin(input), end(input), begin(net_t_input));
-
+    // The compute queue may still be busy with the other slot, the
+    // upload queue isn't. The kernels of the previous batch don't touch
+    // this slot's input, so the transfer can overlap with them. The
+    // first kernel waits for the upload on the device, not here.
     const auto inSize = sizeof(net_t) * input.size();
-    queue.enqueueWriteBuffer(inBuffer, CL_FALSE, 0, inSize, net_t_input.data());
+    buffers.m_input.resize(inSize);
+    std::copy(begin(input), end(input),
+              reinterpret_cast<net_t*>(buffers.m_input.data()));
+
+    auto uploaded = std::vector<cl::Event>(1);
+    opencl_context.m_uploadqueue.enqueueWriteBuffer(
+        buffers.m_inBuffer, CL_FALSE, 0, inSize, buffers.m_input.data(),
+        nullptr, &uploaded[0]);
+    opencl_context.m_uploadqueue.flush();
 
     auto skip_in_trans = false;
     for (auto iter = cbegin(m_layers); iter != cend(m_layers); iter++) {
@@ -212,7 +244,7 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
             convolve3(opencl_context,
                      layer.channels,
                      layer.outputs,
-                     inBuffer,
+                     buffers.m_inBuffer,
                      inBuffer,
                      VBuffer,
                      MBuffer,
@@ -220,7 +252,7 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
                      nullptr,
                      bn_weights,
                      skip_in_trans, skip_next_in_trans, true,
-                     batch_size);
+                     batch_size, &uploaded);
 
             skip_in_trans = skip_next_in_trans;
         } else if (layer.is_residual_block) {
@@ -265,9 +297,9 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
 
             cl::Buffer out_buffer;
             if (niter == cend(m_layers)) {
-                out_buffer = opencl_context.m_pinnedOutBuffer_val;
+                out_buffer = buffers.m_pinnedOutBuffer_val;
             } else {
-                out_buffer = opencl_context.m_pinnedOutBuffer_pol;
+                out_buffer = buffers.m_pinnedOutBuffer_pol;
             }
 
             convolve1(opencl_context, layer.channels,
@@ -280,30 +312,45 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
         }
     }
 
-    auto pinnedOutBufferHost_pol = queue.enqueueMapBuffer(
-        opencl_context.m_pinnedOutBuffer_pol, CL_FALSE,
+    buffers.m_pol_host = queue.enqueueMapBuffer(
+        buffers.m_pinnedOutBuffer_pol, CL_FALSE,
         CL_MAP_READ, 0, batch_size * finalSize_pol);
-    auto pinnedOutBufferHost_val = queue.enqueueMapBuffer(
-        opencl_context.m_pinnedOutBuffer_val, CL_FALSE,
-        CL_MAP_READ, 0, batch_size * finalSize_val);
+    buffers.m_val_host = queue.enqueueMapBuffer(
+        buffers.m_pinnedOutBuffer_val, CL_FALSE,
+        CL_MAP_READ, 0, batch_size * finalSize_val,
+        nullptr, &buffers.m_done);
+    buffers.m_batch_size = batch_size;
+    queue.flush();
+}
+
+template <typename net_t>
+void OpenCL_Network<net_t>::finish_forward(std::vector<float>& output_pol,
+                                    std::vector<float>& output_val,
+                                    OpenCLContext & opencl_context,
+                                    const int slot) {
+    auto& buffers = opencl_context.m_slots[slot];
+    assert(buffers.m_batch_size > 0);
+    cl::CommandQueue & queue = opencl_context.m_commandqueue;
 
     {
-        // Finish call is usually a busy wait. When using multiple threads
+        // Waiting is usually a busy wait. When using multiple threads
         // use the lock to avoid busy waiting with all threads.
         std::lock_guard<std::mutex> lock(m_queue_finish_mutex);
-        queue.finish();
+        buffers.m_done.wait();
     }
 
-    auto polptr = static_cast<net_t*>(pinnedOutBufferHost_pol);
-    auto valptr = static_cast<net_t*>(pinnedOutBufferHost_val);
+    auto polptr = static_cast<net_t*>(buffers.m_pol_host);
+    auto valptr = static_cast<net_t*>(buffers.m_val_host);
     std::copy(polptr, polptr + output_pol.size(), begin(output_pol));
     std::copy(valptr, valptr + output_val.size(), begin(output_val));
 
-    queue.enqueueUnmapMemObject(opencl_context.m_pinnedOutBuffer_pol,
-            pinnedOutBufferHost_pol);
-    queue.enqueueUnmapMemObject(opencl_context.m_pinnedOutBuffer_val,
-            pinnedOutBufferHost_val);
-
+    queue.enqueueUnmapMemObject(buffers.m_pinnedOutBuffer_pol,
+            buffers.m_pol_host);
+    queue.enqueueUnmapMemObject(buffers.m_pinnedOutBuffer_val,
+            buffers.m_val_host);
+    buffers.m_pol_host = nullptr;
+    buffers.m_val_host = nullptr;
+    buffers.m_batch_size = 0;
 }
 
 template <typename net_t>
@@ -319,7 +366,8 @@ void OpenCL_Network<net_t>::convolve3(OpenCLContext & opencl_context,
                               bool skip_in_transform,
                               bool fuse_in_transform,
                               bool store_inout,
-                              int batch_size) {
+                              int batch_size,
+                              const std::vector<cl::Event>* wait_events) {
 
     cl::Kernel & in_transform_kernel = opencl_context.m_in_transform_kernel;
     cl::Kernel & sgemm_kernel = opencl_context.m_sgemm_kernel;
@@ -359,6 +407,8 @@ void OpenCL_Network<net_t>::convolve3(OpenCLContext & opencl_context,
 
     cl::CommandQueue & queue = opencl_context.m_commandqueue;
 
+    // The events are for the first kernel we run.
+    assert(wait_events == nullptr || !skip_in_transform);
     if (!skip_in_transform) {
         try {
             in_transform_kernel.setArg(0, bufferIn);
@@ -369,7 +419,8 @@ void OpenCL_Network<net_t>::convolve3(OpenCLContext & opencl_context,
             in_transform_kernel.setArg(5, batch_size);
 
             queue.enqueueNDRangeKernel(in_transform_kernel, cl::NullRange,
-                                       cl::NDRange(wgs, channels));
+                                       cl::NDRange(wgs, channels),
+                                       cl::NullRange, wait_events);
         } catch (const cl::Error &e) {
             std::cerr << "Error in convolve3: " << e.what() << ": "
                 << e.err() << std::endl;
@@ -770,7 +821,9 @@ OpenCL<net_t>::OpenCL(int gpu, bool silent) {
 }
 
 template <typename net_t>
-void OpenCL<net_t>::initialize(const int channels) {
+void OpenCL<net_t>::initialize(const int channels, const int batch_size) {
+    m_batch_size = batch_size;
+
     // Make program of the source code in the context
     try {
         m_program = cl::Program(m_context,
@@ -784,9 +837,11 @@ void OpenCL<net_t>::initialize(const int channels) {
         throw std::runtime_error("Error getting OpenCL kernels.");
     }
 
+    // Tune for the width of a full batch, that is what we will run.
     auto t = Tuner<net_t>(*this, m_context, m_device);
     auto sgemm_tuners =
-        t.load_sgemm_tuners(channels, WINOGRAD_P, channels, WINOGRAD_TILE);
+        t.load_sgemm_tuners(channels, WINOGRAD_P * batch_size, channels,
+                            WINOGRAD_TILE);
 
     // Exit immediately after tuning. Some NVIDIA drivers are buggy
     // and will fail to compile the rest of the kernels after a tuning
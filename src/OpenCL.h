@@ -25,6 +25,7 @@
 #define CL_HPP_TARGET_OPENCL_VERSION    120
 #define CL_HPP_ENABLE_EXCEPTIONS
 #include <CL/cl2.hpp>
+#include <array>
 #include <cstddef>
 #include <memory>
 #include <string>
@@ -52,9 +53,15 @@ private:
 class OpenCLContext {
     template <typename> friend class OpenCL;
     template <typename> friend class OpenCL_Network;
+public:
+    // Number of batches that can be in flight at once.
+    static constexpr auto NUM_SLOTS = 2;
 private:
     bool m_is_initialized{false};
     cl::CommandQueue m_commandqueue;
+    // Uploads go through their own queue, so the next batch can be
+    // transferred while the current one is still running.
+    cl::CommandQueue m_uploadqueue;
     cl::Kernel m_convolve1_kernel;
     cl::Kernel m_merge_kernel;
     cl::Kernel m_in_transform_kernel;
@@ -65,8 +72,21 @@ private:
     cl::Buffer m_inBuffer2;
     cl::Buffer m_VBuffer;
     cl::Buffer m_MBuffer;
-    cl::Buffer m_pinnedOutBuffer_pol;
-    cl::Buffer m_pinnedOutBuffer_val;
+
+    // Inputs and outputs are double buffered, see
+    // OpenCL_Network::enqueue_forward.
+    struct Slot {
+        // Host copy of the input, kept until the upload is done.
+        std::vector<char> m_input;
+        cl::Buffer m_inBuffer;
+        cl::Buffer m_pinnedOutBuffer_pol;
+        cl::Buffer m_pinnedOutBuffer_val;
+        void* m_pol_host{nullptr};
+        void* m_val_host{nullptr};
+        cl::Event m_done;
+        int m_batch_size{0};
+    };
+    std::array<Slot, NUM_SLOTS> m_slots;
     bool m_buffers_allocated{false};
 };
 
@@ -140,6 +160,18 @@ public:
             OpenCLContext & opencl_context,
             const int batch_size = 1);
 
+    // Split version of forward(). Uploads the batch into the given slot
+    // and queues the network behind whatever is still running, without
+    // waiting for it. finish_forward() waits for the slot's results.
+    // A context can have one batch in flight per slot.
+    void enqueue_forward(const std::vector<float>& input,
+                         OpenCLContext & opencl_context,
+                         const int slot, const int batch_size);
+    void finish_forward(std::vector<float>& output_pol,
+                        std::vector<float>& output_val,
+                        OpenCLContext & opencl_context,
+                        const int slot);
+
 private:
     using weight_slice_t = std::vector<cl::Buffer>::const_iterator;
 
@@ -158,7 +190,8 @@ private:
                     weight_slice_t bn_weights,
                     bool skip_in_transform,
                     bool fuse_in_transform, bool store_inout,
-                    int batch_size);
+                    int batch_size,
+                    const std::vector<cl::Event>* wait_events = nullptr);
 
     void convolve1(OpenCLContext & opencl_context,
                   int channels, int outputs,
@@ -184,7 +217,7 @@ class OpenCL {
     friend class Tuner<net_t>;
 public:
     OpenCL(int gpu, bool silent = false);
-    void initialize(const int channels);
+    void initialize(const int channels, const int batch_size = 1);
     void ensure_context_initialized(OpenCLContext & opencl_context);
     std::string get_device_name();
     bool has_fp16_compute();
@@ -209,6 +242,8 @@ private:
     size_t m_wavefront_size{0};
     size_t m_max_workgroup_size{0};
     std::vector<size_t> m_max_workgroup_dims;
+    // Largest batch the buffers of a context are sized for.
+    int m_batch_size{1};
     bool m_fp16_compute{false};
     bool m_init_ok{false};
 };
@@ -18,6 +18,9 @@
 #include "config.h"
 
 #ifdef USE_OPENCL
+#include <array>
+#include <chrono>
+
 #include "GTP.h"
 #include "Random.h"
 #include "Network.h"
@@ -96,20 +99,49 @@ OpenCLScheduler<net_t>::OpenCLScheduler() {
     }
 }
 
+template <typename net_t>
+OpenCLScheduler<net_t>::~OpenCLScheduler() {
+    {
+        std::unique_lock<std::mutex> lk(m_forward_queue_mutex);
+        m_running = false;
+    }
+    m_cv.notify_all();
+    for (auto& x : m_worker_threads) {
+        x.join();
+    }
+}
+
 template <typename net_t>
 void OpenCLScheduler<net_t>::initialize(const int channels) {
     // Launch the worker thread.
     // Round_up(cfg_num_threads / gpus.size()) threads
     // so that we only have enough contexts to achieve full parallelism.
     const auto num_threads = (cfg_num_threads + m_opencl.size() - 1) / m_opencl.size();
-    m_context_pool.resize(num_threads);
-    auto gnum = 0;
+
+    // Auto mode: batches only fill up when several search threads wait
+    // on the same device, so half of them is about the most that will
+    // be available at once.
+    m_batch_size = cfg_batch_size;
+    if (m_batch_size == 0) {
+        m_batch_size = std::max<int>(1, num_threads / 2);
+    }
+    m_batch_size = std::min(m_batch_size, MAX_BATCH);
+
+    if (m_batch_size == 1) {
+        m_context_pool.resize(num_threads);
+    }
+    auto gnum = size_t{0};
     for (auto & opencl : m_opencl) {
-        opencl->initialize(channels);
+        opencl->initialize(channels, m_batch_size);
 
-        for (auto i = size_t{0}; i < num_threads; i++) {
-            m_context_pool[i].emplace_back(
-                std::make_shared<ContextPoolEntry>(gnum));
+        if (m_batch_size == 1) {
+            for (auto i = size_t{0}; i < num_threads; i++) {
+                m_context_pool[i].emplace_back(
+                    std::make_shared<ContextPoolEntry>(gnum));
+            }
+        } else {
+            m_worker_threads.emplace_back(
+                [this, gnum] { batch_worker(gnum); });
         }
         gnum++;
     }
@@ -237,6 +269,11 @@ template <typename net_t>
 void OpenCLScheduler<net_t>::forward(const std::vector<float>& input,
                                      std::vector<float>& output_pol,
                                      std::vector<float>& output_val) {
+    if (m_batch_size > 1) {
+        forward_batched(input, output_pol, output_val);
+        return;
+    }
+
     std::shared_ptr<ContextPoolEntry> ctx;
     auto queue_num = size_t{0};
     {
@@ -263,6 +300,150 @@ void OpenCLScheduler<net_t>::forward(const std::vector<float>& input,
     }
 }
 
+template <typename net_t>
+void OpenCLScheduler<net_t>::forward_batched(const std::vector<float>& input,
+                                             std::vector<float>& output_pol,
+                                             std::vector<float>& output_val) {
+    ForwardQueueEntry entry(input, output_pol, output_val);
+    {
+        std::unique_lock<std::mutex> lk(m_forward_queue_mutex);
+        m_forward_queue.push_back(&entry);
+    }
+    m_cv.notify_one();
+
+    std::unique_lock<std::mutex> lk(entry.mutex);
+    entry.cv.wait(lk, [&entry] { return entry.done; });
+    if (entry.error) {
+        std::rethrow_exception(entry.error);
+    }
+}
+
+template <typename net_t>
+size_t OpenCLScheduler<net_t>::pop_batch(
+    std::vector<ForwardQueueEntry*>& batch, const bool block) {
+    // How long to hold a partial batch back, waiting for more positions.
+    constexpr auto BATCH_WAIT = std::chrono::milliseconds(1);
+
+    batch.clear();
+    std::unique_lock<std::mutex> lk(m_forward_queue_mutex);
+    if (block) {
+        m_cv.wait(lk, [this] {
+            return !m_running || !m_forward_queue.empty();
+        });
+    }
+    // With a batch still running on the device, there is no point in
+    // holding back: whatever is queued goes right behind it.
+    if (block && m_forward_queue.size() < size_t(m_batch_size)) {
+        m_cv.wait_for(lk, BATCH_WAIT, [this] {
+            return !m_running
+                || m_forward_queue.size() >= size_t(m_batch_size);
+        });
+    }
+    while (!m_forward_queue.empty() && batch.size() < size_t(m_batch_size)) {
+        batch.push_back(m_forward_queue.front());
+        m_forward_queue.pop_front();
+    }
+    // Leave the rest for another device.
+    if (!m_forward_queue.empty()) {
+        m_cv.notify_one();
+    }
+    return batch.size();
+}
+
+template <typename net_t>
+void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
+    constexpr auto in_size = Network::INPUT_CHANNELS * NUM_INTERSECTIONS;
+    constexpr auto out_pol_size = Network::OUTPUTS_POLICY * NUM_INTERSECTIONS;
+    constexpr auto out_val_size = Network::OUTPUTS_VALUE * NUM_INTERSECTIONS;
+
+    auto& network = *m_networks[gnum];
+    OpenCLContext context;
+
+    // Each slot holds a batch that is queued on the device. While one
+    // runs, the next one is uploaded and queued behind it; only then do
+    // we wait for the older one and hand out its results.
+    std::array<std::vector<ForwardQueueEntry*>,
+               OpenCLContext::NUM_SLOTS> pending;
+    auto slot = size_t{0};
+    auto batch_input = std::vector<float>();
+    auto batch_pol = std::vector<float>();
+    auto batch_val = std::vector<float>();
+    auto batch = std::vector<ForwardQueueEntry*>();
+
+    auto complete = [](std::vector<ForwardQueueEntry*>& entries,
+                       std::exception_ptr error) {
+        for (auto entry : entries) {
+            std::unique_lock<std::mutex> lk(entry->mutex);
+            entry->error = error;
+            entry->done = true;
+            entry->cv.notify_one();
+        }
+        entries.clear();
+    };
+
+    auto retire = [&](const size_t s) {
+        auto& entries = pending[s];
+        if (entries.empty()) {
+            return;
+        }
+        auto error = std::exception_ptr{};
+        try {
+            batch_pol.resize(entries.size() * out_pol_size);
+            batch_val.resize(entries.size() * out_val_size);
+            network.finish_forward(batch_pol, batch_val, context, s);
+            for (auto i = size_t{0}; i < entries.size(); i++) {
+                auto pol = begin(batch_pol) + i * out_pol_size;
+                auto val = begin(batch_val) + i * out_val_size;
+                // Heads the caller didn't ask for are computed anyway,
+                // the 1x1 convolutions cost next to nothing on the GPU.
+                std::copy(pol, pol + entries[i]->out_p.size(),
+                          begin(entries[i]->out_p));
+                std::copy(val, val + entries[i]->out_v.size(),
+                          begin(entries[i]->out_v));
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        complete(entries, error);
+    };
+
+    while (true) {
+        const auto in_flight = !pending[(slot + OpenCLContext::NUM_SLOTS - 1)
+                                        % OpenCLContext::NUM_SLOTS].empty();
+        const auto count = pop_batch(batch, !in_flight);
+        if (count == 0) {
+            if (in_flight) {
+                // Nothing to overlap with, so just collect the results.
+                retire((slot + OpenCLContext::NUM_SLOTS - 1)
+                       % OpenCLContext::NUM_SLOTS);
+            } else if (!m_running) {
+                break;
+            }
+            continue;
+        }
+
+        batch_input.resize(count * in_size);
+        for (auto i = size_t{0}; i < count; i++) {
+            std::copy(begin(batch[i]->in), end(batch[i]->in),
+                      begin(batch_input) + i * in_size);
+        }
+        try {
+            network.enqueue_forward(batch_input, context, slot, count);
+            pending[slot] = std::move(batch);
+            batch.clear();
+        } catch (...) {
+            complete(batch, std::current_exception());
+        }
+
+        slot = (slot + 1) % OpenCLContext::NUM_SLOTS;
+        retire(slot);
+    }
+
+    for (auto i = size_t{0}; i < OpenCLContext::NUM_SLOTS; i++) {
+        retire((slot + i) % OpenCLContext::NUM_SLOTS);
+    }
+}
+
 template class OpenCLScheduler<float>;
 #ifdef USE_HALF
 template class OpenCLScheduler<half_float::half>;
@@ -20,7 +20,12 @@
 #define OPENCLSCHEDULER_H_INCLUDED
 #include "config.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <list>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "SMP.h"
@@ -37,8 +42,23 @@ class OpenCLScheduler : public ForwardPipe {
         OpenCLContext context;
         ContextPoolEntry(size_t index) : net_index(index) {}
     };
+    class ForwardQueueEntry {
+    public:
+        std::mutex mutex;
+        std::condition_variable cv;
+        const std::vector<float>& in;
+        std::vector<float>& out_p;
+        std::vector<float>& out_v;
+        std::exception_ptr error;
+        bool done{false};
+        ForwardQueueEntry(const std::vector<float>& input,
+                          std::vector<float>& output_pol,
+                          std::vector<float>& output_val)
+            : in(input), out_p(output_pol), out_v(output_val) {}
+    };
 public:
     OpenCLScheduler();
+    ~OpenCLScheduler();
     virtual void initialize(const int channels);
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
@@ -57,6 +77,23 @@ private:
 
     SMP::Mutex m_context_pool_mutex;
 
+    // Batched evaluation: callers queue their positions and one worker
+    // per device runs them through the network m_batch_size at a time.
+    int m_batch_size{1};
+    std::list<ForwardQueueEntry*> m_forward_queue;
+    std::mutex m_forward_queue_mutex;
+    std::condition_variable m_cv;
+    std::atomic<bool> m_running{true};
+    // Not thread pool tasks: they block for the lifetime of the
+    // scheduler, and searches on the pool wait for them.
+    std::vector<std::thread> m_worker_threads;
+
+    void batch_worker(const size_t gnum);
+    size_t pop_batch(std::vector<ForwardQueueEntry*>& batch, const bool block);
+    void forward_batched(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val);
+
     void push_input_convolution(unsigned int filter_size,
                                 unsigned int channels,
                                 unsigned int outputs,
@@ -0,0 +1,399 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "PositionIndex.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+
+#include "FastBoard.h"
+#include "GTP.h"
+#include "SGFParser.h"
+#include "SGFTree.h"
+#include "Timing.h"
+#include "Utils.h"
+#include "Zobrist.h"
+
+using namespace Utils;
+
+namespace {
+    struct FileHeader {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t num_occurrences;
+        std::uint64_t num_games;
+    };
+
+    constexpr char MAGIC[4] = {'L', 'Z', 'P', 'I'};
+    constexpr auto BATCH_SIZE = size_t{64};
+    // Occurrences read at a time from each run while merging.
+    constexpr auto MERGE_BUFFER_SIZE = size_t{4096};
+
+    // What a worker found out about one game.
+    struct GameResult {
+        size_t game;
+        int winner;
+        size_t moves;
+    };
+
+    // A sorted stretch of the runs file.
+    struct Run {
+        std::streamoff offset;
+        size_t size;
+    };
+
+    bool occurrence_less(const PositionIndex::Occurrence& a,
+                         const PositionIndex::Occurrence& b) {
+        return std::tie(a.hash, a.game, a.move)
+               < std::tie(b.hash, b.game, b.move);
+    }
+}
+
+static_assert(sizeof(PositionIndex::Occurrence) == 16,
+              "Occurrences are stored as they are in memory");
+
+std::uint64_t PositionIndex::position_hash(const GameState& state) {
+    // Captures don't change the position, so take them back out.
+    const auto prisoners =
+        Zobrist::zobrist_pris[0][state.board.get_prisoners(FastBoard::BLACK)]
+        ^ Zobrist::zobrist_pris[1][state.board.get_prisoners(FastBoard::WHITE)];
+    auto hash = state.get_symmetry_hash(0) ^ prisoners;
+    for (auto symmetry = 1; symmetry < 8; symmetry++) {
+        hash = std::min(hash, state.get_symmetry_hash(symmetry) ^ prisoners);
+    }
+    return hash;
+}
+
+// Adds every position of the main line to occurrences. Returns false if
+// the game can't be replayed on our board.
+static bool replay_game(boost::string_ref sgf, size_t game,
+                        std::vector<PositionIndex::Occurrence>& occurrences,
+                        GameResult& result) {
+    auto sgftree = std::make_unique<SGFTree>();
+    try {
+        sgftree->load_from_string(sgf, true);
+    } catch (...) {
+        return false;
+    }
+    if (sgftree->get_mainline().empty()) {
+        return false;
+    }
+    auto state = sgftree->follow_mainline_state();
+    if (state.board.get_boardsize() != BOARD_SIZE) {
+        return false;
+    }
+
+    state.rewind();
+    auto move = std::uint32_t{0};
+    do {
+        occurrences.push_back({PositionIndex::position_hash(state),
+                               std::uint32_t(game), move});
+        move++;
+    } while (state.forward_move());
+
+    const auto winner = sgftree->get_winner();
+    result.game = game;
+    result.winner = (winner == FastBoard::BLACK || winner == FastBoard::WHITE)
+                    ? winner : FastBoard::EMPTY;
+    result.moves = move - 1;
+    return true;
+}
+
+// Merges the sorted runs into out.
+static bool merge_runs(std::ifstream& in, std::vector<Run> runs,
+                       std::ostream& out) {
+    using Occurrence = PositionIndex::Occurrence;
+    auto buffers = std::vector<std::vector<Occurrence>>(runs.size());
+    auto positions = std::vector<size_t>(runs.size());
+    auto refill = [&](size_t run) {
+        const auto count = std::min(runs[run].size, MERGE_BUFFER_SIZE);
+        buffers[run].resize(count);
+        positions[run] = 0;
+        in.seekg(runs[run].offset);
+        in.read(reinterpret_cast<char*>(buffers[run].data()),
+                count * sizeof(Occurrence));
+        runs[run].offset += count * sizeof(Occurrence);
+        runs[run].size -= count;
+        return bool(in);
+    };
+
+    // The smallest occurrence not yet written from each run.
+    using Head = std::pair<Occurrence, size_t>;
+    auto greater = [](const Head& a, const Head& b) {
+        return occurrence_less(b.first, a.first);
+    };
+    auto heads = std::priority_queue<Head, std::vector<Head>,
+                                     decltype(greater)>{greater};
+    for (auto run = size_t{0}; run < runs.size(); run++) {
+        if (!refill(run)) {
+            return false;
+        }
+        heads.emplace(buffers[run][0], run);
+    }
+
+    auto output = std::vector<Occurrence>{};
+    output.reserve(MERGE_BUFFER_SIZE);
+    while (!heads.empty()) {
+        const auto run = heads.top().second;
+        output.emplace_back(heads.top().first);
+        heads.pop();
+        if (++positions[run] == buffers[run].size() && runs[run].size > 0) {
+            if (!refill(run)) {
+                return false;
+            }
+        }
+        if (positions[run] < buffers[run].size()) {
+            heads.emplace(buffers[run][positions[run]], run);
+        }
+        if (output.size() == MERGE_BUFFER_SIZE || heads.empty()) {
+            out.write(reinterpret_cast<const char*>(output.data()),
+                      output.size() * sizeof(Occurrence));
+            output.clear();
+        }
+    }
+    return bool(out);
+}
+
+std::pair<bool, std::string> PositionIndex::build(
+    const std::vector<std::string>& sgf_files, const std::string& filename,
+    const size_t run_size) {
+
+    auto buffers = std::vector<std::unique_ptr<SGFBuffer>>{};
+    for (const auto& sgf_file : sgf_files) {
+        try {
+            buffers.emplace_back(std::make_unique<SGFBuffer>(sgf_file));
+        } catch (const std::exception&) {
+            return {false, "cannot open " + sgf_file};
+        }
+    }
+    auto out = std::ofstream{filename, std::ofstream::binary};
+    if (!out) {
+        return {false, "cannot write " + filename};
+    }
+    // There can be more positions than fit in memory, so they are
+    // sorted in runs that are merged into the index at the end.
+    const auto runs_filename = filename + ".runs";
+    auto runs_out = std::ofstream{runs_filename, std::ofstream::binary};
+    if (!runs_out) {
+        return {false, "cannot write " + runs_filename};
+    }
+
+    auto num_workers = std::max(1, cfg_num_threads);
+    SGFBatchQueue queue{size_t(2 * num_workers)};
+    std::mutex output_mutex;
+    auto runs = std::vector<Run>{};
+    auto num_occurrences = size_t{0};
+    auto results = std::vector<GameResult>{};
+    auto games_done = size_t{0};
+
+    // Only called with output_mutex held.
+    auto write_run = [&](std::vector<Occurrence>& run) {
+        if (run.empty()) {
+            return;
+        }
+        runs.push_back({runs_out.tellp(), run.size()});
+        runs_out.write(reinterpret_cast<const char*>(run.data()),
+                       run.size() * sizeof(Occurrence));
+        num_occurrences += run.size();
+        run.clear();
+    };
+
+    // Each worker collects up to run_size positions and sorts them
+    // before taking the lock to write them out.
+    Time start;
+    auto worker = [&]() {
+        auto batch = SGFBatch{};
+        auto run = std::vector<Occurrence>{};
+        auto batch_results = std::vector<GameResult>{};
+        while (queue.pop(batch)) {
+            for (auto i = size_t{0}; i < batch.games.size(); i++) {
+                auto result = GameResult{};
+                if (replay_game(batch.games[i], batch.first_game + i,
+                                run, result)) {
+                    batch_results.emplace_back(result);
+                }
+            }
+            const auto full = run.size() >= run_size;
+            if (full) {
+                std::sort(begin(run), end(run), occurrence_less);
+            }
+            std::lock_guard<std::mutex> lock(output_mutex);
+            if (full) {
+                write_run(run);
+            }
+            results.insert(end(results), begin(batch_results),
+                           end(batch_results));
+            batch_results.clear();
+            const auto before = games_done;
+            games_done += batch.games.size();
+            if (games_done / 10000 != before / 10000) {
+                Time elapsed;
+                auto elapsed_s = Time::timediff_seconds(start, elapsed);
+                myprintf("Game %6d, %8d positions in %5.2f seconds\n",
+                         int(games_done), int(num_occurrences + run.size()),
+                         elapsed_s);
+            }
+        }
+        std::sort(begin(run), end(run), occurrence_less);
+        std::lock_guard<std::mutex> lock(output_mutex);
+        write_run(run);
+    };
+
+    auto workers = std::vector<std::thread>{};
+    for (auto i = 0; i < num_workers; i++) {
+        workers.emplace_back(worker);
+    }
+
+    // Only this thread touches games until the workers are done.
+    auto games = std::vector<GameInfo>{};
+    for (auto file = size_t{0}; file < buffers.size(); file++) {
+        auto batch = SGFBatch{};
+        batch.first_game = games.size();
+        auto game = boost::string_ref{};
+        auto pos = buffers[file]->begin();
+        auto index = size_t{0};
+        while (SGFParser::chop_next(pos, buffers[file]->end(), game)) {
+            games.push_back({sgf_files[file], index++, FastBoard::EMPTY, 0});
+            batch.games.emplace_back(game);
+            if (batch.games.size() == BATCH_SIZE) {
+                queue.push(std::move(batch));
+                batch = SGFBatch{};
+                batch.first_game = games.size();
+            }
+        }
+        queue.push(std::move(batch));
+    }
+    queue.close();
+
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    for (const auto& result : results) {
+        games[result.game].winner = result.winner;
+        games[result.game].moves = result.moves;
+    }
+    runs_out.close();
+    if (!runs_out) {
+        std::remove(runs_filename.c_str());
+        return {false, "error writing " + runs_filename};
+    }
+
+    auto header = FileHeader{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FILE_VERSION;
+    header.num_occurrences = num_occurrences;
+    header.num_games = games.size();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    auto runs_in = std::ifstream{runs_filename, std::ifstream::binary};
+    const auto merged = merge_runs(runs_in, std::move(runs), out);
+    runs_in.close();
+    std::remove(runs_filename.c_str());
+    if (!merged) {
+        return {false, "error merging " + runs_filename};
+    }
+    for (const auto& info : games) {
+        const auto winner = info.winner == FastBoard::BLACK ? 'B'
+                          : info.winner == FastBoard::WHITE ? 'W' : '-';
+        out << winner << " " << info.moves << " " << info.index << " "
+            << info.sgf_file << "\n";
+    }
+    out.close();
+    if (!out) {
+        return {false, "error writing " + filename};
+    }
+
+    auto summary = std::ostringstream{};
+    summary << num_occurrences << " positions from " << results.size()
+            << " of " << games.size() << " games";
+    return {true, summary.str()};
+}
+
+PositionIndex::PositionIndex(const std::string& filename) {
+    namespace bip = boost::interprocess;
+    try {
+        m_file = bip::file_mapping(filename.c_str(), bip::read_only);
+        m_region = bip::mapped_region(m_file, bip::read_only);
+    } catch (const bip::interprocess_exception&) {
+        throw std::runtime_error("cannot open " + filename);
+    }
+
+    const auto data = static_cast<const char*>(m_region.get_address());
+    const auto size = m_region.get_size();
+    auto header = FileHeader{};
+    if (size < sizeof(header)) {
+        throw std::runtime_error("not a position index");
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+        || header.version != FILE_VERSION) {
+        throw std::runtime_error("not a position index");
+    }
+    const auto games_offset = sizeof(header)
+                              + header.num_occurrences * sizeof(Occurrence);
+    if (size < games_offset) {
+        throw std::runtime_error("truncated position index");
+    }
+    m_occurrences = reinterpret_cast<const Occurrence*>(data + sizeof(header));
+    m_num_occurrences = header.num_occurrences;
+
+    auto games = std::istringstream{std::string(data + games_offset,
+                                                size - games_offset)};
+    auto line = std::string{};
+    while (std::getline(games, line)) {
+        auto fields = std::istringstream{line};
+        auto winner = char{};
+        auto info = GameInfo{};
+        if (!(fields >> winner >> info.moves >> info.index)) {
+            break;
+        }
+        fields.get();
+        std::getline(fields, info.sgf_file);
+        info.winner = winner == 'B' ? FastBoard::BLACK
+                    : winner == 'W' ? FastBoard::WHITE : FastBoard::EMPTY;
+        m_games.emplace_back(std::move(info));
+    }
+    if (m_games.size() != header.num_games) {
+        throw std::runtime_error("truncated position index");
+    }
+}
+
+std::pair<const PositionIndex::Occurrence*, const PositionIndex::Occurrence*>
+PositionIndex::lookup(std::uint64_t hash) const {
+    const auto first = m_occurrences;
+    const auto last = m_occurrences + m_num_occurrences;
+    const auto lower = std::lower_bound(first, last, hash,
+        [](const Occurrence& a, std::uint64_t h) { return a.hash < h; });
+    const auto upper = std::upper_bound(lower, last, hash,
+        [](std::uint64_t h, const Occurrence& a) { return h < a.hash; });
+    return {lower, upper};
+}
+
+const PositionIndex::GameInfo& PositionIndex::get_game(size_t game) const {
+    return m_games.at(game);
+}
@@ -0,0 +1,90 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef POSITIONINDEX_H_INCLUDED
+#define POSITIONINDEX_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "GameState.h"
+
+/*
+    An on-disk index from position to the games and move numbers where it
+    occurred. Positions are keyed by a hash that is the same for all 8
+    symmetries of the board and ignores captured stones, so transpositions
+    are found as well. The file is a header, the occurrences sorted by
+    hash and a text table with one line per game. It is memory mapped for
+    queries, so lookups are a binary search.
+*/
+class PositionIndex {
+public:
+    struct Occurrence {
+        std::uint64_t hash;
+        std::uint32_t game;
+        // Moves played before the position was reached.
+        std::uint32_t move;
+    };
+
+    struct GameInfo {
+        std::string sgf_file;
+        // Position of the game in its SGF collection.
+        size_t index;
+        // FastBoard::BLACK, WHITE or EMPTY if there was no result.
+        int winner;
+        size_t moves;
+    };
+
+    // Replays every game in the SGF files, cfg_num_threads at a time, and
+    // writes the index. Each thread sorts about run_size positions at a
+    // time, the sorted runs go to a temporary file next to the index and
+    // are merged into it at the end. Returns a summary or the error.
+    static std::pair<bool, std::string> build(
+        const std::vector<std::string>& sgf_files,
+        const std::string& filename,
+        size_t run_size = DEFAULT_RUN_SIZE);
+    static std::uint64_t position_hash(const GameState& state);
+
+    // Throws std::runtime_error if the file isn't a valid index.
+    explicit PositionIndex(const std::string& filename);
+    std::pair<const Occurrence*, const Occurrence*> lookup(
+        std::uint64_t hash) const;
+    const GameInfo& get_game(size_t game) const;
+    size_t get_num_positions() const { return m_num_occurrences; }
+    size_t get_num_games() const { return m_games.size(); }
+
+    static constexpr auto FILE_VERSION = std::uint32_t{1};
+    // 16 MiB of positions per thread.
+    static constexpr auto DEFAULT_RUN_SIZE = size_t{1} << 20;
+
+private:
+    boost::interprocess::file_mapping m_file;
+    boost::interprocess::mapped_region m_region;
+    const Occurrence* m_occurrences{nullptr};
+    size_t m_num_occurrences{0};
+    std::vector<GameInfo> m_games;
+};
+
+#endif
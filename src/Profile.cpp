@@ -0,0 +1,325 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "Profile.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace {
+    const char* const PHASE_NAMES[] = {
+        "select", "play_move", "superko", "expand", "cache_probe",
+        "cache_lock", "nn_eval", "link_children", "backup", "expand_wait",
+        "spin_lock"
+    };
+    const char* const COUNTER_NAMES[] = {
+        "playouts", "expand_contention", "cache_hits", "cache_misses",
+        "superko_rejects", "collisions", "wasted_descents"
+    };
+    static_assert(sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0])
+                  == Profile::NUM_PHASES, "Name every phase");
+    static_assert(sizeof(COUNTER_NAMES) / sizeof(COUNTER_NAMES[0])
+                  == Profile::NUM_COUNTERS, "Name every counter");
+
+    using Stat = std::atomic<std::uint64_t>;
+
+    // Only the owning thread adds to these, so a relaxed load and store
+    // is enough and to_json can read them while the search runs. For the
+    // same reason Profile::reset doesn't zero them, it starts a new
+    // generation and each thread zeroes its own on its next update.
+    void add(Stat& stat, std::uint64_t value) {
+        stat.store(stat.load(std::memory_order_relaxed) + value,
+                   std::memory_order_relaxed);
+    }
+
+    struct TraceEvent {
+        Profile::Phase phase;
+        std::int64_t start;
+        std::int64_t duration;
+    };
+
+    struct ThreadStats {
+        int id{0};
+        // Reset generation the counts below belong to.
+        std::atomic<std::uint64_t> generation{0};
+        std::array<Stat, Profile::NUM_PHASES> calls{};
+        std::array<Stat, Profile::NUM_PHASES> nanos{};
+        std::array<Stat, Profile::NUM_PHASES> max_nanos{};
+        std::array<Stat, Profile::NUM_COUNTERS> counters{};
+        std::mutex trace_mutex;
+        std::vector<TraceEvent> trace;
+
+        void clear_counts() {
+            for (auto phase = 0; phase < Profile::NUM_PHASES; phase++) {
+                calls[phase] = 0;
+                nanos[phase] = 0;
+                max_nanos[phase] = 0;
+            }
+            for (auto& counter : counters) {
+                counter = 0;
+            }
+        }
+
+        void clear_trace() {
+            std::lock_guard<std::mutex> lock(trace_mutex);
+            trace.clear();
+        }
+
+        void merge_into(ThreadStats& total) {
+            for (auto phase = 0; phase < Profile::NUM_PHASES; phase++) {
+                add(total.calls[phase], calls[phase]);
+                add(total.nanos[phase], nanos[phase]);
+                total.max_nanos[phase] = std::max(total.max_nanos[phase].load(),
+                                                  max_nanos[phase].load());
+            }
+            for (auto i = 0; i < Profile::NUM_COUNTERS; i++) {
+                add(total.counters[i], counters[i]);
+            }
+        }
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<ThreadStats*> threads;
+        // What threads that have exited left behind.
+        ThreadStats retired;
+        std::vector<std::pair<int, TraceEvent>> retired_trace;
+        int next_id{1};
+        std::atomic<std::uint64_t> generation{0};
+        std::int64_t reset_time{0};
+        std::atomic<std::int64_t> trace_start{0};
+        std::atomic<std::int64_t> trace_end{0};
+    };
+
+    // Never destroyed: search threads can exit after static destructors
+    // have run.
+    Registry& registry() {
+        static auto registry = new Registry;
+        return *registry;
+    }
+
+    // False if the counts are from before the last reset.
+    bool is_current(const ThreadStats& stats) {
+        return stats.generation.load(std::memory_order_acquire)
+            == registry().generation.load(std::memory_order_acquire);
+    }
+
+    class ThreadHandle {
+    public:
+        ThreadHandle() : m_stats(new ThreadStats) {
+            auto& reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            m_stats->id = reg.next_id++;
+            m_stats->generation = reg.generation.load();
+            reg.threads.push_back(m_stats);
+        }
+        ~ThreadHandle() {
+            auto& reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            if (is_current(*m_stats)) {
+                m_stats->merge_into(reg.retired);
+            }
+            for (const auto& event : m_stats->trace) {
+                reg.retired_trace.emplace_back(m_stats->id, event);
+            }
+            reg.threads.erase(std::find(begin(reg.threads), end(reg.threads),
+                                        m_stats));
+            delete m_stats;
+        }
+        ThreadStats& stats() { return *m_stats; }
+    private:
+        ThreadStats* m_stats;
+    };
+
+    ThreadStats& local_stats() {
+        thread_local ThreadHandle handle;
+        auto& stats = handle.stats();
+        const auto generation =
+            registry().generation.load(std::memory_order_acquire);
+        if (stats.generation.load(std::memory_order_relaxed) != generation) {
+            stats.clear_counts();
+            stats.generation.store(generation, std::memory_order_release);
+        }
+        return stats;
+    }
+
+    double to_ms(std::uint64_t nanos) {
+        return nanos / 1e6;
+    }
+}
+
+std::atomic<bool> Profile::s_enabled{false};
+
+std::int64_t Profile::now() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    const auto elapsed = std::chrono::steady_clock::now() - epoch;
+    return 1 + std::chrono::duration_cast<std::chrono::nanoseconds>(
+        elapsed).count();
+}
+
+void Profile::set_enabled(bool enabled) {
+    s_enabled = enabled;
+}
+
+void Profile::count(Counter counter) {
+    if (enabled()) {
+        add(local_stats().counters[counter], 1);
+    }
+}
+
+void Profile::record(Phase phase, std::int64_t start, std::int64_t end) {
+    auto& stats = local_stats();
+    const auto duration = std::uint64_t(end - start);
+    add(stats.calls[phase], 1);
+    add(stats.nanos[phase], duration);
+    if (duration > stats.max_nanos[phase].load(std::memory_order_relaxed)) {
+        stats.max_nanos[phase].store(duration, std::memory_order_relaxed);
+    }
+
+    auto& reg = registry();
+    if (start >= reg.trace_start.load(std::memory_order_relaxed)
+        && end <= reg.trace_end.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(stats.trace_mutex);
+        if (stats.trace.size() < MAX_TRACE_EVENTS) {
+            stats.trace.push_back({phase, start, end - start});
+        }
+    }
+}
+
+void Profile::reset() {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.generation++;
+    for (auto stats : reg.threads) {
+        stats->clear_trace();
+    }
+    reg.retired.clear_counts();
+    reg.retired_trace.clear();
+    reg.trace_start = 0;
+    reg.trace_end = 0;
+    reg.reset_time = now();
+}
+
+void Profile::start_trace(double seconds) {
+    reset();
+    set_enabled(true);
+    auto& reg = registry();
+    const auto start = now();
+    reg.trace_end = start + std::int64_t(seconds * 1e9);
+    reg.trace_start = start;
+}
+
+bool Profile::save_trace(const std::string& filename) {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    auto events = reg.retired_trace;
+    auto ids = std::vector<int>{};
+    for (auto stats : reg.threads) {
+        std::lock_guard<std::mutex> trace_lock(stats->trace_mutex);
+        for (const auto& event : stats->trace) {
+            events.emplace_back(stats->id, event);
+        }
+    }
+    for (const auto& event : events) {
+        ids.push_back(event.first);
+    }
+    std::sort(begin(ids), end(ids));
+    ids.erase(std::unique(begin(ids), end(ids)), end(ids));
+
+    auto out = std::ofstream{filename};
+    if (!out) {
+        return false;
+    }
+    // Chrome trace event format, times in microseconds.
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    auto first = true;
+    for (const auto id : ids) {
+        out << (first ? "" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+            << id << ",\"args\":{\"name\":\"search thread " << id << "\"}}";
+        first = false;
+    }
+    for (const auto& event : events) {
+        out << (first ? "" : ",\n")
+            << "{\"name\":\"" << PHASE_NAMES[event.second.phase]
+            << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.first
+            << ",\"ts\":" << event.second.start / 1e3
+            << ",\"dur\":" << event.second.duration / 1e3 << "}";
+        first = false;
+    }
+    out << "\n]}\n";
+    out.close();
+    return bool(out);
+}
+
+std::string Profile::to_json() {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    ThreadStats total;
+    reg.retired.merge_into(total);
+    for (auto stats : reg.threads) {
+        if (is_current(*stats)) {
+            stats->merge_into(total);
+        }
+    }
+
+    auto out = std::ostringstream{};
+    out << std::fixed << std::setprecision(3);
+    out << "{\"enabled\":" << (enabled() ? "true" : "false")
+        << ",\"elapsed_ms\":" << to_ms(now() - reg.reset_time)
+        << ",\"phases\":{";
+    for (auto phase = 0; phase < NUM_PHASES; phase++) {
+        const auto calls = total.calls[phase].load();
+        const auto nanos = total.nanos[phase].load();
+        out << (phase ? "," : "") << "\"" << PHASE_NAMES[phase] << "\":{"
+            << "\"calls\":" << calls
+            << ",\"total_ms\":" << to_ms(nanos)
+            << ",\"mean_us\":" << (calls ? nanos / 1e3 / calls : 0.0)
+            << ",\"max_us\":" << total.max_nanos[phase] / 1e3 << "}";
+    }
+    out << "},\"counters\":{";
+    for (auto i = 0; i < NUM_COUNTERS; i++) {
+        out << (i ? "," : "") << "\"" << COUNTER_NAMES[i] << "\":"
+            << total.counters[i].load();
+    }
+    out << "},\"threads\":[";
+    auto first = true;
+    for (auto stats : reg.threads) {
+        const auto current = is_current(*stats);
+        out << (first ? "" : ",") << "{\"id\":" << stats->id
+            << ",\"playouts\":"
+            << (current ? stats->counters[PLAYOUTS].load() : 0)
+            << ",\"phases_ms\":{";
+        for (auto phase = 0; phase < NUM_PHASES; phase++) {
+            out << (phase ? "," : "") << "\"" << PHASE_NAMES[phase] << "\":"
+                << to_ms(current ? stats->nanos[phase].load() : 0);
+        }
+        out << "}}";
+        first = false;
+    }
+    out << "]}";
+    return out.str();
+}
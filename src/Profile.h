@@ -0,0 +1,107 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROFILE_H_INCLUDED
+#define PROFILE_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*
+    Per thread time and call counts for the phases of a playout, plus a
+    few event counters. Everything is off by default: a disabled Scope is
+    a single relaxed load, an enabled one reads the clock twice and bumps
+    counters only its own thread writes to. While a trace window is open
+    every timed scope is also kept as a Chrome trace event, which
+    chrome://tracing and Perfetto can show.
+*/
+class Profile {
+public:
+    enum Phase {
+        SELECT,         // UCTNode::uct_select_child
+        PLAY_MOVE,      // GameState::play_move during descent
+        SUPERKO,        // KoState::superko during descent
+        EXPAND,         // UCTNode::create_children, all of it
+        CACHE_PROBE,    // NNCache probes, all symmetries
+        CACHE_LOCK,     // Waiting for the NNCache mutex
+        NN_EVAL,        // Network forward pass
+        LINK_CHILDREN,  // UCTNode::link_nodelist
+        BACKUP,         // UCTNode::update
+        EXPAND_WAIT,    // Waiting for another thread's expansion
+        SPIN_LOCK,      // Contended SMP::Lock
+        NUM_PHASES
+    };
+
+    enum Counter {
+        PLAYOUTS,
+        EXPAND_CONTENTION,  // Lost the race to expand a node
+        CACHE_HITS,
+        CACHE_MISSES,
+        SUPERKO_REJECTS,
+        COLLISIONS,         // Reached a leaf another thread is evaluating
+        WASTED_DESCENTS,    // Playouts that ended without an eval
+        NUM_COUNTERS
+    };
+
+    // Times the enclosing scope while profiling is on.
+    class Scope {
+    public:
+        explicit Scope(Phase phase)
+            : m_phase(phase), m_start(enabled() ? now() : 0) {}
+        ~Scope() {
+            if (m_start) {
+                record(m_phase, m_start, now());
+            }
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        Phase m_phase;
+        std::int64_t m_start;
+    };
+
+    static bool enabled() {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+    static void set_enabled(bool enabled);
+    static void count(Counter counter);
+    // Clears all counters and the trace.
+    static void reset();
+
+    // Turns profiling on and keeps trace events for the next seconds.
+    static void start_trace(double seconds);
+    static bool save_trace(const std::string& filename);
+
+    static std::string to_json();
+
+    // Nanoseconds since startup, never 0.
+    static std::int64_t now();
+
+    // Trace events kept per thread, at most.
+    static constexpr size_t MAX_TRACE_EVENTS = 1 << 20;
+
+private:
+    static void record(Phase phase, std::int64_t start, std::int64_t end);
+
+    static std::atomic<bool> s_enabled;
+};
+
+#endif
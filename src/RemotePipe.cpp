@@ -0,0 +1,513 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "RemotePipe.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <boost/asio.hpp>
+
+#include "GTP.h"
+#include "Network.h"
+#include "Utils.h"
+
+using namespace Utils;
+using boost::asio::ip::tcp;
+
+namespace {
+    template <typename T>
+    void put_le(std::uint8_t* out, const T value) {
+        for (auto i = size_t{0}; i < sizeof(T); i++) {
+            out[i] = std::uint8_t(value >> (8 * i));
+        }
+    }
+
+    template <typename T>
+    T get_le(const std::uint8_t* in) {
+        auto value = T{0};
+        for (auto i = size_t{0}; i < sizeof(T); i++) {
+            value |= T(in[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    bool little_endian_host() {
+        const auto one = std::uint32_t{1};
+        auto first = std::uint8_t{};
+        std::memcpy(&first, &one, 1);
+        return first == 1;
+    }
+}
+
+RemoteProtocol::HelloBytes RemoteProtocol::encode(const Hello& hello) {
+    auto bytes = HelloBytes{};
+    put_le(&bytes[0], hello.magic);
+    put_le(&bytes[4], hello.version);
+    put_le(&bytes[8], hello.board_size);
+    put_le(&bytes[12], hello.threads);
+    put_le(&bytes[16], hello.fingerprint);
+    return bytes;
+}
+
+RemoteProtocol::MessageBytes RemoteProtocol::encode(const Message& message) {
+    auto bytes = MessageBytes{};
+    put_le(&bytes[0], message.id);
+    put_le(&bytes[4], message.heads);
+    return bytes;
+}
+
+RemoteProtocol::Hello RemoteProtocol::decode_hello(const HelloBytes& bytes) {
+    return Hello{get_le<std::uint32_t>(&bytes[0]),
+                 get_le<std::uint32_t>(&bytes[4]),
+                 get_le<std::uint32_t>(&bytes[8]),
+                 get_le<std::uint32_t>(&bytes[12]),
+                 get_le<std::uint64_t>(&bytes[16])};
+}
+
+RemoteProtocol::Message RemoteProtocol::decode_message(
+    const MessageBytes& bytes) {
+    return Message{get_le<std::uint32_t>(&bytes[0]),
+                   get_le<std::uint32_t>(&bytes[4])};
+}
+
+void RemoteProtocol::convert_outputs(std::vector<float>& outputs) {
+    static_assert(sizeof(float) == 4, "This code assumes floats are 32-bit");
+    if (little_endian_host()) {
+        return;
+    }
+    for (auto& output : outputs) {
+        auto bits = std::uint32_t{};
+        std::memcpy(&bits, &output, sizeof(bits));
+        std::uint8_t bytes[4];
+        put_le(bytes, bits);
+        std::memcpy(&output, bytes, sizeof(output));
+    }
+}
+
+size_t RemoteProtocol::packed_size() {
+    return (Network::INPUT_CHANNELS * NUM_INTERSECTIONS + 7) / 8;
+}
+
+std::vector<std::uint8_t> RemoteProtocol::pack_planes(
+    const std::vector<float>& planes) {
+    auto packed = std::vector<std::uint8_t>(packed_size());
+    assert(planes.size() == Network::INPUT_CHANNELS * NUM_INTERSECTIONS);
+    for (auto i = size_t{0}; i < planes.size(); i++) {
+        // All input planes are 0 or 1.
+        assert(planes[i] == 0.0f || planes[i] == 1.0f);
+        if (planes[i] != 0.0f) {
+            packed[i / 8] |= std::uint8_t(1 << (i % 8));
+        }
+    }
+    return packed;
+}
+
+std::vector<float> RemoteProtocol::unpack_planes(
+    const std::vector<std::uint8_t>& packed) {
+    auto planes =
+        std::vector<float>(Network::INPUT_CHANNELS * NUM_INTERSECTIONS);
+    for (auto i = size_t{0}; i < planes.size(); i++) {
+        planes[i] = (packed[i / 8] >> (i % 8)) & 1 ? 1.0f : 0.0f;
+    }
+    return planes;
+}
+
+std::uint64_t RemoteProtocol::fingerprint(const std::string& weightsfile) {
+    std::ifstream in(weightsfile, std::ios::binary);
+    if (!in) {
+        return 0;
+    }
+    // FNV-1a
+    auto hash = std::uint64_t{0xcbf29ce484222325};
+    std::array<char, 65536> buffer;
+    while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0) {
+        for (auto i = std::streamsize{0}; i < in.gcount(); i++) {
+            hash ^= std::uint8_t(buffer[i]);
+            hash *= 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+bool RemoteProtocol::parse_endpoint(const std::string& text,
+                                    std::string& host, std::string& port) {
+    const auto colon = text.rfind(':');
+    if (colon == std::string::npos) {
+        host = "127.0.0.1";
+        port = text;
+    } else {
+        host = text.substr(0, colon);
+        port = text.substr(colon + 1);
+    }
+    return !host.empty() && !port.empty()
+        && std::all_of(begin(port), end(port), ::isdigit);
+}
+
+class RemotePipe::Worker {
+public:
+    explicit Worker(const std::string& address)
+        : m_address(address), m_socket(m_io_service) {}
+
+    ~Worker() {
+        {
+            // Closing on purpose, not worth reporting.
+            std::lock_guard<std::mutex> lock(m_pending_mutex);
+            m_alive = false;
+        }
+        if (m_reader.joinable()) {
+            disconnect();
+            m_reader.join();
+        }
+    }
+
+    bool connect(const std::uint64_t fingerprint);
+
+    // Returns false if the worker went away before answering, throws
+    // if it answered that the evaluation failed.
+    bool forward(const std::vector<std::uint8_t>& packed,
+                 std::vector<float>& output_pol,
+                 std::vector<float>& output_val);
+
+    bool alive() const {
+        return m_alive;
+    }
+
+    // Outstanding requests per thread, scaled to compare as integers
+    // with other workers.
+    bool less_loaded_than(const Worker& other) const {
+        return (m_outstanding + 1) * other.m_threads
+            < (other.m_outstanding + 1) * m_threads;
+    }
+
+private:
+    struct Pending {
+        Pending(std::vector<float>& pol, std::vector<float>& val)
+            : output_pol(pol), output_val(val) {}
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<float>& output_pol;
+        std::vector<float>& output_val;
+        bool done{false};
+        // Got an answer, which can still be an error.
+        bool answered{false};
+        bool failed{false};
+    };
+
+    // Once connected, the socket is only used by the reader thread,
+    // from handlers run by m_io_service. Other threads post to it.
+    void reader();
+    void read_message();
+    void read_outputs(Pending* pending);
+    void write_next();
+    // Fails the outstanding reads and writes, so the reader gives up.
+    void shutdown();
+    // Shuts down from another thread.
+    void disconnect();
+    void finish(Pending& pending, const bool answered, const bool failed);
+
+    std::string m_address;
+    boost::asio::io_service m_io_service;
+    tcp::socket m_socket;
+    std::thread m_reader;
+    int m_threads{1};
+
+    // Only touched by the reader thread.
+    RemoteProtocol::MessageBytes m_message_bytes;
+    RemoteProtocol::Message m_message;
+    // Outputs of requests nobody waits for anymore are read into these.
+    std::vector<float> m_discard_pol;
+    std::vector<float> m_discard_val;
+    std::deque<std::shared_ptr<std::vector<std::uint8_t>>> m_writes;
+
+    // Protects m_pending, m_next_id and the transitions of m_alive.
+    std::mutex m_pending_mutex;
+    std::unordered_map<std::uint32_t, Pending*> m_pending;
+    std::uint32_t m_next_id{0};
+    std::atomic<bool> m_alive{false};
+    std::atomic<int> m_outstanding{0};
+};
+
+bool RemotePipe::Worker::connect(const std::uint64_t fingerprint) {
+    using namespace RemoteProtocol;
+
+    auto host = std::string{};
+    auto port = std::string{};
+    if (!parse_endpoint(m_address, host, port)) {
+        myprintf("Remote eval %s: expected host:port.\n", m_address.c_str());
+        return false;
+    }
+
+    boost::system::error_code ec;
+    tcp::resolver resolver(m_io_service);
+    boost::asio::connect(m_socket,
+                         resolver.resolve(tcp::resolver::query(host, port), ec),
+                         ec);
+    if (!ec) {
+        m_socket.set_option(tcp::no_delay(true), ec);
+    }
+    auto theirs_bytes = HelloBytes{};
+    if (!ec) {
+        const auto ours = encode(Hello{MAGIC, VERSION, BOARD_SIZE,
+                                       std::uint32_t(cfg_num_threads),
+                                       fingerprint});
+        boost::asio::write(m_socket, boost::asio::buffer(ours), ec);
+    }
+    if (!ec) {
+        boost::asio::read(m_socket, boost::asio::buffer(theirs_bytes), ec);
+    }
+    if (ec) {
+        myprintf("Remote eval %s: %s\n", m_address.c_str(),
+                 ec.message().c_str());
+        return false;
+    }
+    const auto theirs = decode_hello(theirs_bytes);
+    if (theirs.magic != MAGIC || theirs.version != VERSION) {
+        myprintf("Remote eval %s: not a compatible leelaz --eval-server.\n",
+                 m_address.c_str());
+        return false;
+    }
+    if (theirs.board_size != BOARD_SIZE || theirs.fingerprint != fingerprint) {
+        myprintf("Remote eval %s: uses a different network.\n",
+                 m_address.c_str());
+        return false;
+    }
+
+    m_threads = std::max(1, int(theirs.threads));
+    m_alive = true;
+    m_reader = std::thread([this] { reader(); });
+    myprintf("Remote eval %s: connected, %d threads.\n",
+             m_address.c_str(), m_threads);
+    return true;
+}
+
+void RemotePipe::Worker::finish(Pending& pending, const bool answered,
+                                const bool failed) {
+    std::lock_guard<std::mutex> lock(pending.mutex);
+    pending.answered = answered;
+    pending.failed = failed;
+    pending.done = true;
+    pending.cv.notify_one();
+}
+
+void RemotePipe::Worker::reader() {
+    read_message();
+    // Returns when the connection fails or is shut down, which
+    // leaves no read outstanding.
+    m_io_service.run();
+
+    // Fail everything still waiting, forward() retries elsewhere.
+    std::lock_guard<std::mutex> lock(m_pending_mutex);
+    if (m_alive) {
+        myprintf("Remote eval %s: connection lost.\n", m_address.c_str());
+    }
+    m_alive = false;
+    for (auto& entry : m_pending) {
+        finish(*entry.second, false, false);
+    }
+    m_pending.clear();
+}
+
+void RemotePipe::Worker::read_message() {
+    boost::asio::async_read(m_socket, boost::asio::buffer(m_message_bytes),
+        [this](const boost::system::error_code& ec, size_t) {
+            if (ec) {
+                shutdown();
+                return;
+            }
+            m_message = RemoteProtocol::decode_message(m_message_bytes);
+            Pending* pending = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(m_pending_mutex);
+                auto it = m_pending.find(m_message.id);
+                if (it != end(m_pending)) {
+                    pending = it->second;
+                    m_pending.erase(it);
+                }
+            }
+            read_outputs(pending);
+        });
+}
+
+void RemotePipe::Worker::read_outputs(Pending* pending) {
+    using namespace RemoteProtocol;
+
+    // Read the outputs straight into the caller's vectors.
+    auto buffers = std::vector<boost::asio::mutable_buffer>{};
+    auto add_output = [&buffers](const size_t size, std::vector<float>* out,
+                                 std::vector<float>& discard) {
+        if (out == nullptr || out->size() != size) {
+            discard.resize(size);
+            out = &discard;
+        }
+        buffers.emplace_back(boost::asio::buffer(out->data(),
+                                                 size * sizeof(float)));
+    };
+    if (m_message.heads & POLICY_OUTPUT) {
+        add_output(Network::OUTPUTS_POLICY * NUM_INTERSECTIONS,
+                   pending ? &pending->output_pol : nullptr, m_discard_pol);
+    }
+    if (m_message.heads & VALUE_OUTPUT) {
+        add_output(Network::OUTPUTS_VALUE * NUM_INTERSECTIONS,
+                   pending ? &pending->output_val : nullptr, m_discard_val);
+    }
+    boost::asio::async_read(m_socket, buffers,
+        [this, pending](const boost::system::error_code& ec, size_t) {
+            if (pending != nullptr) {
+                if (!ec) {
+                    convert_outputs(pending->output_pol);
+                    convert_outputs(pending->output_val);
+                }
+                finish(*pending, !ec, m_message.heads == 0);
+            }
+            if (ec) {
+                shutdown();
+            } else {
+                read_message();
+            }
+        });
+}
+
+void RemotePipe::Worker::write_next() {
+    boost::asio::async_write(m_socket,
+        boost::asio::buffer(*m_writes.front()),
+        [this](const boost::system::error_code& ec, size_t) {
+            if (ec) {
+                shutdown();
+                return;
+            }
+            m_writes.pop_front();
+            if (!m_writes.empty()) {
+                write_next();
+            }
+        });
+}
+
+void RemotePipe::Worker::shutdown() {
+    boost::system::error_code ec;
+    m_socket.shutdown(tcp::socket::shutdown_both, ec);
+}
+
+void RemotePipe::Worker::disconnect() {
+    m_io_service.post([this] { shutdown(); });
+}
+
+bool RemotePipe::Worker::forward(const std::vector<std::uint8_t>& packed,
+                                 std::vector<float>& output_pol,
+                                 std::vector<float>& output_val) {
+    using namespace RemoteProtocol;
+
+    Pending pending(output_pol, output_val);
+    auto msg = Message{0, 0};
+    if (!output_pol.empty()) {
+        msg.heads |= POLICY_OUTPUT;
+    }
+    if (!output_val.empty()) {
+        msg.heads |= VALUE_OUTPUT;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        if (!m_alive) {
+            return false;
+        }
+        msg.id = m_next_id++;
+        m_pending.emplace(msg.id, &pending);
+    }
+
+    m_outstanding++;
+    // If the reader is done already, the post does nothing, but it
+    // failed our request on the way out.
+    const auto header = encode(msg);
+    auto request = std::make_shared<std::vector<std::uint8_t>>(
+        header.size() + packed.size());
+    std::copy(begin(header), end(header), begin(*request));
+    std::copy(begin(packed), end(packed), begin(*request) + header.size());
+    m_io_service.post([this, request] {
+        m_writes.emplace_back(request);
+        if (m_writes.size() == 1) {
+            write_next();
+        }
+    });
+
+    std::unique_lock<std::mutex> lock(pending.mutex);
+    pending.cv.wait(lock, [&pending] { return pending.done; });
+    m_outstanding--;
+    if (pending.failed) {
+        throw std::runtime_error("Remote evaluation failed on " + m_address);
+    }
+    return pending.answered;
+}
+
+RemotePipe::RemotePipe(const std::vector<std::string>& workers,
+                       const std::uint64_t fingerprint)
+    : m_addresses(workers), m_fingerprint(fingerprint) {}
+
+RemotePipe::~RemotePipe() = default;
+
+void RemotePipe::initialize(const int /*channels*/) {
+    m_workers.clear();
+    for (const auto& address : m_addresses) {
+        auto worker = std::make_unique<Worker>(address);
+        if (worker->connect(m_fingerprint)) {
+            m_workers.emplace_back(std::move(worker));
+        }
+    }
+    if (m_workers.empty()) {
+        throw std::runtime_error("No remote evaluation workers available.");
+    }
+}
+
+void RemotePipe::push_weights(unsigned int /*filter_size*/,
+                              unsigned int /*channels*/,
+                              unsigned int /*outputs*/,
+                              std::shared_ptr<const ForwardPipeWeights> /*weights*/) {
+    // The workers load the same weights file themselves, which the
+    // handshake checked.
+}
+
+void RemotePipe::forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val) {
+    const auto packed = RemoteProtocol::pack_planes(input);
+    for (;;) {
+        Worker* best = nullptr;
+        for (const auto& worker : m_workers) {
+            if (worker->alive()
+                && (best == nullptr || worker->less_loaded_than(*best))) {
+                best = worker.get();
+            }
+        }
+        if (best == nullptr) {
+            throw std::runtime_error("All remote evaluation workers failed.");
+        }
+        if (best->forward(packed, output_pol, output_val)) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,126 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REMOTEPIPE_H_INCLUDED
+#define REMOTEPIPE_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ForwardPipe.h"
+
+/*
+    Wire format between RemotePipe and EvalServer. Fields are fixed
+    size and little-endian, whatever the byte order of the host, so
+    Hello and Message go through encode and decode.
+
+    The client opens with a Hello, the server answers with its own and
+    the client hangs up unless both describe the same network. After
+    that the client sends requests and the server answers each one,
+    in any order, with a response carrying the same id:
+
+      request:  Message, then the input planes packed 8 per byte
+      response: Message, then the policy outputs if heads has
+                POLICY_OUTPUT and the value outputs if it has
+                VALUE_OUTPUT, as floats. heads 0 means the
+                evaluation failed.
+*/
+namespace RemoteProtocol {
+    constexpr std::uint32_t MAGIC = 0x4c5a4556;
+    constexpr std::uint32_t VERSION = 1;
+
+    constexpr std::uint32_t POLICY_OUTPUT = 1;
+    constexpr std::uint32_t VALUE_OUTPUT = 2;
+
+    struct Hello {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint32_t board_size;
+        // Evaluations the sender runs at once.
+        std::uint32_t threads;
+        // Of the weights file, see fingerprint().
+        std::uint64_t fingerprint;
+    };
+
+    struct Message {
+        std::uint32_t id;
+        std::uint32_t heads;
+    };
+
+    using HelloBytes = std::array<std::uint8_t, 24>;
+    using MessageBytes = std::array<std::uint8_t, 8>;
+
+    HelloBytes encode(const Hello& hello);
+    MessageBytes encode(const Message& message);
+    Hello decode_hello(const HelloBytes& bytes);
+    Message decode_message(const MessageBytes& bytes);
+    // Converts outputs between host and wire order, in place. Nothing
+    // to do on little-endian hosts.
+    void convert_outputs(std::vector<float>& outputs);
+
+    size_t packed_size();
+    std::vector<std::uint8_t> pack_planes(const std::vector<float>& planes);
+    std::vector<float> unpack_planes(const std::vector<std::uint8_t>& packed);
+
+    // Hash of the weights file contents, 0 if it can't be read.
+    std::uint64_t fingerprint(const std::string& weightsfile);
+
+    // Splits "host:port". A bare port means localhost.
+    bool parse_endpoint(const std::string& text,
+                        std::string& host, std::string& port);
+}
+
+/*
+    Evaluates the network on leelaz processes started with
+    --eval-server, on this or other machines. Each evaluation goes to
+    the worker with the fewest outstanding requests for its thread
+    count, so running the search with about as many threads as all
+    workers together keeps them busy; virtual loss spreads those
+    threads over different leaves. A worker that fails is dropped and
+    its requests are retried on the others.
+*/
+class RemotePipe : public ForwardPipe {
+public:
+    RemotePipe(const std::vector<std::string>& workers,
+               const std::uint64_t fingerprint);
+    ~RemotePipe();
+
+    virtual void initialize(const int channels);
+    virtual void forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val);
+    virtual void push_weights(unsigned int filter_size,
+                              unsigned int channels,
+                              unsigned int outputs,
+                              std::shared_ptr<const ForwardPipeWeights> weights);
+
+private:
+    class Worker;
+
+    std::vector<std::string> m_addresses;
+    std::uint64_t m_fingerprint;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+};
+
+#endif
@@ -21,65 +21,133 @@
 #include <cassert>
 #include <cctype>
 #include <fstream>
+#include <iterator>
 #include <stdexcept>
 #include <string>
 
 #include "SGFTree.h"
 #include "Utils.h"
 
-std::vector<std::string> SGFParser::chop_stream(std::istream& ins,
-                                                size_t stopat) {
-    std::vector<std::string> result;
-    std::string gamebuff;
+SGFBuffer::SGFBuffer(const std::string& filename) {
+    namespace bip = boost::interprocess;
+    try {
+        m_file = bip::file_mapping(filename.c_str(), bip::read_only);
+        m_region = bip::mapped_region(m_file, bip::read_only);
+    } catch (const bip::interprocess_exception&) {
+        // Empty files can't be mapped, but they are fine to read.
+        std::ifstream ins(filename.c_str(), std::ifstream::binary);
+        if (ins.fail() || ins.peek() != EOF) {
+            throw std::runtime_error("Error opening file");
+        }
+    }
+}
 
-    ins >> std::noskipws;
+const char* SGFBuffer::begin() const {
+    return static_cast<const char*>(m_region.get_address());
+}
 
+const char* SGFBuffer::end() const {
+    return begin() + m_region.get_size();
+}
+
+void SGFBatchQueue::push(SGFBatch&& batch) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_not_full.wait(lock, [this] {
+        return m_batches.size() < m_max_batches;
+    });
+    m_batches.emplace_back(std::move(batch));
+    m_not_empty.notify_one();
+}
+
+bool SGFBatchQueue::pop(SGFBatch& batch) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_not_empty.wait(lock, [this] {
+        return !m_batches.empty() || m_closed;
+    });
+    if (m_batches.empty()) {
+        return false;
+    }
+    batch = std::move(m_batches.front());
+    m_batches.pop_front();
+    m_not_full.notify_one();
+    return true;
+}
+
+void SGFBatchQueue::close() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_not_empty.notify_all();
+}
+
+bool SGFParser::chop_next(const char*& pos, const char* end,
+                          boost::string_ref& game) {
     int nesting = 0;      // parentheses
     bool intag = false;   // brackets
-    int line = 0;
-    gamebuff.clear();
+    auto start = pos;
 
-    char c;
-    while (ins >> c && result.size() <= stopat) {
-        if (c == '\n') line++;
+    while (pos < end) {
+        auto c = *pos++;
 
-        gamebuff.push_back(c);
         if (c == '\\') {
             // read literal char
-            ins >> c;
-            gamebuff.push_back(c);
             // Skip special char parsing
+            if (pos < end) {
+                pos++;
+            }
             continue;
         }
 
         if (c == '(' && !intag) {
             if (nesting == 0) {
                 // eat ; too
-                do {
-                    ins >> c;
-                } while (std::isspace(c) && c != ';');
-                gamebuff.clear();
+                while (pos < end && std::isspace(*pos)) {
+                    pos++;
+                }
+                if (pos < end) {
+                    pos++;
+                }
+                start = pos;
             }
             nesting++;
         } else if (c == ')' && !intag) {
             nesting--;
 
             if (nesting == 0) {
-                result.push_back(gamebuff);
+                game = boost::string_ref(start, pos - start);
+                return true;
             }
         } else if (c == '[' && !intag) {
             intag = true;
         } else if (c == ']') {
             if (intag == false) {
-                Utils::myprintf("Tag error on line %d", line);
+                Utils::myprintf("Tag error at offset %d",
+                                int(pos - start));
             }
             intag = false;
         }
     }
 
+    // Whatever is left over, for the benefit of chop_stream.
+    game = boost::string_ref(start, end - start);
+    return false;
+}
+
+std::vector<std::string> SGFParser::chop_stream(std::istream& ins,
+                                                size_t stopat) {
+    std::vector<std::string> result;
+    auto buffer = std::string{std::istreambuf_iterator<char>(ins),
+                              std::istreambuf_iterator<char>()};
+    auto pos = buffer.data();
+    const auto end = buffer.data() + buffer.size();
+    boost::string_ref game;
+
+    while (result.size() <= stopat && chop_next(pos, end, game)) {
+        result.emplace_back(game.to_string());
+    }
+
     // No game found? Assume closing tag was missing (OGS)
     if (result.size() == 0) {
-        result.push_back(gamebuff);
+        result.emplace_back(game.to_string());
     }
 
     return result;
@@ -87,14 +155,19 @@ std::vector<std::string> SGFParser::chop_stream(std::istream& ins,
 
 std::vector<std::string> SGFParser::chop_all(std::string filename,
                                              size_t stopat) {
-    std::ifstream ins(filename.c_str(), std::ifstream::binary | std::ifstream::in);
+    const auto buffer = SGFBuffer{filename};
+    std::vector<std::string> result;
+    auto pos = buffer.begin();
+    boost::string_ref game;
 
-    if (ins.fail()) {
-        throw std::runtime_error("Error opening file");
+    while (result.size() <= stopat && chop_next(pos, buffer.end(), game)) {
+        result.emplace_back(game.to_string());
     }
 
-    auto result = chop_stream(ins, stopat);
-    ins.close();
+    // No game found? Assume closing tag was missing (OGS)
+    if (result.size() == 0) {
+        result.emplace_back(game.to_string());
+    }
 
     return result;
 }
@@ -105,66 +178,88 @@ std::string SGFParser::chop_from_file(std::string filename, size_t index) {
     return vec[index];
 }
 
-std::string SGFParser::parse_property_name(std::istringstream & strm) {
-    std::string result;
-
-    char c;
-    while (strm >> c) {
-        // SGF property names are guaranteed to be uppercase,
-        // except that some implementations like IGS are retarded
-        // and don't folow the spec. So allow both upper/lowercase.
-        if (!std::isupper(c) && !std::islower(c)) {
-            strm.unget();
-            break;
-        } else {
-            result.push_back(c);
-        }
+boost::string_ref SGFParser::parse_property_name(const char*& pos,
+                                                 const char* end) {
+    auto start = pos;
+
+    // SGF property names are guaranteed to be uppercase,
+    // except that some implementations like IGS are retarded
+    // and don't folow the spec. So allow both upper/lowercase.
+    while (pos < end && (std::isupper(*pos) || std::islower(*pos))) {
+        pos++;
     }
 
-    return result;
+    return boost::string_ref(start, pos - start);
 }
 
-bool SGFParser::parse_property_value(std::istringstream & strm,
+bool SGFParser::parse_property_value(const char*& pos, const char* end,
                                      std::string & result) {
-    strm >> std::noskipws;
-
-    char c;
-    while (strm >> c) {
-        if (!std::isspace(c)) {
-            strm.unget();
-            break;
-        }
+    while (pos < end && std::isspace(*pos)) {
+        pos++;
     }
 
-    strm >> c;
-
-    if (c != '[') {
-        strm.unget();
+    if (pos == end || *pos != '[') {
         return false;
     }
-
-    while (strm >> c) {
-        if (c == ']') {
-            break;
-        } else if (c == '\\') {
-            strm >> c;
+    pos++;
+
+    auto start = pos;
+    while (pos < end && *pos != ']') {
+        if (*pos == '\\') {
+            // Copy what we have, and take the next char literally.
+            result.append(start, pos);
+            if (++pos == end) {
+                break;
+            }
+            start = pos;
         }
-        result.push_back(c);
+        pos++;
+    }
+    result.append(start, pos);
+    if (pos < end) {
+        pos++;
     }
-
-    strm >> std::skipws;
 
     return true;
 }
 
-void SGFParser::parse(std::istringstream & strm, SGFTree * node) {
-    bool splitpoint = false;
+void SGFParser::skip_variation(const char*& pos, const char* end) {
+    auto nesting = 1;
+    auto intag = false;
 
-    char c;
-    while (strm >> c) {
-        if (strm.fail()) {
+    while (pos < end) {
+        auto c = *pos++;
+        if (c == '\\') {
+            if (pos < end) {
+                pos++;
+            }
+        } else if (intag) {
+            intag = (c != ']');
+        } else if (c == '[') {
+            intag = true;
+        } else if (c == '(') {
+            nesting++;
+        } else if (c == ')' && --nesting == 0) {
             return;
         }
+    }
+}
+
+void SGFParser::parse(boost::string_ref gamebuff, SGFTree * node,
+                      bool mainline_only) {
+    auto pos = gamebuff.data();
+    parse(pos, gamebuff.data() + gamebuff.size(), node, mainline_only);
+}
+
+void SGFParser::parse(const char*& pos, const char* end, SGFTree * node,
+                      bool mainline_only) {
+    bool splitpoint = false;
+    SGFTree * branched = nullptr;
+    // Reused for every value, the tree keeps its own copy.
+    std::string propval;
+
+    while (pos < end) {
+        auto c = *pos++;
 
         if (std::isspace(c)) {
             continue;
@@ -172,14 +267,14 @@ void SGFParser::parse(std::istringstream & strm, SGFTree * node) {
 
         // parse a property
         if (std::isalpha(c) && std::isupper(c)) {
-            strm.unget();
+            pos--;
 
-            std::string propname = parse_property_name(strm);
+            const auto propname = parse_property_name(pos, end);
             bool success;
 
             do {
-                std::string propval;
-                success = parse_property_value(strm, propval);
+                propval.clear();
+                success = parse_property_value(pos, end, propval);
                 if (success) {
                     node->add_property(propname, propval);
                 }
@@ -190,25 +285,30 @@ void SGFParser::parse(std::istringstream & strm, SGFTree * node) {
 
         if (c == '(') {
             // eat first ;
-            char cc;
-            do {
-                strm >> cc;
-            } while (std::isspace(cc));
-            if (cc != ';') {
-                strm.unget();
+            while (pos < end && std::isspace(*pos)) {
+                pos++;
+            }
+            if (pos < end && *pos == ';') {
+                pos++;
+            }
+            if (mainline_only && branched == node) {
+                // Not the first variation, so not on the mainline
+                skip_variation(pos, end);
+                continue;
             }
+            branched = node;
             // start a variation here
             splitpoint = true;
             // new node
             SGFTree * newptr = node->add_child();
-            parse(strm, newptr);
+            parse(pos, end, newptr, mainline_only);
         } else if (c == ')') {
             // variation ends, go back
             // if the variation didn't start here, then
             // push the "variation ends" mark back
             // and try again one level up the tree
             if (!splitpoint) {
-                strm.unget();
+                pos--;
                 return;
             } else {
                 splitpoint = false;
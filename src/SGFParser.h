@@ -22,23 +22,78 @@
 #include <cstddef>
 #include <cstdint>
 #include <climits>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <vector>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include "SGFTree.h"
 
+// A whole SGF file, memory mapped so games can be chopped and parsed
+// without copying them.
+class SGFBuffer {
+public:
+    explicit SGFBuffer(const std::string& filename);
+    const char* begin() const;
+    const char* end() const;
+private:
+    boost::interprocess::file_mapping m_file;
+    boost::interprocess::mapped_region m_region;
+};
+
+// Consecutive games from a collection, numbered from first_game.
+struct SGFBatch {
+    size_t first_game{0};
+    std::vector<boost::string_ref> games;
+};
+
+// Batches of SGF games waiting for a worker. The games point into the
+// mapped file, and the queue is bounded so the reader never gets far ahead.
+class SGFBatchQueue {
+public:
+    explicit SGFBatchQueue(size_t max_batches) : m_max_batches(max_batches) {}
+    void push(SGFBatch&& batch);
+    // Returns false once the queue is closed and empty.
+    bool pop(SGFBatch& batch);
+    void close();
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+    std::deque<SGFBatch> m_batches;
+    size_t m_max_batches;
+    bool m_closed{false};
+};
+
 class SGFParser {
 private:
-    static std::string parse_property_name(std::istringstream & strm);
-    static bool parse_property_value(std::istringstream & strm, std::string & result);
+    static boost::string_ref parse_property_name(const char*& pos,
+                                                 const char* end);
+    static bool parse_property_value(const char*& pos, const char* end,
+                                     std::string & result);
+    static void skip_variation(const char*& pos, const char* end);
+    static void parse(const char*& pos, const char* end, SGFTree * node,
+                      bool mainline_only);
 public:
     static std::string chop_from_file(std::string fname, size_t index);
     static std::vector<std::string> chop_all(std::string fname,
                                              size_t stopat = SIZE_MAX);
     static std::vector<std::string> chop_stream(std::istream& ins,
                                                 size_t stopat = SIZE_MAX);
-    static void parse(std::istringstream & strm, SGFTree * node);
+    // Find the next game in a collection, starting at pos. The game
+    // points into the buffer. Returns false at the end.
+    static bool chop_next(const char*& pos, const char* end,
+                          boost::string_ref& game);
+    // With mainline_only, only the first variation is parsed at every
+    // branch, which is all that loading positions or training data needs.
+    static void parse(boost::string_ref gamebuff, SGFTree * node,
+                      bool mainline_only = false);
 };
 
 
@@ -22,8 +22,11 @@
 #include <cassert>
 #include <boost/format.hpp>
 #include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <cstring>
 #include <ctime>
 #include <memory>
+#include <new>
 #include <sstream>
 #include <stdexcept>
 #include <type_traits>
@@ -33,12 +36,81 @@
 #include "GTP.h"
 #include "KoState.h"
 #include "SGFParser.h"
+#include "Training.h"
 #include "Utils.h"
 
 using namespace Utils;
 
 const int SGFTree::EOT;
 
+// Nodes are constructed in place in chunks and property text is copied
+// into blocks, so a game costs a handful of allocations instead of a few
+// per node. Everything is freed together with the root.
+struct SGFTree::Arena {
+    static constexpr size_t NODE_CHUNK = 64;
+    static constexpr size_t TEXT_BLOCK = 4096;
+    using NodeStorage =
+        std::aligned_storage_t<sizeof(SGFTree), alignof(SGFTree)>;
+
+    ~Arena() {
+        for (auto i = size_t{0}; i < m_nodes; i++) {
+            node_at(i)->~SGFTree();
+        }
+    }
+
+    SGFTree * node_at(size_t index) {
+        auto& chunk = m_node_chunks[index / NODE_CHUNK];
+        return reinterpret_cast<SGFTree*>(&chunk[index % NODE_CHUNK]);
+    }
+
+    SGFTree * new_node() {
+        if (m_nodes == m_node_chunks.size() * NODE_CHUNK) {
+            m_node_chunks.emplace_back(new NodeStorage[NODE_CHUNK]);
+        }
+        auto node = new (node_at(m_nodes)) SGFTree();
+        m_nodes++;
+        node->m_arena = this;
+        return node;
+    }
+
+    boost::string_ref store(boost::string_ref text) {
+        if (text.empty()) {
+            return boost::string_ref{};
+        }
+        if (text.size() > m_text_left) {
+            m_text_left = std::max(TEXT_BLOCK, text.size());
+            m_text_blocks.emplace_back(new char[m_text_left]);
+            m_text_next = m_text_blocks.back().get();
+        }
+        std::memcpy(m_text_next, text.data(), text.size());
+        const auto result = boost::string_ref(m_text_next, text.size());
+        m_text_next += text.size();
+        m_text_left -= text.size();
+        return result;
+    }
+
+    std::vector<std::unique_ptr<NodeStorage[]>> m_node_chunks;
+    size_t m_nodes{0};
+    std::vector<std::unique_ptr<char[]>> m_text_blocks;
+    char * m_text_next{nullptr};
+    size_t m_text_left{0};
+};
+
+constexpr size_t SGFTree::Arena::NODE_CHUNK;
+constexpr size_t SGFTree::Arena::TEXT_BLOCK;
+
+SGFTree::SGFTree() = default;
+
+SGFTree::~SGFTree() = default;
+
+SGFTree::Arena& SGFTree::arena() {
+    if (m_arena == nullptr) {
+        m_own_arena = std::make_unique<Arena>();
+        m_arena = m_own_arena.get();
+    }
+    return *m_arena;
+}
+
 void SGFTree::init_state() {
     m_initialized = true;
     // Initialize with defaults.
@@ -55,7 +127,7 @@ KoState * SGFTree::get_state() {
 SGFTree * SGFTree::get_child(size_t count) {
     if (count < m_children.size()) {
         assert(m_initialized);
-        return &(m_children[count]);
+        return m_children[count];
     } else {
         return nullptr;
     }
@@ -91,11 +163,10 @@ GameState SGFTree::follow_mainline_state(unsigned int movenum) {
     return result;
 }
 
-void SGFTree::load_from_string(const std::string& gamebuff) {
-    std::istringstream pstream(gamebuff);
-
+void SGFTree::load_from_string(boost::string_ref gamebuff,
+                               bool mainline_only) {
     // loads properties with moves
-    SGFParser::parse(pstream, this);
+    SGFParser::parse(gamebuff, this, mainline_only);
 
     // Set up the root state to defaults
     init_state();
@@ -106,38 +177,37 @@ void SGFTree::load_from_string(const std::string& gamebuff) {
 }
 
 // load a single game from a file
-void SGFTree::load_from_file(const std::string& filename, int index) {
+void SGFTree::load_from_file(const std::string& filename, int index,
+                             bool mainline_only) {
     auto gamebuff = SGFParser::chop_from_file(filename, index);
 
     //myprintf("Parsing: %s\n", gamebuff.c_str());
 
-    load_from_string(gamebuff);
+    load_from_string(gamebuff, mainline_only);
 }
 
 void SGFTree::populate_states() {
-    PropertyMap::iterator it;
     auto valid_size = false;
     auto has_handicap = false;
 
     // first check for go game setup in properties
-    it = m_properties.find("GM");
-    if (it != end(m_properties)) {
-        if (it->second != "1") {
+    auto prop = find_property("GM");
+    if (prop != nullptr) {
+        if (*prop != "1") {
             throw std::runtime_error("SGF Game is not a Go game");
         } else {
-            if (!m_properties.count("SZ")) {
+            if (find_property("SZ") == nullptr) {
                 // No size, but SGF spec defines default size for Go
-                m_properties.insert(std::make_pair("SZ", "19"));
+                m_properties.emplace_back("SZ", "19");
                 valid_size = true;
             }
         }
     }
 
     // board size
-    it = m_properties.find("SZ");
-    if (it != end(m_properties)) {
-        std::string size = it->second;
-        std::istringstream strm(size);
+    prop = find_property("SZ");
+    if (prop != nullptr) {
+        std::istringstream strm(prop->to_string());
         int bsize;
         strm >> bsize;
         if (bsize == BOARD_SIZE) {
@@ -150,10 +220,9 @@ void SGFTree::populate_states() {
     }
 
     // komi
-    it = m_properties.find("KM");
-    if (it != end(m_properties)) {
-        std::string foo = it->second;
-        std::istringstream strm(foo);
+    prop = find_property("KM");
+    if (prop != nullptr) {
+        std::istringstream strm(prop->to_string());
         float komi;
         strm >> komi;
         int handicap = m_state.get_handicap();
@@ -171,10 +240,9 @@ void SGFTree::populate_states() {
     }
 
     // handicap
-    it = m_properties.find("HA");
-    if (it != end(m_properties)) {
-        std::string size = it->second;
-        std::istringstream strm(size);
+    prop = find_property("HA");
+    if (prop != nullptr) {
+        std::istringstream strm(prop->to_string());
         float handicap;
         strm >> handicap;
         has_handicap = (handicap > 0.0f);
@@ -182,9 +250,9 @@ void SGFTree::populate_states() {
     }
 
     // result
-    it = m_properties.find("RE");
-    if (it != end(m_properties)) {
-        std::string result = it->second;
+    prop = find_property("RE");
+    if (prop != nullptr) {
+        const auto result = *prop;
         if (boost::algorithm::find_first(result, "Time")) {
             // std::cerr << "Skipping: " << result << std::endl;
             m_winner = FastBoard::EMPTY;
@@ -203,54 +271,53 @@ void SGFTree::populate_states() {
     }
 
     // handicap stones
-    auto prop_pair_ab = m_properties.equal_range("AB");
+    auto setup = this;
     // Do we have a handicap specified but no handicap stones placed in
     // the same node? Then the SGF file is corrupt. Let's see if we can find
     // them in the next node, which is a common bug in some Go apps.
-    if (has_handicap && prop_pair_ab.first == prop_pair_ab.second) {
+    if (has_handicap && find_property("AB") == nullptr) {
         if (!m_children.empty()) {
-            auto& successor = m_children[0];
-            prop_pair_ab = successor.m_properties.equal_range("AB");
+            setup = m_children[0];
         }
     }
     // Loop through the stone list and apply
-    for (auto pit = prop_pair_ab.first; pit != prop_pair_ab.second; ++pit) {
-        auto move = pit->second;
-        int vtx = string_to_vertex(move);
-        apply_move(FastBoard::BLACK, vtx);
+    for (const auto& setup_prop : setup->m_properties) {
+        if (setup_prop.first == "AB") {
+            int vtx = string_to_vertex(setup_prop.second);
+            apply_move(FastBoard::BLACK, vtx);
+        }
     }
 
     // XXX: count handicap stones
-    const auto& prop_pair_aw = m_properties.equal_range("AW");
-    for (auto pit = prop_pair_aw.first; pit != prop_pair_aw.second; ++pit) {
-        auto move = pit->second;
-        int vtx = string_to_vertex(move);
-        apply_move(FastBoard::WHITE, vtx);
+    for (const auto& setup_prop : m_properties) {
+        if (setup_prop.first == "AW") {
+            int vtx = string_to_vertex(setup_prop.second);
+            apply_move(FastBoard::WHITE, vtx);
+        }
     }
 
-    it = m_properties.find("PL");
-    if (it != end(m_properties)) {
-        std::string who = it->second;
-        if (who == "W") {
+    prop = find_property("PL");
+    if (prop != nullptr) {
+        if (*prop == "W") {
             m_state.set_to_move(FastBoard::WHITE);
-        } else if (who == "B") {
+        } else if (*prop == "B") {
             m_state.set_to_move(FastBoard::BLACK);
         }
     }
 
     // now for all children play out the moves
-    for (auto& child_state : m_children) {
+    for (auto child_state : m_children) {
         // propagate state
-        child_state.copy_state(*this);
+        child_state->copy_state(*this);
 
         // XXX: maybe move this to the recursive call
         // get move for side to move
-        auto colored_move = child_state.get_colored_move();
+        auto colored_move = child_state->get_colored_move();
         if (colored_move.first != FastBoard::INVAL) {
-            child_state.apply_move(colored_move.first, colored_move.second);
+            child_state->apply_move(colored_move.first, colored_move.second);
         }
 
-        child_state.populate_states();
+        child_state->populate_states();
     }
 }
 
@@ -280,8 +347,10 @@ void SGFTree::apply_move(int move) {
     apply_move(color, move);
 }
 
-void SGFTree::add_property(std::string property, std::string value) {
-    m_properties.emplace(property, value);
+void SGFTree::add_property(boost::string_ref property,
+                           boost::string_ref value) {
+    auto& text = arena();
+    m_properties.emplace_back(text.store(property), text.store(value));
 }
 
 SGFTree * SGFTree::add_child() {
@@ -289,11 +358,21 @@ SGFTree * SGFTree::add_child() {
     if (m_children.size() == 0) {
         m_children.reserve(1);
     }
-    m_children.emplace_back();
-    return &(m_children.back());
+    m_children.emplace_back(arena().new_node());
+    return m_children.back();
+}
+
+const boost::string_ref * SGFTree::find_property(
+    boost::string_ref name) const {
+    for (const auto& prop : m_properties) {
+        if (prop.first == name) {
+            return &prop.second;
+        }
+    }
+    return nullptr;
 }
 
-int SGFTree::string_to_vertex(const std::string& movestring) const {
+int SGFTree::string_to_vertex(boost::string_ref movestring) const {
     if (movestring.size() == 0) {
         return FastBoard::PASS;
     }
@@ -338,19 +417,10 @@ int SGFTree::string_to_vertex(const std::string& movestring) const {
 }
 
 int SGFTree::get_move(int tomove) {
-    std::string colorstring;
-
-    if (tomove == FastBoard::BLACK) {
-        colorstring = "B";
-    } else {
-        colorstring = "W";
-    }
+    const auto prop = find_property(tomove == FastBoard::BLACK ? "B" : "W");
 
-    auto it = m_properties.find(colorstring);
-
-    if (it != end(m_properties)) {
-        std::string movestring = it->second;
-        return string_to_vertex(movestring);
+    if (prop != nullptr) {
+        return string_to_vertex(*prop);
     }
 
     return SGFTree::EOT;
@@ -470,6 +540,11 @@ std::string SGFTree::state_to_string(GameState& pstate, int compcolor) {
         } else {
             moves.append(";B[" + movestr + "]");
         }
+        const auto comment =
+            Training::search_comment(state->get_movenum() - 1);
+        if (!comment.empty()) {
+            moves.append("C[" + comment + "]");
+        }
         if (++counter % 10 == 0) {
             moves.append("\n");
         }
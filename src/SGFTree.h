@@ -20,10 +20,12 @@
 #define SGFTREE_H_INCLUDED
 
 #include <cstddef>
-#include <map>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
+#include <boost/utility/string_ref.hpp>
 
 #include "FastBoard.h"
 #include "GameState.h"
@@ -33,16 +35,22 @@ class SGFTree {
 public:
     static constexpr auto EOT = 0;               // End-Of-Tree marker
 
-    SGFTree() = default;
+    SGFTree();
+    ~SGFTree();
     void init_state();
 
     KoState * get_state();
     GameState follow_mainline_state(unsigned int movenum = 999);
     std::vector<int> get_mainline();
-    void load_from_file(const std::string& filename, int index = 0);
-    void load_from_string(const std::string& gamebuff);
+    // With mainline_only, variations other than the first are skipped
+    // while parsing. get_mainline and follow_mainline_state still work.
+    void load_from_file(const std::string& filename, int index = 0,
+                        bool mainline_only = false);
+    void load_from_string(boost::string_ref gamebuff,
+                          bool mainline_only = false);
 
-    void add_property(std::string property, std::string value);
+    // The name and value are copied into the tree.
+    void add_property(boost::string_ref property, boost::string_ref value);
     SGFTree * add_child();
     SGFTree * get_child(size_t count);
     int get_move(int tomove);
@@ -59,15 +67,24 @@ private:
     void apply_move(int color, int move);
     void apply_move(int move);
     void copy_state(const SGFTree& state);
-    int string_to_vertex(const std::string& move) const;
+    int string_to_vertex(boost::string_ref move) const;
+    const boost::string_ref * find_property(boost::string_ref name) const;
 
-    using PropertyMap = std::multimap<std::string, std::string>;
+    // Storage for all the nodes and property text of one game.
+    struct Arena;
+    Arena& arena();
+
+    // Names and values point into the arena.
+    using Property = std::pair<boost::string_ref, boost::string_ref>;
 
     bool m_initialized{false};
     KoState m_state;
     FastBoard::vertex_t m_winner{FastBoard::INVAL};
-    std::vector<SGFTree> m_children;
-    PropertyMap m_properties;
+    // Only the root owns the arena, the other nodes live in it.
+    std::unique_ptr<Arena> m_own_arena;
+    Arena * m_arena{nullptr};
+    std::vector<SGFTree*> m_children;
+    std::vector<Property> m_properties;
 };
 
 #endif
@@ -21,6 +21,8 @@
 #include <cassert>
 #include <thread>
 
+#include "Profile.h"
+
 SMP::Mutex::Mutex() {
     m_lock = false;
 }
@@ -35,8 +37,12 @@ void SMP::Lock::lock() {
     // Test and Test-and-Set reduces memory contention
     // However, just trying to Test-and-Set first improves performance in almost
     // all cases
-    while (m_mutex->m_lock.exchange(true, std::memory_order_acquire)) {
-      while (m_mutex->m_lock.load(std::memory_order_relaxed));
+    if (m_mutex->m_lock.exchange(true, std::memory_order_acquire)) {
+        // Only contended locks are timed.
+        Profile::Scope spin{Profile::SPIN_LOCK};
+        do {
+            while (m_mutex->m_lock.load(std::memory_order_relaxed));
+        } while (m_mutex->m_lock.exchange(true, std::memory_order_acquire));
     }
     m_owns_lock = true;
 }
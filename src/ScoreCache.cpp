@@ -0,0 +1,81 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include "ScoreCache.h"
+#include "FastState.h"
+#include "Timing.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+ScoreCache::ScoreCache() : m_entries(CACHE_SIZE) {
+    clear();
+}
+
+void ScoreCache::clear() {
+    for (auto& entry : m_entries) {
+        entry = 0;
+    }
+    m_hits = 0;
+    m_lookups = 0;
+}
+
+float ScoreCache::final_score(const FastState& state) {
+    const auto hash = state.board.get_ko_hash();
+    const auto key = hash & ~SCORE_MASK;
+    auto& entry = m_entries[hash & (CACHE_SIZE - 1)];
+    const auto komi = state.get_komi() + state.get_handicap();
+
+    m_lookups++;
+    // A stored score is biased, so an empty entry never matches.
+    const auto stored = entry.load(std::memory_order_relaxed);
+    if ((stored & ~SCORE_MASK) == key && (stored & SCORE_MASK) != 0) {
+        m_hits++;
+        return int(stored & SCORE_MASK) - SCORE_BIAS - komi;
+    }
+
+    const auto diff = state.board.area_difference();
+    entry.store(key | std::uint64_t(diff + SCORE_BIAS),
+                std::memory_order_relaxed);
+    return diff - komi;
+}
+
+void ScoreCache::benchmark(const FastState& state, const int iterations) {
+    // Read through a volatile pointer so the compiler cannot hoist
+    // the scoring out of the loops.
+    const FastState* volatile position = &state;
+    auto sum = 0.0f;
+    const Time start;
+    for (auto i = 0; i < iterations; i++) {
+        sum += position->final_score();
+    }
+    const Time middle;
+
+    ScoreCache cache;
+    for (auto i = 0; i < iterations; i++) {
+        sum -= cache.final_score(*position);
+    }
+    const Time end;
+
+    const auto uncached = Time::timediff_seconds(start, middle);
+    const auto cached = Time::timediff_seconds(middle, end);
+    myprintf("%d scores: %5.3f seconds uncached, %5.3f seconds cached"
+             " (checksum %.1f)\n", iterations, uncached, cached, sum);
+}
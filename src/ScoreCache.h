@@ -0,0 +1,65 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCORECACHE_H_INCLUDED
+#define SCORECACHE_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class FastState;
+
+/*
+    Direct mapped cache of Tromp-Taylor area scores for passed out
+    positions, keyed by the positional (ko) hash. The score is stored
+    without komi so that changing komi does not invalidate entries.
+    Every entry is a single atomic word, so lookups need no locking.
+*/
+class ScoreCache {
+public:
+    static constexpr int CACHE_BITS = 14;
+    static constexpr size_t CACHE_SIZE = size_t{1} << CACHE_BITS;
+
+    ScoreCache();
+
+    // Returns the same value as FastState::final_score().
+    float final_score(const FastState& state);
+
+    void clear();
+
+    // Times uncached and cached scoring of the given position.
+    static void benchmark(const FastState& state, int iterations = 100000);
+
+    int get_hits() const { return m_hits; }
+    int get_lookups() const { return m_lookups; }
+
+private:
+    static constexpr std::uint64_t SCORE_MASK = 0xFFFF;
+    static constexpr int SCORE_BIAS = 0x8000;
+
+    std::vector<std::atomic<std::uint64_t>> m_entries;
+
+    std::atomic<int> m_hits{0};
+    std::atomic<int> m_lookups{0};
+};
+
+#endif
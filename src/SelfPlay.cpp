@@ -0,0 +1,99 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "SelfPlay.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "FastBoard.h"
+#include "GTP.h"
+#include "GameState.h"
+#include "SGFTree.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+SelfPlay::SelfPlay(int games, int parallel, const std::string& basename)
+    : m_games(games), m_parallel(parallel), m_basename(basename),
+      m_chunker(basename, true, cfg_training_compression,
+                cfg_training_binary),
+      m_sgf(basename + ".sgf", std::ofstream::out | std::ofstream::app) {
+}
+
+void SelfPlay::run() {
+    auto threads = std::vector<std::thread>{};
+    for (auto i = 0; i < m_parallel; i++) {
+        threads.emplace_back(&SelfPlay::play_games, this);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void SelfPlay::play_games() {
+    // Training keeps the positions of the current game per thread,
+    // so every game needs its own thread.
+    while (m_next_game++ < m_games) {
+        auto game = std::make_unique<GameState>();
+        game->init_game(BOARD_SIZE, 7.5f);
+        Training::clear_training();
+
+        auto search = std::make_unique<UCTSearch>(*game, *GTP::s_network);
+        do {
+            const auto move = search->think(game->get_to_move());
+            game->play_move(move);
+        } while (!game->has_resigned() && game->get_passes() < 2);
+
+        finish_game(*game);
+    }
+}
+
+void SelfPlay::finish_game(GameState& game) {
+    auto winner = FastBoard::WHITE;
+    if (game.has_resigned()) {
+        if (game.who_resigned() == FastBoard::WHITE) {
+            winner = FastBoard::BLACK;
+        }
+    } else {
+        // Jigo is possible with integer komi.
+        const auto score = game.final_score();
+        if (score > 0.0f) {
+            winner = FastBoard::BLACK;
+        } else if (score == 0.0f) {
+            winner = FastBoard::EMPTY;
+        }
+    }
+    auto sgf = SGFTree::state_to_string(game, 0);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Training::dump_training(winner, m_chunker);
+    m_sgf << sgf << std::endl;
+
+    m_finished++;
+    Time now;
+    auto elapsed = Time::timediff_seconds(m_start, now);
+    myprintf("Game %d finished, %s after %d moves (%.1f games/hour)\n",
+             m_finished,
+             winner == FastBoard::BLACK ? "black won"
+             : winner == FastBoard::WHITE ? "white won" : "draw",
+             game.get_movenum(), m_finished * 3600.0 / elapsed);
+}
@@ -0,0 +1,61 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SELFPLAY_H_INCLUDED
+#define SELFPLAY_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+#include "Timing.h"
+#include "Training.h"
+
+/*
+    Plays self-play games inside this process, several at a time, each
+    with its own UCTSearch but all sharing the one Network and NNCache.
+    Training data goes to <basename>.N.gz chunks of
+    OutputChunker::CHUNK_SIZE games, and all games are appended to
+    <basename>.sgf.
+*/
+class SelfPlay {
+public:
+    SelfPlay(int games, int parallel, const std::string& basename);
+    void run();
+
+private:
+    void play_games();
+    void finish_game(GameState& game);
+
+    int m_games;
+    int m_parallel;
+    std::string m_basename;
+    std::atomic<int> m_next_game{0};
+    int m_finished{0};
+    Time m_start;
+
+    // Protects the outputs below, which are shared by all games.
+    std::mutex m_mutex;
+    OutputChunker m_chunker;
+    std::ofstream m_sgf;
+};
+
+#endif
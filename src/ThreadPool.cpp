@@ -0,0 +1,240 @@
+/*
+    Extended from code:
+    Copyright (c) 2012 Jakob Progsch, Václav Zeman
+    Modifications:
+    Copyright (c) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace Utils {
+
+constexpr size_t ThreadPool::QUEUE_SIZE;
+constexpr size_t ThreadPool::LOCAL_QUEUE_SIZE;
+constexpr size_t ThreadPool::MAX_WORKERS;
+
+// Pool and queue index of the worker running on this thread, if any.
+static thread_local ThreadPool* t_pool = nullptr;
+static thread_local size_t t_index = 0;
+
+TaskQueue::TaskQueue(size_t capacity) {
+    auto size = size_t{2};
+    while (size < capacity) {
+        size *= 2;
+    }
+    m_cells = std::make_unique<Cell[]>(size);
+    m_mask = size - 1;
+    for (auto i = size_t{0}; i < size; i++) {
+        m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool TaskQueue::try_push(Task& task) {
+    auto pos = m_tail.load(std::memory_order_relaxed);
+    for (;;) {
+        auto& cell = m_cells[pos & m_mask];
+        const auto seq = cell.m_sequence.load(std::memory_order_acquire);
+        const auto diff = intptr_t(seq) - intptr_t(pos);
+        if (diff == 0) {
+            if (m_tail.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+                cell.m_task = std::move(task);
+                cell.m_sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // Full.
+            return false;
+        } else {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool TaskQueue::try_pop(Task& task) {
+    auto pos = m_head.load(std::memory_order_relaxed);
+    for (;;) {
+        auto& cell = m_cells[pos & m_mask];
+        const auto seq = cell.m_sequence.load(std::memory_order_acquire);
+        const auto diff = intptr_t(seq) - intptr_t(pos + 1);
+        if (diff == 0) {
+            if (m_head.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+                task = std::move(cell.m_task);
+                cell.m_sequence.store(pos + m_mask + 1,
+                                      std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // Empty.
+            return false;
+        } else {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool TaskQueue::empty() const {
+    return m_head.load() >= m_tail.load();
+}
+
+void ThreadPool::add_thread(std::function<void()> initializer) {
+    const auto index = m_num_workers.load();
+    if (index < MAX_WORKERS) {
+        m_local_queues[index] = std::make_unique<TaskQueue>(LOCAL_QUEUE_SIZE);
+    }
+    // Publish the queue before anyone can try to steal from it.
+    m_num_workers.store(index + 1);
+    m_threads.emplace_back(&ThreadPool::worker_loop, this, index,
+                           std::move(initializer));
+}
+
+void ThreadPool::initialize(size_t threads) {
+    for (size_t i = 0; i < threads; i++) {
+        add_thread([](){} /* null function */);
+    }
+}
+
+void ThreadPool::worker_loop(size_t index,
+                             std::function<void()> initializer) {
+    t_pool = this;
+    t_index = index;
+    initializer();
+    for (;;) {
+        Task task;
+        // Spin a little before going to sleep, tasks often
+        // come in bursts.
+        auto found = false;
+        for (auto spin = 0; spin < 64 && !found; spin++) {
+            found = pop_task(task, index);
+            if (!found) {
+                std::this_thread::yield();
+            }
+        }
+        if (!found) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_sleeping++;
+            // Pairs with the fence in wake_workers: either the
+            // producer sees us sleeping, or we see its task here.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            found = pop_task(task, index);
+            if (!found) {
+                if (m_exit) {
+                    m_sleeping--;
+                    return;
+                }
+                m_condvar.wait(lock);
+            }
+            m_sleeping--;
+        }
+        if (found) {
+            task();
+        }
+    }
+}
+
+bool ThreadPool::pop_task(Task& task, size_t index) {
+    const auto workers = std::min(m_num_workers.load(), MAX_WORKERS);
+    if (index < workers && m_local_queues[index]->try_pop(task)) {
+        return true;
+    }
+    if (m_queue.try_pop(task)) {
+        return true;
+    }
+    if (m_overflow_size.load() > 0) {
+        std::lock_guard<std::mutex> lock(m_overflow_mutex);
+        if (!m_overflow.empty()) {
+            task = std::move(m_overflow.front());
+            m_overflow.pop();
+            m_overflow_size--;
+            return true;
+        }
+    }
+    // Steal from the other workers.
+    for (auto i = size_t{1}; i < workers; i++) {
+        const auto victim = (index + i) % workers;
+        if (m_local_queues[victim]->try_pop(task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::push_task(Task& task) {
+    if (t_pool == this && t_index < MAX_WORKERS
+        && m_local_queues[t_index]->try_push(task)) {
+        return;
+    }
+    if (m_queue.try_push(task)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_overflow_mutex);
+    m_overflow.emplace(std::move(task));
+    m_overflow_size++;
+}
+
+void ThreadPool::wake_workers(size_t count) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load() == 0) {
+        return;
+    }
+    {
+        // Sleepers check the queues while holding the lock,
+        // so taking it makes sure the notification isn't lost.
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    if (count == 1) {
+        m_condvar.notify_one();
+    } else {
+        m_condvar.notify_all();
+    }
+}
+
+void ThreadPool::submit(Task task) {
+    push_task(task);
+    wake_workers(1);
+}
+
+void ThreadPool::submit(std::vector<Task>& tasks) {
+    const auto count = tasks.size();
+    for (auto& task : tasks) {
+        push_task(task);
+    }
+    tasks.clear();
+    wake_workers(count);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_condvar.notify_all();
+    for (std::thread & worker : m_threads) {
+        worker.join();
+    }
+}
+
+}
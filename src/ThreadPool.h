@@ -26,6 +26,8 @@
     distribution.
 */
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <vector>
 #include <thread>
@@ -35,11 +37,170 @@
 #include <memory>
 #include <future>
 #include <functional>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 namespace Utils {
 
+/*
+    Type erased void() callable. Small callables (a few pointers, which
+    covers everything the search submits) are stored inline so queueing
+    a task doesn't allocate. Move-only, so it can hold a packaged_task.
+*/
+class Task {
+public:
+    Task() = default;
+    template<class F,
+             class = typename std::enable_if<
+                 !std::is_same<typename std::decay<F>::type, Task>::value
+             >::type>
+    Task(F&& f) {
+        using Fn = typename std::decay<F>::type;
+        m_ops = &s_ops<Fn>;
+        Ops::construct<Fn>(&m_storage, std::forward<F>(f));
+    }
+    Task(Task&& other) noexcept {
+        take(other);
+    }
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        reset();
+    }
+
+    explicit operator bool() const {
+        return m_ops != nullptr;
+    }
+    void operator()() {
+        m_ops->invoke(&m_storage);
+    }
+
+private:
+    static constexpr auto INLINE_SIZE = 6 * sizeof(void*);
+    using Storage = typename std::aligned_storage<INLINE_SIZE>::type;
+
+    template<class Fn>
+    static constexpr bool is_inline() {
+        return sizeof(Fn) <= INLINE_SIZE
+            && alignof(Fn) <= alignof(Storage)
+            && std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    struct Ops {
+        void (*invoke)(void*);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void*);
+
+        template<class Fn, class F>
+        static void construct(void* p, F&& f) {
+            if (is_inline<Fn>()) {
+                new (p) Fn(std::forward<F>(f));
+            } else {
+                *static_cast<Fn**>(p) = new Fn(std::forward<F>(f));
+            }
+        }
+        template<class Fn>
+        static Fn* get(void* p) {
+            if (is_inline<Fn>()) {
+                return static_cast<Fn*>(p);
+            }
+            return *static_cast<Fn**>(p);
+        }
+        template<class Fn>
+        static void invoke_impl(void* p) {
+            (*get<Fn>(p))();
+        }
+        template<class Fn>
+        static void move_impl(void* dst, void* src) {
+            if (is_inline<Fn>()) {
+                new (dst) Fn(std::move(*get<Fn>(src)));
+                get<Fn>(src)->~Fn();
+            } else {
+                *static_cast<Fn**>(dst) = get<Fn>(src);
+            }
+        }
+        template<class Fn>
+        static void destroy_impl(void* p) {
+            if (is_inline<Fn>()) {
+                get<Fn>(p)->~Fn();
+            } else {
+                delete get<Fn>(p);
+            }
+        }
+    };
+
+    template<class Fn>
+    static const Ops s_ops;
+
+    void take(Task& other) {
+        m_ops = other.m_ops;
+        if (m_ops) {
+            m_ops->move(&m_storage, &other.m_storage);
+            other.m_ops = nullptr;
+        }
+    }
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    Storage m_storage;
+    const Ops* m_ops{nullptr};
+};
+
+template<class Fn>
+const Task::Ops Task::s_ops = {
+    &Task::Ops::invoke_impl<Fn>,
+    &Task::Ops::move_impl<Fn>,
+    &Task::Ops::destroy_impl<Fn>
+};
+
+/*
+    Bounded lock-free multi-producer multi-consumer queue
+    (Dmitry Vyukov's design). Every cell carries a sequence number
+    that tells producers and consumers whose turn it is, so a push or
+    pop is one CAS on the shared index in the common case.
+*/
+class TaskQueue {
+public:
+    explicit TaskQueue(size_t capacity);
+    bool try_push(Task& task);
+    bool try_pop(Task& task);
+    bool empty() const;
+
+private:
+    struct Cell {
+        std::atomic<size_t> m_sequence;
+        Task m_task;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+};
+
 class ThreadPool {
 public:
+    /*
+        Capacity of the shared queue and of every worker's own
+        queue. Anything beyond that goes to a locked overflow queue.
+    */
+    static constexpr size_t QUEUE_SIZE = 4096;
+    static constexpr size_t LOCAL_QUEUE_SIZE = 256;
+    static constexpr size_t MAX_WORKERS = 256;
+
     ThreadPool() = default;
     ~ThreadPool();
 
@@ -52,86 +213,224 @@ public:
     template<class F, class... Args>
     auto add_task(F&& f, Args&&... args)
         -> std::future<typename std::result_of<F(Args...)>::type>;
+
+    // Fire and forget. Tasks submitted from a worker go to its own
+    // queue first, idle workers steal from there.
+    void submit(Task task);
+    // Queue all tasks and wake the workers once.
+    void submit(std::vector<Task>& tasks);
+
+    /*
+        Calls f(i) for every i in [begin, end), in chunks of grain
+        indices, and returns when all calls are done. The calling
+        thread works on chunks too, so this makes progress even
+        when every worker is busy and can be nested in a task.
+        Exceptions are rethrown on the calling thread.
+    */
+    template<class F>
+    void parallel_for(size_t begin, size_t end, F f, size_t grain = 1);
+
+    size_t get_num_threads() const {
+        return m_num_workers.load();
+    }
+
 private:
+    void worker_loop(size_t index, std::function<void()> initializer);
+    bool pop_task(Task& task, size_t index);
+    void push_task(Task& task);
+    void wake_workers(size_t count);
+
     std::vector<std::thread> m_threads;
-    std::queue<std::function<void()>> m_tasks;
+    TaskQueue m_queue{QUEUE_SIZE};
+    std::unique_ptr<TaskQueue> m_local_queues[MAX_WORKERS];
+    std::atomic<size_t> m_num_workers{0};
+
+    std::mutex m_overflow_mutex;
+    std::queue<Task> m_overflow;
+    std::atomic<size_t> m_overflow_size{0};
 
     std::mutex m_mutex;
     std::condition_variable m_condvar;
-    bool m_exit{false};
+    std::atomic<int> m_sleeping{0};
+    std::atomic<bool> m_exit{false};
 };
 
-inline void ThreadPool::add_thread(std::function<void()> initializer) {
-    m_threads.emplace_back([this, initializer] {
-        initializer();
-        for (;;) {
-            std::function<void()> task;
-            {
-                std::unique_lock<std::mutex> lock(m_mutex);
-                m_condvar.wait(lock, [this]{ return m_exit || !m_tasks.empty(); });
-                if (m_exit && m_tasks.empty()) {
-                    return;
-                }
-                task = std::move(m_tasks.front());
-                m_tasks.pop();
-            }
-            task();
-        }
-    });
-}
-
-inline void ThreadPool::initialize(size_t threads) {
-    for (size_t i = 0; i < threads; i++) {
-        add_thread([](){} /* null function */);
-    }
-}
-
 template<class F, class... Args>
 auto ThreadPool::add_task(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type> {
     using return_type = typename std::result_of<F(Args...)>::type;
 
-    auto task = std::make_shared< std::packaged_task<return_type()> >(
+    auto task = std::packaged_task<return_type()>(
         std::bind(std::forward<F>(f), std::forward<Args>(args)...)
     );
 
-    std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_tasks.emplace([task](){(*task)();});
-    }
-    m_condvar.notify_one();
+    std::future<return_type> res = task.get_future();
+    submit(Task(std::move(task)));
     return res;
 }
 
-inline ThreadPool::~ThreadPool() {
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_exit = true;
+template<class F>
+void ThreadPool::parallel_for(size_t begin, size_t end, F f, size_t grain) {
+    if (begin >= end) {
+        return;
     }
-    m_condvar.notify_all();
-    for (std::thread & worker : m_threads) {
-        worker.join();
+    grain = std::max(grain, size_t{1});
+
+    // Helpers may only get to run after we returned, so they
+    // share ownership of the loop state.
+    struct Loop {
+        Loop(size_t b, size_t e, size_t g, F&& fn)
+            : m_next(b), m_end(e), m_grain(g), m_f(std::move(fn)) {}
+        std::atomic<size_t> m_next;
+        std::atomic<size_t> m_done{0};
+        size_t m_end;
+        size_t m_grain;
+        F m_f;
+        std::mutex m_mutex;
+        std::condition_variable m_condvar;
+        std::exception_ptr m_exception;
+
+        void run(size_t total) {
+            for (;;) {
+                const auto first = m_next.fetch_add(m_grain);
+                if (first >= m_end) {
+                    return;
+                }
+                const auto last = std::min(first + m_grain, m_end);
+                try {
+                    for (auto i = first; i < last; i++) {
+                        m_f(i);
+                    }
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (!m_exception) {
+                        m_exception = std::current_exception();
+                    }
+                }
+                const auto count = last - first;
+                if (m_done.fetch_add(count) + count == total) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_condvar.notify_all();
+                }
+            }
+        }
+    };
+
+    const auto total = end - begin;
+    const auto chunks = (total + grain - 1) / grain;
+    auto loop = std::make_shared<Loop>(begin, end, grain, std::move(f));
+
+    const auto helpers = std::min(chunks - 1, get_num_threads());
+    if (helpers > 0) {
+        auto tasks = std::vector<Task>();
+        tasks.reserve(helpers);
+        for (auto i = size_t{0}; i < helpers; i++) {
+            tasks.emplace_back([loop, total]() { loop->run(total); });
+        }
+        submit(tasks);
+    }
+    loop->run(total);
+
+    std::unique_lock<std::mutex> lock(loop->m_mutex);
+    loop->m_condvar.wait(lock, [&]() { return loop->m_done == total; });
+    if (loop->m_exception) {
+        std::rethrow_exception(loop->m_exception);
     }
 }
 
+/*
+    Set of tasks that can be waited for together. Completion is
+    tracked with a counter instead of a future per task.
+*/
 class ThreadGroup {
 public:
-    ThreadGroup(ThreadPool & pool) : m_pool(pool) {}
+    ThreadGroup(ThreadPool & pool)
+        : m_pool(&pool), m_state(std::make_unique<State>()) {}
+    ThreadGroup(ThreadGroup&&) = default;
+    ~ThreadGroup() {
+        if (m_state) {
+            wait(false);
+        }
+    }
+
     template<class F, class... Args>
     void add_task(F&& f, Args&&... args) {
-        m_taskresults.emplace_back(
-            m_pool.add_task(std::forward<F>(f), std::forward<Args>(args)...)
+        m_state->m_pending++;
+        m_pool->submit(
+            wrap(std::bind(std::forward<F>(f), std::forward<Args>(args)...))
         );
     }
-    void wait_all() {
-        for (auto && result : m_taskresults) {
-            result.get();
+    // Run count copies of f.
+    template<class F>
+    void add_tasks(size_t count, const F& f) {
+        auto tasks = std::vector<Task>();
+        tasks.reserve(count);
+        for (auto i = size_t{0}; i < count; i++) {
+            tasks.emplace_back(wrap(F(f)));
         }
+        m_state->m_pending += count;
+        m_pool->submit(tasks);
+    }
+    // Waits for all tasks, rethrowing the first exception any of them threw.
+    void wait_all() {
+        wait(true);
     }
+
 private:
-    ThreadPool & m_pool;
-    std::vector<std::future<void>> m_taskresults;
+    struct State {
+        std::atomic<size_t> m_pending{0};
+        std::mutex m_mutex;
+        std::condition_variable m_condvar;
+        std::exception_ptr m_exception;
+
+        void finish() {
+            // The waiter may free us as soon as it sees zero, so the
+            // last task only drops the count while holding the lock.
+            auto pending = m_pending.load();
+            for (;;) {
+                if (pending == 1) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (m_pending.compare_exchange_strong(pending, 0)) {
+                        m_condvar.notify_all();
+                        return;
+                    }
+                } else if (m_pending.compare_exchange_weak(pending,
+                                                           pending - 1)) {
+                    return;
+                }
+            }
+        }
+    };
+
+    template<class Fn>
+    Task wrap(Fn fn) {
+        auto state = m_state.get();
+        return Task([state, fn = std::move(fn)]() mutable {
+            try {
+                fn();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state->m_mutex);
+                if (!state->m_exception) {
+                    state->m_exception = std::current_exception();
+                }
+            }
+            state->finish();
+        });
+    }
+
+    void wait(bool rethrow) {
+        std::unique_lock<std::mutex> lock(m_state->m_mutex);
+        m_state->m_condvar.wait(lock,
+                                [this]() { return m_state->m_pending == 0; });
+        if (rethrow && m_state->m_exception) {
+            auto exception = m_state->m_exception;
+            m_state->m_exception = nullptr;
+            std::rethrow_exception(exception);
+        }
+    }
+
+    ThreadPool * m_pool;
+    std::unique_ptr<State> m_state;
 };
 
 }
@@ -190,6 +190,35 @@ int TimeControl::max_time_for_move(int boardsize,
     return base_time + inc_time;
 }
 
+// Upper bound for a move whose time gets extended: we never spend
+// more than half of what is left before we would lose on time.
+int TimeControl::max_extended_time(int color) const {
+    if (m_byotime != 0 && m_byostones == 0 && m_byoperiods == 0) {
+        return 31 * 24 * 60 * 60 * 100;
+    }
+
+    auto time_remaining = m_remaining_time[color];
+    auto byo_time = 0;
+    if (m_byotime != 0) {
+        if (m_inbyo[color]) {
+            if (!m_byostones) {
+                // The period is reset every move, so there is
+                // nothing to borrow from.
+                return std::max(m_byotime - cfg_lagbuffer_cs, 0);
+            }
+            if (m_stones_left[color] == 1) {
+                return std::max(time_remaining - cfg_lagbuffer_cs, 0);
+            }
+        } else if (m_byostones) {
+            byo_time = m_byotime / m_byostones;
+        } else {
+            byo_time = m_byotime;
+        }
+    }
+    return std::max(time_remaining - cfg_lagbuffer_cs, 0) / 2
+           + std::max(byo_time - cfg_lagbuffer_cs, 0);
+}
+
 void TimeControl::adjust_time(int color, int time, int stones) {
     m_remaining_time[color] = time;
     // From pachi: some GTP things send 0 0 at the end of main time
@@ -0,0 +1,207 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "TimeManager.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <mutex>
+
+#include "FastBoard.h"
+#include "GTP.h"
+#include "UCTNode.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+constexpr int TimeManager::SAMPLE_CENTIS;
+constexpr float TimeManager::EXTEND_STEP;
+constexpr float TimeManager::EASY_SHARE;
+constexpr float TimeManager::STABLE_EVAL;
+constexpr float TimeManager::UNSTABLE_EVAL;
+
+void TimeManager::start(int movenum, int color, int base_time, int max_time) {
+    *this = TimeManager();
+    m_enabled = true;
+    m_movenum = movenum;
+    m_color = color;
+    m_base_time = base_time;
+    m_min_time = static_cast<int>(cfg_time_min_ratio * base_time);
+    m_max_time = std::max(base_time,
+        std::min(static_cast<int>(cfg_time_max_ratio * base_time), max_time));
+    m_deadline = base_time;
+    m_last_sample = 0;
+
+    myprintf("Adaptive time: %.1f to %.1f seconds.\n",
+             m_min_time / 100.0f, m_max_time / 100.0f);
+}
+
+int TimeManager::update(int elapsed_centis, int playouts,
+                        const UCTNode& root) {
+    // Always take a look when the time is up, we might extend it.
+    if (elapsed_centis - m_last_sample < SAMPLE_CENTIS
+        && elapsed_centis < m_deadline) {
+        return m_deadline;
+    }
+
+    // Recent rate rather than the average since the start, which lags
+    // behind when the NN cache warms up or other searches come and go.
+    const auto interval = std::max(1, elapsed_centis - m_last_sample);
+    const auto rate = float(playouts - m_last_playouts) / interval;
+    m_rate = m_rate > 0.0f ? 0.8f * m_rate + 0.2f * rate : rate;
+    m_last_sample = elapsed_centis;
+    m_last_playouts = playouts;
+
+    // There are no cases where the root's children vector gets modified
+    // during a multithreaded search, so it is safe to walk it here.
+    const UCTNode* best = nullptr;
+    auto second_visits = 0;
+    auto total_visits = 0;
+    for (const auto& child : root.get_children()) {
+        if (!child->valid()) {
+            continue;
+        }
+        const auto visits = child->get_visits();
+        total_visits += visits;
+        if (!best || visits > best->get_visits()) {
+            if (best) {
+                second_visits = best->get_visits();
+            }
+            best = child.get();
+        } else {
+            second_visits = std::max(second_visits, visits);
+        }
+    }
+    if (!best || !best->get_visits()) {
+        return m_deadline;
+    }
+
+    if (best->get_move() != m_best_move) {
+        if (m_best_move != -1) {
+            m_best_changes++;
+        }
+        m_best_move = best->get_move();
+        m_best_since = elapsed_centis;
+    }
+    m_best_visits = best->get_visits();
+    m_second_visits = second_visits;
+    m_share = float(m_best_visits) / total_visits;
+    m_eval = best->get_raw_eval(m_color);
+    m_evals.emplace_back(elapsed_centis, m_eval);
+
+    decide(elapsed_centis);
+    return m_deadline;
+}
+
+// Change of the best move's eval over the last half of the search.
+float TimeManager::eval_drift(int elapsed_centis) const {
+    const auto half = std::lower_bound(
+        begin(m_evals), end(m_evals),
+        std::make_pair(elapsed_centis / 2, 0.0f));
+    if (half == end(m_evals)) {
+        return 0.0f;
+    }
+    return m_eval - half->second;
+}
+
+void TimeManager::decide(int elapsed_centis) {
+    if (elapsed_centis < m_min_time || m_rate <= 0.0f) {
+        return;
+    }
+
+    const auto gap = m_best_visits - m_second_visits;
+    const auto drift = eval_drift(elapsed_centis);
+
+    if (elapsed_centis < m_deadline) {
+        // Easy move: the same best move for the last half of the search,
+        // most of the visits and a steady eval. Even if the runner-up
+        // got half of the remaining playouts, it wouldn't catch up.
+        const auto stable = m_best_since <= elapsed_centis / 2
+                            && m_share >= EASY_SHARE
+                            && std::abs(drift) <= STABLE_EVAL;
+        const auto remaining = m_deadline - elapsed_centis;
+        if (stable && gap > 0.5f * m_rate * remaining) {
+            m_deadline = elapsed_centis;
+            log("stop", elapsed_centis);
+        }
+        return;
+    }
+
+    if (m_deadline >= m_max_time) {
+        return;
+    }
+    // Hard move: the best move only just took over, its eval is
+    // dropping, or the runner-up could still pass it with more time.
+    const auto step = std::max(1, static_cast<int>(EXTEND_STEP * m_base_time));
+    const auto changed = m_best_since > elapsed_centis * 3 / 4;
+    const auto falling = drift < -UNSTABLE_EVAL;
+    const auto close = m_second_visits + m_rate * step >= m_best_visits;
+    if (changed || falling || close) {
+        m_deadline = std::min(m_max_time, m_deadline + step);
+        log("extend", elapsed_centis);
+    }
+}
+
+void TimeManager::finish(int elapsed_centis, int playouts) {
+    if (!m_enabled) {
+        return;
+    }
+    m_last_playouts = playouts;
+    log("done", elapsed_centis);
+    m_enabled = false;
+}
+
+void TimeManager::log(const char* decision, int elapsed_centis) const {
+    const auto which = std::string(decision);
+    if (which == "stop") {
+        myprintf("Best move is stable, stopping after %.1fs of %.1fs.\n",
+                 elapsed_centis / 100.0f, m_base_time / 100.0f);
+    } else if (which == "extend") {
+        myprintf("Best move is unstable, extending to %.1fs.\n",
+                 m_deadline / 100.0f);
+    }
+    if (cfg_time_log.empty()) {
+        return;
+    }
+
+    // One JSON object per line, for offline tuning of the thresholds.
+    static std::mutex log_mutex;
+    std::lock_guard<std::mutex> lock(log_mutex);
+    std::ofstream out(cfg_time_log, std::ios::app);
+    if (!out) {
+        return;
+    }
+    out << "{\"move\":" << m_movenum
+        << ",\"color\":\"" << (m_color == FastBoard::BLACK ? "b" : "w")
+        << "\",\"decision\":\"" << decision
+        << "\",\"elapsed\":" << elapsed_centis
+        << ",\"deadline\":" << m_deadline
+        << ",\"base\":" << m_base_time
+        << ",\"min\":" << m_min_time
+        << ",\"max\":" << m_max_time
+        << ",\"playouts\":" << m_last_playouts
+        << ",\"rate\":" << m_rate
+        << ",\"share\":" << m_share
+        << ",\"gap\":" << m_best_visits - m_second_visits
+        << ",\"eval\":" << m_eval
+        << ",\"drift\":" << eval_drift(elapsed_centis)
+        << ",\"best_changes\":" << m_best_changes
+        << "}\n";
+}
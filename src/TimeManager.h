@@ -0,0 +1,96 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TIMEMANAGER_H_INCLUDED
+#define TIMEMANAGER_H_INCLUDED
+
+#include "config.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+class UCTNode;
+
+/*
+    Adjusts the time for a move while searching. The budget from
+    TimeControl is the starting point. The search stops early once the
+    best move has been stable for a while and the runner-up can't
+    realistically catch up. It is extended in steps when the best move
+    just changed, its eval is falling or the runner-up could still
+    overtake it. Both stay within [min_ratio, max_ratio] of the budget
+    and below the hard limit from TimeControl.
+*/
+class TimeManager {
+public:
+    // Sample the root at most this often.
+    static constexpr int SAMPLE_CENTIS = 10;
+    // Extensions are granted in steps of this fraction of the budget.
+    static constexpr float EXTEND_STEP = 0.25f;
+    // Minimum visit share of the best move for an early stop.
+    static constexpr float EASY_SHARE = 0.6f;
+    // Eval changes over the last half of the search below this are
+    // stable, drops above UNSTABLE_EVAL call for more time.
+    static constexpr float STABLE_EVAL = 0.02f;
+    static constexpr float UNSTABLE_EVAL = 0.03f;
+
+    // Disabled until start() is called.
+    TimeManager() = default;
+
+    void start(int movenum, int color, int base_time, int max_time);
+    // Returns the time the search may currently use.
+    int update(int elapsed_centis, int playouts, const UCTNode& root);
+    void finish(int elapsed_centis, int playouts);
+
+    bool enabled() const {
+        return m_enabled;
+    }
+    // Recent playouts per centisecond, 0 until measured.
+    float get_playout_rate() const {
+        return m_rate;
+    }
+
+private:
+    void decide(int elapsed_centis);
+    float eval_drift(int elapsed_centis) const;
+    void log(const char* decision, int elapsed_centis) const;
+
+    bool m_enabled{false};
+    int m_movenum{0};
+    int m_color{0};
+    int m_base_time{0};
+    int m_min_time{0};
+    int m_max_time{0};
+    int m_deadline{0};
+
+    int m_last_sample{-SAMPLE_CENTIS};
+    int m_last_playouts{0};
+    float m_rate{0.0f};
+
+    int m_best_move{-1};
+    int m_best_since{0};
+    int m_best_changes{0};
+    int m_best_visits{0};
+    int m_second_visits{0};
+    float m_share{0.0f};
+    float m_eval{0.5f};
+    // (elapsed, eval of the best move) per sample
+    std::vector<std::pair<int, float>> m_evals;
+};
+
+#endif
@@ -21,15 +21,21 @@
 #include <algorithm>
 #include <bitset>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
 #include <utility>
 
 #include "FastBoard.h"
+#include "Float16.h"
 #include "FullBoard.h"
 #include "GTP.h"
 #include "GameState.h"
@@ -42,7 +48,11 @@
 #include "string.h"
 #include "zlib.h"
 
-std::vector<TimeStep> Training::m_data{};
+thread_local std::vector<TimeStep> Training::m_data{};
+thread_local std::vector<std::pair<size_t, std::string>>
+    Training::m_searches{};
+std::mutex Training::m_chunkers_mutex;
+std::map<std::string, std::unique_ptr<OutputChunker>> Training::m_chunkers;
 
 std::ostream& operator <<(std::ostream& stream, const TimeStep& timestep) {
     stream << timestep.planes.size() << ' ';
@@ -86,17 +96,20 @@ std::istream& operator>> (std::istream& stream, TimeStep& timestep) {
 
 std::string OutputChunker::gen_chunk_name() const {
     auto base = std::string{m_basename};
-    base.append("." + std::to_string(m_chunk_count) + ".gz");
+    base.append("." + std::to_string(m_chunk_count));
+    base.append(m_binary ? ".bin.gz" : ".gz");
     return base;
 }
 
 OutputChunker::OutputChunker(const std::string& basename,
-                             bool compress)
-    : m_basename(basename), m_compress(compress) {
+                             bool compress, int level, bool binary)
+    : m_basename(basename), m_compress(compress),
+      m_level(std::min(std::max(level, 0), 9)), m_binary(binary) {
 }
 
 OutputChunker::~OutputChunker() {
     flush_chunks();
+    wait_writer();
 }
 
 void OutputChunker::append(const std::string& str) {
@@ -107,60 +120,146 @@ void OutputChunker::append(const std::string& str) {
     }
 }
 
+void OutputChunker::wait_writer() {
+    if (!m_writer.valid()) {
+        return;
+    }
+    try {
+        m_writer.get();
+    } catch (const std::exception& e) {
+        Utils::myprintf("Error writing training data: %s\n", e.what());
+    }
+}
+
 void OutputChunker::flush_chunks() {
-    if (m_compress) {
-        auto chunk_name = gen_chunk_name();
-        auto out = gzopen(chunk_name.c_str(), "wb9");
+    if (m_buffer.empty()) {
+        return;
+    }
 
-        auto in_buff_size = m_buffer.size();
-        auto in_buff = std::make_unique<char[]>(in_buff_size);
-        memcpy(in_buff.get(), m_buffer.data(), in_buff_size);
+    // At most one chunk is in flight. This keeps chunks in order and
+    // bounds the memory held by the writer.
+    wait_writer();
+    auto chunk_name = m_compress ? gen_chunk_name() : m_basename;
+    m_writer = std::async(std::launch::async, &OutputChunker::write_chunk,
+                          this, std::move(m_buffer), chunk_name,
+                          m_chunk_count);
 
-        auto comp_size = gzwrite(out, in_buff.get(), in_buff_size);
+    m_buffer.clear();
+    m_chunk_count++;
+    m_game_count = 0;
+}
+
+void OutputChunker::write_chunk(const std::string& buffer,
+                                const std::string& chunk_name,
+                                size_t chunk_count) const {
+    if (m_compress) {
+        // Written under a temporary name, so that a chunk that exists
+        // is complete.
+        const auto tmp_name = chunk_name + ".tmp";
+        auto mode = "wb" + std::to_string(m_level);
+        auto out = gzopen(tmp_name.c_str(), mode.c_str());
+        if (!out) {
+            throw std::runtime_error("Error opening " + tmp_name);
+        }
+
+        auto comp_size = gzwrite(out, buffer.data(), buffer.size());
         if (!comp_size) {
+            gzclose(out);
             throw std::runtime_error("Error in gzip output");
         }
-        Utils::myprintf("Writing chunk %d\n",  m_chunk_count);
-        gzclose(out);
+        Utils::myprintf("Writing chunk %d\n", chunk_count);
+        if (gzclose(out) != Z_OK) {
+            throw std::runtime_error("Error closing " + tmp_name);
+        }
+        std::remove(chunk_name.c_str());
+        if (std::rename(tmp_name.c_str(), chunk_name.c_str()) != 0) {
+            throw std::runtime_error("Error renaming " + tmp_name);
+        }
     } else {
-        auto chunk_name = m_basename;
         auto flags = std::ofstream::out | std::ofstream::app;
         auto out = std::ofstream{chunk_name, flags};
-        out << m_buffer;
+        out << buffer;
         out.close();
     }
+}
 
-    m_buffer.clear();
-    m_chunk_count++;
-    m_game_count = 0;
+static bool read_chunk(const std::string& filename, std::string& data) {
+    // gzread passes uncompressed files through unchanged.
+    auto in = gzopen(filename.c_str(), "rb");
+    if (!in) {
+        return false;
+    }
+    char buffer[64 * 1024];
+    int bytes;
+    while ((bytes = gzread(in, buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, bytes);
+    }
+    gzclose(in);
+    return bytes == 0;
 }
 
 void Training::clear_training() {
     Training::m_data.clear();
+    Training::m_searches.clear();
 }
 
-TimeStep::NNPlanes Training::get_planes(const GameState* const state) {
-    const auto input_data = Network::gather_features(state, 0);
+void Training::record_search(const GameState& state,
+                             const std::string& comment) {
+    const auto movenum = state.get_movenum();
+    // Searches from positions we undid past are stale.
+    m_searches.erase(
+        std::remove_if(begin(m_searches), end(m_searches),
+                       [movenum](const auto& search) {
+                           return search.first >= movenum;
+                       }),
+        end(m_searches));
+    m_searches.emplace_back(movenum, comment);
+}
 
-    auto planes = TimeStep::NNPlanes{};
-    planes.resize(Network::INPUT_CHANNELS);
+std::string Training::search_comment(const size_t movenum) {
+    for (const auto& search : m_searches) {
+        if (search.first == movenum) {
+            return search.second;
+        }
+    }
+    return {};
+}
 
-    for (auto c = size_t{0}; c < Network::INPUT_CHANNELS; c++) {
+TimeStep::NNPlanes Training::get_planes(const GameState* const state) {
+    // Same layout as Network::gather_features with the identity symmetry,
+    // but filled straight from the boards.
+    auto planes = TimeStep::NNPlanes(Network::INPUT_CHANNELS);
+
+    const auto to_move = state->get_to_move();
+    const auto moves =
+        std::min<size_t>(state->get_movenum() + 1, Network::INPUT_MOVES);
+    for (auto h = size_t{0}; h < moves; h++) {
+        const auto& board = state->get_past_board(h);
+        auto& own = planes[h];
+        auto& opponent = planes[Network::INPUT_MOVES + h];
         for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
-            planes[c][idx] = bool(input_data[c * NUM_INTERSECTIONS + idx]);
+            const auto color =
+                board.get_state(idx % BOARD_SIZE, idx / BOARD_SIZE);
+            if (color == to_move) {
+                own[idx] = true;
+            } else if (color != FastBoard::EMPTY) {
+                opponent[idx] = true;
+            }
         }
     }
+
+    const auto to_move_plane = to_move == FastBoard::BLACK ? 0 : 1;
+    planes[2 * Network::INPUT_MOVES + to_move_plane].set();
     return planes;
 }
 
-void Training::record(Network & network, GameState& state, UCTNode& root) {
+void Training::record(GameState& state, UCTNode& root) {
     auto step = TimeStep{};
     step.to_move = state.board.get_to_move();
     step.planes = get_planes(&state);
 
-    auto result =
-        network.get_output(&state, Network::Ensemble::DIRECT, 0);
-    step.net_winrate = result.winrate;
+    // The root keeps the raw network evaluation it was expanded with.
+    step.net_winrate = root.get_net_eval(step.to_move);
 
     const auto& best_node = root.get_best_root_child(step.to_move);
     step.root_uct_winrate = root.get_eval(step.to_move);
@@ -198,9 +297,27 @@ void Training::record(Network & network, GameState& state, UCTNode& root) {
     m_data.emplace_back(step);
 }
 
+OutputChunker& Training::get_chunker(const std::string& filename,
+                                     const bool binary) {
+    auto& chunker = m_chunkers[filename];
+    if (!chunker) {
+        chunker = std::make_unique<OutputChunker>(
+            filename, true, cfg_training_compression, binary);
+    }
+    return *chunker;
+}
+
 void Training::dump_training(int winner_color, const std::string& filename) {
-    auto chunker = OutputChunker{filename, true};
+    std::lock_guard<std::mutex> lock(m_chunkers_mutex);
+    auto& chunker = get_chunker(filename, cfg_training_binary);
     dump_training(winner_color, chunker);
+    chunker.flush_chunks();
+}
+
+void Training::finish_output() {
+    std::lock_guard<std::mutex> lock(m_chunkers_mutex);
+    // The chunkers write what they still have and wait for it.
+    m_chunkers.clear();
 }
 
 void Training::save_training(const std::string& filename) {
@@ -231,62 +348,247 @@ void Training::load_training(std::ifstream& in) {
     }
 }
 
-void Training::dump_training(int winner_color, OutputChunker& outchunk) {
-    auto training_str = std::string{};
-    for (const auto& step : m_data) {
-        auto out = std::stringstream{};
-        // First output 16 times an input feature plane
-        for (auto p = size_t{0}; p < 16; p++) {
-            const auto& plane = step.planes[p];
-            // Write it out as a string of hex characters
-            for (auto bit = size_t{0}; bit + 3 < plane.size(); bit += 4) {
-                auto hexbyte =  plane[bit]     << 3
-                              | plane[bit + 1] << 2
-                              | plane[bit + 2] << 1
-                              | plane[bit + 3] << 0;
-                out << std::hex << hexbyte;
+// Game result for the side to move: 1 won, -1 lost, 0 for a draw
+// (winner_color FastBoard::EMPTY).
+static int game_result(const TimeStep& step, const int winner_color) {
+    if (winner_color == FastBoard::EMPTY) {
+        return 0;
+    }
+    return step.to_move == winner_color ? 1 : -1;
+}
+
+// The winner that gives the side to move this result.
+static int winner_from_result(const TimeStep& step, const int result) {
+    if (result == 0) {
+        return FastBoard::EMPTY;
+    }
+    return (result > 0) == (step.to_move == FastBoard::BLACK)
+        ? FastBoard::BLACK : FastBoard::WHITE;
+}
+
+void Training::append_text_record(std::string& training_str,
+                                  const TimeStep& step, int winner_color) {
+    auto out = std::stringstream{};
+    // First output 16 times an input feature plane
+    for (auto p = size_t{0}; p < TRAINING_PLANES; p++) {
+        const auto& plane = step.planes[p];
+        // Write it out as a string of hex characters
+        for (auto bit = size_t{0}; bit + 3 < plane.size(); bit += 4) {
+            auto hexbyte =  plane[bit]     << 3
+                          | plane[bit + 1] << 2
+                          | plane[bit + 2] << 1
+                          | plane[bit + 3] << 0;
+            out << std::hex << hexbyte;
+        }
+        // NUM_INTERSECTIONS % 4 = 1 so the last bit goes by itself
+        // for odd sizes
+        assert(plane.size() % 4 == 1);
+        out << plane[plane.size() - 1];
+        out << std::dec << std::endl;
+    }
+    // The side to move planes can be compactly encoded into a single
+    // bit, 0 = black to move.
+    out << (step.to_move == FastBoard::BLACK ? "0" : "1") << std::endl;
+    // Then a POTENTIAL_MOVES long array of float probabilities
+    for (auto it = begin(step.probabilities);
+        it != end(step.probabilities); ++it) {
+        out << *it;
+        if (next(it) != end(step.probabilities)) {
+            out << " ";
+        }
+    }
+    out << std::endl;
+    // And the game result for the side to move
+    out << game_result(step, winner_color) << std::endl;
+    training_str.append(out.str());
+}
+
+void Training::append_binary_record(std::string& training_str,
+                                    const TimeStep& step, int winner_color) {
+    auto record = std::string(BINARY_RECORD_SIZE, '\0');
+    auto pos = size_t{0};
+    record[pos++] = char(BINARY_VERSION);
+    for (auto p = size_t{0}; p < TRAINING_PLANES; p++) {
+        const auto& plane = step.planes[p];
+        for (auto idx = size_t{0}; idx < plane.size(); idx++) {
+            if (plane[idx]) {
+                record[pos + idx / 8] |= char(0x80 >> (idx % 8));
             }
-            // NUM_INTERSECTIONS % 4 = 1 so the last bit goes by itself
-            // for odd sizes
-            assert(plane.size() % 4 == 1);
-            out << plane[plane.size() - 1];
-            out << std::dec << std::endl;
         }
-        // The side to move planes can be compactly encoded into a single
-        // bit, 0 = black to move.
-        out << (step.to_move == FastBoard::BLACK ? "0" : "1") << std::endl;
-        // Then a POTENTIAL_MOVES long array of float probabilities
-        for (auto it = begin(step.probabilities);
-            it != end(step.probabilities); ++it) {
-            out << *it;
-            if (next(it) != end(step.probabilities)) {
-                out << " ";
+        pos += PLANE_BYTES;
+    }
+    record[pos++] = char(step.to_move == FastBoard::BLACK ? 0 : 1);
+    for (const auto prob : step.probabilities) {
+        const auto half = Float16::to_half(prob).bits;
+        record[pos++] = char(half & 0xff);
+        record[pos++] = char(half >> 8);
+    }
+    record[pos++] = char(game_result(step, winner_color));
+    assert(pos == BINARY_RECORD_SIZE);
+    training_str.append(record);
+}
+
+bool Training::parse_text_record(std::istream& in, TimeStep& step,
+                                 int& winner_color) {
+    auto line = std::string{};
+    step.planes.assign(TRAINING_PLANES, TimeStep::BoardPlane{});
+    for (auto p = size_t{0}; p < TRAINING_PLANES; p++) {
+        if (!std::getline(in, line)
+            || line.size() != (NUM_INTERSECTIONS + 3) / 4) {
+            return false;
+        }
+        auto& plane = step.planes[p];
+        for (auto i = size_t{0}; i + 1 < line.size(); i++) {
+            const auto c = line[i];
+            auto hexbyte = 0;
+            if (c >= '0' && c <= '9') {
+                hexbyte = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                hexbyte = c - 'a' + 10;
+            } else {
+                return false;
             }
+            for (auto bit = 0; bit < 4; bit++) {
+                plane[4 * i + bit] = (hexbyte >> (3 - bit)) & 1;
+            }
+        }
+        plane[plane.size() - 1] = line.back() == '1';
+    }
+    if (!std::getline(in, line)) {
+        return false;
+    }
+    step.to_move = line == "0" ? FastBoard::BLACK : FastBoard::WHITE;
+    if (!std::getline(in, line)) {
+        return false;
+    }
+    auto probstream = std::istringstream{line};
+    step.probabilities.resize(POTENTIAL_MOVES);
+    for (auto& prob : step.probabilities) {
+        if (!(probstream >> prob)) {
+            return false;
         }
-        out << std::endl;
-        // And the game result for the side to move
-        if (step.to_move == winner_color) {
-            out << "1";
+    }
+    if (!std::getline(in, line)) {
+        return false;
+    }
+    if (line != "1" && line != "-1" && line != "0") {
+        return false;
+    }
+    winner_color = winner_from_result(step, std::stoi(line));
+    return true;
+}
+
+bool Training::parse_binary_record(const char* data, TimeStep& step,
+                                   int& winner_color) {
+    auto pos = size_t{0};
+    if (data[pos++] != char(BINARY_VERSION)) {
+        return false;
+    }
+    step.planes.assign(TRAINING_PLANES, TimeStep::BoardPlane{});
+    for (auto p = size_t{0}; p < TRAINING_PLANES; p++) {
+        auto& plane = step.planes[p];
+        for (auto idx = size_t{0}; idx < plane.size(); idx++) {
+            plane[idx] = (data[pos + idx / 8] >> (7 - idx % 8)) & 1;
+        }
+        pos += PLANE_BYTES;
+    }
+    step.to_move = data[pos++] ? FastBoard::WHITE : FastBoard::BLACK;
+    step.probabilities.resize(POTENTIAL_MOVES);
+    for (auto& prob : step.probabilities) {
+        const auto lo = std::uint8_t(data[pos++]);
+        const auto hi = std::uint8_t(data[pos++]);
+        const auto half = Float16::half_t{std::uint16_t(lo | (hi << 8))};
+        prob = Float16::to_float(half);
+    }
+    const auto result = data[pos++];
+    if (result != 1 && result != -1 && result != 0) {
+        return false;
+    }
+    winner_color = winner_from_result(step, result);
+    return true;
+}
+
+std::string Training::format_training(int winner_color, bool binary) {
+    auto training_str = std::string{};
+    for (const auto& step : m_data) {
+        if (binary) {
+            append_binary_record(training_str, step, winner_color);
         } else {
-            out << "-1";
+            append_text_record(training_str, step, winner_color);
         }
-        out << std::endl;
-        training_str.append(out.str());
     }
-    outchunk.append(training_str);
+    return training_str;
+}
+
+void Training::dump_training(int winner_color, OutputChunker& outchunk) {
+    outchunk.append(format_training(winner_color, outchunk.is_binary()));
+}
+
+std::pair<bool, std::string> Training::convert_training(
+    const std::string& in_filename, const std::string& out_basename) {
+
+    auto data = std::string{};
+    if (!read_chunk(in_filename, data)) {
+        return {false, "cannot read " + in_filename};
+    }
+    if (data.empty()) {
+        return {false, in_filename + " is empty"};
+    }
+
+    // Text chunks start with a hex digit, so the version byte tells them
+    // apart. Convert to whichever format the input is not.
+    const auto binary_in = data[0] == char(BINARY_VERSION);
+    auto converted = std::string{};
+    auto records = size_t{0};
+    auto step = TimeStep{};
+    auto winner_color = int{FastBoard::BLACK};
+    if (binary_in) {
+        if (data.size() % BINARY_RECORD_SIZE != 0) {
+            return {false, "truncated binary chunk"};
+        }
+        for (auto offset = size_t{0}; offset < data.size();
+             offset += BINARY_RECORD_SIZE) {
+            if (!parse_binary_record(&data[offset], step, winner_color)) {
+                return {false, "bad record at offset "
+                               + std::to_string(offset)};
+            }
+            append_text_record(converted, step, winner_color);
+            records++;
+        }
+    } else {
+        auto in = std::istringstream{data};
+        while (in.peek() != EOF) {
+            if (!parse_text_record(in, step, winner_color)) {
+                return {false, "bad text record "
+                               + std::to_string(records)};
+            }
+            append_binary_record(converted, step, winner_color);
+            records++;
+        }
+    }
+
+    OutputChunker outchunker{out_basename, true,
+                             cfg_training_compression, !binary_in};
+    outchunker.append(converted);
+    return {true, std::to_string(records) + " positions"};
 }
 
 void Training::dump_debug(const std::string& filename) {
-    auto chunker = OutputChunker{filename, true};
+    std::lock_guard<std::mutex> lock(m_chunkers_mutex);
+    auto& chunker = get_chunker(filename, false);
     dump_debug(chunker);
+    chunker.flush_chunks();
 }
 
 void Training::dump_debug(OutputChunker& outchunk) {
     auto debug_str = std::string{};
     {
         auto out = std::stringstream{};
-        out << "2" << std::endl; // File format version
+        out << "3" << std::endl; // File format version
         out << cfg_resignpct << " " << cfg_weightsfile << std::endl;
+        // Playout cap randomization. Only full searches are recorded.
+        out << cfg_max_visits << " " << cfg_max_playouts << " "
+            << cfg_fast_visits << " " << cfg_full_search_prob << std::endl;
         debug_str.append(out.str());
     }
     for (const auto& step : m_data) {
@@ -300,9 +602,10 @@ void Training::dump_debug(OutputChunker& outchunk) {
     outchunk.append(debug_str);
 }
 
-void Training::process_game(GameState& state, size_t& train_pos, int who_won,
-                            const std::vector<int>& tree_moves,
-                            OutputChunker& outchunker) {
+std::string Training::process_game(GameState& state, size_t& train_pos,
+                                   int who_won,
+                                   const std::vector<int>& tree_moves,
+                                   bool binary) {
     clear_training();
     auto counter = size_t{0};
     state.rewind();
@@ -316,7 +619,8 @@ void Training::process_game(GameState& state, size_t& train_pos, int who_won,
         if (!state.is_move_legal(to_move, move_vertex)) {
             std::cout << "Mainline move not found: " << move_vertex
                       << std::endl;
-            return;
+            clear_training();
+            return {};
         }
 
         if (move_vertex != FastBoard::PASS) {
@@ -334,67 +638,119 @@ void Training::process_game(GameState& state, size_t& train_pos, int who_won,
         step.probabilities.resize(POTENTIAL_MOVES);
         step.probabilities[move_idx] = 1.0f;
 
-        train_pos++;
         m_data.emplace_back(step);
 
         counter++;
     } while (state.forward_move() && counter < tree_moves.size());
 
-    dump_training(who_won, outchunker);
+    train_pos += m_data.size();
+    return format_training(who_won, binary);
+}
+
+std::string Training::process_sgf(boost::string_ref sgf, size_t& train_pos,
+                                  bool binary) {
+    auto sgftree = std::make_unique<SGFTree>();
+    try {
+        sgftree->load_from_string(sgf, true);
+    } catch (...) {
+        return {};
+    };
+
+    auto tree_moves = sgftree->get_mainline();
+    // Empty game or couldn't be parsed?
+    if (tree_moves.size() == 0) {
+        return {};
+    }
+
+    auto who_won = sgftree->get_winner();
+    // Accept all komis and handicaps, but reject no usable result
+    if (who_won != FastBoard::BLACK && who_won != FastBoard::WHITE) {
+        return {};
+    }
+
+    auto state =
+        std::make_unique<GameState>(sgftree->follow_mainline_state());
+    // Our board size is hardcoded in several places
+    if (state->board.get_boardsize() != BOARD_SIZE) {
+        return {};
+    }
+
+    return process_game(*state, train_pos, who_won, tree_moves, binary);
 }
 
 void Training::dump_supervised(const std::string& sgf_name,
                                const std::string& out_filename) {
-    auto outchunker = OutputChunker{out_filename, true};
-    auto games = SGFParser::chop_all(sgf_name);
-    auto gametotal = games.size();
-    auto train_pos = size_t{0};
+    std::unique_ptr<SGFBuffer> sgf_buffer;
+    try {
+        sgf_buffer = std::make_unique<SGFBuffer>(sgf_name);
+    } catch (const std::exception&) {
+        Utils::myprintf("Error opening %s\n", sgf_name.c_str());
+        return;
+    }
 
-    std::cout << "Total games in file: " << gametotal << std::endl;
-    // Shuffle games around
-    std::cout << "Shuffling...";
-    std::shuffle(begin(games), end(games), Random::get_Rng());
-    std::cout << "done." << std::endl;
+    OutputChunker outchunker{out_filename, true,
+                             cfg_training_compression, cfg_training_binary};
+    auto binary = outchunker.is_binary();
+    auto num_workers = std::max(1, cfg_num_threads);
+    SGFBatchQueue queue{size_t(2 * num_workers)};
+    std::mutex output_mutex;
+    auto gamecount = size_t{0};
+    auto train_pos = size_t{0};
 
+    // Games are read, shuffled per batch and handed to the workers. Each
+    // worker replays its games and appends them to the chunker as they
+    // finish, so chunks are in no particular order.
     Time start;
-    for (auto gamecount = size_t{0}; gamecount < gametotal; gamecount++) {
-        auto sgftree = std::make_unique<SGFTree>();
-        try {
-            sgftree->load_from_string(games[gamecount]);
-        } catch (...) {
-            continue;
-        };
-
-        if (gamecount > 0 && gamecount % 1000 == 0) {
-            Time elapsed;
-            auto elapsed_s = Time::timediff_seconds(start, elapsed);
-            Utils::myprintf(
-                "Game %5d, %5d positions in %5.2f seconds -> %d pos/s\n",
-                gamecount, train_pos, elapsed_s, int(train_pos / elapsed_s));
-        }
-
-        auto tree_moves = sgftree->get_mainline();
-        // Empty game or couldn't be parsed?
-        if (tree_moves.size() == 0) {
-            continue;
+    auto worker = [&]() {
+        auto batch = SGFBatch{};
+        while (queue.pop(batch)) {
+            for (const auto& sgf : batch.games) {
+                auto positions = size_t{0};
+                auto training_str = process_sgf(sgf, positions, binary);
+
+                std::lock_guard<std::mutex> lock(output_mutex);
+                if (!training_str.empty()) {
+                    outchunker.append(training_str);
+                }
+                train_pos += positions;
+                gamecount++;
+                if (gamecount % 1000 == 0) {
+                    Time elapsed;
+                    auto elapsed_s = Time::timediff_seconds(start, elapsed);
+                    Utils::myprintf("Game %5d, %5d positions in %5.2f "
+                                    "seconds -> %d pos/s\n",
+                                    gamecount, train_pos, elapsed_s,
+                                    int(train_pos / elapsed_s));
+                }
+            }
         }
+    };
 
-        auto who_won = sgftree->get_winner();
-        // Accept all komis and handicaps, but reject no usable result
-        if (who_won != FastBoard::BLACK && who_won != FastBoard::WHITE) {
-            continue;
-        }
+    auto workers = std::vector<std::thread>{};
+    for (auto i = 0; i < num_workers; i++) {
+        workers.emplace_back(worker);
+    }
 
-        auto state =
-            std::make_unique<GameState>(sgftree->follow_mainline_state());
-        // Our board size is hardcoded in several places
-        if (state->board.get_boardsize() != BOARD_SIZE) {
-            continue;
+    auto batch = SGFBatch{};
+    auto game = boost::string_ref{};
+    auto pos = sgf_buffer->begin();
+    while (SGFParser::chop_next(pos, sgf_buffer->end(), game)) {
+        batch.games.emplace_back(game);
+        if (batch.games.size() == SUPERVISED_BATCH) {
+            std::shuffle(begin(batch.games), end(batch.games),
+                         Random::get_Rng());
+            queue.push(std::move(batch));
+            batch = SGFBatch{};
         }
+    }
+    std::shuffle(begin(batch.games), end(batch.games), Random::get_Rng());
+    queue.push(std::move(batch));
+    queue.close();
 
-        process_game(*state, train_pos, who_won, tree_moves,
-                    outchunker);
+    for (auto& thread : workers) {
+        thread.join();
     }
 
+    std::cout << "Total games in file: " << gamecount << std::endl;
     std::cout << "Dumped " << train_pos << " training positions." << std::endl;
 }
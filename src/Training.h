@@ -23,9 +23,15 @@
 
 #include <bitset>
 #include <cstddef>
+#include <future>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
+#include <boost/utility/string_ref.hpp>
 
 #include "GameState.h"
 #include "Network.h"
@@ -49,20 +55,32 @@ std::istream& operator>> (std::istream& stream, TimeStep& timestep);
 
 class OutputChunker {
 public:
-    OutputChunker(const std::string& basename, bool compress = false);
+    OutputChunker(const std::string& basename, bool compress = false,
+                  int level = 9, bool binary = false);
     ~OutputChunker();
     void append(const std::string& str);
+    // Starts writing the games appended so far as a chunk, without
+    // waiting for CHUNK_SIZE games.
+    void flush_chunks();
+    bool is_binary() const { return m_binary; }
 
     // Group this many games in a batch.
     static constexpr size_t CHUNK_SIZE = 32;
 private:
     std::string gen_chunk_name() const;
-    void flush_chunks();
+    void wait_writer();
+    void write_chunk(const std::string& buffer,
+                     const std::string& chunk_name,
+                     size_t chunk_count) const;
     size_t m_game_count{0};
     size_t m_chunk_count{0};
     std::string m_buffer;
     std::string m_basename;
     bool m_compress{false};
+    int m_level{9};
+    bool m_binary{false};
+    // Compression runs here so the game thread can carry on.
+    std::future<void> m_writer;
 };
 
 class Training {
@@ -70,25 +88,74 @@ public:
     static void clear_training();
     static void dump_training(int winner_color,
                               const std::string& out_filename);
+    static void dump_training(int winner_color,
+                              OutputChunker& outchunker);
     static void dump_debug(const std::string& out_filename);
-    static void record(Network & network, GameState& state, UCTNode& node);
+    // dump_training and dump_debug with a filename return before the
+    // data is compressed. This waits until all of it is on disk.
+    static void finish_output();
+    static void record(GameState& state, UCTNode& node);
+    // Describes the search for the move played from this state, for
+    // the SGF. Used for playout cap randomization, where only full
+    // searches are recorded as training data.
+    static void record_search(const GameState& state,
+                              const std::string& comment);
+    // Comment for the search from the position after movenum moves,
+    // empty if there is none.
+    static std::string search_comment(size_t movenum);
 
     static void dump_supervised(const std::string& sgf_file,
                                 const std::string& out_filename);
+    // SGF games are handed to the workers in batches of this many.
+    static constexpr size_t SUPERVISED_BATCH = 64;
+    static std::pair<bool, std::string> convert_training(
+        const std::string& in_filename, const std::string& out_basename);
     static void save_training(const std::string& filename);
     static void load_training(const std::string& filename);
 
+    // Binary chunks are a sequence of fixed-size records: a version byte,
+    // the 16 input planes packed 8 points per byte (first point in the
+    // high bit), the side to move, POTENTIAL_MOVES little-endian fp16
+    // probabilities and the game result for the side to move (+1 won,
+    // -1 lost, 0 draw) as a signed byte.
+    // Record n starts at byte n * BINARY_RECORD_SIZE.
+    static constexpr auto BINARY_VERSION = 2;
+    static constexpr auto TRAINING_PLANES = size_t{16};
+    static constexpr auto PLANE_BYTES = size_t{(NUM_INTERSECTIONS + 7) / 8};
+    static constexpr auto BINARY_RECORD_SIZE =
+        1 + TRAINING_PLANES * PLANE_BYTES + 1 + 2 * POTENTIAL_MOVES + 1;
+
 private:
+    static void append_text_record(std::string& out, const TimeStep& step,
+                                   int winner_color);
+    static void append_binary_record(std::string& out, const TimeStep& step,
+                                     int winner_color);
+    static bool parse_text_record(std::istream& in, TimeStep& step,
+                                  int& winner_color);
+    static bool parse_binary_record(const char* data, TimeStep& step,
+                                    int& winner_color);
     static TimeStep::NNPlanes get_planes(const GameState* const state);
-    static void process_game(GameState& state, size_t& train_pos, int who_won,
-                             const std::vector<int>& tree_moves,
-                             OutputChunker& outchunker);
-    static void dump_training(int winner_color,
-                              OutputChunker& outchunker);
+    static std::string format_training(int winner_color, bool binary);
+    static std::string process_game(GameState& state, size_t& train_pos,
+                                    int who_won,
+                                    const std::vector<int>& tree_moves,
+                                    bool binary);
+    static std::string process_sgf(boost::string_ref sgf, size_t& train_pos,
+                                   bool binary);
     static void dump_debug(OutputChunker& outchunker);
+    static OutputChunker& get_chunker(const std::string& filename,
+                                      bool binary);
     static void save_training(std::ofstream& out);
     static void load_training(std::ifstream& in);
-    static std::vector<TimeStep> m_data;
+    // Per thread, so several games can be recorded at once.
+    static thread_local std::vector<TimeStep> m_data;
+    // Move number and comment for every search of this game.
+    static thread_local std::vector<std::pair<size_t, std::string>>
+        m_searches;
+    // Chunkers of dump_training and dump_debug by file name. They live
+    // until finish_output, so compression doesn't hold up the game.
+    static std::mutex m_chunkers_mutex;
+    static std::map<std::string, std::unique_ptr<OutputChunker>> m_chunkers;
 };
 
 #endif
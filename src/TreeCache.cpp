@@ -0,0 +1,74 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "TreeCache.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "UCTNodePointer.h"
+
+TreeCache::Entry TreeCache::make_entry(const GameState& state) {
+    return Entry{state.board.get_hash(), state.get_history_hash(),
+                 state.get_komi(), nullptr};
+}
+
+void TreeCache::insert(const GameState& state,
+                       std::unique_ptr<UCTNode> root) {
+    if (!root || !root->has_children()) {
+        return;
+    }
+    // Replace any tree for the same position, the new one is fresher.
+    take(state);
+
+    auto entry = make_entry(state);
+    entry.root = std::move(root);
+    m_entries.emplace_back(std::move(entry));
+
+    while (m_entries.size() > MAX_TREES) {
+        m_entries.pop_front();
+    }
+}
+
+std::unique_ptr<UCTNode> TreeCache::take(const GameState& state) {
+    const auto key = make_entry(state);
+    auto it = std::find_if(begin(m_entries), end(m_entries),
+        [&key](const auto& entry) {
+            return entry.hash == key.hash
+                && entry.history_hash == key.history_hash
+                && entry.komi == key.komi;
+        });
+    if (it == end(m_entries)) {
+        return nullptr;
+    }
+    auto root = std::move(it->root);
+    m_entries.erase(it);
+    return root;
+}
+
+void TreeCache::trim(const std::atomic<size_t>& tree_size,
+                     const size_t max_tree_size) {
+    while (!m_entries.empty() && tree_size > max_tree_size) {
+        m_entries.pop_front();
+    }
+}
+
+void TreeCache::clear() {
+    m_entries.clear();
+}
@@ -0,0 +1,67 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TREECACHE_H_INCLUDED
+#define TREECACHE_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+
+#include "GameState.h"
+#include "UCTNode.h"
+
+/*
+    Search trees that were discarded because the root moved somewhere
+    that is not reachable by playing forward (undo, switching variations,
+    loadsgf). Navigating back to such a position re-attaches the tree.
+    Trees are keyed by position, side to move, komi and the position
+    history (for superko), and the oldest trees are dropped first.
+*/
+class TreeCache {
+public:
+    static constexpr size_t MAX_TREES = 16;
+
+    void insert(const GameState& state, std::unique_ptr<UCTNode> root);
+    // Removes the tree for this state from the cache and returns it,
+    // or nullptr if there is none.
+    std::unique_ptr<UCTNode> take(const GameState& state);
+    // Drops trees until tree_size, the memory of all trees of the
+    // owning search, is at most max_tree_size or the cache is empty.
+    void trim(const std::atomic<size_t>& tree_size, size_t max_tree_size);
+    void clear();
+
+    size_t size() const { return m_entries.size(); }
+
+private:
+    struct Entry {
+        std::uint64_t hash;
+        std::uint64_t history_hash;
+        float komi;
+        std::unique_ptr<UCTNode> root;
+    };
+
+    static Entry make_entry(const GameState& state);
+
+    std::deque<Entry> m_entries;
+};
+
+#endif
@@ -22,11 +22,16 @@
 #include <cstdio>
 #include <cstdint>
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <condition_variable>
 #include <functional>
+#include <istream>
 #include <iterator>
 #include <limits>
+#include <mutex>
 #include <numeric>
+#include <ostream>
 #include <utility>
 #include <vector>
 
@@ -36,10 +41,28 @@
 #include "GTP.h"
 #include "GameState.h"
 #include "Network.h"
+#include "Profile.h"
 #include "Utils.h"
 
 using namespace Utils;
 
+namespace {
+    // Threads waiting for another thread's expansion park here instead
+    // of spinning. Nodes share slots by address so UCTNode stays small.
+    struct ExpandWaiters {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::atomic<int> count{0};
+    };
+    std::array<ExpandWaiters, 64> s_expand_waiters;
+
+    ExpandWaiters& expand_waiters(const UCTNode* node) {
+        const auto addr = reinterpret_cast<std::uintptr_t>(node);
+        return s_expand_waiters[(addr / sizeof(UCTNode))
+                                % s_expand_waiters.size()];
+    }
+}
+
 UCTNode::UCTNode(int vertex, float policy) : m_move(vertex), m_policy(policy) {
 }
 
@@ -59,6 +82,7 @@ bool UCTNode::create_children(Network & network,
 
     // acquire the lock
     if (!acquire_expanding()) {
+        Profile::count(Profile::EXPAND_CONTENTION);
         return false;
     }
 
@@ -108,7 +132,10 @@ bool UCTNode::create_children(Network & network,
         }
     }
 
-    link_nodelist(nodecount, nodelist, min_psa_ratio);
+    {
+        Profile::Scope link{Profile::LINK_CHILDREN};
+        link_nodelist(nodecount, nodelist, min_psa_ratio);
+    }
     expand_done();
     return true;
 }
@@ -161,11 +188,11 @@ int UCTNode::get_move() const {
 }
 
 void UCTNode::virtual_loss() {
-    m_virtual_loss += VIRTUAL_LOSS_COUNT;
+    m_virtual_loss += cfg_virtual_loss;
 }
 
 void UCTNode::virtual_loss_undo() {
-    m_virtual_loss -= VIRTUAL_LOSS_COUNT;
+    m_virtual_loss -= cfg_virtual_loss;
 }
 
 void UCTNode::update(float eval) {
@@ -173,6 +200,11 @@ void UCTNode::update(float eval) {
     accumulate_eval(eval);
 }
 
+void UCTNode::merge_stats(int visits, double blackevals) {
+    m_visits += visits;
+    atomic_add(m_blackevals, blackevals);
+}
+
 bool UCTNode::has_children() const {
     return m_min_psa_ratio_children <= 1.0f;
 }
@@ -265,7 +297,7 @@ UCTNode* UCTNode::uct_select_child(int color, bool is_root) {
         }
 
         auto winrate = fpu_eval;
-        if (child.is_inflated() && child->m_expand_state.load() == ExpandState::EXPANDING) {
+        if (child.is_inflated() && child->expanding()) {
             // Someone else is expanding this node, never select it
             // if we can avoid so, because we'd block on it.
             winrate = -1.0f - fpu_reduction;
@@ -342,6 +374,108 @@ size_t UCTNode::count_nodes_and_clear_expand_state() {
     return nodecount;
 }
 
+void UCTNode::deflate_children(const int max_visits) {
+    for (auto& child : m_children) {
+        if (!child.is_inflated()) {
+            continue;
+        }
+        // Keep invalid (superko) nodes, they have no subtree anyway.
+        if (!child->valid()) {
+            continue;
+        }
+        if (child->get_visits() == 0) {
+            // Nothing but the policy, which the pointer keeps.
+            child.deflate();
+        } else if (child->get_visits() <= max_visits) {
+            // Keep N and Q so the parent's statistics stay consistent.
+            child->collapse();
+        } else {
+            child->deflate_children(max_visits);
+        }
+    }
+}
+
+void UCTNode::collapse() {
+    // Drop the whole subtree but keep our own statistics. The node
+    // becomes expandable again, so the next visit will re-link the
+    // children (usually straight from the NNCache).
+    m_children.clear();
+    m_children.shrink_to_fit();
+    m_min_psa_ratio_children = 2.0f;
+    m_expand_state = ExpandState::INITIAL;
+}
+
+template<typename T>
+static void write_value(std::ostream& out, const T value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+static bool read_value(std::istream& in, T& value) {
+    return bool(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+void UCTNode::save_tree(std::ostream& out) const {
+    write_value(out, std::int32_t(m_visits));
+    write_value(out, m_policy);
+    write_value(out, m_net_eval);
+    write_value(out, double(m_blackevals));
+    write_value(out, std::uint8_t(m_status.load()));
+    write_value(out, std::uint8_t(
+        m_expand_state == ExpandState::EXPANDED ? 1 : 0));
+    write_value(out, float(m_min_psa_ratio_children));
+    write_value(out, std::uint32_t(m_children.size()));
+
+    for (const auto& child : m_children) {
+        write_value(out, std::uint8_t(child.is_inflated() ? 1 : 0));
+        write_value(out, std::int16_t(child.get_move()));
+        write_value(out, child.get_policy());
+        if (child.is_inflated()) {
+            child->save_tree(out);
+        }
+    }
+}
+
+bool UCTNode::load_tree(std::istream& in) {
+    std::int32_t visits;
+    double blackevals;
+    std::uint8_t status, expanded;
+    float min_psa_ratio;
+    std::uint32_t children;
+    if (!read_value(in, visits) || !read_value(in, m_policy)
+        || !read_value(in, m_net_eval) || !read_value(in, blackevals)
+        || !read_value(in, status) || !read_value(in, expanded)
+        || !read_value(in, min_psa_ratio) || !read_value(in, children)
+        || status > ACTIVE || children > NUM_INTERSECTIONS + 1) {
+        return false;
+    }
+    m_visits = visits;
+    m_blackevals = blackevals;
+    m_status = Status(status);
+    m_min_psa_ratio_children = min_psa_ratio;
+
+    m_children.clear();
+    m_children.reserve(children);
+    for (auto i = std::uint32_t{0}; i < children; i++) {
+        std::uint8_t inflated;
+        std::int16_t move;
+        float policy;
+        if (!read_value(in, inflated) || !read_value(in, move)
+            || !read_value(in, policy)) {
+            return false;
+        }
+        m_children.emplace_back(move, policy);
+        if (inflated) {
+            m_children.back().inflate();
+            if (!m_children.back()->load_tree(in)) {
+                return false;
+            }
+        }
+    }
+    m_expand_state = expanded ? ExpandState::EXPANDED : ExpandState::INITIAL;
+    return true;
+}
+
 void UCTNode::invalidate() {
     m_status = INVALID;
 }
@@ -372,6 +506,7 @@ void UCTNode::expand_done() {
     (void)v;
 #endif
     assert(v == ExpandState::EXPANDING);
+    notify_expanded();
 }
 void UCTNode::expand_cancel() {
     auto v = m_expand_state.exchange(ExpandState::INITIAL);
@@ -379,9 +514,35 @@ void UCTNode::expand_cancel() {
     (void)v;
 #endif
     assert(v == ExpandState::EXPANDING);
+    notify_expanded();
+}
+void UCTNode::notify_expanded() {
+    // Waiters count themselves before checking the state, so either
+    // they see the new state or we see them.
+    auto& waiters = expand_waiters(this);
+    if (waiters.count.load() > 0) {
+        std::lock_guard<std::mutex> lock(waiters.mutex);
+        waiters.cv.notify_all();
+    }
+}
+bool UCTNode::expanding() const {
+    return m_expand_state.load() == ExpandState::EXPANDING;
+}
+void UCTNode::wait_expansion() {
+    if (!expanding()) {
+        return;
+    }
+    Profile::Scope wait{Profile::EXPAND_WAIT};
+    auto& waiters = expand_waiters(this);
+    waiters.count++;
+    {
+        std::unique_lock<std::mutex> lock(waiters.mutex);
+        waiters.cv.wait(lock, [this] { return !expanding(); });
+    }
+    waiters.count--;
 }
 void UCTNode::wait_expanded() {
-    while (m_expand_state.load() == ExpandState::EXPANDING) {}
+    wait_expansion();
     auto v = m_expand_state.load();
 #ifdef NDEBUG
     (void)v;
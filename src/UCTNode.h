@@ -22,6 +22,7 @@
 #include "config.h"
 
 #include <atomic>
+#include <iosfwd>
 #include <memory>
 #include <vector>
 #include <cassert>
@@ -36,7 +37,7 @@ class UCTNode {
 public:
     // When we visit a node, add this amount of virtual losses
     // to it to encourage other CPUs to explore other parts of the
-    // search tree.
+    // search tree. Default for cfg_virtual_loss.
     static constexpr auto VIRTUAL_LOSS_COUNT = 3;
     // Defined in UCTNode.cpp
     explicit UCTNode(int vertex, float policy);
@@ -54,9 +55,21 @@ public:
     UCTNode* uct_select_child(int color, bool is_root);
 
     size_t count_nodes_and_clear_expand_state();
+    void deflate_children(int max_visits);
+    void collapse();
+
+    // Binary (native byte order) dump of this node and its subtree,
+    // written and read depth first so no second copy is needed.
+    // Not thread-safe: the search must be stopped.
+    void save_tree(std::ostream& out) const;
+    bool load_tree(std::istream& in);
     bool first_visit() const;
     bool has_children() const;
     bool expandable(const float min_psa_ratio = 0.0f) const;
+    // True while another thread is creating the children.
+    bool expanding() const;
+    // Blocks until no thread is expanding this node.
+    void wait_expansion();
     void invalidate();
     void set_active(const bool active);
     bool valid() const;
@@ -71,12 +84,15 @@ public:
     void virtual_loss();
     void virtual_loss_undo();
     void update(float eval);
+    // Adds visits and evaluations found by another tree for this move.
+    void merge_stats(int visits, double blackevals);
+    double get_blackevals() const;
 
     // Defined in UCTNodeRoot.cpp, only to be called on m_root in UCTSearch
     void randomize_first_proportionally();
     void prepare_root_node(Network & network, int color,
                            std::atomic<int>& nodecount,
-                           GameState& state);
+                           GameState& state, bool add_noise = true);
 
     UCTNode* get_first_child() const;
     UCTNode* get_nopass_child(FastState& state) const;
@@ -93,7 +109,6 @@ private:
     void link_nodelist(std::atomic<int>& nodecount,
                        std::vector<Network::PolicyVertexPair>& nodelist,
                        float min_psa_ratio);
-    double get_blackevals() const;
     void accumulate_eval(float eval);
     void kill_superkos(const KoState& state);
     void dirichlet_noise(float epsilon, float alpha);
@@ -148,6 +163,9 @@ private:
 
     // wait until we are on EXPANDED state
     void wait_expanded();
+
+    // wake threads in wait_expansion()
+    void notify_expanded();
 };
 
 #endif
@@ -26,6 +26,7 @@
 #include "UCTNode.h"
 
 std::atomic<size_t> UCTNodePointer::m_tree_size = {0};
+thread_local std::atomic<size_t>* UCTNodePointer::t_account = nullptr;
 
 size_t UCTNodePointer::get_tree_size() {
     return m_tree_size.load();
@@ -33,11 +34,18 @@ size_t UCTNodePointer::get_tree_size() {
 
 void UCTNodePointer::increment_tree_size(size_t sz) {
     m_tree_size += sz;
+    if (t_account) {
+        *t_account += sz;
+    }
 }
 
 void UCTNodePointer::decrement_tree_size(size_t sz) {
     assert(UCTNodePointer::m_tree_size >= sz);
     m_tree_size -= sz;
+    if (t_account) {
+        assert(*t_account >= sz);
+        *t_account -= sz;
+    }
 }
 
 UCTNodePointer::~UCTNodePointer() {
@@ -61,13 +69,18 @@ UCTNodePointer::UCTNodePointer(UCTNodePointer&& n) {
     increment_tree_size(sizeof(UCTNodePointer));
 }
 
-UCTNodePointer::UCTNodePointer(std::int16_t vertex, float policy) {
+std::uint64_t UCTNodePointer::pack_uninflated(std::int16_t vertex,
+                                              float policy) {
     std::uint32_t i_policy;
     auto i_vertex = static_cast<std::uint16_t>(vertex);
     std::memcpy(&i_policy, &policy, sizeof(i_policy));
 
-    m_data =  (static_cast<std::uint64_t>(i_policy)  << 32)
-            | (static_cast<std::uint64_t>(i_vertex) << 16);
+    return  (static_cast<std::uint64_t>(i_policy)  << 32)
+          | (static_cast<std::uint64_t>(i_vertex) << 16);
+}
+
+UCTNodePointer::UCTNodePointer(std::int16_t vertex, float policy) {
+    m_data = pack_uninflated(vertex, policy);
     increment_tree_size(sizeof(UCTNodePointer));
 }
 
@@ -88,6 +101,13 @@ UCTNode * UCTNodePointer::release() {
     return read_ptr(v);
 }
 
+UCTNode * UCTNodePointer::detach() {
+    auto node = read_ptr(m_data.load());
+    m_data = pack_uninflated(node->get_move(), node->get_policy());
+    decrement_tree_size(sizeof(UCTNode));
+    return node;
+}
+
 void UCTNodePointer::inflate() const {
     while (true) {
         auto v = m_data.load();
@@ -108,6 +128,16 @@ void UCTNodePointer::inflate() const {
     }
 }
 
+void UCTNodePointer::deflate() const {
+    auto v = m_data.load();
+    if (!is_inflated(v)) return;
+
+    auto node = read_ptr(v);
+    m_data = pack_uninflated(node->get_move(), node->get_policy());
+    decrement_tree_size(sizeof(UCTNode));
+    delete node;
+}
+
 bool UCTNodePointer::valid() const {
     auto v = m_data.load();
     if (is_inflated(v)) return read_ptr(v)->valid();
@@ -49,6 +49,8 @@ private:
     static constexpr std::uint64_t UNINFLATED = 0;
 
     static std::atomic<size_t> m_tree_size;
+    // See AccountScope, nullptr if none is active.
+    static thread_local std::atomic<size_t>* t_account;
     static void increment_tree_size(size_t sz);
     static void decrement_tree_size(size_t sz);
 
@@ -84,9 +86,30 @@ private:
         return (v & 3ULL) == POINTER;
     }
 
+    static std::uint64_t pack_uninflated(std::int16_t vertex, float policy);
+
 public:
+    // Total for all trees in the process.
     static size_t get_tree_size();
 
+    // While alive, tree memory this thread allocates or frees is also
+    // added to or subtracted from account, so that every search can
+    // keep track of its own trees.
+    class AccountScope {
+    public:
+        explicit AccountScope(std::atomic<size_t>& account)
+            : m_previous(t_account) {
+            t_account = &account;
+        }
+        ~AccountScope() {
+            t_account = m_previous;
+        }
+        AccountScope(const AccountScope&) = delete;
+        AccountScope& operator=(const AccountScope&) = delete;
+    private:
+        std::atomic<size_t>* m_previous;
+    };
+
     ~UCTNodePointer();
     UCTNodePointer(UCTNodePointer&& n);
     UCTNodePointer(std::int16_t vertex, float policy);
@@ -109,10 +132,18 @@ public:
     }
     UCTNodePointer& operator=(UCTNodePointer&& n);
     UCTNode * release();
+    // like release(), but leaves the vertex/policy pair behind, so the
+    // parent still has a valid (unvisited) child for this move.
+    UCTNode * detach();
 
     // construct UCTNode instance from the vertex/policy pair
     void inflate() const;
 
+    // destroy the UCTNode instance (and its subtree), going back to
+    // the vertex/policy pair.  Not thread-safe: no other thread may
+    // be accessing the subtree.
+    void deflate() const;
+
     // proxy of UCTNode methods which can be called without
     // constructing UCTNode
     bool valid() const;
@@ -157,13 +157,14 @@ UCTNode* UCTNode::get_nopass_child(FastState& state) const {
     return nullptr;
 }
 
-// Used to find new root in UCTSearch.
+// Used to find new root in UCTSearch. The rest of the tree stays
+// usable, the child is replaced by an unvisited one.
 std::unique_ptr<UCTNode> UCTNode::find_child(const int move) {
     for (auto& child : m_children) {
         if (child.get_move() == move) {
              // no guarantee that this is a non-inflated node
             child.inflate();
-            return std::unique_ptr<UCTNode>(child.release());
+            return std::unique_ptr<UCTNode>(child.detach());
         }
     }
 
@@ -179,7 +180,7 @@ void UCTNode::inflate_all_children() {
 
 void UCTNode::prepare_root_node(Network & network, int color,
                                 std::atomic<int>& nodes,
-                                GameState& root_state) {
+                                GameState& root_state, bool add_noise) {
     float root_eval;
     const auto had_children = has_children();
     if (expandable()) {
@@ -201,7 +202,7 @@ void UCTNode::prepare_root_node(Network & network, int color,
     // This also removes a lot of special cases.
     kill_superkos(root_state);
 
-    if (cfg_noise) {
+    if (cfg_noise && add_noise) {
         // Adjust the Dirichlet noise's alpha constant to the board size
         auto alpha = 0.03f * 361.0f / NUM_INTERSECTIONS;
         dirichlet_noise(0.25f, alpha);
@@ -22,8 +22,11 @@
 #include <cassert>
 #include <cmath>
 #include <cstddef>
+#include <fstream>
+#include <iterator>
 #include <limits>
 #include <memory>
+#include <random>
 #include <type_traits>
 #include <algorithm>
 
@@ -32,6 +35,8 @@
 #include "FullBoard.h"
 #include "GTP.h"
 #include "GameState.h"
+#include "Profile.h"
+#include "Random.h"
 #include "TimeControl.h"
 #include "Timing.h"
 #include "Training.h"
@@ -44,9 +49,22 @@ constexpr int UCTSearch::UNLIMITED_PLAYOUTS;
 class OutputAnalysisData {
 public:
     OutputAnalysisData(const std::string& move, int visits,
-                       float winrate, float policy_prior, std::string pv)
+                       float winrate, float policy_prior, std::string pv,
+                       bool changed = true)
     : m_move(move), m_visits(visits), m_winrate(winrate),
-      m_policy_prior(policy_prior), m_pv(pv) {};
+      m_policy_prior(policy_prior), m_pv(pv), m_changed(changed) {};
+
+    bool changed() const {
+        return m_changed;
+    }
+
+    void set_changed() {
+        m_changed = true;
+    }
+
+    const std::string& get_move() const {
+        return m_move;
+    }
 
     std::string get_info_string(int order) const {
         auto tmp = "info move " + m_move
@@ -76,15 +94,28 @@ private:
     float m_winrate;
     float m_policy_prior;
     std::string m_pv;
+    bool m_changed;
 };
 
 
+std::atomic<int> UCTSearch::s_active_searches{0};
+std::atomic<int> UCTSearch::s_searches{0};
+
 UCTSearch::UCTSearch(GameState& g, Network& network)
-    : m_rootstate(g), m_network(network) {
+    : m_rootstate(g), m_delete_tasks(thread_pool), m_network(network) {
     set_playout_limit(cfg_max_playouts);
     set_visit_limit(cfg_max_visits);
 
     m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    s_searches++;
+}
+
+UCTSearch::~UCTSearch() {
+    s_searches--;
+}
+
+size_t UCTSearch::max_tree_size() const {
+    return cfg_max_tree_size / std::max(1, s_searches.load());
 }
 
 bool UCTSearch::advance_to_new_rootstate() {
@@ -94,6 +125,7 @@ bool UCTSearch::advance_to_new_rootstate() {
     }
 
     if (m_rootstate.get_komi() != m_last_rootstate->get_komi()) {
+        stash_root();
         return false;
     }
 
@@ -101,6 +133,7 @@ bool UCTSearch::advance_to_new_rootstate() {
         int(m_rootstate.get_movenum() - m_last_rootstate->get_movenum());
 
     if (depth < 0) {
+        stash_root();
         return false;
     }
 
@@ -112,33 +145,25 @@ bool UCTSearch::advance_to_new_rootstate() {
 
     if (m_last_rootstate->board.get_hash() != test->board.get_hash()) {
         // m_rootstate and m_last_rootstate don't match
+        stash_root();
         return false;
     }
 
     // Make sure that the nodes we destroyed the previous move are
     // in fact destroyed.
-    while (!m_delete_futures.empty()) {
-        m_delete_futures.front().wait_all();
-        m_delete_futures.pop_front();
-    }
+    m_delete_tasks.wait_all();
 
     // Try to replay moves advancing m_root
     for (auto i = 0; i < depth; i++) {
-        ThreadGroup tg(thread_pool);
-
         test->forward_move();
         const auto move = test->get_last_move();
 
         auto oldroot = std::move(m_root);
         m_root = oldroot->find_child(move);
 
-        // Lazy tree destruction.  Instead of calling the destructor of the
-        // old root node on the main thread, send the old root to a separate
-        // thread and destroy it from the child thread.  This will save a
-        // bit of time when dealing with large trees.
-        auto p = oldroot.release();
-        tg.add_task([p]() { delete p; });
-        m_delete_futures.push_back(std::move(tg));
+        // Keep the rest of the old tree, undo or switching to another
+        // variation can come back to this position.
+        stash_tree(*m_last_rootstate, std::move(oldroot));
 
         if (!m_root) {
             // Tree hasn't been expanded this far
@@ -151,22 +176,108 @@ bool UCTSearch::advance_to_new_rootstate() {
 
     if (m_last_rootstate->board.get_hash() != test->board.get_hash()) {
         // Can happen if user plays multiple moves in a row by same player
+        stash_root();
         return false;
     }
 
     return true;
 }
 
+void UCTSearch::stash_root() {
+    if (!m_root || !m_last_rootstate) {
+        return;
+    }
+    stash_tree(*m_last_rootstate, std::move(m_root));
+}
+
+void UCTSearch::stash_tree(const GameState& state,
+                           std::unique_ptr<UCTNode> root) {
+    m_tree_cache.insert(state, std::move(root));
+    m_tree_cache.trim(m_tree_size, size_t(TREE_CACHE_RATIO * max_tree_size()));
+}
+
+// Tree files start with this, followed by the root position's hash,
+// history hash and komi, and then the root node (see UCTNode::save_tree).
+static const char TREE_FILE_MAGIC[8] = {'L', 'Z', 'T', 'R', 'E', 'E', '0', '1'};
+
+std::pair<bool, std::string> UCTSearch::save_tree(const std::string& filename) {
+    UCTNodePointer::AccountScope account(m_tree_size);
+    // Bring the tree to the current position, like a search would.
+    update_root();
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        return {false, "cannot open " + filename};
+    }
+    const auto hash = m_rootstate.board.get_hash();
+    const auto history_hash = m_rootstate.get_history_hash();
+    const auto komi = m_rootstate.get_komi();
+    out.write(TREE_FILE_MAGIC, sizeof(TREE_FILE_MAGIC));
+    out.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+    out.write(reinterpret_cast<const char*>(&history_hash), sizeof(history_hash));
+    out.write(reinterpret_cast<const char*>(&komi), sizeof(komi));
+    m_root->save_tree(out);
+
+    m_last_rootstate = std::make_unique<GameState>(m_rootstate);
+    if (!out) {
+        return {false, "error writing " + filename};
+    }
+    return {true, std::to_string(m_nodes) + " nodes"};
+}
+
+std::pair<bool, std::string> UCTSearch::load_tree(const std::string& filename) {
+    UCTNodePointer::AccountScope account(m_tree_size);
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        return {false, "cannot open " + filename};
+    }
+    char magic[sizeof(TREE_FILE_MAGIC)];
+    std::uint64_t hash, history_hash;
+    float komi;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&hash), sizeof(hash));
+    in.read(reinterpret_cast<char*>(&history_hash), sizeof(history_hash));
+    in.read(reinterpret_cast<char*>(&komi), sizeof(komi));
+    if (!in || !std::equal(std::begin(magic), std::end(magic),
+                           std::begin(TREE_FILE_MAGIC))) {
+        return {false, "not a tree file"};
+    }
+    if (hash != m_rootstate.board.get_hash()
+        || history_hash != m_rootstate.get_history_hash()
+        || komi != m_rootstate.get_komi()) {
+        return {false, "tree is for a different position"};
+    }
+
+    auto root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    if (!root->load_tree(in)) {
+        return {false, "truncated or corrupt tree file"};
+    }
+    m_root = std::move(root);
+    m_nodes = m_root->count_nodes_and_clear_expand_state();
+    // Make the next search pick up the loaded tree, and not one
+    // cached earlier for the same position.
+    m_last_rootstate = std::make_unique<GameState>(m_rootstate);
+    m_tree_cache.take(m_rootstate);
+    return {true, std::to_string(m_nodes) + " nodes"};
+}
+
 void UCTSearch::update_root() {
     // Definition of m_playouts is playouts per search call.
     // So reset this count now.
     m_playouts = 0;
+    m_tree_size_after_gc = 0;
 
 #ifndef NDEBUG
     auto start_nodes = m_root->count_nodes_and_clear_expand_state();
 #endif
 
-    if (!advance_to_new_rootstate() || !m_root) {
+    // A tree we searched earlier from exactly this position wins over
+    // whatever is left after advancing the current one.
+    auto cached_root = m_tree_cache.take(m_rootstate);
+    if (cached_root) {
+        stash_root();
+        m_root = std::move(cached_root);
+    } else if (!advance_to_new_rootstate() || !m_root) {
         m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
     }
     // Clear last_rootstate to prevent accidental use.
@@ -184,7 +295,7 @@ void UCTSearch::update_root() {
 }
 
 float UCTSearch::get_min_psa_ratio() const {
-    const auto mem_full = UCTNodePointer::get_tree_size() / static_cast<float>(cfg_max_tree_size);
+    const auto mem_full = m_tree_size / static_cast<float>(max_tree_size());
     // If we are halfway through our memory budget, start trimming
     // moves with very low policy priors.
     if (mem_full > 0.5f) {
@@ -210,33 +321,74 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
 
     if (node->expandable()) {
         if (currstate.get_passes() >= 2) {
-            auto score = currstate.final_score();
+            auto score = m_score_cache.final_score(currstate);
             result = SearchResult::from_score(score);
         } else {
             float eval;
             const auto had_children = node->has_children();
-            const auto success =
-                node->create_children(m_network, m_nodes, currstate, eval,
-                                      get_min_psa_ratio());
+            auto success = false;
+            {
+                Profile::Scope expand{Profile::EXPAND};
+                success = node->create_children(m_network, m_nodes,
+                                                currstate, eval,
+                                                get_min_psa_ratio());
+            }
             if (!had_children && success) {
                 result = SearchResult::from_eval(eval);
+            } else if (!success && !node->has_children()
+                       && node->expanding()) {
+                Profile::count(Profile::COLLISIONS);
+                if (cfg_collisions == collision_t::WAIT) {
+                    // Continue below the leaf once it is expanded.
+                    node->wait_expansion();
+                } else if (cfg_collisions == collision_t::RETRY) {
+                    result = SearchResult::from_collision();
+                }
             }
         }
     }
 
-    if (node->has_children() && !result.valid()) {
-        auto next = node->uct_select_child(color, node == m_root.get());
+    auto retries = 0;
+    while (node->has_children() && !result.valid()) {
+        UCTNode* next;
+        {
+            Profile::Scope select{Profile::SELECT};
+            // Each replica has its own root, all at the root position.
+            const auto is_root =
+                currstate.get_movenum() == m_rootstate.get_movenum();
+            next = node->uct_select_child(color, is_root);
+        }
         auto move = next->get_move();
 
-        currstate.play_move(move);
-        if (move != FastBoard::PASS && currstate.superko()) {
+        {
+            Profile::Scope play{Profile::PLAY_MOVE};
+            currstate.play_move(move);
+        }
+        auto superko = false;
+        if (move != FastBoard::PASS) {
+            Profile::Scope check{Profile::SUPERKO};
+            superko = currstate.superko();
+        }
+        if (superko) {
+            Profile::count(Profile::SUPERKO_REJECTS);
             next->invalidate();
         } else {
             result = play_simulation(currstate, next);
         }
+        if (!result.collision()) {
+            break;
+        }
+        // Give up here rather than making our parent retry too.
+        result = SearchResult{};
+        if (++retries > MAX_COLLISION_RETRIES) {
+            break;
+        }
+        // The leaf shows as expanding now, so selection avoids it.
+        currstate.undo_move();
     }
 
     if (result.valid()) {
+        Profile::Scope backup{Profile::BACKUP};
         node->update(result.eval());
     }
     node->virtual_loss_undo();
@@ -265,9 +417,7 @@ void UCTSearch::dump_stats(FastState & state, UCTNode & parent) {
         if (++movecount > 2 && !node->get_visits()) break;
 
         std::string move = state.move_to_text(node->get_move());
-        FastState tmpstate = state;
-        tmpstate.play_move(node->get_move());
-        std::string pv = move + " " + get_pv(tmpstate, *node);
+        std::string pv = move + " " + get_pv(state.board, *node, !color);
 
         myprintf("%4s -> %7d (V: %5.2f%%) (N: %5.2f%%) PV: %s\n",
             move.c_str(),
@@ -288,32 +438,63 @@ void UCTSearch::output_analysis(FastState & state, UCTNode & parent) {
     }
 
     const auto color = state.get_to_move();
+    auto any_changed = false;
 
     for (const auto& node : parent.get_children()) {
         // Only send variations with visits
-        if (!node->get_visits()) {
+        const auto visits = node->get_visits();
+        if (!visits) {
             continue;
         }
-        std::string move = state.move_to_text(node->get_move());
-        FastState tmpstate = state;
-        tmpstate.play_move(node->get_move());
-        std::string pv = move + " " + get_pv(tmpstate, *node);
-        auto move_eval = node->get_visits() ? node->get_raw_eval(color) : 0.0f;
-        auto policy = node->get_policy();
+        // The PV and winrate of a child can only change when a playout
+        // went through it, so only walk the subtrees that got visits
+        // since the last line.
+        auto& cached = m_analysis_cache[node->get_move()];
+        const auto changed = cached.visits != visits;
+        if (changed) {
+            cached.visits = visits;
+            cached.eval = node->get_raw_eval(color);
+            cached.pv = state.move_to_text(node->get_move()) + " "
+                      + get_pv(state.board, *node, !color);
+            any_changed = true;
+        }
         // Store data in array
-        sortable_data.emplace_back(move, node->get_visits(),
-                                   move_eval, policy, pv);
+        sortable_data.emplace_back(state.move_to_text(node->get_move()),
+                                   visits, cached.eval, node->get_policy(),
+                                   cached.pv, changed);
     }
     // Sort array to decide order
     std::stable_sort(rbegin(sortable_data), rend(sortable_data));
 
+    // A move that moved up or down the list changed its order field.
+    for (auto i = size_t{0}; i < sortable_data.size(); i++) {
+        auto& node = sortable_data[i];
+        if (i >= m_analysis_order.size()
+            || m_analysis_order[i] != node.get_move()) {
+            node.set_changed();
+            any_changed = true;
+        }
+    }
+    m_analysis_order.clear();
+    for (const auto& node : sortable_data) {
+        m_analysis_order.emplace_back(node.get_move());
+    }
+
+    if (cfg_analyze_changed_only && !any_changed) {
+        return;
+    }
+
     auto i = 0;
+    auto first = true;
     // Output analysis data in gtp stream
     for (const auto& node : sortable_data) {
-        if (i > 0) {
-            gtp_printf_raw(" ");
+        if (!cfg_analyze_changed_only || node.changed()) {
+            if (!first) {
+                gtp_printf_raw(" ");
+            }
+            gtp_printf_raw(node.get_info_string(i).c_str());
+            first = false;
         }
-        gtp_printf_raw(node.get_info_string(i).c_str());
         i++;
     }
     gtp_printf_raw("\n");
@@ -535,31 +716,31 @@ int UCTSearch::get_best_move(passflag_t passflag) {
     return bestmove;
 }
 
-std::string UCTSearch::get_pv(FastState & state, UCTNode& parent) {
-    if (!parent.has_children()) {
-        return std::string();
-    }
-
-    if (parent.expandable()) {
-        // Not fully expanded. This means someone could expand
-        // the node while we want to traverse the children.
-        // Avoid the race conditions and don't go through the rabbit hole
-        // of trying to print things from this node.
-        return std::string();
-    }
-
-    auto& best_child = parent.get_best_root_child(state.get_to_move());
-    if (best_child.first_visit()) {
-        return std::string();
-    }
-    auto best_move = best_child.get_move();
-    auto res = state.move_to_text(best_move);
-
-    state.play_move(best_move);
+std::string UCTSearch::get_pv(const FastBoard& board, UCTNode& parent,
+                              int color) {
+    auto res = std::string();
+    auto node = &parent;
+    // Only the side to move matters for picking the best child, so
+    // there is no need to play the moves out on a copy of the board.
+    while (node->has_children()) {
+        if (node->expandable()) {
+            // Not fully expanded. This means someone could expand
+            // the node while we want to traverse the children.
+            // Avoid the race conditions and don't go through the rabbit
+            // hole of trying to print things from this node.
+            break;
+        }
 
-    auto next = get_pv(state, best_child);
-    if (!next.empty()) {
-        res.append(" ").append(next);
+        auto& best_child = node->get_best_root_child(color);
+        if (best_child.first_visit()) {
+            break;
+        }
+        if (!res.empty()) {
+            res.append(" ");
+        }
+        res.append(board.move_to_text(best_child.get_move()));
+        node = &best_child;
+        color = !color;
     }
     return res;
 }
@@ -569,31 +750,239 @@ void UCTSearch::dump_analysis(int playouts) {
         return;
     }
 
-    FastState tempstate = m_rootstate;
-    int color = tempstate.board.get_to_move();
+    int color = m_rootstate.board.get_to_move();
 
-    std::string pvstring = get_pv(tempstate, *m_root);
+    std::string pvstring = get_pv(m_rootstate.board, *m_root, color);
     float winrate = 100.0f * m_root->get_raw_eval(color);
     myprintf("Playouts: %d, Win: %5.2f%%, PV: %s\n",
              playouts, winrate, pvstring.c_str());
 }
 
+void UCTSearch::collect_garbage(ThreadGroup & tg) {
+    const auto tree_size = m_tree_size.load();
+    const auto start = size_t(GC_START_RATIO * max_tree_size());
+    const auto target = size_t(GC_TARGET_RATIO * max_tree_size());
+    // If the last collection could not get below the target, wait
+    // until the tree grew by a full collection margin again.
+    if (tree_size < std::max(start, m_tree_size_after_gc + start - target)) {
+        return;
+    }
+
+    // Deflating needs exclusive access to the tree, so park the workers.
+    m_run = false;
+    tg.wait_all();
+
+    // Trees cached for other positions go first.
+    m_tree_cache.trim(m_tree_size, target);
+
+    // Drop ever larger subtrees until we are below the target.
+    // Visited nodes keep their statistics and only lose their children,
+    // so parents and PUCT still see the same N and Q. Only unvisited
+    // nodes below the root children are deflated completely.
+    // The subtrees are disjoint, so each root child is a separate job.
+    const auto root_visits = m_root->get_visits();
+    for (auto max_visits = 1;
+         m_tree_size > target && max_visits < root_visits;
+         max_visits *= 2) {
+        for (const auto& replica : m_replicas) {
+            const auto& children = replica->root->get_children();
+            thread_pool.parallel_for(0, children.size(), [&](size_t i) {
+                UCTNodePointer::AccountScope account(m_tree_size);
+                const auto& child = children[i];
+                if (!child.is_inflated()) {
+                    return;
+                }
+                if (child->get_visits() <= max_visits && child->valid()) {
+                    child->collapse();
+                } else {
+                    child->deflate_children(max_visits);
+                }
+            });
+        }
+    }
+    m_tree_size_after_gc = m_tree_size;
+    m_nodes = 0;
+    for (const auto& replica : m_replicas) {
+        m_nodes += replica->root->count_nodes_and_clear_expand_state();
+    }
+
+    myprintf("Tree GC: %.1f -> %.1f MiB\n",
+             tree_size / (1024.0 * 1024.0),
+             m_tree_size_after_gc / (1024.0 * 1024.0));
+
+    m_run = true;
+    balance_workers(tg);
+}
+
+int UCTSearch::thread_share() {
+    const auto searches = std::max(1, s_active_searches.load());
+    return std::max(1, cfg_num_threads / searches);
+}
+
+void UCTSearch::balance_workers(ThreadGroup & tg) {
+    // The calling thread is searching too, hence the - 1.
+    const auto missing = thread_share() - 1 - m_workers;
+    if (missing <= 0) {
+        return;
+    }
+    // Top up the replicas with the fewest threads.
+    auto added = std::vector<int>(m_replicas.size(), 0);
+    for (auto i = 0; i < missing; i++) {
+        auto best = size_t{0};
+        for (auto r = size_t{1}; r < m_replicas.size(); r++) {
+            if (m_replicas[r]->workers + added[r]
+                < m_replicas[best]->workers + added[best]) {
+                best = r;
+            }
+        }
+        added[best]++;
+    }
+    for (auto r = size_t{0}; r < m_replicas.size(); r++) {
+        if (added[r] > 0) {
+            m_workers += added[r];
+            m_replicas[r]->workers += added[r];
+            tg.add_tasks(added[r], UCTWorker(m_rootstate, this,
+                                             m_replicas[r]->root, r));
+        }
+    }
+}
+
+bool UCTSearch::keep_worker(size_t replica) {
+    // Deciding and leaving is one step, so that two workers cannot
+    // both leave for a single surplus thread, or both stay.
+    auto workers = m_workers.load();
+    while (!is_running() || workers > thread_share() - 1) {
+        if (m_workers.compare_exchange_weak(workers, workers - 1)) {
+            m_replicas[replica]->workers--;
+            return false;
+        }
+    }
+    return true;
+}
+
+void UCTSearch::start_replicas(int color) {
+    const auto count = std::max(1, std::min(cfg_search_replicas,
+                                            thread_share()));
+    const auto& children = m_root->get_children();
+    m_replicas.clear();
+    for (auto r = 0; r < count; r++) {
+        auto replica = std::make_unique<Replica>();
+        if (r == 0) {
+            replica->root = m_root.get();
+            // The calling thread searches m_root.
+            replica->workers = 1;
+        } else {
+            // No noise of their own, they get m_root's priors below.
+            replica->tree = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+            replica->tree->prepare_root_node(m_network, color, m_nodes,
+                                             m_rootstate, false);
+            replica->root = replica->tree.get();
+        }
+        const auto& own_children = replica->root->get_children();
+        for (const auto& child : children) {
+            const auto move = child.get_move();
+            const auto it = std::find_if(
+                begin(own_children), end(own_children),
+                [move](const auto& own) { return own.get_move() == move; });
+            if (it == end(own_children)) {
+                replica->child_index.emplace_back(-1);
+                continue;
+            }
+            replica->child_index.emplace_back(
+                static_cast<int>(it - begin(own_children)));
+            // All trees search with the same (noisy) priors.
+            (*it)->set_policy(child->get_policy());
+        }
+        replica->imported.resize(children.size());
+        m_replicas.emplace_back(std::move(replica));
+    }
+}
+
+void UCTSearch::merge_replicas() {
+    if (m_replicas.size() < 2) {
+        return;
+    }
+    // Root children are inflated and never change during the search,
+    // so we can walk them while the workers run.
+    const auto& children = m_root->get_children();
+    auto own = std::vector<std::pair<int, double>>(m_replicas.size());
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        auto total = std::make_pair(0, 0.0);
+        for (auto r = size_t{0}; r < m_replicas.size(); r++) {
+            const auto& replica = *m_replicas[r];
+            own[r] = {0, 0.0};
+            if (replica.child_index[i] < 0) {
+                continue;
+            }
+            const auto& child =
+                replica.root->get_children()[replica.child_index[i]];
+            own[r].first = child->get_visits() - replica.imported[i].first;
+            own[r].second =
+                child->get_blackevals() - replica.imported[i].second;
+            total.first += own[r].first;
+            total.second += own[r].second;
+        }
+        for (auto r = size_t{0}; r < m_replicas.size(); r++) {
+            auto& replica = *m_replicas[r];
+            if (replica.child_index[i] < 0) {
+                continue;
+            }
+            const auto& child =
+                replica.root->get_children()[replica.child_index[i]];
+            const auto visits =
+                total.first - own[r].first - replica.imported[i].first;
+            const auto blackevals =
+                total.second - own[r].second - replica.imported[i].second;
+            child->merge_stats(visits, blackevals);
+            replica.root->merge_stats(visits, blackevals);
+            replica.imported[i].first += visits;
+            replica.imported[i].second += blackevals;
+            // Moves pruned by time management are pruned everywhere.
+            if (r > 0) {
+                child->set_active(children[i]->active());
+            }
+        }
+    }
+}
+
+void UCTSearch::stop_replicas() {
+    merge_replicas();
+    for (auto& replica : m_replicas) {
+        if (replica->tree) {
+            auto p = replica->tree.release();
+            m_delete_tasks.add_task([this, p]() {
+                UCTNodePointer::AccountScope account(m_tree_size);
+                delete p;
+            });
+        }
+    }
+    m_replicas.clear();
+}
+
 bool UCTSearch::is_running() const {
-    return m_run && UCTNodePointer::get_tree_size() < cfg_max_tree_size;
+    return m_run && !m_stopped && m_tree_size < max_tree_size();
+}
+
+void UCTSearch::stop() {
+    m_stopped = true;
+    m_run = false;
 }
 
 int UCTSearch::est_playouts_left(int elapsed_centis, int time_for_move) const {
     auto playouts = m_playouts.load();
     const auto playouts_left =
-        std::max(0, std::min(m_maxplayouts - playouts,
-                             m_maxvisits - m_root->get_visits()));
+        std::max(0, std::min(playout_limit() - playouts,
+                             visit_limit() - m_root->get_visits()));
 
     // Wait for at least 1 second and 100 playouts
     // so we get a reliable playout_rate.
     if (elapsed_centis < 100 || playouts < 100) {
         return playouts_left;
     }
-    const auto playout_rate = 1.0f * playouts / elapsed_centis;
+    auto playout_rate = 1.0f * playouts / elapsed_centis;
+    if (m_time_manager.enabled() && m_time_manager.get_playout_rate() > 0.0f) {
+        playout_rate = m_time_manager.get_playout_rate();
+    }
     const auto time_left = std::max(0, time_for_move - elapsed_centis);
     return std::min(playouts_left,
                     static_cast<int>(std::ceil(playout_rate * time_left)));
@@ -648,7 +1037,7 @@ bool UCTSearch::have_alternate_moves(int elapsed_centis, int time_for_move) {
     auto my_color = m_rootstate.get_to_move();
     auto tc = m_rootstate.get_timecontrol();
     if (!tc.can_accumulate_time(my_color)
-        || m_maxplayouts < UCTSearch::UNLIMITED_PLAYOUTS) {
+        || playout_limit() < UCTSearch::UNLIMITED_PLAYOUTS) {
         if (cfg_timemanage != TimeManagement::FAST) {
             return true;
         }
@@ -665,26 +1054,31 @@ bool UCTSearch::have_alternate_moves(int elapsed_centis, int time_for_move) {
 }
 
 bool UCTSearch::stop_thinking(int elapsed_centis, int time_for_move) const {
-    return m_playouts >= m_maxplayouts
-           || m_root->get_visits() >= m_maxvisits
+    return m_playouts >= playout_limit()
+           || m_root->get_visits() >= visit_limit()
            || elapsed_centis >= time_for_move;
 }
 
 void UCTWorker::operator()() {
+    UCTNodePointer::AccountScope account(m_search->tree_size_account());
     do {
         auto currstate = std::make_unique<GameState>(m_rootstate);
         auto result = m_search->play_simulation(*currstate, m_root);
         if (result.valid()) {
             m_search->increment_playouts();
+        } else {
+            Profile::count(Profile::WASTED_DESCENTS);
         }
-    } while (m_search->is_running());
+    } while (m_search->keep_worker(m_replica));
 }
 
 void UCTSearch::increment_playouts() {
     m_playouts++;
+    Profile::count(Profile::PLAYOUTS);
 }
 
 int UCTSearch::think(int color, passflag_t passflag) {
+    UCTNodePointer::AccountScope account(m_tree_size);
     // Start counting time for us
     m_rootstate.start_clock(color);
 
@@ -695,6 +1089,14 @@ int UCTSearch::think(int color, passflag_t passflag) {
     // set side to move
     m_rootstate.board.set_to_move(color);
 
+    // Playout cap randomization: most moves only get a small search to
+    // move the game along. Those don't get noise and aren't recorded.
+    m_full_search = true;
+    if (cfg_fast_visits > 0) {
+        auto dist = std::uniform_real_distribution<float>{0.0f, 1.0f};
+        m_full_search = dist(Random::get_Rng()) < cfg_full_search_prob;
+    }
+
     auto time_for_move =
         m_rootstate.get_timecontrol().max_time_for_move(
             m_rootstate.board.get_boardsize(),
@@ -702,37 +1104,66 @@ int UCTSearch::think(int color, passflag_t passflag) {
 
     myprintf("Thinking at most %.1f seconds...\n", time_for_move/100.0f);
 
+    // Adaptive time needs the early exits of time management and
+    // some time it can save up or borrow.
+    const auto& tc = m_rootstate.get_timecontrol();
+    if (cfg_adaptive_time
+        && (cfg_timemanage == TimeManagement::ON
+            || cfg_timemanage == TimeManagement::FAST)
+        && tc.can_accumulate_time(color)) {
+        const auto movenum = static_cast<int>(m_rootstate.get_movenum());
+        m_time_manager.start(movenum, color, time_for_move,
+                             tc.max_extended_time(color));
+    }
+
     // create a sorted list of legal moves (make sure we
     // play something legal and decent even in time trouble)
-    m_root->prepare_root_node(m_network, color, m_nodes, m_rootstate);
+    m_root->prepare_root_node(m_network, color, m_nodes, m_rootstate,
+                              m_full_search);
+    m_analysis_cache.clear();
+    m_analysis_order.clear();
 
+    s_active_searches++;
+    start_replicas(color);
     m_run = true;
-    int cpus = cfg_num_threads;
     ThreadGroup tg(thread_pool);
-    for (int i = 1; i < cpus; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
-    }
+    balance_workers(tg);
 
     auto keeprunning = true;
     auto last_update = 0;
     auto last_output = 0;
+    auto last_merge = 0;
     do {
         auto currstate = std::make_unique<GameState>(m_rootstate);
 
         auto result = play_simulation(*currstate, m_root.get());
         if (result.valid()) {
             increment_playouts();
+        } else {
+            Profile::count(Profile::WASTED_DESCENTS);
         }
+        collect_garbage(tg);
+        balance_workers(tg);
 
         Time elapsed;
         int elapsed_centis = Time::timediff_centis(start, elapsed);
 
+        if (elapsed_centis - last_merge >= REPLICA_MERGE_CENTIS) {
+            last_merge = elapsed_centis;
+            merge_replicas();
+        }
+
         if (cfg_analyze_interval_centis &&
             elapsed_centis - last_output > cfg_analyze_interval_centis) {
             last_output = elapsed_centis;
             output_analysis(m_rootstate, *m_root);
         }
 
+        if (m_time_manager.enabled()) {
+            time_for_move = m_time_manager.update(elapsed_centis, m_playouts,
+                                                  *m_root);
+        }
+
         // output some stats every few seconds
         // check if we should still search
         if (elapsed_centis - last_update > 250) {
@@ -747,6 +1178,13 @@ int UCTSearch::think(int color, passflag_t passflag) {
     // stop the search
     m_run = false;
     tg.wait_all();
+    stop_replicas();
+    s_active_searches--;
+    {
+        Time elapsed;
+        m_time_manager.finish(Time::timediff_centis(start, elapsed),
+                              m_playouts);
+    }
 
     // reactivate all pruned root children
     for (const auto& node : m_root->get_children()) {
@@ -761,7 +1199,20 @@ int UCTSearch::think(int color, passflag_t passflag) {
     // display search info
     myprintf("\n");
     dump_stats(m_rootstate, *m_root);
-    Training::record(m_network, m_rootstate, *m_root);
+    if (m_full_search) {
+        Training::record(m_rootstate, *m_root);
+    }
+    if (cfg_fast_visits > 0) {
+        auto comment = std::string{m_full_search ? "full" : "fast"};
+        comment += " search";
+        if (visit_limit() < UNLIMITED_PLAYOUTS) {
+            comment += ", " + std::to_string(visit_limit()) + " visits";
+        }
+        if (playout_limit() < visit_limit()) {
+            comment += ", " + std::to_string(playout_limit()) + " playouts";
+        }
+        Training::record_search(m_rootstate, comment);
+    }
 
     Time elapsed;
     int elapsed_centis = Time::timediff_centis(start, elapsed);
@@ -780,32 +1231,44 @@ int UCTSearch::think(int color, passflag_t passflag) {
 }
 
 void UCTSearch::ponder() {
+    UCTNodePointer::AccountScope account(m_tree_size);
     update_root();
+    m_full_search = true;
 
     m_root->prepare_root_node(m_network, m_rootstate.board.get_to_move(),
                               m_nodes, m_rootstate);
+    m_analysis_cache.clear();
+    m_analysis_order.clear();
 
+    s_active_searches++;
+    start_replicas(m_rootstate.board.get_to_move());
     m_run = true;
     ThreadGroup tg(thread_pool);
-    for (int i = 1; i < cfg_num_threads; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
-    }
+    balance_workers(tg);
     Time start;
     auto keeprunning = true;
     auto last_output = 0;
+    auto last_merge = 0;
     do {
         auto currstate = std::make_unique<GameState>(m_rootstate);
         auto result = play_simulation(*currstate, m_root.get());
         if (result.valid()) {
             increment_playouts();
+        } else {
+            Profile::count(Profile::WASTED_DESCENTS);
         }
-        if (cfg_analyze_interval_centis) {
-            Time elapsed;
-            int elapsed_centis = Time::timediff_centis(start, elapsed);
-            if (elapsed_centis - last_output > cfg_analyze_interval_centis) {
-                last_output = elapsed_centis;
-                output_analysis(m_rootstate, *m_root);
-            }
+        collect_garbage(tg);
+        balance_workers(tg);
+        Time elapsed;
+        int elapsed_centis = Time::timediff_centis(start, elapsed);
+        if (elapsed_centis - last_merge >= REPLICA_MERGE_CENTIS) {
+            last_merge = elapsed_centis;
+            merge_replicas();
+        }
+        if (cfg_analyze_interval_centis
+            && elapsed_centis - last_output > cfg_analyze_interval_centis) {
+            last_output = elapsed_centis;
+            output_analysis(m_rootstate, *m_root);
         }
         keeprunning  = is_running();
         keeprunning &= !stop_thinking(0, 1);
@@ -814,6 +1277,8 @@ void UCTSearch::ponder() {
     // stop the search
     m_run = false;
     tg.wait_all();
+    stop_replicas();
+    s_active_searches--;
 
     // display search info
     myprintf("\n");
@@ -825,6 +1290,20 @@ void UCTSearch::ponder() {
     m_last_rootstate = std::make_unique<GameState>(m_rootstate);
 }
 
+int UCTSearch::playout_limit() const {
+    if (m_full_search) {
+        return m_maxplayouts;
+    }
+    return std::min(m_maxplayouts, cfg_fast_visits);
+}
+
+int UCTSearch::visit_limit() const {
+    if (m_full_search) {
+        return m_maxvisits;
+    }
+    return std::min(m_maxvisits, cfg_fast_visits);
+}
+
 void UCTSearch::set_playout_limit(int playouts) {
     static_assert(std::is_convertible<decltype(playouts),
                                       decltype(m_maxplayouts)>::value,
@@ -19,11 +19,13 @@
 #ifndef UCTSEARCH_H_INCLUDED
 #define UCTSEARCH_H_INCLUDED
 
-#include <list>
 #include <atomic>
 #include <memory>
 #include <string>
 #include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <future>
 
 #include "ThreadPool.h"
@@ -32,6 +34,9 @@
 #include "GameState.h"
 #include "UCTNode.h"
 #include "Network.h"
+#include "ScoreCache.h"
+#include "TimeManager.h"
+#include "TreeCache.h"
 
 
 class SearchResult {
@@ -39,9 +44,16 @@ public:
     SearchResult() = default;
     bool valid() const { return m_valid;  }
     float eval() const { return m_eval;  }
+    // The leaf was being evaluated by another thread.
+    bool collision() const { return m_collision; }
     static SearchResult from_eval(float eval) {
         return SearchResult(eval);
     }
+    static SearchResult from_collision() {
+        auto result = SearchResult{};
+        result.m_collision = true;
+        return result;
+    }
     static SearchResult from_score(float board_score) {
         if (board_score > 0.0f) {
             return SearchResult(1.0f);
@@ -55,6 +67,7 @@ private:
     explicit SearchResult(float eval)
         : m_valid(true), m_eval(eval) {}
     bool m_valid{false};
+    bool m_collision{false};
     float m_eval{0.0f};
 };
 
@@ -88,6 +101,47 @@ public:
     */
     static constexpr size_t MIN_TREE_SPACE = 100'000'000;
 
+    /*
+        When the tree reaches this fraction of cfg_max_tree_size,
+        low-visit subtrees are deflated until it is back down to
+        GC_TARGET_RATIO, so the search can keep running indefinitely.
+    */
+    static constexpr float GC_START_RATIO = 0.9f;
+    static constexpr float GC_TARGET_RATIO = 0.7f;
+
+    /*
+        Trees kept for revisiting earlier positions may use up to
+        this fraction of cfg_max_tree_size, counting the live tree.
+    */
+    static constexpr float TREE_CACHE_RATIO = 0.5f;
+
+    /*
+        Number of searches running concurrently. They split
+        cfg_num_threads evenly. Only the analysis server runs more
+        than one at a time.
+    */
+    static std::atomic<int> s_active_searches;
+
+    /*
+        Number of UCTSearch instances, one per analysis server session.
+        Each may use an equal share of cfg_max_tree_size for its trees.
+    */
+    static std::atomic<int> s_searches;
+
+    /*
+        With cfg_search_replicas > 1, groups of threads search their
+        own copy of the tree so they don't all contend on the same root
+        children. Root statistics are merged this often.
+    */
+    static constexpr int REPLICA_MERGE_CENTIS = 10;
+
+    /*
+        With cfg_collisions == RETRY, a thread that reaches a leaf
+        another thread is evaluating picks another child of its parent
+        at most this many times before giving up the playout.
+    */
+    static constexpr int MAX_COLLISION_RETRIES = 4;
+
     /*
         Value representing unlimited visits or playouts. Due to
         concurrent updates while multithreading, we need some
@@ -97,19 +151,34 @@ public:
         std::numeric_limits<int>::max() / 2;
 
     UCTSearch(GameState& g, Network & network);
+    ~UCTSearch();
     int think(int color, passflag_t passflag = NORMAL);
     void set_playout_limit(int playouts);
     void set_visit_limit(int visits);
     void ponder();
     bool is_running() const;
+    // Ends the current think() or ponder() early, and makes later ones
+    // return after a single playout. Can be called from any thread.
+    void stop();
+    std::pair<bool, std::string> save_tree(const std::string& filename);
+    std::pair<bool, std::string> load_tree(const std::string& filename);
+    // Called by workers between playouts. False means the worker
+    // should exit, either because the search stopped or because
+    // other searches need our share of the threads.
+    bool keep_worker(size_t replica);
     void increment_playouts();
+    // Memory used by our trees, including the tree cache. Threads
+    // working on them charge it through UCTNodePointer::AccountScope.
+    std::atomic<size_t>& tree_size_account() {
+        return m_tree_size;
+    }
     SearchResult play_simulation(GameState& currstate, UCTNode* const node);
 
 private:
     float get_min_psa_ratio() const;
     void dump_stats(FastState& state, UCTNode& parent);
     void tree_stats(const UCTNode& node);
-    std::string get_pv(FastState& state, UCTNode& parent);
+    std::string get_pv(const FastBoard& board, UCTNode& parent, int color);
     void dump_analysis(int playouts);
     bool should_resign(passflag_t passflag, float besteval);
     bool have_alternate_moves(int elapsed_centis, int time_for_move);
@@ -119,8 +188,19 @@ private:
     bool stop_thinking(int elapsed_centis = 0, int time_for_move = 0) const;
     int get_best_move(passflag_t passflag);
     void update_root();
+    void stash_root();
+    void stash_tree(const GameState& state, std::unique_ptr<UCTNode> root);
     bool advance_to_new_rootstate();
     void output_analysis(FastState & state, UCTNode & parent);
+    void collect_garbage(Utils::ThreadGroup & tg);
+    void balance_workers(Utils::ThreadGroup & tg);
+    void start_replicas(int color);
+    void merge_replicas();
+    void stop_replicas();
+    static int thread_share();
+    int playout_limit() const;
+    size_t max_tree_size() const;
+    int visit_limit() const;
 
     GameState & m_rootstate;
     std::unique_ptr<GameState> m_last_rootstate;
@@ -128,23 +208,67 @@ private:
     std::atomic<int> m_nodes{0};
     std::atomic<int> m_playouts{0};
     std::atomic<bool> m_run{false};
+    std::atomic<bool> m_stopped{false};
+    std::atomic<int> m_workers{0};
+    std::atomic<size_t> m_tree_size{0};
+    size_t m_tree_size_after_gc{0};
     int m_maxplayouts;
     int m_maxvisits;
+    // False when playout cap randomization picked a fast search.
+    bool m_full_search{true};
+
+    // Old trees are destroyed in the background.
+    Utils::ThreadGroup m_delete_tasks;
+
+    /*
+        Trees searched concurrently during think() and ponder(). The
+        first one is m_root, the others only live for one search.
+        Merged statistics are tracked per child of m_root, so each
+        tree only receives what the others found since the last merge.
+    */
+    struct Replica {
+        UCTNode* root{nullptr};
+        std::unique_ptr<UCTNode> tree;
+        std::atomic<int> workers{0};
+        // Index of each m_root child in root's children, -1 if missing.
+        std::vector<int> child_index;
+        // Visits and black evals of the other trees added so far.
+        std::vector<std::pair<int, double>> imported;
+    };
+    std::vector<std::unique_ptr<Replica>> m_replicas;
+
+    /*
+        Root child data from the last lz-analyze line, keyed by move.
+        Entries are rebuilt only when the child got new visits.
+    */
+    struct AnalysisCacheEntry {
+        int visits{0};
+        float eval{0.0f};
+        std::string pv;
+    };
+    std::unordered_map<int, AnalysisCacheEntry> m_analysis_cache;
+    // Moves in the order of the last analysis line.
+    std::vector<std::string> m_analysis_order;
 
-    std::list<Utils::ThreadGroup> m_delete_futures;
+    TimeManager m_time_manager;
+    ScoreCache m_score_cache;
+    TreeCache m_tree_cache;
 
     Network & m_network;
 };
 
 class UCTWorker {
 public:
-    UCTWorker(GameState & state, UCTSearch * search, UCTNode * root)
-      : m_rootstate(state), m_search(search), m_root(root) {}
+    UCTWorker(GameState & state, UCTSearch * search, UCTNode * root,
+              size_t replica)
+      : m_rootstate(state), m_search(search), m_root(root),
+        m_replica(replica) {}
     void operator()();
 private:
     GameState & m_rootstate;
     UCTSearch * m_search;
     UCTNode * m_root;
+    size_t m_replica;
 };
 
 #endif
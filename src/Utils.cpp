@@ -19,9 +19,11 @@
 #include "config.h"
 #include "Utils.h"
 
+#include <algorithm>
 #include <mutex>
 #include <cstdarg>
 #include <cstdio>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 
@@ -38,7 +40,16 @@
 
 Utils::ThreadPool thread_pool;
 
+static thread_local Utils::GtpStream* gtp_stream = nullptr;
+
+void Utils::set_gtp_stream(GtpStream* stream) {
+    gtp_stream = stream;
+}
+
 bool Utils::input_pending() {
+    if (gtp_stream) {
+        return gtp_stream->input_pending();
+    }
 #ifdef HAVE_SELECT
     fd_set read_fds;
     FD_ZERO(&read_fds);
@@ -120,16 +131,34 @@ static void gtp_fprintf(FILE* file, const std::string& prefix,
     fprintf(file, "\n\n");
 }
 
+static std::string vformat(const char *fmt, va_list ap) {
+    va_list ap2;
+    va_copy(ap2, ap);
+    auto size = vsnprintf(nullptr, 0, fmt, ap2);
+    va_end(ap2);
+
+    auto buffer = std::vector<char>(std::max(size, 0) + 1);
+    vsnprintf(buffer.data(), buffer.size(), fmt, ap);
+    return std::string(buffer.data());
+}
+
 static void gtp_base_printf(int id, std::string prefix,
                             const char *fmt, va_list ap) {
     if (id != -1) {
         prefix += std::to_string(id);
     }
-    gtp_fprintf(stdout, prefix, fmt, ap);
+    va_list ap2;
+    va_copy(ap2, ap);
+    if (gtp_stream) {
+        gtp_stream->write(prefix + " " + vformat(fmt, ap) + "\n\n");
+    } else {
+        gtp_fprintf(stdout, prefix, fmt, ap);
+    }
     if (cfg_logfile_handle) {
         std::lock_guard<std::mutex> lock(IOmutex);
-        gtp_fprintf(cfg_logfile_handle, prefix, fmt, ap);
+        gtp_fprintf(cfg_logfile_handle, prefix, fmt, ap2);
     }
+    va_end(ap2);
 }
 
 void Utils::gtp_printf(int id, const char *fmt, ...) {
@@ -142,7 +171,11 @@ void Utils::gtp_printf(int id, const char *fmt, ...) {
 void Utils::gtp_printf_raw(const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    vfprintf(stdout, fmt, ap);
+    if (gtp_stream) {
+        gtp_stream->write(vformat(fmt, ap));
+    } else {
+        vfprintf(stdout, fmt, ap);
+    }
     va_end(ap);
 
     if (cfg_logfile_handle) {
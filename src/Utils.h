@@ -38,6 +38,16 @@ namespace Utils {
     void log_input(const std::string& input);
     bool input_pending();
 
+    // Destination of the GTP replies of the calling thread, and the
+    // source input_pending() polls. Without one, stdin/stdout are used.
+    class GtpStream {
+    public:
+        virtual ~GtpStream() = default;
+        virtual void write(const std::string& text) = 0;
+        virtual bool input_pending() = 0;
+    };
+    void set_gtp_stream(GtpStream* stream);
+
     template<class T>
     void atomic_add(std::atomic<T> &f, T d) {
         T old = f.load();
@@ -92,8 +92,7 @@ static constexpr auto POTENTIAL_MOVES = NUM_INTERSECTIONS + 1; // including pass
 
 /* Maximum supported batch size for OpenCL.
  */
-static constexpr auto MAX_BATCH = 1;
-static_assert(MAX_BATCH == 1, "MAX_BATCH != 1 not implemented");
+static constexpr auto MAX_BATCH = 32;
 
 /*
  * USE_TUNER: Expose some extra command line parameters that allow tuning the
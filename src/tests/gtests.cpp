@@ -19,21 +19,42 @@
 
 #include "config.h"
 
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
 #include <algorithm>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <regex>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "EvalServer.h"
+#include "Float16.h"
 #include "GTP.h"
 #include "GameState.h"
 #include "NNCache.h"
+#include "Network.h"
+#include "PositionIndex.h"
+#include "Profile.h"
 #include "Random.h"
+#include "RemotePipe.h"
+#include "SGFTree.h"
+#include "ScoreCache.h"
 #include "ThreadPool.h"
+#include "TimeControl.h"
+#include "TimeManager.h"
+#include "Training.h"
+#include "UCTNode.h"
+#include "UCTNodePointer.h"
+#include "UCTSearch.h"
 #include "Utils.h"
 #include "Zobrist.h"
+#include "zlib.h"
 
 using namespace Utils;
 
@@ -73,7 +94,7 @@ public:
 
         auto playouts = std::min(cfg_max_playouts, cfg_max_visits);
         auto network = std::make_unique<Network>();
-        network->initialize(playouts, cfg_weightsfile);
+        network->initialize(playouts, "../src/tests/0k.txt");
         GTP::initialize(std::move(network));
     }
     void TearDown() {}
@@ -208,6 +229,560 @@ TEST_F(LeelaTest, MoveOnOccupiedPnt) {
     EXPECT_NE(output.find("illegal move"), std::string::npos);
 }
 
+TEST_F(LeelaTest, ScoreCache) {
+    auto game = GameState{};
+    game.init_game(5, 0.5f);
+
+    // Black wall on C, white wall on D: black owns A-C, white D-E.
+    for (auto y = 0; y < 5; y++) {
+        game.play_move(FastBoard::BLACK, game.board.get_vertex(2, y));
+        game.play_move(FastBoard::WHITE, game.board.get_vertex(3, y));
+    }
+    EXPECT_EQ(game.board.area_difference(), 5);
+    EXPECT_FLOAT_EQ(game.final_score(), 4.5f);
+
+    // A region reaching both colors counts for neither side.
+    game.play_move(FastBoard::WHITE, game.board.get_vertex(0, 0));
+    EXPECT_EQ(game.board.area_difference(), 5 - 6 - 5);
+
+    ScoreCache cache;
+    EXPECT_FLOAT_EQ(cache.final_score(game), game.final_score());
+    EXPECT_FLOAT_EQ(cache.final_score(game), game.final_score());
+    EXPECT_EQ(cache.get_lookups(), 2);
+    EXPECT_EQ(cache.get_hits(), 1);
+
+    // Komi is not part of the cached entry.
+    game.set_komi(7.5f);
+    EXPECT_FLOAT_EQ(cache.final_score(game), game.final_score());
+    EXPECT_EQ(cache.get_hits(), 2);
+}
+
+// A tiny tree budget must not stop the search
+TEST_F(LeelaTest, TreeGarbageCollection) {
+    std::pair<std::string, std::string> result;
+
+    cfg_max_playouts = 400;
+    cfg_max_tree_size = 512 * 1024;
+
+    // clear_board to force GTP to make a new UCTSearch.
+    // This will pickup our new cfg_* settings.
+    result = gtp_execute("clear_board");
+    result = gtp_execute("genmove b");
+    expect_regex(result.second, "Tree GC: ");
+    expect_regex(result.second, " 400 playouts");
+    EXPECT_LT(UCTNodePointer::get_tree_size(), cfg_max_tree_size);
+}
+
+// Playouts of all replicas end up in the root we pick the move from
+TEST_F(LeelaTest, SearchReplicas) {
+    std::pair<std::string, std::string> result;
+    const auto stats = std::regex("(\\d+) visits, \\d+ nodes, (\\d+) playouts");
+    std::smatch match;
+
+    cfg_num_threads = 4;
+    cfg_search_replicas = 2;
+    cfg_max_playouts = 400;
+    cfg_timemanage = TimeManagement::OFF;
+
+    // clear_board to force GTP to make a new UCTSearch.
+    // This will pickup our new cfg_* settings.
+    result = gtp_execute("clear_board");
+    result = gtp_execute("genmove b");
+    ASSERT_TRUE(std::regex_search(result.second, match, stats));
+    EXPECT_GT(std::stoi(match[1]), std::stoi(match[2]));
+}
+
+// Without virtual loss, collided threads must still finish the search
+TEST_F(LeelaTest, SearchCollisions) {
+    std::pair<std::string, std::string> result;
+    const auto stats = std::regex("\\d+ visits, \\d+ nodes, (\\d+) playouts");
+    std::smatch match;
+
+    cfg_num_threads = 8;
+    cfg_virtual_loss = 0;
+    cfg_max_playouts = 200;
+    cfg_timemanage = TimeManagement::OFF;
+    Profile::reset();
+    Profile::set_enabled(true);
+
+    for (const auto mode : {collision_t::RETRY, collision_t::WAIT}) {
+        cfg_collisions = mode;
+        // clear_board to force GTP to make a new UCTSearch.
+        // This will pickup our new cfg_* settings.
+        result = gtp_execute("clear_board");
+        result = gtp_execute("genmove b");
+        ASSERT_TRUE(std::regex_search(result.second, match, stats));
+        EXPECT_GE(std::stoi(match[1]), 200);
+    }
+
+    result = gtp_execute("lz-profile");
+    expect_regex(result.first, "\"collisions\":\\d+,\"wasted_descents\":\\d+");
+    Profile::set_enabled(false);
+    Profile::reset();
+}
+
+// Threads drop their counts from before a reset, even if they don't
+// update them again
+TEST_F(LeelaTest, ProfileReset) {
+    Profile::reset();
+    Profile::set_enabled(true);
+    Profile::count(Profile::PLAYOUTS);
+    expect_regex(Profile::to_json(), "\"counters\":\\{\"playouts\":1,");
+
+    Profile::reset();
+    expect_regex(Profile::to_json(), "\"counters\":\\{\"playouts\":0,");
+    Profile::count(Profile::PLAYOUTS);
+    Profile::count(Profile::PLAYOUTS);
+    expect_regex(Profile::to_json(), "\"counters\":\\{\"playouts\":2,");
+    Profile::set_enabled(false);
+    Profile::reset();
+}
+
+// A big tree in one search does not push another search into GC
+TEST_F(LeelaTest, TreeBudgetPerSearch) {
+    auto big_state = GameState{};
+    big_state.init_game(19, 7.5f);
+    auto small_state = GameState{};
+    small_state.init_game(19, 7.5f);
+    small_state.play_textmove("b", "d4");
+
+    cfg_max_playouts = 400;
+    cfg_timemanage = TimeManagement::OFF;
+    UCTSearch big(big_state, *GTP::s_network);
+    big.think(FastBoard::BLACK);
+    EXPECT_GT(big.tree_size_account().load(), size_t{0});
+
+    // Every search may use less than the total, but the small one
+    // stays far below its share.
+    cfg_max_tree_size = size_t(1.05 * UCTNodePointer::get_tree_size());
+    cfg_max_playouts = 20;
+    UCTSearch small(small_state, *GTP::s_network);
+    testing::internal::CaptureStderr();
+    small.think(FastBoard::WHITE);
+    const auto output = testing::internal::GetCapturedStderr();
+    expect_regex(output, "Tree GC: ", false);
+    expect_regex(output, " 20 playouts");
+    EXPECT_LT(small.tree_size_account().load(),
+              big.tree_size_account().load());
+}
+
+// Garbage collection keeps the statistics of visited nodes
+TEST_F(LeelaTest, DeflateKeepsStatistics) {
+    auto& state = get_gamestate();
+    std::atomic<int> nodes{0};
+    float eval;
+
+    UCTNode root(FastBoard::PASS, 0.0f);
+    root.prepare_root_node(*GTP::s_network, FastBoard::BLACK, nodes, state);
+    auto child = root.get_first_child();
+    child->update(0.5f);
+    child->update(0.5f);
+
+    auto child_state = state;
+    child_state.play_move(child->get_move());
+    ASSERT_TRUE(child->create_children(*GTP::s_network, nodes,
+                                       child_state, eval));
+    const auto& grandchildren = child->get_children();
+    grandchildren[0].inflate();
+    grandchildren[0]->update(0.25f);
+    grandchildren[1].inflate();
+
+    root.deflate_children(1);
+    ASSERT_TRUE(grandchildren[0].is_inflated());
+    EXPECT_EQ(grandchildren[0]->get_visits(), 1);
+    EXPECT_FLOAT_EQ(grandchildren[0]->get_raw_eval(FastBoard::BLACK), 0.25f);
+    EXPECT_FALSE(grandchildren[0]->has_children());
+    EXPECT_FALSE(grandchildren[1].is_inflated());
+    EXPECT_EQ(child->get_visits(), 2);
+}
+
+// Going back to a position searched earlier re-attaches its tree
+TEST_F(LeelaTest, TreeCache) {
+    std::pair<std::string, std::string> result;
+    const auto stats = std::regex("(\\d+) visits, \\d+ nodes, (\\d+) playouts");
+    std::smatch match;
+
+    cfg_max_playouts = 50;
+    cfg_allow_pondering = false;
+
+    // clear_board to force GTP to make a new UCTSearch.
+    // This will pickup our new cfg_* settings.
+    result = gtp_execute("clear_board");
+    result = gtp_execute("play b D4");
+    result = gtp_execute("genmove w");
+
+    // Search somewhere not reachable by playing forward.
+    result = gtp_execute("undo");
+    result = gtp_execute("undo");
+    result = gtp_execute("genmove b");
+
+    result = gtp_execute("undo");
+    result = gtp_execute("play b D4");
+    result = gtp_execute("genmove w");
+    ASSERT_TRUE(std::regex_search(result.second, match, stats));
+    EXPECT_GT(std::stoi(match[1]), std::stoi(match[2]) + 1);
+}
+
+// Playing forward keeps the tree of the position we came from
+TEST_F(LeelaTest, TreeCacheAfterAdvance) {
+    std::pair<std::string, std::string> result;
+    const auto stats = std::regex("(\\d+) visits, \\d+ nodes, (\\d+) playouts");
+    std::smatch match;
+
+    cfg_max_playouts = 50;
+    cfg_allow_pondering = false;
+
+    result = gtp_execute("clear_board");
+    result = gtp_execute("play b D4");
+    result = gtp_execute("genmove w");
+    result = gtp_execute("play b Q16");
+    result = gtp_execute("genmove w");
+
+    result = gtp_execute("undo");
+    result = gtp_execute("undo");
+    result = gtp_execute("undo");
+    result = gtp_execute("genmove w");
+    ASSERT_TRUE(std::regex_search(result.second, match, stats));
+    EXPECT_GT(std::stoi(match[1]), std::stoi(match[2]) + 1);
+}
+
+// A saved tree can be loaded into a fresh search
+TEST_F(LeelaTest, SaveLoadTree) {
+    std::pair<std::string, std::string> result;
+    const auto stats = std::regex("(\\d+) visits, \\d+ nodes, (\\d+) playouts");
+    std::smatch match;
+    const auto filename = std::string("SaveLoadTree.tree");
+
+    cfg_max_playouts = 50;
+    cfg_allow_pondering = false;
+
+    result = gtp_execute("clear_board");
+    result = gtp_execute("play b D4");
+    result = gtp_execute("genmove w");
+    result = gtp_execute("undo");
+    result = gtp_execute("lz-save_tree " + filename);
+    expect_regex(result.first, "^= \\d+ nodes");
+
+    // Different position
+    result = gtp_execute("clear_board");
+    result = gtp_execute("lz-load_tree " + filename);
+    expect_regex(result.first, "^\\? tree is for a different position");
+
+    result = gtp_execute("play b D4");
+    result = gtp_execute("lz-load_tree " + filename);
+    expect_regex(result.first, "^= \\d+ nodes");
+    result = gtp_execute("genmove w");
+    ASSERT_TRUE(std::regex_search(result.second, match, stats));
+    EXPECT_GT(std::stoi(match[1]), std::stoi(match[2]) + 1);
+
+    std::remove(filename.c_str());
+}
+
+// A loaded tree wins over one cached earlier for the same position
+TEST_F(LeelaTest, LoadTreeOverCachedTree) {
+    std::pair<std::string, std::string> result;
+    const auto stats = std::regex("(\\d+) visits, \\d+ nodes, (\\d+) playouts");
+    std::smatch match;
+    const auto filename = std::string("LoadTreeOverCachedTree.tree");
+
+    cfg_allow_pondering = false;
+    cfg_timemanage = TimeManagement::OFF;
+
+    cfg_max_playouts = 200;
+    result = gtp_execute("clear_board");
+    result = gtp_execute("play b D4");
+    result = gtp_execute("genmove w");
+    result = gtp_execute("undo");
+    result = gtp_execute("lz-save_tree " + filename);
+    expect_regex(result.first, "^= \\d+ nodes");
+
+    // Leave a small tree for the same position in the tree cache.
+    cfg_max_playouts = 10;
+    result = gtp_execute("clear_board");
+    result = gtp_execute("play b D4");
+    result = gtp_execute("genmove w");
+    result = gtp_execute("undo");
+    result = gtp_execute("undo");
+    result = gtp_execute("genmove b");
+    result = gtp_execute("undo");
+    result = gtp_execute("play b D4");
+
+    result = gtp_execute("lz-load_tree " + filename);
+    expect_regex(result.first, "^= \\d+ nodes");
+    result = gtp_execute("genmove w");
+    ASSERT_TRUE(std::regex_search(result.second, match, stats));
+    EXPECT_GT(std::stoi(match[1]), 200);
+
+    std::remove(filename.c_str());
+}
+
+static std::string read_gz(const std::string& filename) {
+    auto data = std::string{};
+    auto in = gzopen(filename.c_str(), "rb");
+    char buffer[4096];
+    int bytes;
+    while (in && (bytes = gzread(in, buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, bytes);
+    }
+    if (in) {
+        gzclose(in);
+    }
+    return data;
+}
+
+TEST_F(LeelaTest, ConvertTraining) {
+    std::pair<std::string, std::string> result;
+
+    cfg_max_playouts = 20;
+    cfg_allow_pondering = false;
+
+    result = gtp_execute("clear_board");
+    result = gtp_execute("genmove b");
+    result = gtp_execute("genmove w");
+    result = gtp_execute("genmove b");
+    result = gtp_execute("dump_training b converttext");
+    // dump_training compresses in the background.
+    Training::finish_output();
+    result = gtp_execute("convert_training converttext.0.gz convertbin");
+    expect_regex(result.first, "^= 3 positions");
+    result = gtp_execute("convert_training convertbin.0.bin.gz converttext2");
+    expect_regex(result.first, "^= 3 positions");
+    result = gtp_execute("convert_training converttext2.0.gz convertbin2");
+    expect_regex(result.first, "^= 3 positions");
+
+    // fp16 probabilities survive a trip through the text format.
+    const auto binary = read_gz("convertbin.0.bin.gz");
+    EXPECT_EQ(binary.size(), 3 * Training::BINARY_RECORD_SIZE);
+    EXPECT_EQ(binary, read_gz("convertbin2.0.bin.gz"));
+
+    for (const auto name : {"converttext.0.gz", "convertbin.0.bin.gz",
+                            "converttext2.0.gz", "convertbin2.0.bin.gz"}) {
+        std::remove(name);
+    }
+}
+
+TEST_F(LeelaTest, ConvertTrainingDraw) {
+    std::pair<std::string, std::string> result;
+
+    cfg_max_playouts = 20;
+    cfg_allow_pondering = false;
+
+    result = gtp_execute("clear_board");
+    result = gtp_execute("genmove b");
+    result = gtp_execute("genmove w");
+    result = gtp_execute("dump_training draw drawtext");
+    Training::finish_output();
+    result = gtp_execute("convert_training drawtext.0.gz drawbin");
+    expect_regex(result.first, "^= 2 positions");
+    result = gtp_execute("convert_training drawbin.0.bin.gz drawtext2");
+    expect_regex(result.first, "^= 2 positions");
+
+    // The result line of every position is 0, also after the binary trip.
+    for (const auto name : {"drawtext.0.gz", "drawtext2.0.gz"}) {
+        std::istringstream lines(read_gz(name));
+        auto line = std::string{};
+        auto line_num = 0;
+        while (std::getline(lines, line)) {
+            if (++line_num % 19 == 0) {
+                EXPECT_EQ(line, "0");
+            }
+        }
+        EXPECT_EQ(line_num, 2 * 19);
+    }
+
+    for (const auto name : {"drawtext.0.gz", "drawbin.0.bin.gz",
+                            "drawtext2.0.gz"}) {
+        std::remove(name);
+    }
+}
+
+TEST_F(LeelaTest, SearchCommentsInSGF) {
+    std::pair<std::string, std::string> result;
+
+    cfg_max_playouts = UCTSearch::UNLIMITED_PLAYOUTS;
+    cfg_max_visits = 20;
+    cfg_fast_visits = 5;
+    cfg_full_search_prob = 0.5f;
+    cfg_allow_pondering = false;
+
+    result = gtp_execute("clear_board");
+    for (auto i = 0; i < 4; i++) {
+        result = gtp_execute(i % 2 ? "genmove w" : "genmove b");
+    }
+    result = gtp_execute("printsgf");
+    const auto comment = std::regex{
+        ";[BW]\\[[a-t]*\\]C\\[(fast search, 5|full search, 20) visits\\]"};
+    const auto sgf = result.first;
+    EXPECT_EQ(std::distance(std::sregex_iterator(begin(sgf), end(sgf),
+                                                 comment),
+                            std::sregex_iterator()), 4);
+}
+
+TEST_F(LeelaTest, DumpSupervised) {
+    std::pair<std::string, std::string> result;
+    const auto sgfname = std::string("dumpsupervised.sgf");
+
+    {
+        std::ofstream sgf(sgfname);
+        for (auto i = 0; i < 150; i++) {
+            sgf << "(;GM[1]SZ[19]KM[7.5]RE[" << (i % 2 ? "B+R" : "W+R")
+                << "];B[pd];W[dp];B[pp](;W[dd])(;W[cc]))\n";
+        }
+        // No result, skipped
+        sgf << "(;GM[1]SZ[19]KM[7.5];B[pd])\n";
+    }
+
+    cfg_training_binary = true;
+    result = gtp_execute("dump_supervised " + sgfname + " dumpsupervised");
+    cfg_training_binary = false;
+
+    // 150 games of 4 mainline moves each, 32 games per chunk
+    auto positions = size_t{0};
+    for (auto chunk = 0; chunk < 5; chunk++) {
+        const auto name =
+            "dumpsupervised." + std::to_string(chunk) + ".bin.gz";
+        positions += read_gz(name).size() / Training::BINARY_RECORD_SIZE;
+        std::remove(name.c_str());
+    }
+    EXPECT_EQ(positions, size_t{150 * 4});
+    std::remove(sgfname.c_str());
+}
+
+TEST_F(LeelaTest, SGFMainline) {
+    const auto sgf = std::string(
+        "GM[1]SZ[19]KM[6.5]RE[W+3.5]C[a \\] (not a variation]"
+        ";B[pd](;W[dp];B[pp](;W[dd])(;W[cc]))(;W[dd](;B[dp])))");
+
+    SGFTree full;
+    full.load_from_string(sgf);
+    SGFTree mainline;
+    mainline.load_from_string(sgf, true);
+
+    EXPECT_EQ(full.get_mainline(), mainline.get_mainline());
+    EXPECT_EQ(mainline.get_mainline().size(), size_t{4});
+    EXPECT_EQ(mainline.get_winner(), FastBoard::WHITE);
+    EXPECT_EQ(mainline.follow_mainline_state().get_komi(), 6.5f);
+    // The other variations are not there
+    EXPECT_EQ(mainline.get_child(0)->get_child(1), nullptr);
+    EXPECT_NE(full.get_child(0)->get_child(1), nullptr);
+}
+
+TEST_F(LeelaTest, SGFTreeOwnsText) {
+    SGFTree tree;
+    {
+        // More nodes than one arena chunk, and a text that is gone
+        // before the tree is used.
+        auto sgf = std::string("GM[1]SZ[19]KM[7.5]HA[2]AB[pd][pp]");
+        for (auto i = 0; i < 100; i++) {
+            sgf += ";W[" + std::string(1, char('a' + i / 19))
+                + std::string(1, char('a' + i % 19)) + "];B[]";
+        }
+        tree.load_from_string(sgf);
+    }
+
+    const auto moves = tree.get_mainline();
+    ASSERT_EQ(moves.size(), size_t{200});
+    EXPECT_EQ(moves[0], tree.get_state()->board.text_to_move("A19"));
+    EXPECT_EQ(moves[1], FastBoard::PASS);
+    const auto state = tree.follow_mainline_state();
+    EXPECT_EQ(state.board.get_state(state.board.text_to_move("Q16")),
+              FastBoard::BLACK);
+    EXPECT_EQ(state.board.get_state(state.board.text_to_move("Q4")),
+              FastBoard::BLACK);
+}
+
+TEST_F(LeelaTest, PositionIndex) {
+    std::pair<std::string, std::string> result;
+    const auto sgfname = std::string("positionindex.sgf");
+    const auto indexname = std::string("positionindex.idx");
+
+    {
+        std::ofstream sgf(sgfname);
+        sgf << "(;GM[1]SZ[19]KM[7.5]RE[B+R];B[pd];W[dp];B[pp])\n";
+        // The same game mirrored
+        sgf << "(;GM[1]SZ[19]KM[7.5]RE[W+R];B[dd];W[pp];B[dp])\n";
+        sgf << "(;GM[1]SZ[19]KM[7.5]RE[W+2.5];B[pd];W[dd])\n";
+        // Wrong board size, skipped
+        sgf << "(;GM[1]SZ[9]KM[7.5]RE[B+R];B[ee])\n";
+    }
+    auto built = PositionIndex::build({sgfname}, indexname);
+    EXPECT_TRUE(built.first);
+    EXPECT_EQ(built.second, "11 positions from 3 of 4 games");
+
+    result = gtp_execute("load_position_index " + indexname);
+    EXPECT_EQ(result.first, "= 11 positions from 4 games\n\n");
+
+    gtp_execute("clear_board");
+    gtp_execute("play b q16");
+    result = gtp_execute("query_position");
+    expect_regex(result.first,
+                 "3 occurrences in 3 games, black won 1, white won 2");
+    expect_regex(result.first, "positionindex.sgf 1 1 W");
+
+    gtp_execute("play w d4");
+    result = gtp_execute("query_position 0");
+    EXPECT_EQ(result.first,
+              "= 2 occurrences in 2 games, black won 1, white won 1\n\n");
+
+    gtp_execute("play b k10");
+    result = gtp_execute("query_position");
+    expect_regex(result.first, "^= 0 occurrences");
+    gtp_execute("clear_board");
+
+    // Merging one sorted run per file gives the same index.
+    auto read_file = [](const std::string& filename) {
+        std::ifstream in(filename, std::ifstream::binary);
+        return std::string{std::istreambuf_iterator<char>(in),
+                           std::istreambuf_iterator<char>()};
+    };
+    const auto sgfname2 = std::string("positionindex2.sgf");
+    const auto indexname2 = std::string("positionindex2.idx");
+    {
+        std::ofstream sgf(sgfname2);
+        sgf << "(;GM[1]SZ[19]KM[7.5]RE[B+R];B[pp];W[dd];B[dp];W[pd])\n";
+    }
+    cfg_num_threads = 1;
+    built = PositionIndex::build({sgfname, sgfname2}, indexname);
+    EXPECT_EQ(built.second, "16 positions from 4 of 5 games");
+    built = PositionIndex::build({sgfname, sgfname2}, indexname2, 1);
+    EXPECT_EQ(built.second, "16 positions from 4 of 5 games");
+    EXPECT_EQ(read_file(indexname), read_file(indexname2));
+    EXPECT_FALSE(std::ifstream(indexname2 + ".runs"));
+
+    std::remove(sgfname.c_str());
+    std::remove(indexname.c_str());
+    std::remove(sgfname2.c_str());
+    std::remove(indexname2.c_str());
+}
+
+TEST_F(LeelaTest, Profile) {
+    std::pair<std::string, std::string> result;
+    const auto tracename = std::string("profile.json");
+
+    cfg_max_playouts = 20;
+    gtp_execute("clear_board");
+    gtp_execute("lz-profile trace 600");
+    gtp_execute("genmove b");
+    gtp_execute("lz-profile off");
+
+    result = gtp_execute("lz-profile");
+    expect_regex(result.first, "^= \\{\"enabled\":false,");
+    expect_regex(result.first, "\"playouts\":[1-9]");
+    expect_regex(result.first, "\"cache_probe\":\\{\"calls\":[1-9]");
+
+    result = gtp_execute("lz-profile save " + tracename);
+    EXPECT_EQ(result.first, "= \n\n");
+    std::ifstream trace(tracename);
+    const auto json = std::string(std::istreambuf_iterator<char>(trace), {});
+    expect_regex(json, "\"name\":\"select\",\"ph\":\"X\"");
+    trace.close();
+    std::remove(tracename.c_str());
+
+    Profile::reset();
+    result = gtp_execute("lz-profile");
+    expect_regex(result.first, "\"playouts\":0");
+}
+
 // Basic TimeControl test
 TEST_F(LeelaTest, TimeControl) {
     std::pair<std::string, std::string> result;
@@ -232,6 +807,298 @@ TEST_F(LeelaTest, TimeControl) {
     expect_regex(result.second, "White time: \\S*, 24 stones left");
 }
 
+TEST_F(LeelaTest, TimeControlExtension) {
+    // Absolute time: half of what is left after the lag buffer.
+    auto tc = TimeControl(600 * 100, 0, 0, 0);
+    EXPECT_EQ(tc.max_extended_time(FastBoard::BLACK), (60000 - 100) / 2);
+
+    // Japanese byo-yomi can't borrow once in the periods.
+    tc = TimeControl(0, 30 * 100, 0, 3);
+    tc.adjust_time(FastBoard::BLACK, 0, 0);
+    EXPECT_EQ(tc.max_extended_time(FastBoard::BLACK), 3000 - 100);
+
+    // Canadian, last stone of the period.
+    tc = TimeControl(0, 60 * 100, 5, 0);
+    tc.adjust_time(FastBoard::WHITE, 20 * 100, 1);
+    EXPECT_EQ(tc.max_extended_time(FastBoard::WHITE), 2000 - 100);
+}
+
+TEST_F(LeelaTest, TimeManagerDecide) {
+    auto& state = get_gamestate();
+    std::atomic<int> nodes{0};
+
+    // Feeds the time manager a root whose first two moves get the
+    // given visits every sample, at one playout per centisecond.
+    // Returns when the search ended.
+    auto search = [&](const std::function<std::pair<int, int>(int)>& visits) {
+        UCTNode root(FastBoard::PASS, 0.0f);
+        root.prepare_root_node(*GTP::s_network, FastBoard::BLACK, nodes,
+                               state);
+        const auto& children = root.get_children();
+        children[0].inflate();
+        children[1].inflate();
+
+        TimeManager tm;
+        tm.start(0, FastBoard::BLACK, 1000, 4000);
+        auto deadline = 1000;
+        auto elapsed = 0;
+        while (elapsed < deadline) {
+            elapsed += TimeManager::SAMPLE_CENTIS;
+            const auto sample = visits(elapsed);
+            for (auto i = 0; i < sample.first; i++) {
+                children[0]->update(0.6f);
+            }
+            for (auto i = 0; i < sample.second; i++) {
+                children[1]->update(0.5f);
+            }
+            deadline = tm.update(elapsed, elapsed, root);
+        }
+        return elapsed;
+    };
+
+    // Stable best move with most of the visits: stop at the minimum.
+    EXPECT_EQ(search([](int) { return std::make_pair(20, 2); }), 250);
+
+    // The runner-up stays close: extend up to the maximum.
+    EXPECT_EQ(search([](int) { return std::make_pair(20, 19); }), 2000);
+
+    // A close race that the best move pulls away from: stop early.
+    EXPECT_LT(search([](int elapsed) {
+        return elapsed <= 800 ? std::make_pair(10, 8) : std::make_pair(60, 0);
+    }), 1000);
+
+    // The same race, but the runner-up takes over late: extend.
+    EXPECT_GT(search([](int elapsed) {
+        return elapsed <= 800 ? std::make_pair(10, 8) : std::make_pair(0, 60);
+    }), 1000);
+}
+
+TEST_F(LeelaTest, CPUPrecision) {
+    // Conversions round to nearest even.
+    EXPECT_EQ(Float16::to_half(1.0f).bits, 0x3c00);
+    EXPECT_EQ(Float16::to_float(Float16::to_half(65504.0f)), 65504.0f);
+    EXPECT_EQ(Float16::to_bfloat16(1.0f + 1.0f / 256).bits, 0x3f80);
+    EXPECT_EQ(Float16::to_bfloat16(1.0f + 3.0f / 256).bits, 0x3f82);
+
+    auto& state = get_gamestate();
+    state.play_textmove("b", "q16");
+    state.play_textmove("w", "d4");
+    state.play_textmove("b", "c16");
+
+    cfg_cpu_only = true;
+    const auto playouts = std::min(cfg_max_playouts, cfg_max_visits);
+    auto evaluate = [&state, playouts](const cpu_precision_t precision) {
+        cfg_cpu_precision = precision;
+        auto network = std::make_unique<Network>();
+        network->initialize(playouts, "../src/tests/0k.txt");
+        return network->get_output(&state, Network::DIRECT,
+                                   Network::IDENTITY_SYMMETRY, true);
+    };
+
+    const auto ref = evaluate(cpu_precision_t::SINGLE);
+    for (const auto precision : {cpu_precision_t::HALF,
+                                 cpu_precision_t::BFLOAT16}) {
+        const auto result = evaluate(precision);
+        EXPECT_NEAR(result.winrate, ref.winrate, 0.01f);
+        EXPECT_NEAR(result.policy_pass, ref.policy_pass, 0.01f);
+        for (auto idx = size_t{0}; idx < ref.policy.size(); ++idx) {
+            EXPECT_NEAR(result.policy[idx], ref.policy[idx], 0.01f);
+        }
+    }
+}
+
+#ifdef USE_OPENCL
+// Batched OpenCL evaluations must match unbatched ones.
+TEST_F(LeelaTest, OpenCLBatching) {
+    const auto weights = std::string{"../src/tests/0k.txt"};
+    cfg_cpu_only = false;
+#ifdef USE_HALF
+    cfg_precision = precision_t::SINGLE;
+#endif
+    auto make_network = [&weights](const int batch_size) {
+        cfg_batch_size = batch_size;
+        auto network = std::make_unique<Network>();
+        try {
+            network->initialize(std::min(cfg_max_playouts, cfg_max_visits),
+                                weights);
+        } catch (const std::exception&) {
+            network.reset();
+        }
+        return network;
+    };
+    const auto single = make_network(1);
+    if (!single) {
+        GTEST_SKIP() << "No usable OpenCL device.";
+    }
+    // Enough search threads to fill the batches.
+    constexpr auto BATCH_SIZE = 4;
+    cfg_num_threads = 2 * BATCH_SIZE;
+    const auto batched = make_network(BATCH_SIZE);
+    ASSERT_TRUE(batched);
+
+    auto states = std::vector<GameState>{};
+    auto& state = get_gamestate();
+    for (const auto move : {"q16", "d4", "q3", "d16", "r5", "c14", "o17",
+                            "f3"}) {
+        state.play_textmove(state.get_to_move() == FastBoard::BLACK
+                            ? "b" : "w", move);
+        states.emplace_back(state);
+    }
+
+    auto expected = std::vector<Network::Netresult>{};
+    for (auto& position : states) {
+        expected.emplace_back(single->get_output(
+            &position, Network::DIRECT, Network::IDENTITY_SYMMETRY, true));
+    }
+    auto results = std::vector<Network::Netresult>(states.size());
+    auto threads = std::vector<std::thread>{};
+    for (auto i = size_t{0}; i < states.size(); i++) {
+        threads.emplace_back([&, i] {
+            results[i] = batched->get_output(
+                &states[i], Network::DIRECT, Network::IDENTITY_SYMMETRY,
+                true);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (auto i = size_t{0}; i < states.size(); i++) {
+        EXPECT_NEAR(results[i].winrate, expected[i].winrate, 1e-4f);
+        EXPECT_NEAR(results[i].policy_pass, expected[i].policy_pass, 1e-4f);
+        for (auto idx = size_t{0}; idx < expected[i].policy.size(); ++idx) {
+            EXPECT_NEAR(results[i].policy[idx], expected[i].policy[idx],
+                        1e-4f);
+        }
+    }
+}
+#endif
+
+TEST_F(LeelaTest, PartialEvaluation) {
+    using Netresult = Network::Netresult;
+
+    auto partial = Netresult{};
+    partial.heads = Netresult::VALUE_HEAD;
+    partial.winrate = 0.75f;
+
+    NNCache cache;
+    auto result = Netresult{};
+    EXPECT_FALSE(cache.lookup(1, result));
+    EXPECT_EQ(result.heads, 0);
+    cache.insert(1, partial);
+    EXPECT_TRUE(cache.lookup(1, result, Netresult::VALUE_HEAD));
+    EXPECT_FALSE(cache.lookup(1, result));
+    EXPECT_EQ(result.heads, Netresult::VALUE_HEAD);
+    EXPECT_FLOAT_EQ(result.winrate, 0.75f);
+
+    // Completing the entry replaces it.
+    auto full = partial;
+    full.heads = Netresult::ALL_HEADS;
+    full.policy_pass = 0.5f;
+    cache.insert(1, full);
+    EXPECT_TRUE(cache.lookup(1, result));
+    EXPECT_FLOAT_EQ(result.policy_pass, 0.5f);
+
+    auto& state = get_gamestate();
+    state.play_textmove("b", "q16");
+    state.play_textmove("w", "d4");
+
+    cfg_cpu_only = true;
+    auto network = std::make_unique<Network>();
+    network->initialize(std::min(cfg_max_playouts, cfg_max_visits),
+                        "../src/tests/0k.txt");
+
+    // A value-only probe leaves the policy alone...
+    const auto value = network->get_output(
+        &state, Network::DIRECT, Network::IDENTITY_SYMMETRY, false, false,
+        Netresult::VALUE_HEAD);
+    EXPECT_EQ(value.heads, Netresult::VALUE_HEAD);
+    EXPECT_FLOAT_EQ(value.policy_pass, 0.0f);
+
+    // ...and is completed with the policy on the next full request.
+    const auto upgraded = network->get_output(
+        &state, Network::DIRECT, Network::IDENTITY_SYMMETRY);
+    EXPECT_EQ(upgraded.heads, Netresult::ALL_HEADS);
+
+    const auto ref = network->get_output(&state, Network::DIRECT,
+                                         Network::IDENTITY_SYMMETRY, true);
+    EXPECT_FLOAT_EQ(value.winrate, ref.winrate);
+    EXPECT_FLOAT_EQ(upgraded.winrate, ref.winrate);
+    EXPECT_FLOAT_EQ(upgraded.policy_pass, ref.policy_pass);
+    for (auto idx = size_t{0}; idx < ref.policy.size(); ++idx) {
+        EXPECT_FLOAT_EQ(upgraded.policy[idx], ref.policy[idx]);
+    }
+}
+
+TEST_F(LeelaTest, RemoteEval) {
+    const auto weights = std::string{"../src/tests/0k.txt"};
+    auto& state = get_gamestate();
+    state.play_textmove("b", "q16");
+
+    cfg_cpu_only = true;
+    auto local = std::make_unique<Network>();
+    local->initialize(std::min(cfg_max_playouts, cfg_max_visits), weights);
+
+    EvalServer server(*local, RemoteProtocol::fingerprint(weights));
+    const auto port = server.listen("127.0.0.1:0");
+    ASSERT_NE(port, 0);
+    std::thread server_thread([&server] { server.run(); });
+
+    cfg_remote_eval = {"127.0.0.1:" + std::to_string(port)};
+    auto remote = std::make_unique<Network>();
+    remote->initialize(std::min(cfg_max_playouts, cfg_max_visits), weights);
+
+    const auto ref = local->get_output(&state, Network::DIRECT,
+                                       Network::IDENTITY_SYMMETRY, true);
+    const auto result = remote->get_output(&state, Network::DIRECT,
+                                           Network::IDENTITY_SYMMETRY, true);
+    EXPECT_FLOAT_EQ(result.winrate, ref.winrate);
+    EXPECT_FLOAT_EQ(result.policy_pass, ref.policy_pass);
+    for (auto idx = size_t{0}; idx < ref.policy.size(); ++idx) {
+        EXPECT_FLOAT_EQ(result.policy[idx], ref.policy[idx]);
+    }
+
+    EXPECT_EQ(server.get_num_sessions(), size_t{1});
+    remote.reset();
+    // The session ends on its own once the client hangs up.
+    for (auto i = 0; i < 500 && server.get_num_sessions() > 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(server.get_num_sessions(), size_t{0});
+
+    // Stopping the server ends sessions that are still connected.
+    remote = std::make_unique<Network>();
+    remote->initialize(std::min(cfg_max_playouts, cfg_max_visits), weights);
+    EXPECT_EQ(server.get_num_sessions(), size_t{1});
+    server.stop();
+    server_thread.join();
+    EXPECT_EQ(server.get_num_sessions(), size_t{0});
+}
+
+// Wire integers are little-endian on every host
+TEST_F(LeelaTest, RemoteProtocolEncoding) {
+    using namespace RemoteProtocol;
+
+    const auto message = encode(Message{0x01020304, 0x0a0b0c0d});
+    EXPECT_EQ(message, (MessageBytes{4, 3, 2, 1, 0x0d, 0x0c, 0x0b, 0x0a}));
+    const auto decoded = decode_message(message);
+    EXPECT_EQ(decoded.id, 0x01020304u);
+    EXPECT_EQ(decoded.heads, 0x0a0b0c0du);
+
+    const auto hello = Hello{MAGIC, VERSION, BOARD_SIZE, 8,
+                             0x0102030405060708ull};
+    const auto bytes = encode(hello);
+    EXPECT_EQ(bytes[0], MAGIC & 0xff);
+    EXPECT_EQ(bytes[16], 0x08);
+    EXPECT_EQ(bytes[23], 0x01);
+    const auto back = decode_hello(bytes);
+    EXPECT_EQ(back.magic, MAGIC);
+    EXPECT_EQ(back.version, VERSION);
+    EXPECT_EQ(back.board_size, std::uint32_t(BOARD_SIZE));
+    EXPECT_EQ(back.threads, 8u);
+    EXPECT_EQ(back.fingerprint, 0x0102030405060708ull);
+}
+
 // Test changing TimeControl during game
 TEST_F(LeelaTest, TimeControl2) {
     std::pair<std::string, std::string> result;
@@ -17,12 +17,15 @@
 */
 
 #include <boost/math/distributions/chi_squared.hpp>
+#include <atomic>
 #include <cstddef>
 #include <gtest/gtest.h>
 #include <limits>
+#include <stdexcept>
 #include <vector>
 
 #include "Random.h"
+#include "ThreadPool.h"
 #include "Utils.h"
 
 // Test should fail about this often from distribution not looking uniform.
@@ -128,3 +131,40 @@ TEST(UtilsTest, Randuint64_max) {
     auto p = randomlyDistributedProbability(count, expected);
     EXPECT_PRED2(rngBucketsLookRandom, p, ALPHA);
 }
+
+TEST(UtilsTest, ThreadPool) {
+    ThreadPool pool;
+    pool.initialize(3);
+
+    // More tasks than fit in the queues, so some overflow.
+    std::atomic<int> count{0};
+    {
+        ThreadGroup tg(pool);
+        tg.add_tasks(ThreadPool::QUEUE_SIZE + 100, [&count]() { count++; });
+        tg.add_task([&count](int n) { count += n; }, 1000);
+        tg.wait_all();
+    }
+    EXPECT_EQ(count, int(ThreadPool::QUEUE_SIZE) + 1100);
+
+    auto result = pool.add_task([]() { return 42; });
+    EXPECT_EQ(result.get(), 42);
+
+    ThreadGroup tg(pool);
+    tg.add_task([]() { throw std::runtime_error("task failed"); });
+    EXPECT_THROW(tg.wait_all(), std::runtime_error);
+    tg.wait_all();
+
+    // Nested loops must not wait on busy workers.
+    auto sums = std::vector<int>(100);
+    pool.parallel_for(0, sums.size(), [&](size_t i) {
+        std::atomic<int> sum{0};
+        pool.parallel_for(0, i, [&](size_t j) { sum += int(j); }, 7);
+        sums[i] = sum;
+    });
+    for (auto i = size_t{0}; i < sums.size(); i++) {
+        EXPECT_EQ(sums[i], int(i * (i - 1) / 2));
+    }
+    EXPECT_THROW(pool.parallel_for(0, 10, [](size_t i) {
+        if (i == 5) throw std::runtime_error("index failed");
+    }), std::runtime_error);
+}
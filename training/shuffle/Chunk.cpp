@@ -0,0 +1,379 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Chunk.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
+
+#include "Float16.h"
+
+using Plane = std::array<std::uint32_t, Chunk::BOARD_SIZE>;
+
+// The v2 winner byte for a +1/-1/0 game result.
+constexpr char V2_DRAW = 2;
+static char v2_result(const int result) {
+    return result > 0 ? 1 : result < 0 ? 0 : V2_DRAW;
+}
+
+// leelaz --training-binary records, see Training.h.
+constexpr auto LEELAZ_VERSION = 2;
+constexpr auto LEELAZ_PLANE_BYTES = (Chunk::NUM_INTERSECTIONS + 7) / 8;
+constexpr auto LEELAZ_RECORD_SIZE = 1 + Chunk::INPUT_PLANES * LEELAZ_PLANE_BYTES
+                                    + 1 + 2 * Chunk::POTENTIAL_MOVES + 1;
+
+// Lines per position in the text format.
+constexpr auto TEXT_LINES = Chunk::INPUT_PLANES + 3;
+
+// Packed planes are big-endian bit strings: the first point is the high
+// bit of its byte. These read and write width bits starting at bit offset,
+// touching only the bytes that hold them.
+static std::uint32_t get_bits(const char* data, size_t offset, int width) {
+    const auto bytes = reinterpret_cast<const unsigned char*>(data)
+                       + offset / 8;
+    const auto shift = int(offset % 8);
+    auto word = std::uint32_t{0};
+    for (auto i = 0; i < (shift + width + 7) / 8; i++) {
+        word |= std::uint32_t(bytes[i]) << (24 - 8 * i);
+    }
+    return (word >> (32 - width - shift)) & ((std::uint32_t{1} << width) - 1);
+}
+
+// ORs the bits in, so the destination must start out cleared.
+static void put_bits(char* data, size_t offset, int width,
+                     std::uint32_t value) {
+    auto bytes = reinterpret_cast<unsigned char*>(data) + offset / 8;
+    const auto shift = int(offset % 8);
+    const auto word = value << (32 - width - shift);
+    for (auto i = 0; i < (shift + width + 7) / 8; i++) {
+        bytes[i] |= (word >> (24 - 8 * i)) & 0xff;
+    }
+}
+
+static std::uint32_t get_row(const char* data, size_t offset) {
+    return get_bits(data, offset, Chunk::BOARD_SIZE);
+}
+
+static void put_row(char* data, size_t offset, std::uint32_t row) {
+    put_bits(data, offset, Chunk::BOARD_SIZE, row);
+}
+
+static std::uint32_t reverse_row(std::uint32_t row) {
+    row = ((row >> 1) & 0x55555555) | ((row & 0x55555555) << 1);
+    row = ((row >> 2) & 0x33333333) | ((row & 0x33333333) << 2);
+    row = ((row >> 4) & 0x0f0f0f0f) | ((row & 0x0f0f0f0f) << 4);
+    row = ((row >> 8) & 0x00ff00ff) | ((row & 0x00ff00ff) << 8);
+    row = (row >> 16) | (row << 16);
+    return row >> (32 - Chunk::BOARD_SIZE);
+}
+
+static Plane transpose(const Plane& in) {
+    auto out = Plane{};
+    for (auto y = 0; y < Chunk::BOARD_SIZE; y++) {
+        auto row = in[y];
+        const auto bit = std::uint32_t{1} << (Chunk::BOARD_SIZE - 1 - y);
+        for (auto x = Chunk::BOARD_SIZE - 1; row; x--, row >>= 1) {
+            if (row & 1) {
+                out[x] |= bit;
+            }
+        }
+    }
+    return out;
+}
+
+using SymmetryTable = std::array<std::array<int, Chunk::NUM_INTERSECTIONS>, 8>;
+
+// Same mapping as chunkparser.remap_vertex.
+static SymmetryTable make_symmetry_table() {
+    auto table = SymmetryTable{};
+    for (auto symmetry = 0; symmetry < 8; symmetry++) {
+        for (auto vertex = 0; vertex < Chunk::NUM_INTERSECTIONS; vertex++) {
+            auto x = vertex % Chunk::BOARD_SIZE;
+            auto y = vertex / Chunk::BOARD_SIZE;
+            if (symmetry & 4) {
+                std::swap(x, y);
+            }
+            if (symmetry & 1) {
+                x = Chunk::BOARD_SIZE - 1 - x;
+            }
+            if (symmetry & 2) {
+                y = Chunk::BOARD_SIZE - 1 - y;
+            }
+            table[symmetry][vertex] = y * Chunk::BOARD_SIZE + x;
+        }
+    }
+    return table;
+}
+
+bool Chunk::read_file(const std::string& filename, std::string& data) {
+    auto in = gzopen(filename.c_str(), "rb");
+    if (!in) {
+        return false;
+    }
+    char buffer[64 * 1024];
+    int bytes;
+    while ((bytes = gzread(in, buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, bytes);
+    }
+    gzclose(in);
+    return bytes == 0;
+}
+
+int Chunk::parse(const std::string& data, std::string& out,
+                 int sample, std::mt19937_64& rng) {
+    auto dist = std::uniform_int_distribution<int>{0, std::max(sample, 1) - 1};
+    auto keep = [&]() { return sample <= 1 || dist(rng) == 0; };
+    auto bad = 0;
+
+    if (data.empty()) {
+        return 0;
+    }
+    if (data.size() >= 4 && std::memcmp(data.data(), "\1\0\0\0", 4) == 0) {
+        bad += data.size() % RECORD_SIZE ? 1 : 0;
+        for (auto pos = size_t{0}; pos + RECORD_SIZE <= data.size();
+             pos += RECORD_SIZE) {
+            if (keep()) {
+                out.append(data, pos, RECORD_SIZE);
+            }
+        }
+        return bad;
+    }
+    if (data[0] == char(LEELAZ_VERSION)) {
+        bad += data.size() % LEELAZ_RECORD_SIZE ? 1 : 0;
+        for (auto pos = size_t{0}; pos + LEELAZ_RECORD_SIZE <= data.size();
+             pos += LEELAZ_RECORD_SIZE) {
+            if (keep() && !parse_binary(&data[pos], out)) {
+                bad++;
+            }
+        }
+        return bad;
+    }
+    if (!std::isxdigit(static_cast<unsigned char>(data[0]))) {
+        return -1;
+    }
+    // Text: TEXT_LINES lines per position. Discarded positions are only
+    // scanned for their line ends.
+    auto pos = data.c_str();
+    const auto end = pos + data.size();
+    while (pos < end) {
+        const auto begin = pos;
+        auto lines = 0;
+        while (lines < TEXT_LINES && pos < end) {
+            pos = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+            pos = pos ? pos + 1 : end;
+            lines++;
+        }
+        if (lines < TEXT_LINES) {
+            bad++;
+        } else if (keep() && !parse_text(begin, pos, out)) {
+            bad++;
+        }
+    }
+    return bad;
+}
+
+bool Chunk::parse_text(const char* begin, const char* end, std::string& out) {
+    auto record = std::array<char, RECORD_SIZE>{};
+    auto planes = &record[PLANES_OFFSET];
+    std::memcpy(&record[0], "\1\0\0\0", 4);
+
+    auto line_end = [&](const char* pos) {
+        auto eol = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+        return eol ? eol : end;
+    };
+    auto next_line = [&](const char* pos) {
+        const auto eol = line_end(pos);
+        return eol < end ? eol + 1 : end;
+    };
+    auto pos = begin;
+    for (auto p = 0; p < INPUT_PLANES; p++) {
+        auto eol = line_end(pos);
+        if (eol > pos && eol[-1] == '\r') {
+            eol--;
+        }
+        if (eol - pos != (NUM_INTERSECTIONS + 3) / 4) {
+            return false;
+        }
+        // 4 points per hex digit, the last point by itself.
+        for (auto i = 0; i < NUM_INTERSECTIONS / 4; i++) {
+            const auto c = pos[i];
+            auto nibble = 0;
+            if (c >= '0' && c <= '9') {
+                nibble = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                nibble = c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                nibble = c - 'A' + 10;
+            } else {
+                return false;
+            }
+            put_bits(planes, p * NUM_INTERSECTIONS + 4 * i, 4, nibble);
+        }
+        const auto last = pos[NUM_INTERSECTIONS / 4];
+        if (last != '0' && last != '1') {
+            return false;
+        }
+        put_bits(planes, (p + 1) * NUM_INTERSECTIONS - 1, 1, last - '0');
+        pos = next_line(pos);
+    }
+
+    if (pos >= end || (*pos != '0' && *pos != '1')) {
+        return false;
+    }
+    const auto to_move = *pos - '0';
+    pos = next_line(pos);
+
+    const auto probs_end = line_end(pos);
+    float probs[POTENTIAL_MOVES];
+    for (auto& prob : probs) {
+        while (pos < probs_end && *pos == ' ') {
+            pos++;
+        }
+        if (pos >= probs_end) {
+            return false;
+        }
+        auto next = static_cast<char*>(nullptr);
+        prob = std::strtof(pos, &next);
+        // Old versions could write NaN probabilities, skip those positions.
+        if (next == pos || next > probs_end || std::isnan(prob)) {
+            return false;
+        }
+        pos = next;
+    }
+    pos = next_line(pos);
+    std::memcpy(&record[4], probs, sizeof(probs));
+
+    // Don't let strtof skip ahead into the next position.
+    if (pos >= end || std::isspace(static_cast<unsigned char>(*pos))) {
+        return false;
+    }
+    const auto winner = std::strtof(pos, nullptr);
+    if (winner != 1.0f && winner != -1.0f && winner != 0.0f) {
+        return false;
+    }
+    record[PLANES_OFFSET + PLANES_BYTES] = char(to_move);
+    record[PLANES_OFFSET + PLANES_BYTES + 1] = v2_result(int(winner));
+    out.append(record.data(), record.size());
+    return true;
+}
+
+bool Chunk::parse_binary(const char* data, std::string& out) {
+    auto record = std::array<char, RECORD_SIZE>{};
+    auto planes = &record[PLANES_OFFSET];
+    std::memcpy(&record[0], "\1\0\0\0", 4);
+
+    auto pos = size_t{1};
+    for (auto p = 0; p < INPUT_PLANES; p++) {
+        for (auto y = 0; y < BOARD_SIZE; y++) {
+            const auto row = get_row(data + pos, y * BOARD_SIZE);
+            put_row(planes, p * NUM_INTERSECTIONS + y * BOARD_SIZE, row);
+        }
+        pos += LEELAZ_PLANE_BYTES;
+    }
+    const auto to_move = data[pos++];
+    float probs[POTENTIAL_MOVES];
+    for (auto& prob : probs) {
+        const auto lo = std::uint8_t(data[pos++]);
+        const auto hi = std::uint8_t(data[pos++]);
+        const auto half = Float16::half_t{std::uint16_t(lo | (hi << 8))};
+        prob = Float16::to_float(half);
+    }
+    std::memcpy(&record[4], probs, sizeof(probs));
+    const auto result = data[pos++];
+    if ((to_move != 0 && to_move != 1)
+        || (result != 1 && result != -1 && result != 0)) {
+        return false;
+    }
+    record[PLANES_OFFSET + PLANES_BYTES] = to_move;
+    record[PLANES_OFFSET + PLANES_BYTES + 1] = v2_result(result);
+    out.append(record.data(), record.size());
+    return true;
+}
+
+void Chunk::apply_symmetry(char* record, int symmetry) {
+    assert(symmetry >= 0 && symmetry < 8);
+    if (symmetry == 0) {
+        return;
+    }
+    static const auto table = make_symmetry_table();
+
+    float probs[POTENTIAL_MOVES];
+    float remapped[POTENTIAL_MOVES];
+    std::memcpy(probs, record + 4, sizeof(probs));
+    for (auto vertex = 0; vertex < NUM_INTERSECTIONS; vertex++) {
+        remapped[vertex] = probs[table[symmetry][vertex]];
+    }
+    // Pass is not affected.
+    remapped[NUM_INTERSECTIONS] = probs[NUM_INTERSECTIONS];
+    std::memcpy(record + 4, remapped, sizeof(remapped));
+
+    // Mirroring a row is a bit reversal, flipping the board reverses the
+    // rows and the diagonal reflection transposes the bit matrix.
+    auto planes = record + PLANES_OFFSET;
+    auto boards = std::array<Plane, INPUT_PLANES>{};
+    for (auto p = 0; p < INPUT_PLANES; p++) {
+        auto& rows = boards[p];
+        for (auto y = 0; y < BOARD_SIZE; y++) {
+            rows[y] = get_row(planes, p * NUM_INTERSECTIONS + y * BOARD_SIZE);
+            if (symmetry & 1) {
+                rows[y] = reverse_row(rows[y]);
+            }
+        }
+        if (symmetry & 2) {
+            std::reverse(begin(rows), end(rows));
+        }
+        if (symmetry & 4) {
+            rows = transpose(rows);
+        }
+    }
+    std::memset(planes, 0, PLANES_BYTES);
+    for (auto p = 0; p < INPUT_PLANES; p++) {
+        for (auto y = 0; y < BOARD_SIZE; y++) {
+            put_row(planes, p * NUM_INTERSECTIONS + y * BOARD_SIZE,
+                    boards[p][y]);
+        }
+    }
+}
+
+void Chunk::to_tensors(const char* record, std::uint8_t* planes,
+                       float* probs, float* winner) {
+    const auto packed = record + PLANES_OFFSET;
+    for (auto p = 0; p < INPUT_PLANES; p++) {
+        for (auto y = 0; y < BOARD_SIZE; y++) {
+            const auto row = get_row(packed,
+                                     p * NUM_INTERSECTIONS + y * BOARD_SIZE);
+            for (auto x = 0; x < BOARD_SIZE; x++) {
+                *planes++ = (row >> (BOARD_SIZE - 1 - x)) & 1;
+            }
+        }
+    }
+    // Side to move: all ones in the first plane for black, in the
+    // second for white.
+    const auto to_move = packed[PLANES_BYTES];
+    std::memset(planes, to_move ? 0 : 1, NUM_INTERSECTIONS);
+    std::memset(planes + NUM_INTERSECTIONS, to_move ? 1 : 0,
+                NUM_INTERSECTIONS);
+    std::memcpy(probs, record + 4, TENSOR_PROBS_SIZE);
+    const auto result = packed[PLANES_BYTES + 1];
+    *winner = result == V2_DRAW ? 0.0f : result ? 1.0f : -1.0f;
+}
@@ -0,0 +1,73 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHUNK_H_INCLUDED
+#define CHUNK_H_INCLUDED
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+// Positions are kept in the packed "v2" layout of training/tf/chunkparser.py:
+// int32 version (1), POTENTIAL_MOVES float32 probabilities, the 16 input
+// planes as one bit string (first point in the high bit), the side to move
+// and the winner (1 if the side to move won, 0 if it lost, 2 for a draw).
+class Chunk {
+public:
+    static constexpr auto BOARD_SIZE = 19;
+    static constexpr auto NUM_INTERSECTIONS = BOARD_SIZE * BOARD_SIZE;
+    static constexpr auto POTENTIAL_MOVES = NUM_INTERSECTIONS + 1;
+    static constexpr auto INPUT_PLANES = 16;
+    static constexpr auto PLANES_OFFSET = 4 + 4 * POTENTIAL_MOVES;
+    static constexpr auto PLANES_BYTES = INPUT_PLANES * NUM_INTERSECTIONS / 8;
+    static constexpr auto RECORD_SIZE = PLANES_OFFSET + PLANES_BYTES + 2;
+
+    // Raw tensors as produced by ChunkParser.convert_v2_to_tuple: the 16
+    // planes plus the two side to move planes unpacked to one byte per
+    // point, the probabilities and the winner as +1/-1.
+    static constexpr auto TENSOR_PLANES_SIZE = (INPUT_PLANES + 2)
+                                               * NUM_INTERSECTIONS;
+    static constexpr auto TENSOR_PROBS_SIZE = 4 * POTENTIAL_MOVES;
+    static constexpr auto TENSOR_WINNER_SIZE = 4;
+
+    // Decompresses a chunk file. Uncompressed files are read as they are.
+    static bool read_file(const std::string& filename, std::string& data);
+
+    // Converts the text, leelaz binary or v2 chunk in data to v2 records
+    // appended to out, keeping each position with probability 1/sample.
+    // Returns the number of positions that could not be parsed, or -1 if
+    // the format is unknown.
+    static int parse(const std::string& data, std::string& out,
+                     int sample, std::mt19937_64& rng);
+
+    // Rotates and reflects the record in place, with the symmetry
+    // numbering of chunkparser.remap_vertex.
+    static void apply_symmetry(char* record, int symmetry);
+
+    static void to_tensors(const char* record, std::uint8_t* planes,
+                           float* probs, float* winner);
+
+private:
+    static bool parse_text(const char* begin, const char* end,
+                           std::string& out);
+    static bool parse_binary(const char* data, std::string& out);
+};
+
+#endif
@@ -0,0 +1,73 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHUFFLEBUFFER_H_INCLUDED
+#define SHUFFLEBUFFER_H_INCLUDED
+
+#include <cstddef>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Fixed size records held in shuffled order, as in
+// training/tf/shufflebuffer.py.
+class ShuffleBuffer {
+public:
+    ShuffleBuffer(size_t elem_size, size_t elem_count)
+        : m_elem_size(elem_size), m_elem_count(elem_count),
+          m_buffer(elem_size * elem_count) {}
+
+    // Puts item in a random slot. Once the buffer is full the item it
+    // displaces is copied to out and true is returned.
+    bool insert_or_replace(const char* item, char* out,
+                           std::mt19937_64& rng) {
+        if (m_used > 0) {
+            auto dist = std::uniform_int_distribution<size_t>{0, m_used - 1};
+            auto slot = slot_ptr(dist(rng));
+            std::memcpy(out, slot, m_elem_size);
+            std::memcpy(slot, item, m_elem_size);
+        } else {
+            std::memcpy(out, item, m_elem_size);
+        }
+        if (m_used < m_elem_count) {
+            std::memcpy(slot_ptr(m_used++), out, m_elem_size);
+            return false;
+        }
+        return true;
+    }
+
+    bool extract(char* out) {
+        if (m_used == 0) {
+            return false;
+        }
+        std::memcpy(out, slot_ptr(--m_used), m_elem_size);
+        return true;
+    }
+
+private:
+    char* slot_ptr(size_t index) {
+        return &m_buffer[index * m_elem_size];
+    }
+
+    size_t m_elem_size;
+    size_t m_elem_count;
+    size_t m_used{0};
+    std::vector<char> m_buffer;
+};
+
+#endif
@@ -0,0 +1,449 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Reads training chunks written by leelaz (text or --training-binary) or
+// shards written by this tool, shuffles them and either writes pre-shuffled
+// v2 shards or streams ready-made batches of raw tensors to stdout, in the
+// form training/tf/chunkparser.py hands them to the trainer.
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <zlib.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "Chunk.h"
+#include "ShuffleBuffer.h"
+
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+// Hands out the chunk files in a new random order on every pass, like
+// FileDataSrc in training/tf/parse.py. Zero passes means forever.
+class ChunkSource {
+public:
+    ChunkSource(std::vector<std::string> files, int passes,
+                std::uint64_t seed)
+        : m_files(std::move(files)), m_next(m_files.size()),
+          m_passes(passes), m_rng(seed) {}
+
+    bool next(std::string& filename) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_next == m_files.size()) {
+            if (m_files.empty() || (m_passes && m_pass == m_passes)) {
+                return false;
+            }
+            std::shuffle(begin(m_files), end(m_files), m_rng);
+            m_next = 0;
+            m_pass++;
+        }
+        filename = m_files[m_next++];
+        return true;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<std::string> m_files;
+    size_t m_next;
+    int m_passes;
+    int m_pass{0};
+    std::mt19937_64 m_rng;
+};
+
+// Parsed chunks on their way from the readers to the shuffle buffer.
+// Bounded, so the readers can't run away from a slow consumer.
+class RecordQueue {
+public:
+    RecordQueue(size_t capacity, size_t producers)
+        : m_capacity(capacity), m_producers(producers) {}
+
+    // Returns false once the consumer has gone away.
+    bool push(std::string records) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_full.wait(lock, [this] {
+            return m_closed || m_queue.size() < m_capacity;
+        });
+        if (m_closed) {
+            return false;
+        }
+        m_queue.emplace_back(std::move(records));
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    void producer_done() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_producers--;
+        m_not_empty.notify_all();
+    }
+
+    bool pop(std::string& records) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_empty.wait(lock, [this] {
+            return !m_queue.empty() || m_producers == 0;
+        });
+        if (m_queue.empty()) {
+            return false;
+        }
+        records = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_not_full.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_not_full;
+    std::condition_variable m_not_empty;
+    std::deque<std::string> m_queue;
+    size_t m_capacity;
+    size_t m_producers;
+    bool m_closed{false};
+};
+
+struct ReaderStats {
+    size_t chunks{0};
+    size_t positions{0};
+    size_t bad_positions{0};
+    size_t bad_chunks{0};
+};
+
+static void read_chunks(ChunkSource& source, RecordQueue& queue,
+                        int sample, bool symmetry, std::uint64_t seed,
+                        ReaderStats& stats) {
+    auto rng = std::mt19937_64{seed};
+    auto symmetry_dist = std::uniform_int_distribution<int>{0, 7};
+    auto filename = std::string{};
+    while (source.next(filename)) {
+        auto data = std::string{};
+        auto records = std::string{};
+        if (!Chunk::read_file(filename, data)) {
+            std::cerr << "Failed to read " << filename << std::endl;
+            stats.bad_chunks++;
+            continue;
+        }
+        const auto bad = Chunk::parse(data, records, sample, rng);
+        if (bad < 0) {
+            std::cerr << "Unknown chunk format: " << filename << std::endl;
+            stats.bad_chunks++;
+            continue;
+        }
+        stats.chunks++;
+        stats.bad_positions += bad;
+        stats.positions += records.size() / Chunk::RECORD_SIZE;
+        if (symmetry) {
+            for (auto pos = size_t{0}; pos < records.size();
+                 pos += Chunk::RECORD_SIZE) {
+                Chunk::apply_symmetry(&records[pos], symmetry_dist(rng));
+            }
+        }
+        if (!records.empty() && !queue.push(std::move(records))) {
+            break;
+        }
+    }
+    queue.producer_done();
+}
+
+// Writes shuffled records to <prefix>.<n>.gz, shard_size per file. The
+// shards can be read by chunkparser.py directly, or by this tool again.
+class ShardWriter {
+public:
+    ShardWriter(std::string prefix, size_t shard_size)
+        : m_prefix(std::move(prefix)), m_shard_size(shard_size) {}
+    ~ShardWriter() { close(); }
+
+    bool write(const char* record) {
+        if (!m_out) {
+            const auto name = m_prefix + "." + std::to_string(m_shards++)
+                              + ".gz";
+            // Shards are short lived, favor speed over size.
+            m_out = gzopen(name.c_str(), "wb1");
+            if (!m_out) {
+                std::cerr << "Failed to open " << name << std::endl;
+                return false;
+            }
+        }
+        if (gzwrite(m_out, record, Chunk::RECORD_SIZE)
+            != Chunk::RECORD_SIZE) {
+            return false;
+        }
+        if (++m_count == m_shard_size) {
+            close();
+        }
+        return true;
+    }
+
+private:
+    void close() {
+        if (m_out) {
+            gzclose(m_out);
+            m_out = nullptr;
+            m_count = 0;
+        }
+    }
+
+    std::string m_prefix;
+    size_t m_shard_size;
+    size_t m_shards{0};
+    size_t m_count{0};
+    gzFile m_out{nullptr};
+};
+
+// Streams batches as three consecutive blocks: batch_size * 18 * 361 plane
+// bytes, batch_size * 362 float32 probabilities and batch_size float32
+// winners, the tuple ChunkParser.parse yields. A final partial batch is
+// dropped so every read on the other end has the same size.
+class BatchWriter {
+public:
+    BatchWriter(std::FILE* out, size_t batch_size)
+        : m_out(out), m_batch_size(batch_size),
+          m_planes(batch_size * Chunk::TENSOR_PLANES_SIZE),
+          m_probs(batch_size * Chunk::POTENTIAL_MOVES),
+          m_winners(batch_size) {}
+
+    bool write(const char* record) {
+        Chunk::to_tensors(record,
+                          &m_planes[m_count * Chunk::TENSOR_PLANES_SIZE],
+                          &m_probs[m_count * Chunk::POTENTIAL_MOVES],
+                          &m_winners[m_count]);
+        if (++m_count < m_batch_size) {
+            return true;
+        }
+        m_count = 0;
+        return write_block(m_planes.data(), m_planes.size())
+            && write_block(m_probs.data(), m_probs.size() * sizeof(float))
+            && write_block(m_winners.data(), m_winners.size() * sizeof(float))
+            && std::fflush(m_out) == 0;
+    }
+
+private:
+    bool write_block(const void* data, size_t size) {
+        return std::fwrite(data, 1, size, m_out) == size;
+    }
+
+    std::FILE* m_out;
+    size_t m_batch_size;
+    size_t m_count{0};
+    std::vector<std::uint8_t> m_planes;
+    std::vector<float> m_probs;
+    std::vector<float> m_winners;
+};
+
+// Files are taken as they are, anything else is a prefix matched like
+// get_chunks in training/tf/parse.py (prefix*.gz).
+static void add_chunks(const std::string& arg,
+                       std::vector<std::string>& files) {
+    auto path = fs::path{arg};
+    if (fs::is_regular_file(path)) {
+        files.emplace_back(arg);
+        return;
+    }
+    auto dir = path.parent_path();
+    if (dir.empty()) {
+        dir = ".";
+    }
+    const auto stem = path.filename().string();
+    if (!fs::is_directory(dir)) {
+        return;
+    }
+    auto matches = std::vector<std::string>{};
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        const auto name = entry.path().filename().string();
+        if (name.size() >= stem.size() + 3
+            && name.compare(0, stem.size(), stem) == 0
+            && name.compare(name.size() - 3, 3, ".gz") == 0) {
+            matches.emplace_back(entry.path().string());
+        }
+    }
+    std::sort(begin(matches), end(matches));
+    files.insert(end(files), begin(matches), end(matches));
+}
+
+int main(int argc, char* argv[]) {
+    auto threads = std::max(1, int(std::thread::hardware_concurrency()));
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help,h", "Show commandline options.")
+        ("input-list", po::value<std::string>(),
+                       "File with one chunk file or prefix per line.")
+        ("output,o", po::value<std::string>(),
+                     "Write shuffled shards <output>.<n>.gz instead of "
+                     "streaming batches to stdout.")
+        ("shard-size", po::value<size_t>()->default_value(16384),
+                       "Positions per output shard.")
+        ("batch-size,b", po::value<size_t>()->default_value(128),
+                         "Positions per batch on stdout.")
+        ("shuffle-size", po::value<size_t>()->default_value(1 << 18),
+                         "Positions held in the shuffle buffer.")
+        ("sample", po::value<int>()->default_value(1),
+                   "Keep one in this many positions.")
+        ("passes", po::value<int>()->default_value(1),
+                   "Passes over the chunks, 0 to loop forever.")
+        ("threads,t", po::value<int>()->default_value(threads),
+                      "Number of reader threads.")
+        ("seed,s", po::value<std::uint64_t>(), "Random number seed.")
+        ("no-symmetry", "Don't apply a random symmetry to each position.")
+        ;
+    po::options_description hidden;
+    hidden.add_options()
+        ("chunks", po::value<std::vector<std::string>>());
+    po::options_description all;
+    all.add(desc).add(hidden);
+    po::positional_options_description positional;
+    positional.add("chunks", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv)
+                  .options(all).positional(positional).run(), vm);
+        po::notify(vm);
+    } catch (const boost::program_options::error& e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (vm.count("help")) {
+        std::cerr << "Usage: " << argv[0] << " [options] chunks..."
+                  << std::endl << desc << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    auto files = std::vector<std::string>{};
+    if (vm.count("chunks")) {
+        for (const auto& arg : vm["chunks"].as<std::vector<std::string>>()) {
+            add_chunks(arg, files);
+        }
+    }
+    if (vm.count("input-list")) {
+        auto list = std::ifstream{vm["input-list"].as<std::string>()};
+        auto line = std::string{};
+        while (std::getline(list, line)) {
+            if (!line.empty()) {
+                add_chunks(line, files);
+            }
+        }
+    }
+    if (files.empty()) {
+        std::cerr << "No chunks to read." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const auto shuffle_size = std::max(size_t{1},
+                                       vm["shuffle-size"].as<size_t>());
+    const auto batch_size = std::max(size_t{1},
+                                     vm["batch-size"].as<size_t>());
+    const auto shard_size = std::max(size_t{1},
+                                     vm["shard-size"].as<size_t>());
+    const auto sample = vm["sample"].as<int>();
+    const auto passes = std::max(0, vm["passes"].as<int>());
+    const auto symmetry = !vm.count("no-symmetry");
+    threads = std::max(1, vm["threads"].as<int>());
+    const auto seed = vm.count("seed") ? vm["seed"].as<std::uint64_t>()
+        : (std::uint64_t{std::random_device{}()} << 32)
+          | std::random_device{}();
+
+    std::cerr << "Reading " << files.size() << " chunks with " << threads
+              << " threads." << std::endl;
+
+    ChunkSource source{std::move(files), passes, seed};
+    RecordQueue queue{size_t(2 * threads), size_t(threads)};
+    auto stats = std::vector<ReaderStats>(threads);
+    auto readers = std::vector<std::thread>{};
+    for (auto i = 0; i < threads; i++) {
+        readers.emplace_back(read_chunks, std::ref(source), std::ref(queue),
+                             sample, symmetry, seed + i + 1,
+                             std::ref(stats[i]));
+    }
+
+    std::unique_ptr<ShardWriter> shards;
+    std::unique_ptr<BatchWriter> batches;
+    if (vm.count("output")) {
+        shards = std::make_unique<ShardWriter>(vm["output"].as<std::string>(),
+                                               shard_size);
+    } else {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        batches = std::make_unique<BatchWriter>(stdout, batch_size);
+    }
+    auto emit = [&](const char* record) {
+        return shards ? shards->write(record) : batches->write(record);
+    };
+
+    auto rng = std::mt19937_64{seed};
+    auto buffer = ShuffleBuffer{Chunk::RECORD_SIZE, shuffle_size};
+    auto record = std::vector<char>(Chunk::RECORD_SIZE);
+    auto records = std::string{};
+    auto written = size_t{0};
+    auto ok = true;
+    while (ok && queue.pop(records)) {
+        for (auto pos = size_t{0}; ok && pos < records.size();
+             pos += Chunk::RECORD_SIZE) {
+            if (buffer.insert_or_replace(&records[pos], record.data(), rng)) {
+                ok = emit(record.data());
+                written++;
+            }
+        }
+    }
+    while (ok && buffer.extract(record.data())) {
+        ok = emit(record.data());
+        written++;
+    }
+    // Let the readers go if the other end stopped listening.
+    queue.close();
+    while (queue.pop(records)) {}
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    shards.reset();
+
+    auto total = ReaderStats{};
+    for (const auto& s : stats) {
+        total.chunks += s.chunks;
+        total.positions += s.positions;
+        total.bad_positions += s.bad_positions;
+        total.bad_chunks += s.bad_chunks;
+    }
+    std::cerr << "Read " << total.positions << " positions from "
+              << total.chunks << " chunks (" << total.bad_chunks
+              << " unreadable chunks, " << total.bad_positions
+              << " bad positions), wrote " << written << "." << std::endl;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -23,11 +23,14 @@ import itertools
 import math
 import multiprocessing as mp
 import numpy as np
+import os
 import queue
 import random
 import shufflebuffer as sb
 import struct
+import subprocess
 import sys
+import tempfile
 import threading
 import time
 import unittest
@@ -35,6 +38,10 @@ import unittest
 # 16 planes, 1 side to move, 1 x 362 probs, 1 winner = 19 lines
 DATA_ITEM_LINES = 16 + 1 + 1 + 1
 
+# Game result (+1 won, -1 lost, 0 draw) <-> v2 winner byte
+V2_WINNER = { 1.0: 1, -1.0: 0, 0.0: 2 }
+V2_RESULT = { 1: 1.0, 0: -1.0, 2: 0.0 }
+
 def remap_vertex(vertex, symmetry):
     """
         Remap a go board coordinate according to a symmetry.
@@ -146,7 +153,7 @@ class ChunkParser:
         # (19*19+1) float32 probabilities (1448 bytes)
         # 19*19*16 packed bit planes (722 bytes)
         # uint8 side_to_move (1 byte)
-        # uint8 is_winner (1 byte)
+        # uint8 is_winner (1 byte, 2 for a draw)
         self.v2_struct = struct.Struct('4s1448s722sBB')
 
         # Struct used to return data from child workers.
@@ -210,9 +217,9 @@ class ChunkParser:
 
         # Load the game winner color.
         winner = float(text_item[18])
-        if not(winner == 1.0 or winner == -1.0):
+        if not(winner == 1.0 or winner == -1.0 or winner == 0.0):
             return False, None
-        winner = int((winner + 1) / 2)
+        winner = V2_WINNER[winner]
 
         version = struct.pack('i', 1)
 
@@ -254,7 +261,7 @@ class ChunkParser:
                 float probs[19*18+1]
                 byte planes[19*19*16/8]
                 byte to_move
-                byte winner
+                byte winner (1 won, 0 lost, 2 draw)
 
             packed tensor formats are
                 float32 winner
@@ -272,9 +279,8 @@ class ChunkParser:
         planes = planes.tobytes() + self.flat_planes[stm]
         assert len(planes) == (18 * 19 * 19), len(planes)
 
-        winner = float(winner * 2 - 1)
-        assert winner == 1.0 or winner == -1.0, winner
-        winner = struct.pack('f', winner)
+        assert winner in V2_RESULT, winner
+        winner = struct.pack('f', V2_RESULT[winner])
 
         return (planes, probs, winner)
 
@@ -383,6 +389,71 @@ class ChunkParser:
             yield b
 
 
+class ShuffleToolParser:
+    def __init__(self, tool, chunks, shuffle_size=1, sample=1,
+                 batch_size=256, workers=None):
+        """
+            Yield the same batches of raw tensors as ChunkParser, read
+            from the C++ shuffler in training/shuffle.
+
+            'tool' is the path to the shuffle binary.
+            'chunks' is the list of chunk files, read over and over.
+        """
+        self.batch_size = batch_size
+        self.process = None
+        # Pass the chunks through a file, there can be too many for
+        # the command line.
+        self.chunk_list = tempfile.NamedTemporaryFile(
+            mode='w', suffix='.txt', delete=False)
+        self.chunk_list.write('\n'.join(chunks) + '\n')
+        self.chunk_list.close()
+        command = [tool, '--input-list', self.chunk_list.name,
+                   '--passes', '0',
+                   '--batch-size', str(batch_size),
+                   '--shuffle-size', str(shuffle_size),
+                   '--sample', str(sample)]
+        if workers is not None:
+            command += ['--threads', str(workers)]
+        self.process = subprocess.Popen(command, stdout=subprocess.PIPE)
+
+    def close(self):
+        """
+            Stop the shuffler and remove the chunk list.
+        """
+        if self.process is not None:
+            self.process.stdout.close()
+            self.process.terminate()
+            self.process.wait()
+            self.process = None
+        if self.chunk_list is not None:
+            try:
+                os.unlink(self.chunk_list.name)
+            except FileNotFoundError:
+                pass
+            self.chunk_list = None
+
+    def __del__(self):
+        self.close()
+
+    def read(self, size):
+        data = self.process.stdout.read(size)
+        if len(data) != size:
+            return None
+        return data
+
+    def parse(self):
+        """
+            Yield batches of raw tensors: planes, probs, winner.
+        """
+        sizes = (self.batch_size * 18 * 19 * 19,
+                 self.batch_size * 362 * 4,
+                 self.batch_size * 4)
+        while True:
+            batch = tuple(self.read(size) for size in sizes)
+            if any(part is None for part in batch):
+                return
+            yield batch
+
 # Tests to check that records can round-trip successfully
 class ChunkParserTest(unittest.TestCase):
     def generate_fake_pos(self):
@@ -398,23 +469,14 @@ class ChunkParserTest(unittest.TestCase):
         planes.append([1. - stm] * 361)
         # 2. 362 probs
         probs = np.random.randint(3, size=362).tolist()
-        # 3. And a winner: 1 or -1
-        winner = [ 2 * float(np.random.randint(2)) - 1 ]
+        # 3. And a winner: 1, -1 or 0 for a draw
+        winner = [ float(np.random.randint(3) - 1) ]
         return (planes, probs, winner)
 
-    def test_parsing(self):
+    def generate_v1(self, planes, probs, winner):
         """
-            Test game position decoding pipeline.
-
-            We generate a V1 record, and feed it all the way
-            through the parsing pipeline to final tensors,
-            checking that what we get out is what we put in.
+            Encode a position as a v1 text record.
         """
-        batch_size=256
-        # First, build a random game position.
-        planes, probs, winner = self.generate_fake_pos()
-
-        # Convert that to a v1 text record.
         items = []
         for p in range(16):
             # generate first 360 bits
@@ -429,18 +491,13 @@ class ChunkParserTest(unittest.TestCase):
         # and finally if the side to move is a winner
         items.append(str(int(winner[0])) + "\n")
 
-        # Convert to a chunkdata byte string.
-        chunkdata = ''.join(items).encode('ascii')
-
-        # feed batch_size copies into parser
-        chunkdatasrc = ChunkDataSrc([chunkdata for _ in range(batch_size*2)])
-        parser = ChunkParser(chunkdatasrc,
-                             shuffle_size=1, workers=1, batch_size=batch_size)
-
-        # Get one batch from the parser.
-        batchgen = parser.parse()
-        data = next(batchgen)
+        return ''.join(items).encode('ascii')
 
+    def assert_symmetries(self, data, batch_size, planes, probs, winner):
+        """
+            Check that every position in a batch of raw tensors is
+            some symmetry of the given position.
+        """
         # Convert batch to python lists.
         batch = ( np.reshape(np.frombuffer(data[0], dtype=np.uint8),
                              (batch_size, 18, 19*19)).tolist(),
@@ -449,8 +506,6 @@ class ChunkParserTest(unittest.TestCase):
                   np.reshape(np.frombuffer(data[2], dtype=np.float32),
                              (batch_size, 1)).tolist() )
 
-        # Check that every record in the batch is a some valid symmetry
-        # of the original data.
         for i in range(batch_size):
             data = (batch[0][i], batch[1][i], batch[2][i])
 
@@ -476,10 +531,94 @@ class ChunkParserTest(unittest.TestCase):
                     break
             # Check that there is at least one matching symmetry.
             assert result == True
+
+    def test_parsing(self):
+        """
+            Test game position decoding pipeline.
+
+            We generate a V1 record, and feed it all the way
+            through the parsing pipeline to final tensors,
+            checking that what we get out is what we put in.
+        """
+        batch_size=256
+        # First, build a random game position.
+        planes, probs, winner = self.generate_fake_pos()
+
+        # Convert that to a v1 text record.
+        chunkdata = self.generate_v1(planes, probs, winner)
+
+        # feed batch_size copies into parser
+        chunkdatasrc = ChunkDataSrc([chunkdata for _ in range(batch_size*2)])
+        parser = ChunkParser(chunkdatasrc,
+                             shuffle_size=1, workers=1, batch_size=batch_size)
+
+        # Get one batch from the parser.
+        batchgen = parser.parse()
+        data = next(batchgen)
+
+        # Check that every record in the batch is a some valid symmetry
+        # of the original data.
+        self.assert_symmetries(data, batch_size, planes, probs, winner)
         print("Test parse passes")
         # drain parser
         for _ in batchgen:
             pass
 
+    def generate_binary(self, planes, probs, winner):
+        """
+            Encode a position as a leelaz --training-binary record.
+        """
+        record = bytes([2])
+        for p in range(16):
+            record += np.packbits(planes[p]).tobytes()
+        record += bytes([int(planes[17][0])])
+        record += np.array(probs, dtype='<f2').tobytes()
+        record += struct.pack('b', int(winner[0]))
+        return record
+
+    def test_shuffle_tool(self):
+        """
+            Test that the C++ shuffler reads text and binary chunks into
+            the same v2 records and tensors as ChunkParser.
+        """
+        tool = os.environ.get('SHUFFLE_TOOL')
+        if not tool:
+            self.skipTest("SHUFFLE_TOOL is not set to the shuffle binary")
+        batch_size = 16
+        planes, probs, winner = self.generate_fake_pos()
+        text = self.generate_v1(planes, probs, winner)
+        binary = self.generate_binary(planes, probs, winner)
+
+        with tempfile.TemporaryDirectory() as tmpdir:
+            chunks = []
+            for name, record in (('text.gz', text), ('binary.gz', binary)):
+                chunks.append(os.path.join(tmpdir, name))
+                with gzip.open(chunks[-1], 'wb') as f:
+                    f.write(record * batch_size)
+
+            # Shards hold exactly the records ChunkParser would make.
+            parser = ChunkParser(ChunkDataSrc([]), workers=1)
+            v2 = list(parser.convert_chunkdata_to_v2(text))
+            assert len(v2) == 1 and len(v2[0]) == 2176
+            shard = os.path.join(tmpdir, 'shard')
+            subprocess.check_call([tool, '--no-symmetry', '--threads', '1',
+                                   '--output', shard] + chunks)
+            with gzip.open(shard + '.0.gz', 'rb') as f:
+                assert f.read() == v2[0] * (2 * batch_size)
+
+            # Batches hold the tensors ChunkParser would make.
+            tool_parser = ShuffleToolParser(tool, chunks, workers=1,
+                                            batch_size=batch_size)
+            batchgen = tool_parser.parse()
+            for _ in range(4):
+                self.assert_symmetries(next(batchgen), batch_size,
+                                       planes, probs, winner)
+            chunk_list = tool_parser.chunk_list.name
+            process = tool_parser.process
+            tool_parser.close()
+            assert not os.path.exists(chunk_list)
+            assert process.returncode is not None
+        print("Test shuffle tool passes")
+
 if __name__ == '__main__':
     unittest.main()
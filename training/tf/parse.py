@@ -18,7 +18,7 @@
 
 
 from tfprocess import TFProcess
-from chunkparser import ChunkParser
+from chunkparser import ChunkParser, ShuffleToolParser
 import argparse
 import glob
 import gzip
@@ -120,6 +120,8 @@ def main():
         help="Log file prefix (for tensorboard)")
     parser.add_argument("--sample", default=DOWN_SAMPLE, type=int,
         help="Rate of data down-sampling to use")
+    parser.add_argument("--shuffle-tool", type=str,
+        help="Read the chunks with the C++ shuffler at this path")
     args = parser.parse_args()
 
     train_data_prefix = args.train or args.trainpref
@@ -140,15 +142,26 @@ def main():
     print("Training with {0} chunks, validating on {1} chunks".format(
         len(training), len(test)))
 
-    train_parser = ChunkParser(FileDataSrc(training),
-                               shuffle_size=1<<20, # 2.2GB of RAM.
-                               sample=args.sample,
-                               batch_size=RAM_BATCH_SIZE).parse()
+    if args.shuffle_tool:
+        train_parser = ShuffleToolParser(args.shuffle_tool, training,
+                                         shuffle_size=1<<20,
+                                         sample=args.sample,
+                                         batch_size=RAM_BATCH_SIZE).parse()
 
-    test_parser = ChunkParser(FileDataSrc(test),
-                              shuffle_size=1<<19,
-                              sample=args.sample,
-                              batch_size=RAM_BATCH_SIZE).parse()
+        test_parser = ShuffleToolParser(args.shuffle_tool, test,
+                                        shuffle_size=1<<19,
+                                        sample=args.sample,
+                                        batch_size=RAM_BATCH_SIZE).parse()
+    else:
+        train_parser = ChunkParser(FileDataSrc(training),
+                                   shuffle_size=1<<20, # 2.2GB of RAM.
+                                   sample=args.sample,
+                                   batch_size=RAM_BATCH_SIZE).parse()
+
+        test_parser = ChunkParser(FileDataSrc(test),
+                                  shuffle_size=1<<19,
+                                  sample=args.sample,
+                                  batch_size=RAM_BATCH_SIZE).parse()
 
     tfprocess = TFProcess()
     tfprocess.init(RAM_BATCH_SIZE,
@@ -20,8 +20,8 @@
 
 #include "SPRT.h"
 #include <cmath>
+#include <cassert>
 #include <iostream>
-#include <QtGlobal>
 
 class BayesElo;
 class SprtProbability;
@@ -67,7 +67,7 @@ BayesElo::BayesElo(double bayesElo, double drawElo)
 
 BayesElo::BayesElo(const SprtProbability& p)
 {
-    Q_ASSERT(p.isValid());
+    assert(p.isValid());
 
     m_bayesElo = 200.0 * std::log10(p.pWin() / p.pLoss() *
                                    (1.0 - p.pLoss()) / (1.0 - p.pWin()));
@@ -93,7 +93,7 @@ double BayesElo::scale() const
 
 SprtProbability::SprtProbability(int wins, int losses, int draws)
 {
-    Q_ASSERT(wins > 0 && losses > 0 && draws > 0);
+    assert(wins > 0 && losses > 0 && draws > 0);
 
     const int count = wins + losses + draws;
 
@@ -160,7 +160,7 @@ void Sprt::initialize(double elo0, double elo1,
 
 Sprt::Status Sprt::status() const
 {
-    QMutexLocker locker(&m_mutex);
+    std::lock_guard<std::mutex> locker(m_mutex);
     Status status = {
         Continue,
         0.0,
@@ -206,7 +206,7 @@ Sprt::Status Sprt::status() const
 
 void Sprt::addGameResult(GameResult result)
 {
-    QMutexLocker locker(&m_mutex);
+    std::lock_guard<std::mutex> locker(m_mutex);
     if (result == Win)
         m_wins++;
     else if (result == Draw)
@@ -220,6 +220,7 @@ std::tuple<int, int, int> Sprt::getWDL() const
     return std::make_tuple(m_wins, m_draws, m_losses);
 }
 
+#ifdef QT_CORE_LIB
 QTextStream& operator<<(QTextStream& stream, const Sprt& sprt) {
     stream << sprt.m_elo0 << ' ' << sprt.m_elo1 << ' ';
     stream << sprt.m_alpha << ' ' << sprt.m_beta << ' ';
@@ -238,3 +239,4 @@ QTextStream& operator>>(QTextStream& stream, Sprt& sprt) {
     stream >> sprt.m_draws;
     return stream;
 }
+#endif
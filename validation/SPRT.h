@@ -29,11 +29,16 @@
  * interval.
  *
  * \sa http://en.wikipedia.org/wiki/Sequential_probability_ratio_test
+ *
+ * Qt is only needed for the stream operators, so leelaz can use this class
+ * for its in-process matches.
  */
 
-#include <QMutex>
-#include <QTextStream>
+#include <mutex>
 #include <tuple>
+#ifdef QT_CORE_LIB
+#include <QTextStream>
+#endif
 
 class Sprt
 {
@@ -99,8 +104,10 @@ public:
      * check if H0 or H1 can be accepted.
      */
     void addGameResult(GameResult result);
+#ifdef QT_CORE_LIB
     friend QTextStream& operator<<(QTextStream& stream, const Sprt& sprt);
     friend QTextStream& operator>>(QTextStream& stream, Sprt& sprt);
+#endif
 private:
     double m_elo0;
     double m_elo1;
@@ -109,7 +116,7 @@ private:
     int m_wins;
     int m_losses;
     int m_draws;
-    mutable QMutex m_mutex;
+    mutable std::mutex m_mutex;
 };
 
 #endif // SPRT_H